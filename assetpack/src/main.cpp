@@ -0,0 +1,136 @@
+/*  Sirikata
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Standard.hh>
+#include <transfer/PackFile.hpp>
+#include <transfer/URI.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+namespace {
+using namespace Sirikata;
+using Transfer::PackFile;
+using Transfer::PackFileWriter;
+using Transfer::Fingerprint;
+
+void usage(const char *program) {
+    std::cerr << "Usage: " << program << " output.pack input..." << std::endl
+              << "       " << program << " -l input.pack" << std::endl
+              << "  Each input is a file, a directory (every file under it is added)," << std::endl
+              << "  or @names.txt, a name list as written by an upload to file:///;" << std::endl
+              << "  the hashes it names are read from the directory it is in." << std::endl;
+}
+
+bool addDirectory(PackFileWriter &writer, const std::string &dirpath) {
+    using namespace boost::filesystem;
+    bool ok = true;
+    recursive_directory_iterator end;
+    for (recursive_directory_iterator di((path(dirpath))); di != end; ++di) {
+        if (is_directory(di->status()))
+            continue;
+        ok = writer.addFile(di->path().string()) && ok;
+    }
+    return ok;
+}
+
+/// Adds the files named in a names.txt, whose lines are "name mhash:///<hex digest>".
+bool addNameList(PackFileWriter &writer, const std::string &listpath) {
+    std::ifstream list(listpath.c_str());
+    if (!list) {
+        std::cerr << "Unable to read " << listpath << std::endl;
+        return false;
+    }
+    std::string::size_type slash = listpath.find_last_of("/\\");
+    std::string dir = (slash == std::string::npos) ? std::string() : listpath.substr(0, slash+1);
+    bool ok = true;
+    std::string line;
+    while (std::getline(list, line)) {
+        std::string::size_type space = line.find(' ');
+        if (space == std::string::npos || line.length() - space - 1 < (size_t)SHA256::hex_size)
+            continue; // an unbound name
+        std::string hex = line.substr(line.length() - SHA256::hex_size);
+        Fingerprint expected;
+        try {
+            expected = Fingerprint::convertFromHex(hex);
+        } catch (std::invalid_argument &) {
+            std::cerr << "Skipping " << line << std::endl;
+            continue;
+        }
+        Fingerprint actual;
+        if (!writer.addFile(dir + hex, &actual)) {
+            ok = false;
+        } else if (actual != expected) {
+            std::cerr << dir + hex << " does not match its name" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int listPack(const std::string &packpath) {
+    PackFile pack;
+    if (!pack.open(packpath))
+        return 1;
+    std::cout << pack.size() << " assets in " << packpath << std::endl;
+    return 0;
+}
+
+}
+
+int main(int argc, const char **argv) {
+    using namespace Sirikata;
+    if (argc == 3 && std::string(argv[1]) == "-l")
+        return listPack(argv[2]);
+    if (argc < 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    PackFileWriter writer;
+    bool ok = true;
+    for (int i = 2; i < argc; ++i) {
+        std::string input(argv[i]);
+        if (input[0] == '@')
+            ok = addNameList(writer, input.substr(1)) && ok;
+        else if (boost::filesystem::is_directory(boost::filesystem::path(input)))
+            ok = addDirectory(writer, input) && ok;
+        else
+            ok = writer.addFile(input) && ok;
+    }
+    if (!ok) {
+        std::cerr << "Some inputs could not be read; not writing " << argv[1] << std::endl;
+        return 1;
+    }
+    if (!writer.write(argv[1]))
+        return 1;
+    std::cout << "Wrote " << writer.size() << " assets to " << argv[1] << std::endl;
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include <transfer/DiskCacheLayer.hpp>
 #include <transfer/MemoryCacheLayer.hpp>
 #include <transfer/NetworkCacheLayer.hpp>
+#include <transfer/PackCacheLayer.hpp>
 #include <transfer/HTTPDownloadHandler.hpp>
 #include <transfer/HTTPUploadHandler.hpp>
 #include <transfer/HTTPFormUploadHandler.hpp>
@@ -83,12 +84,16 @@ CacheLayer *createDiskCache(const OptionMap &options) {
         return NULL;
     return new DiskCacheLayer(policy, options["directory"].getValue(), NULL);
 }
+CacheLayer *createPackCache(const OptionMap &options) {
+    return new PackCacheLayer(options["file"].getValue(), NULL);
+}
 CacheLayer *createNetworkCache(const OptionMap &options); // Defined below.
 
 
 void initializeLayer(OptionFactory<CacheLayer> &factories) {
     factories.insert("Memory",&createMemoryCache);
     factories.insert("Disk",&createDiskCache);
+    factories.insert("Pack",&createPackCache);
     factories.insert("Network",&createNetworkCache);
 }
 OptionFactory<CacheLayer> CreateCache(&initializeLayer);
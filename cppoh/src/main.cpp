@@ -38,6 +38,7 @@
 
 #include <task/EventManager.hpp>
 #include <task/WorkQueue.hpp>
+#include <task/Time.hpp>
 #include "CDNConfig.hpp"
 
 #include <oh/ObjectHost.hpp>
@@ -50,6 +51,7 @@
 #include <util/KnownServices.hpp>
 #include <persistence/ObjectStorage.hpp>
 #include <persistence/ReadWriteHandlerFactory.hpp>
+#include <oh/CachingReadWriteHandler.hpp>
 #include <ObjectHostBinary_Persistence.pbj.hpp>
 #include <ObjectHostBinary_Sirikata.pbj.hpp>
 #include <time.h>
@@ -61,13 +63,27 @@ using Transfer::TransferManager;
 OptionValue *cdnConfigFile;
 OptionValue *floatExcept;
 OptionValue *dbFile;
+OptionValue *dbFlushInterval;
+OptionValue *dbCacheEntries;
+OptionValue *dbMaxDirty;
 OptionValue *host;
+OptionValue *objectThreads;
+OptionValue *interestSize;
+OptionValue *interestFalloff;
+OptionValue *interestMaxInterval;
 InitializeGlobalOptions main_options("",
 //    simulationPlugins=new OptionValue("simulationPlugins","ogregraphics",OptionValueType<String>(),"List of plugins that handle simulation."),
     cdnConfigFile=new OptionValue("cdnConfig","cdn = ($import=cdn.txt)",OptionValueType<String>(),"CDN configuration."),
     floatExcept=new OptionValue("sigfpe","false",OptionValueType<bool>(),"Enable floating point exceptions"),
     dbFile=new OptionValue("db","scene.db",OptionValueType<String>(),"Persistence database"),
+    dbFlushInterval=new OptionValue("dbFlushInterval","1",OptionValueType<float>(),"Seconds between writing cached persistence changes to the database"),
+    dbCacheEntries=new OptionValue("dbCacheEntries","65536",OptionValueType<uint32>(),"Persistence values kept in memory"),
+    dbMaxDirty=new OptionValue("dbMaxDirty","4096",OptionValueType<uint32>(),"Unwritten persistence values that force an early write to the database"),
     host=new OptionValue("host","localhost",OptionValueType<String>(),"space address"),
+    objectThreads=new OptionValue("objectThreads","0",OptionValueType<uint32>(),"Threads running hosted objects' messages and scripts in parallel (0 runs them on the main thread)"),
+    interestSize=new OptionValue("interestSize","0.05",OptionValueType<float>(),"Apparent size (radius over distance) below which proxies get fewer location updates (0 updates all of them continuously)"),
+    interestFalloff=new OptionValue("interestFalloff","0.1",OptionValueType<float>(),"Seconds added between location updates for each multiple a proxy is smaller than interestSize"),
+    interestMaxInterval=new OptionValue("interestMaxInterval","2",OptionValueType<float>(),"Longest a visible proxy goes between location updates, in seconds"),
     NULL
 );
 
@@ -76,10 +92,55 @@ class UUIDLister : public MessageService {
     SpaceID mSpace;
     MessagePort mPort;
     volatile bool mSuccess;
-
+    /// Objects whose fields are requested together in one ReadWriteSet; batch k is answered with reply id k+1.
+    std::vector<std::vector<UUID> > mBatches;
+    size_t mBatchesRemaining;
+    size_t mNumRestored;
+    HostedObjectPtr mFirstRestored;
+    Task::LocalTime mStartTime;
+    Task::LocalTime mStartupTime;
+    enum {OBJECTS_PER_BATCH = 256};
+
+    void sendBatch(uint32 batch) {
+        Persistence::Protocol::ReadWriteSet rws;
+        Persistence::ReadWriteHandler::createBulkReadSet(&rws, mBatches[batch], HostedObject::getRestoreFieldNames());
+        RoutableMessageHeader hdr;
+        hdr.set_source_object(ObjectReference::spaceServiceID());
+        hdr.set_source_port(mPort);
+        hdr.set_destination_port(Services::PERSISTENCE);
+        hdr.set_destination_object(ObjectReference::spaceServiceID());
+        hdr.set_id(batch + 1);
+        std::string body;
+        rws.SerializeToString(&body);
+        mObjectHost->processMessage(hdr, MemoryReference(body));
+    }
+    void restoreBatch(uint32 batch, const Persistence::Protocol::Response &resp) {
+        const std::vector<UUID> &objects = mBatches[batch];
+        int numFields = (int)HostedObject::getRestoreFieldNames().size();
+        if (resp.reads_size() < (int)objects.size() * numFields) {
+            SILOG(cppoh,error,"Short database reply restoring "<<objects.size()<<" objects: "<<resp.reads_size()<<" reads");
+            return;
+        }
+        for (size_t i = 0; i < objects.size(); i++) {
+            SILOG(cppoh,debug,"Loading object "<<ObjectReference(objects[i]));
+            HostedObjectPtr obj = HostedObject::construct<HostedObject>(mObjectHost, objects[i]);
+            // all restored objects share the first one's space connection.
+            obj->initializeRestoreFromReads(mSpace, resp, (int)i * numFields, mFirstRestored);
+            if (!mFirstRestored) {
+                mFirstRestored = obj;
+            }
+            ++mNumRestored;
+        }
+    }
+    /// The scene is as complete as it will get once the restore settles, whether or not it succeeded.
+    void restoreFinished() {
+        SILOG(cppoh,info,"Scene restore time: "<<(Task::LocalTime::now() - mStartupTime).toSeconds()<<" seconds");
+        mSuccess = true;
+    }
 public:
-    UUIDLister(ObjectHost*oh, const SpaceID &space)
-        : mObjectHost(oh), mSpace(space), mPort(Services::REGISTRATION) {
+    UUIDLister(ObjectHost*oh, const SpaceID &space, const Task::LocalTime &startupTime)
+        : mObjectHost(oh), mSpace(space), mPort(Services::REGISTRATION),
+          mBatchesRemaining(0), mNumRestored(0), mStartTime(Task::LocalTime::null()), mStartupTime(startupTime) {
         mObjectHost->registerService(mPort, this);
     }
     ~UUIDLister() {
@@ -96,25 +157,54 @@ public:
         resp.ParseFromArray(body.data(), body.length());
         if (hdr.has_return_status() || resp.has_return_status()) {
             SILOG(cppoh,info,"Failed to connect to database: "<<hdr.has_return_status()<<", "<<resp.has_return_status());
-            mSuccess = true;
+            if (hdr.has_reply_id() && mBatchesRemaining && --mBatchesRemaining) {
+                return;
+            }
+            restoreFinished();
+            return;
+        }
+        if (hdr.has_reply_id()) {
+            uint64 batch = hdr.reply_id() - 1;
+            if (batch >= mBatches.size() || mBatchesRemaining == 0) {
+                return;
+            }
+            restoreBatch((uint32)batch, resp);
+            if (--mBatchesRemaining == 0) {
+                SILOG(cppoh,info,"Restored "<<mNumRestored<<" objects in "
+                      <<(Task::LocalTime::now() - mStartTime).toSeconds()<<" seconds");
+                restoreFinished();
+            }
             return;
         }
         Protocol::UUIDListProperty uuidList;
         if (resp.reads(0).has_return_status()) {
             SILOG(cppoh,info,"Failed to find ObjectList in database.");
-            mSuccess = true;
+            restoreFinished();
             return;
         }
         uuidList.ParseFromString(resp.reads(0).data());
+        mBatches.clear();
         for (int i = 0; i < uuidList.value_size(); i++) {
-            SILOG(cppoh,info,"Loading object "<<ObjectReference(uuidList.value(i)));
-            HostedObjectPtr obj = HostedObject::construct<HostedObject>(mObjectHost, uuidList.value(i));
-            obj->initializeRestoreFromDatabase(mSpace, HostedObjectPtr());
+            if (i % OBJECTS_PER_BATCH == 0) {
+                mBatches.push_back(std::vector<UUID>());
+                mBatches.back().reserve(OBJECTS_PER_BATCH);
+            }
+            mBatches.back().push_back(uuidList.value(i));
+        }
+        if (mBatches.empty()) {
+            restoreFinished();
+            return;
+        }
+        SILOG(cppoh,info,"Loading "<<uuidList.value_size()<<" objects in "<<mBatches.size()<<" batches");
+        mBatchesRemaining = mBatches.size();
+        // Issue every batch up front so the database works on later batches while earlier ones are constructed.
+        for (uint32 batch = 0; batch < mBatches.size(); batch++) {
+            sendBatch(batch);
         }
-        mSuccess = true;
     }
     void go() {
         mSuccess = false;
+        mStartTime = Task::LocalTime::now();
         Persistence::Protocol::ReadWriteSet rws;
         Persistence::Protocol::IStorageElement el = rws.add_reads();
         el.set_field_name("ObjectList");
@@ -155,6 +245,7 @@ int main ( int argc,const char**argv ) {
     myargv[argc+1] = "transfer=fatal,ogre=fatal,task=fatal,resource=fatal";
 
     using namespace Sirikata;
+    Task::LocalTime startupTime = Task::LocalTime::now();
 
     PluginManager plugins;
     const char* pluginNames[] = { "tcpsst", "monoscript", "sqlite", "ogregraphics", "bulletphysics", "colladamodels", NULL};
@@ -198,14 +289,24 @@ int main ( int argc,const char**argv ) {
         if (fp) fclose(fp);
         else localDbFile=dbFile->as<String>();
     }
-    Persistence::ReadWriteHandler *database=Persistence::ReadWriteHandlerFactory::getSingleton()
+    Persistence::ReadWriteHandler *databaseBackend=Persistence::ReadWriteHandlerFactory::getSingleton()
         .getConstructor("sqlite")(String("--databasefile ")+localDbFile);
+    // coalesces repeated writes to the same fields between database flushes
+    Persistence::CachingReadWriteHandler *database=new Persistence::CachingReadWriteHandler(
+        databaseBackend, workQueue,
+        Duration::seconds(dbFlushInterval->as<float>()),
+        dbCacheEntries->as<uint32>(),
+        dbMaxDirty->as<uint32>());
 
     ObjectHost *oh = new ObjectHost(spaceMap, workQueue, ioServ);
+    oh->setMailboxThreads(objectThreads->as<uint32>());
+    oh->setInterestPolicy(interestSize->as<float>(),
+                          Duration::seconds(interestFalloff->as<float>()),
+                          Duration::seconds(interestMaxInterval->as<float>()));
     oh->registerService(Services::PERSISTENCE, database);
 
     {
-        UUIDLister lister(oh, mainSpace);
+        UUIDLister lister(oh, mainSpace, startupTime);
         lister.goWait(ioServ, workQueue);
     }
 
@@ -280,11 +381,18 @@ int main ( int argc,const char**argv ) {
 			sim->forwardMessagesTo(oh);
         }
     }
+    // goWait returned once the restore finished, so the first tick renders the restored scene
+    bool firstFrame = true;
     while ( continue_simulation ) {
         for(SimList::iterator it = sims.begin(); it != sims.end(); it++) {
             continue_simulation = continue_simulation && (*it)->tick();
         }
+        if (firstFrame) {
+            firstFrame = false;
+            SILOG(cppoh,info,"Time to first frame: "<<(Task::LocalTime::now() - startupTime).toSeconds()<<" seconds");
+        }
         oh->tick();
+        database->tick();
         Network::IOServiceFactory::pollService(ioServ);
     }
 	for(SimList::iterator it = sims.begin(); it != sims.end(); it++) {
@@ -292,7 +400,8 @@ int main ( int argc,const char**argv ) {
 	}
     delete oh;
 
-    // delete after OH in case objects want to do last-minute state flushes
+    // delete after OH in case objects want to do last-minute state flushes;
+    // this also writes out anything still cached and deletes the sqlite backend
     delete database;
 
     destroyTransferManager(tm);
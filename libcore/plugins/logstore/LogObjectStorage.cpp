@@ -0,0 +1,540 @@
+/*  Sirikata -- LogStore plugin -- Persistence Services
+ *  LogObjectStorage.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Platform.hpp>
+#include "options/Options.hpp"
+#include <boost/thread.hpp>
+#include <cstdio>
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+#include <io.h>
+#define fsync _commit
+#else
+#include <unistd.h>
+#endif
+#include "LogStore_Persistence.pbj.hpp"
+#include "LogObjectStorage.hpp"
+
+namespace Sirikata { namespace Persistence {
+
+namespace {
+enum LogOp {
+    LOG_ERASE=0,
+    LOG_PUT=1
+};
+
+void appendUInt32(String&out, uint32 val) {
+    char buf[4]={(char)(val&255),(char)((val>>8)&255),(char)((val>>16)&255),(char)((val>>24)&255)};
+    out.append(buf,4);
+}
+bool readUInt32(const String&in, size_t&offset, uint32&val) {
+    if (in.size()<offset+4)
+        return false;
+    const unsigned char*buf=(const unsigned char*)in.data()+offset;
+    val=buf[0]|(buf[1]<<8)|(buf[2]<<16)|((uint32)buf[3]<<24);
+    offset+=4;
+    return true;
+}
+void appendEntry(String&out, LogOp op, const UUID&object, const String&field, const String*value) {
+    out.push_back((char)op);
+    out.append((const char*)object.getArray().begin(),UUID::static_size);
+    appendUInt32(out,(uint32)field.size());
+    out+=field;
+    if (value) {
+        appendUInt32(out,(uint32)value->size());
+        out+=*value;
+    }
+}
+
+template <typename StorageSet,typename ReadSet> void mergeKeysFromStorageSet(StorageSet &ss, const ReadSet&other) {
+    int len = other.reads_size();
+    int sslen = ss.reads_size();
+    int i;
+    for (i=0;i<sslen;++i) {
+        mergeStorageKey(ss.mutable_reads(i),other.reads(i));
+    }
+    for (;i<len;++i) {
+        ss.add_reads();
+        mergeStorageKey(ss.mutable_reads(i),other.reads(i));
+    }
+}
+}
+
+LogObjectStorage*LogObjectStorage::create(bool t, const String&s){
+    return new LogObjectStorage(t,s);
+}
+
+LogObjectStorage::LogObjectStorage(bool transactional, const String& pl)
+ : mTransactional(transactional),
+   mLog(NULL),
+   mLogFailed(false),
+   mLogBytes(0),
+   mLiveBytes(0)
+{
+    OptionValue*databaseFile;
+    OptionValue*workQueueInstance;
+    OptionValue*compactBytes;
+    OptionValue*syncWrites;
+    unsigned char * epoch=NULL;
+    static AtomicValue<int> counter(0);
+    int handle_offset=counter++;
+    InitializeClassOptions("logstore",epoch+handle_offset,
+                           databaseFile=new OptionValue("databasefile","",OptionValueType<String>(),"Sets the log file used to persist the store; empty keeps it in memory only"),
+                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk writes to a common work queue"),
+                           compactBytes=new OptionValue("compactbytes","16777216",OptionValueType<uint32>(),"Minimum log size before it is compacted into a snapshot"),
+                           syncWrites=new OptionValue("sync","false",OptionValueType<bool>(),"Flush every log record to disk before replying"),NULL);
+    (mOptions=OptionSet::getOptions("logstore",epoch+handle_offset))->parse(pl);
+
+    mDiskWorkQueue=(Task::WorkQueue*)workQueueInstance->as<void*>();
+    mWorkQueueThread=NULL;
+    if(mDiskWorkQueue==NULL) {
+        mDiskWorkQueue=&_mLocalWorkQueue;
+        mWorkQueueThread=mDiskWorkQueue->createWorkerThreads(1);
+    }
+    mCompactBytes=compactBytes->as<uint32>();
+    mSync=syncWrites->as<bool>();
+
+    mLogName=databaseFile->as<String>();
+    if (!mLogName.empty()) {
+        mSnapshotName=mLogName+".snapshot";
+        replay(mSnapshotName);
+        size_t logLength=replay(mLogName);
+        mLog=fopen(mLogName.c_str(),"ab");
+        if (mLog==NULL) {
+            SILOG(logstore,error,"Unable to open log "<<mLogName<<", storage will not be persistent");
+        }else {
+            fseek(mLog,0,SEEK_END);
+            if ((size_t)ftell(mLog)!=logLength) {
+                // a torn record at the end would hide everything appended after it
+                SILOG(logstore,warning,"Discarding partial record at the end of "<<mLogName);
+                if (!snapshot()&&mLog) {
+                    SILOG(logstore,error,"Unable to discard the partial record, storage will not be persistent");
+                    fclose(mLog);
+                    mLog=NULL;
+                }
+            }else {
+                mLogBytes=logLength;
+            }
+        }
+    }
+}
+
+LogObjectStorage::~LogObjectStorage() {
+    if(mWorkQueueThread) {
+        _mLocalWorkQueue.destroyWorkerThreads(mWorkQueueThread);
+    }
+    if (mLog) {
+        fclose(mLog);
+    }
+}
+
+size_t LogObjectStorage::replay(const String&filename) {
+    String contents;
+    FILE*fp=fopen(filename.c_str(),"rb");
+    if (fp==NULL)
+        return 0;
+    char buf[65536];
+    size_t len;
+    while ((len=fread(buf,1,sizeof(buf),fp))>0)
+        contents.append(buf,len);
+    fclose(fp);
+
+    size_t offset=0;
+    uint32 recordLength;
+    size_t recordStart=0;
+    while (readUInt32(contents,offset,recordLength)&&contents.size()-offset>=recordLength) {
+        size_t recordEnd=offset+recordLength;
+        while (offset<recordEnd) {
+            LogOp op=(LogOp)contents[offset++];
+            if (recordEnd-offset<UUID::static_size)
+                return recordStart;
+            Key key;
+            key.mObject=UUID((const UUID::byte*)contents.data()+offset,UUID::static_size);
+            offset+=UUID::static_size;
+            uint32 fieldLength;
+            if (!readUInt32(contents,offset,fieldLength)||recordEnd-offset<fieldLength)
+                return recordStart;
+            key.mField=contents.substr(offset,fieldLength);
+            offset+=fieldLength;
+            if (op==LOG_PUT) {
+                uint32 valueLength;
+                if (!readUInt32(contents,offset,valueLength)||recordEnd-offset<valueLength)
+                    return recordStart;
+                putValue(key,contents.data()+offset,valueLength);
+                offset+=valueLength;
+            }else {
+                eraseValue(key);
+            }
+        }
+        recordStart=offset;
+    }
+    return recordStart;
+}
+
+String &LogObjectStorage::putValue(const Key&key, const char*data, size_t length) {
+    std::pair<Index::iterator,bool> where=mIndex.insert(Index::value_type(key,String()));
+    if (where.second)
+        mLiveBytes+=key.mField.size()+UUID::static_size;
+    mLiveBytes+=length;
+    mLiveBytes-=where.first->second.size();
+    where.first->second.assign(data,length);
+    return where.first->second;
+}
+
+void LogObjectStorage::eraseValue(const Key&key) {
+    Index::iterator where=mIndex.find(key);
+    if (where!=mIndex.end()) {
+        mLiveBytes-=where->second.size()+key.mField.size()+UUID::static_size;
+        mIndex.erase(where);
+    }
+}
+
+bool LogObjectStorage::appendLog(const String&record) {
+    String frame;
+    frame.reserve(record.size()+4);
+    appendUInt32(frame,(uint32)record.size());
+    frame+=record;
+    bool written=fwrite(frame.data(),1,frame.size(),mLog)==frame.size();
+    written=written&&fflush(mLog)==0;
+    written=written&&(!mSync||fsync(fileno(mLog))==0);
+    if (!written) {
+        // a torn record is discarded on the next replay, but nothing appended after it would be
+        SILOG(logstore,error,"Unable to append to log "<<mLogName<<", refusing further writes");
+        fclose(mLog);
+        mLog=NULL;
+        mLogFailed=true;
+        return false;
+    }
+    mLogBytes+=frame.size();
+    return true;
+}
+
+bool LogObjectStorage::snapshot() {
+    if (mLogName.empty())
+        return false;
+    String tmpName=mSnapshotName+".tmp";
+    FILE*fp=fopen(tmpName.c_str(),"wb");
+    if (fp==NULL) {
+        SILOG(logstore,error,"Unable to write snapshot "<<tmpName);
+        return false;
+    }
+    bool written=true;
+    String record;
+    for (Index::const_iterator i=mIndex.begin(),ie=mIndex.end();i!=ie&&written;++i) {
+        String entry;
+        appendEntry(entry,LOG_PUT,i->first.mObject,i->first.mField,&i->second);
+        appendUInt32(record,(uint32)entry.size());
+        record+=entry;
+        if (record.size()>65536) {
+            written=fwrite(record.data(),1,record.size(),fp)==record.size();
+            record.clear();
+        }
+    }
+    written=written&&fwrite(record.data(),1,record.size(),fp)==record.size();
+    written=written&&fflush(fp)==0;
+    written=written&&fsync(fileno(fp))==0;
+    written=(fclose(fp)==0)&&written;
+    if (!written) {
+        // the log still holds everything, so keep appending to it and try again at the next compaction
+        SILOG(logstore,error,"Unable to write snapshot "<<tmpName<<", keeping the log");
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    // the snapshot must be in place before the log it replaces is dropped
+#if SIRIKATA_PLATFORM == PLATFORM_WINDOWS
+    std::remove(mSnapshotName.c_str());
+#endif
+    if (std::rename(tmpName.c_str(),mSnapshotName.c_str())!=0) {
+        SILOG(logstore,error,"Unable to replace snapshot "<<mSnapshotName<<", keeping the log");
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    if (mLog)
+        fclose(mLog);
+    mLog=fopen(mLogName.c_str(),"wb");
+    mLogBytes=0;
+    if (mLog==NULL) {
+        // the snapshot holds everything written so far, but nothing after it could be persisted
+        SILOG(logstore,error,"Unable to reopen log "<<mLogName<<", refusing further writes");
+        mLogFailed=true;
+    }
+    return true;
+}
+
+template <class StorageKey> LogObjectStorage::Key LogObjectStorage::getKey(const StorageKey& key) {
+    std::stringstream ss;
+    ss<<key.field_name()<<'_'<<key.field_id();
+    return Key(key.object_uuid(),ss.str());
+}
+
+Protocol::Response::ReturnStatus LogObjectStorage::convertError(Error internal) {
+    switch(internal) {
+      case None:
+        return Protocol::Response::SUCCESS;
+      case KeyMissing:
+        return Protocol::Response::KEY_MISSING;
+      case ComparisonFailed:
+        return Protocol::Response::COMPARISON_FAILED;
+      default:
+        return Protocol::Response::INTERNAL_ERROR;
+    }
+}
+
+template <class ReadSet> void LogObjectStorage::applyReadSet(const ReadSet& rs, Protocol::Response&retval) {
+    int num_reads=rs.reads_size();
+    retval.clear_reads();
+    while (retval.reads_size()<num_reads)
+        retval.add_reads();
+    for (int rs_it=0;rs_it<num_reads;++rs_it) {
+        Index::const_iterator where=mIndex.find(getKey(rs.reads(rs_it)));
+        if (where==mIndex.end()) {
+            retval.reads(rs_it).clear_data();
+            retval.reads(rs_it).set_return_status(Protocol::StorageElement::KEY_MISSING);
+        }else {
+            retval.reads(rs_it).set_data(where->second);
+        }
+        if(rs.reads(rs_it).has_index()) {
+            retval.reads(rs_it).set_index(rs.reads(rs_it).index());
+        }
+    }
+    if (rs.has_options()&&(rs.options()&Protocol::ReadWriteSet::RETURN_READ_NAMES)!=0) {
+        mergeKeysFromStorageSet( retval, rs );
+    }
+}
+
+template <class WriteSet> LogObjectStorage::Error LogObjectStorage::applyWriteSet(const WriteSet& ws) {
+    int num_writes=ws.writes_size();
+    if (num_writes==0)
+        return None;
+    if (mLogFailed)
+        return LogFailed;
+    std::vector<Key> keys;
+    keys.reserve(num_writes);
+    for (int ws_it=0;ws_it<num_writes;++ws_it)
+        keys.push_back(getKey(ws.writes(ws_it)));
+    if (mLog) {
+        String record;
+        for (int ws_it=0;ws_it<num_writes;++ws_it) {
+            const Key&key=keys[ws_it];
+            if (ws.writes(ws_it).has_data()) {
+                const String&data=ws.writes(ws_it).data();
+                appendEntry(record,LOG_PUT,key.mObject,key.mField,&data);
+            }else {
+                appendEntry(record,LOG_ERASE,key.mObject,key.mField,NULL);
+            }
+        }
+        if (!appendLog(record))
+            return LogFailed;
+    }
+    for (int ws_it=0;ws_it<num_writes;++ws_it) {
+        if (ws.writes(ws_it).has_data()) {
+            const String&data=ws.writes(ws_it).data();
+            putValue(keys[ws_it],data.data(),data.size());
+        }else {
+            eraseValue(keys[ws_it]);
+        }
+    }
+    // compact once most of the log is overwritten values
+    if (mLog&&mLogBytes>mCompactBytes&&mLogBytes>2*mLiveBytes&&!snapshot()) {
+        // wait for the log to double before trying again rather than rewriting the snapshot on every record
+        mCompactBytes=2*mLogBytes;
+    }
+    return None;
+}
+
+template <class CompareSet> LogObjectStorage::Error LogObjectStorage::checkCompareSet(const CompareSet& cs) {
+    int num_compares=cs.compares_size();
+    for (int cs_it=0;cs_it<num_compares;++cs_it) {
+        Index::const_iterator where=mIndex.find(getKey(cs.compares(cs_it)));
+        if (where==mIndex.end())
+            return KeyMissing;
+        const String&data=where->second;
+        bool passed_test=true;
+        if(cs.compares(cs_it).has_data()==false) {
+            passed_test=false;
+        } else if (cs.compares(cs_it).has_comparator()==false) {
+            passed_test=(cs.compares(cs_it).data()==data);
+        }else {
+            switch (cs.compares(cs_it).comparator()) {
+              case Protocol::CompareElement::EQUAL:
+                passed_test=(cs.compares(cs_it).data()==data);
+                break;
+              case Protocol::CompareElement::NEQUAL:
+                passed_test=(cs.compares(cs_it).data()!=data);
+                break;
+              default:
+                passed_test=false;
+                break;
+            }
+        }
+        if (!passed_test)
+            return ComparisonFailed;
+    }
+    return None;
+}
+
+LogObjectStorage::ApplyReadWriteWorker::ApplyReadWriteWorker(LogObjectStorage*parent, Protocol::ReadWriteSet*rws, const ResultCallback&cb, const RoutableMessageHeader*hdr, void (*destroyReadWrite)(Protocol::ReadWriteSet*))
+ : mParent(parent),
+   mCallback(cb),
+   mIsMessage(hdr!=NULL),
+   mReadWrite(rws),
+   mDestroyReadWrite(destroyReadWrite) {
+    if (hdr)
+        mHeader=*hdr;
+}
+
+void LogObjectStorage::ApplyReadWriteWorker::operator()() {
+    Protocol::Response*response=new Protocol::Response;
+    mParent->applyReadSet(*mReadWrite,*response);
+    Error error=mParent->applyWriteSet(*mReadWrite);
+    if (error!=None)
+        response->set_return_status(convertError(error));
+    (*mDestroyReadWrite)(mReadWrite);
+    if (mIsMessage) {
+        mHeader.swap_source_and_destination();
+        mParent->forward(mHeader,*response);
+        delete response;
+    }else {
+        mCallback(response);
+    }
+    delete this;
+}
+
+LogObjectStorage::ApplyTransactionWorker::ApplyTransactionWorker(LogObjectStorage*parent, Protocol::Minitransaction*mt, const ResultCallback&cb, const RoutableMessageHeader*hdr, void (*destroyMinitransaction)(Protocol::Minitransaction*))
+ : mParent(parent),
+   mCallback(cb),
+   mIsMessage(hdr!=NULL),
+   mTransaction(mt),
+   mDestroyMinitransaction(destroyMinitransaction) {
+    if (hdr)
+        mHeader=*hdr;
+}
+
+void LogObjectStorage::ApplyTransactionWorker::operator()() {
+    Protocol::Response*response=new Protocol::Response;
+    // requests are applied one at a time, so compares, reads and writes are atomic
+    Error error=mParent->checkCompareSet(*mTransaction);
+    mParent->applyReadSet(*mTransaction,*response);
+    if (error==None)
+        error=mParent->applyWriteSet(*mTransaction);
+    if (error!=None)
+        response->set_return_status(convertError(error));
+    (*mDestroyMinitransaction)(mTransaction);
+    if (mIsMessage) {
+        mHeader.swap_source_and_destination();
+        mParent->forward(mHeader,*response);
+        delete response;
+    }else {
+        mCallback(response);
+    }
+    delete this;
+}
+
+void LogObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*mt, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+    mDiskWorkQueue->enqueue(new ApplyTransactionWorker(this,mt,ResultCallback(),&rmh,destroyMinitransaction));
+}
+
+void LogObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*rws, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    assert(mTransactional == false);
+    mDiskWorkQueue->enqueue(new ApplyReadWriteWorker(this,rws,ResultCallback(),&rmh,destroyReadWriteSet));
+}
+
+void LogObjectStorage::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
+    assert(mTransactional == false);
+    mDiskWorkQueue->enqueue(new ApplyReadWriteWorker(this,rws,cb,NULL,destroyReadWriteSet));
+}
+
+void LogObjectStorage::applyInternal(Protocol::Minitransaction* mt, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
+    assert(mTransactional == true);
+    mDiskWorkQueue->enqueue(new ApplyTransactionWorker(this,mt,cb,NULL,destroyMinitransaction));
+}
+
+void LogObjectStorage::destroyResponse(Persistence::Protocol::Response*res) {
+    delete res;
+}
+
+bool LogObjectStorage::forwardMessagesTo(MessageService*ms) {
+    mDiskWorkQueue->enqueue(new AddMessageServiceMessage(this,ms));
+    return true;
+}
+void LogObjectStorage::AddMessageServiceMessage::operator() (){
+    mParent->mInterestedParties.push_back(mToAdd);
+    delete this;
+}
+
+void LogObjectStorage::RemoveMessageServiceMessage::operator()(){
+    mParent->mInterestedParties.erase(std::remove(mParent->mInterestedParties.begin(),
+                                                  mParent->mInterestedParties.end(),
+                                                  mToRemove),
+                                      mParent->mInterestedParties.end());
+    *mDone=true;
+    delete this;
+}
+
+bool LogObjectStorage::endForwardingMessagesTo(MessageService*ms) {
+    volatile bool complete=false;
+    mDiskWorkQueue->enqueue(new RemoveMessageServiceMessage(this,ms,&complete));
+    while(!complete) {
+    }
+    return true;
+}
+
+void LogObjectStorage::processMessage(const RoutableMessageHeader&hdr,MemoryReference ref) {
+    if (mTransactional) {
+        Protocol::Minitransaction *trans=new Protocol::Minitransaction;
+        if (trans->ParseFromArray(ref.data(),ref.size())) {
+            transactMessage(hdr,trans);
+        }else {
+            delete trans;
+        }
+    }else {
+        Protocol::ReadWriteSet *rws=new Protocol::ReadWriteSet;
+        if (rws->ParseFromArray(ref.data(),ref.size())) {
+            applyMessage(hdr,rws);
+        }else {
+            delete rws;
+        }
+    }
+}
+
+void LogObjectStorage::forward (RoutableMessageHeader&hdr, Protocol::Response&resp) {
+    String databuf;
+    resp.SerializeToString(&databuf);
+    MemoryReference membuf(databuf);
+    for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end();
+         i!=ie;
+         ++i) {
+        (*i)->processMessage(hdr,membuf);
+    }
+}
+
+} }// namespace Sirikata::Persistence
@@ -0,0 +1,178 @@
+/*  Sirikata -- LogStore plugin -- Persistence Services
+ *  LogObjectStorage.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _LOG_OBJECT_STORAGE_HPP_
+#define _LOG_OBJECT_STORAGE_HPP_
+
+#include "persistence/ObjectStorage.hpp"
+#include "task/WorkQueue.hpp"
+#include "util/RoutableMessageHeader.hpp"
+#include "util/ThreadSafeQueue.hpp"
+namespace Sirikata { namespace Persistence {
+
+/** In-memory object storage for hot state such as positions and script
+ *  variables.  Values live in a hash index keyed by (object, field); every
+ *  ReadWriteSet or Minitransaction that changes them appends one record to a
+ *  log file, which is replayed on startup.  Once the log holds mostly
+ *  overwritten values it is compacted by writing a snapshot of the index and
+ *  starting a new, empty log.
+ *
+ *  Like SQLiteObjectStorage an instance is used either as a ReadWriteHandler
+ *  or as a MinitransactionHandler, and requests are applied in order on a
+ *  disk work queue.  Without a databasefile nothing is persisted.
+ */
+class LogObjectStorage : public ReadWriteHandler, public MinitransactionHandler {
+public:
+    static LogObjectStorage*create(bool transactional,const String&);
+    virtual ~LogObjectStorage();
+
+    virtual void destroyResponse(Persistence::Protocol::Response*);
+
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::Minitransaction*, const ResultCallback&, void(*minitransactionDestruction)(Protocol::Minitransaction*));
+    virtual void applyInternal(Sirikata::Persistence::Protocol::ReadWriteSet*, const ResultCallback&,void(*)(Protocol::ReadWriteSet*));
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+private:
+    LogObjectStorage(bool transactional, const String& pl);
+
+    /// Identifies one stored value: the object and its "name_id" field key.
+    struct Key {
+        UUID mObject;
+        String mField;
+        Key() {}
+        Key(const UUID&object, const String&field):mObject(object),mField(field) {}
+        bool operator==(const Key&other) const {
+            return mObject==other.mObject&&mField==other.mField;
+        }
+        class Hasher {public:
+            size_t operator()(const Key&k) const {
+                return UUID::Hasher()(k.mObject)^std::tr1::hash<std::string>()(k.mField);
+            }
+        };
+    };
+    typedef std::tr1::unordered_map<Key,String,Key::Hasher> Index;
+
+    /** Applies one request and delivers its response.  Message variants
+     *  forward the response to every interested MessageService.
+     */
+    class ApplyReadWriteWorker:public Task::WorkItem{
+        LogObjectStorage*mParent;
+        ResultCallback mCallback;
+        RoutableMessageHeader mHeader;
+        bool mIsMessage;
+        Protocol::ReadWriteSet*mReadWrite;
+        void (*mDestroyReadWrite)(Protocol::ReadWriteSet*);
+    public:
+        ApplyReadWriteWorker(LogObjectStorage*parent, Protocol::ReadWriteSet*rws, const ResultCallback&cb, const RoutableMessageHeader*hdr, void (*destroyReadWrite)(Protocol::ReadWriteSet*));
+        void operator()();
+    };
+    class ApplyTransactionWorker:public Task::WorkItem{
+        LogObjectStorage*mParent;
+        ResultCallback mCallback;
+        RoutableMessageHeader mHeader;
+        bool mIsMessage;
+        Protocol::Minitransaction*mTransaction;
+        void (*mDestroyMinitransaction)(Protocol::Minitransaction*);
+    public:
+        ApplyTransactionWorker(LogObjectStorage*parent, Protocol::Minitransaction*mt, const ResultCallback&cb, const RoutableMessageHeader*hdr, void (*destroyMinitransaction)(Protocol::Minitransaction*));
+        void operator()();
+    };
+    class AddMessageServiceMessage:public Task::WorkItem {
+        LogObjectStorage*mParent;
+        MessageService*mToAdd;
+    public:
+        AddMessageServiceMessage(LogObjectStorage*p,MessageService*a):mParent(p),mToAdd(a){}
+        void operator()();
+    };
+    class RemoveMessageServiceMessage:public Task::WorkItem {
+        LogObjectStorage*mParent;
+        MessageService*mToRemove;
+        volatile bool*mDone;
+    public:
+        RemoveMessageServiceMessage(LogObjectStorage*p,MessageService*a,volatile bool*d):mParent(p),mToRemove(a),mDone(d){}
+        void operator()();
+    };
+
+    enum Error {
+        None,
+        KeyMissing,
+        ComparisonFailed,
+        LogFailed
+    };
+    static Protocol::Response::ReturnStatus convertError(Error internal);
+
+    template <class StorageKey> static Key getKey(const StorageKey& key);
+    template <class ReadSet> void applyReadSet(const ReadSet& rs, Protocol::Response&retval);
+    /** Appends every write in ws to the log as a single record, so a request is
+     *  recovered entirely or not at all, then updates the index. Returns LogFailed,
+     *  leaving the index alone, if the record could not be written.
+     */
+    template <class WriteSet> Error applyWriteSet(const WriteSet& ws);
+    template <class CompareSet> Error checkCompareSet(const CompareSet& cs);
+
+    /// Stores a value in the index, keeping mLiveBytes up to date.
+    String &putValue(const Key&key, const char*data, size_t length);
+    void eraseValue(const Key&key);
+    /// Reads one log or snapshot file into the index, returning the length of its intact prefix.
+    size_t replay(const String&filename);
+    /// Appends a record body to the log. Returns false, and closes the log for good, if it could not be written.
+    bool appendLog(const String&record);
+    /// Writes every live value to the snapshot file and truncates the log. Returns false, leaving the log alone, if the snapshot could not be written.
+    bool snapshot();
+
+    void forward(RoutableMessageHeader&hdr, Protocol::Response&);
+
+    std::vector<MessageService*>mInterestedParties;
+    OptionSet*mOptions;
+    Task::WorkQueue *mDiskWorkQueue;
+    Task::ThreadSafeWorkQueue _mLocalWorkQueue;
+    Task::WorkQueueThread* mWorkQueueThread;
+
+    bool mTransactional;
+    Index mIndex;
+    String mLogName;
+    String mSnapshotName;
+    FILE*mLog;
+    bool mLogFailed; // an append failed, so writes are refused rather than lost
+    bool mSync;
+    size_t mLogBytes; // bytes appended since the last snapshot
+    size_t mLiveBytes; // approximate size of the index's keys and values
+    size_t mCompactBytes; // the log is not compacted until it is at least this big
+};
+
+} }// namespace Sirikata::Persistence
+
+
+#endif //_LOG_OBJECT_STORAGE_HPP_
@@ -63,9 +63,31 @@ SQLiteDB::SQLiteDB(const String& name) {
 }
 
 SQLiteDB::~SQLiteDB() {
+    for (StatementMap::iterator i = mStatements.begin(), ie = mStatements.end(); i != ie; ++i) {
+        sqlite3_finalize(i->second);
+    }
     sqlite3_close(mObjectDB);
 }
 
+sqlite3_stmt* SQLiteDB::prepare(const String& sql) {
+    StatementMap::iterator where = mStatements.find(sql);
+    if (where != mStatements.end()) {
+        sqlite3_reset(where->second);
+        sqlite3_clear_bindings(where->second);
+        return where->second;
+    }
+    sqlite3_stmt* stmt = NULL;
+    int rc = sqlite3_prepare_v2(mObjectDB, sql.c_str(), (int)sql.size(), &stmt, NULL);
+    SQLite::check_sql_error(mObjectDB, rc, NULL, "Error preparing statement " + sql);
+    if (rc != SQLITE_OK) {
+        if (stmt)
+            sqlite3_finalize(stmt);
+        return NULL;
+    }
+    mStatements[sql] = stmt;
+    return stmt;
+}
+
 sqlite3* SQLiteDB::db() const {
     return mObjectDB;
 }
@@ -46,8 +46,18 @@ public:
     ~SQLiteDB();
 
     sqlite3* db() const;
+    /** Returns a compiled statement for sql, reset and with its bindings cleared.
+     *  Statements are compiled once per connection and finalized with it, so
+     *  the result must not be finalized by the caller.  Since each thread
+     *  has its own connection no locking is done.
+     *  \param sql the statement text, which also serves as the cache key
+     *  \returns the statement or NULL if it failed to compile
+     */
+    sqlite3_stmt* prepare(const String& sql);
 private:
+    typedef std::tr1::unordered_map<String, sqlite3_stmt*> StatementMap;
     sqlite3* mObjectDB;
+    StatementMap mStatements;
 };
 
 typedef std::tr1::shared_ptr<SQLiteDB> SQLiteDBPtr;
@@ -41,9 +41,13 @@
 #define OPTION_DATABASE   "db"
 
 #define TABLE_NAME "persistence"
+#define VALUE_QUERY "SELECT value FROM \"" TABLE_NAME "\" WHERE object == ? AND key == ?"
+#define VALUE_INSERT "INSERT OR REPLACE INTO \"" TABLE_NAME "\" (object, key, value) VALUES(?, ?, ?)"
+#define VALUE_DELETE "DELETE FROM \"" TABLE_NAME "\" WHERE object = ? AND key = ?"
 
 namespace Sirikata { namespace Persistence {
 
+class SQLiteObjectStorage::UniqueLock : public boost::mutex {};
  
 template <typename StorageSet> void clearValuesFromStorageSet(StorageSet &ss) {
     int len = ss.reads_size();
@@ -100,19 +104,26 @@ SQLiteObjectStorage::SQLiteObjectStorage(bool transactional, const String& pl)
  : mTransactional(transactional),
    mDBName(),
    mRetries(5),
-   mBusyTimeout(1000)
+   mBusyTimeout(1000),
+   mGroupLock(new UniqueLock),
+   mGroupScheduled(false)
 {
     OptionValue*databaseFile;
     OptionValue*workQueueInstance;
+    OptionValue*groupCommit;
     unsigned char * epoch=NULL;
     static AtomicValue<int> counter(0);
     int handle_offset=counter++;
     InitializeClassOptions("sqlite",epoch+handle_offset,
                            databaseFile=new OptionValue("databasefile","",OptionValueType<String>(),"Sets the database to be used for storage"),
-                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk reads to a common work queue"),NULL);
+                           workQueueInstance=new OptionValue("workqueue","0",OptionValueType<void*>(),"Sets the work queue to be used for disk reads to a common work queue"),
+                           groupCommit=new OptionValue("groupcommit","64",OptionValueType<uint32>(),"Maximum number of queued requests applied in a single transaction"),NULL);
     (mOptions=OptionSet::getOptions("sqlite",epoch+handle_offset))->parse(pl);
 
     mDiskWorkQueue=(Task::WorkQueue*)workQueueInstance->as<void*>();
+    mMaxGroupCommit=groupCommit->as<uint32>();
+    if (mMaxGroupCommit==0)
+        mMaxGroupCommit=1;
     mWorkQueueThread=NULL;
     if(mDiskWorkQueue==NULL) {
         mDiskWorkQueue=&_mLocalWorkQueue;
@@ -149,41 +160,98 @@ SQLiteObjectStorage::~SQLiteObjectStorage() {
     if(mWorkQueueThread) {
         _mLocalWorkQueue.destroyWorkerThreads(mWorkQueueThread);
     }
+    delete mGroupLock;
 }
 void SQLiteObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::Minitransaction*mt, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
     assert(mTransactional == true);
 
-    mDiskWorkQueue->enqueue(new ApplyTransactionMessage(this,mt,rmh,destroyMinitransaction));
+    enqueueGroup(new ApplyTransactionMessage(this,mt,rmh,destroyMinitransaction));
 }
 
 void SQLiteObjectStorage::applyInternal(const RoutableMessageHeader&rmh,Protocol::ReadWriteSet*mt, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
     assert(mTransactional == false);
 
-    mDiskWorkQueue->enqueue(new ApplyReadWriteMessage(this,mt,rmh,destroyReadWriteSet));
+    enqueueGroup(new ApplyReadWriteMessage(this,mt,rmh,destroyReadWriteSet));
 }
 
 void SQLiteObjectStorage::applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb, void (*destroyReadWriteSet)(Protocol::ReadWriteSet*)){
     assert(mTransactional == false);
 
-    mDiskWorkQueue->enqueue(new ApplyReadWriteWorker(this,rws,cb,destroyReadWriteSet));
+    enqueueGroup(new ApplyReadWriteWorker(this,rws,cb,destroyReadWriteSet));
 }
 
 void SQLiteObjectStorage::applyInternal(Protocol::Minitransaction* mt, const ResultCallback& cb, void (*destroyMinitransaction)(Protocol::Minitransaction*)){
     assert(mTransactional == true);
 
-    mDiskWorkQueue->enqueue(new ApplyTransactionWorker(this,mt,cb,destroyMinitransaction));
+    enqueueGroup(new ApplyTransactionWorker(this,mt,cb,destroyMinitransaction));
 }
 SQLiteObjectStorage::ApplyReadWriteWorker::ApplyReadWriteWorker(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb, void (*destroyRWS)(Protocol::ReadWriteSet*)){
     mDestroyReadWrite=destroyRWS;
     mParent=parent;
     this->rws=rws;
     this->cb=cb;
-    mResponse=NULL;
+    mResponse=new Protocol::Response;
 }
 
-Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyReadWriteWorker::processReadWrite() {
-    Error error = DatabaseLocked;
+void SQLiteObjectStorage::enqueueGroup(ApplyWorker*w) {
+    bool schedule;
+    {
+        boost::lock_guard<boost::mutex> lok(*mGroupLock);
+        mGroupPending.push_back(w);
+        schedule=!mGroupScheduled;
+        mGroupScheduled=true;
+    }
+    if (schedule)
+        mDiskWorkQueue->enqueue(new GroupCommit(this));
+}
+
+void SQLiteObjectStorage::GroupCommit::operator()() {
+    std::vector<ApplyWorker*> group;
+    {
+        boost::lock_guard<boost::mutex> lok(*mParent->mGroupLock);
+        if (mParent->mGroupPending.size()<=mParent->mMaxGroupCommit) {
+            group.swap(mParent->mGroupPending);
+        }else {
+            group.assign(mParent->mGroupPending.begin(),mParent->mGroupPending.begin()+mParent->mMaxGroupCommit);
+            mParent->mGroupPending.erase(mParent->mGroupPending.begin(),mParent->mGroupPending.begin()+mParent->mMaxGroupCommit);
+        }
+    }
     SQLiteDBPtr db = mParent->mDB;
+    mParent->beginTransaction(db);
+    for (std::vector<ApplyWorker*>::iterator i=group.begin(),ie=group.end();i!=ie;++i)
+        (*i)->process(db);
+    if (!mParent->commitTransaction(db)) {
+        mParent->rollbackTransaction(db);
+        for (std::vector<ApplyWorker*>::iterator i=group.begin(),ie=group.end();i!=ie;++i)
+            (*i)->commitFailed();
+    }
+    // only answer once the writes are durable
+    for (std::vector<ApplyWorker*>::iterator i=group.begin(),ie=group.end();i!=ie;++i)
+        (**i)();
+    bool reschedule;
+    {
+        boost::lock_guard<boost::mutex> lok(*mParent->mGroupLock);
+        reschedule=!mParent->mGroupPending.empty();
+        mParent->mGroupScheduled=reschedule;
+    }
+    // at most one group is in flight per storage, so requests stay in order
+    if (reschedule)
+        mParent->mDiskWorkQueue->enqueue(this);
+    else
+        delete this;
+}
+
+void SQLiteObjectStorage::ApplyWorker::commitFailed() {
+    mResponse->clear_reads();
+    mResponse->set_return_status(convertError(DatabaseLocked));
+}
+
+void SQLiteObjectStorage::ApplyReadWriteWorker::process(const SQLiteDBPtr&db) {
+    processReadWrite(db);
+}
+
+Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyReadWriteWorker::processReadWrite(const SQLiteDBPtr&db) {
+    Error error = DatabaseLocked;
     int retries =mParent->mRetries;
     for(int tries = 0; tries < retries+1 && error != None; tries++)
         error = mParent->applyReadSet(db, *rws, *mResponse);
@@ -193,8 +261,15 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyReadWriteWorker::proc
     }else {//FIXME do we want to abort the operation (note it's not a transaction) if we failed to read any items? I think so...
         error = DatabaseLocked;
 
-        for(int tries = 0; tries < retries+1 && error != None; tries++)
+        // each attempt runs in its own savepoint so a failed one leaves none of its writes in the group
+        for(int tries = 0; tries < retries+1 && error != None; tries++) {
+            mParent->beginSavepoint(db);
             error = mParent->applyWriteSet(db, *rws, retries);
+            if (error != None)
+                mParent->rollbackSavepoint(db);
+            else
+                mParent->releaseSavepoint(db);
+        }
         if (error != None) {
             mResponse->set_return_status(convertError(error));
             return mResponse->return_status();
@@ -208,14 +283,17 @@ SQLiteObjectStorage::ApplyTransactionWorker::ApplyTransactionWorker(SQLiteObject
     mParent=parent;
     this->mt=mt;
     this->cb=cb;
+    mResponse=new Protocol::Response;
+}
+void SQLiteObjectStorage::ApplyTransactionWorker::process(const SQLiteDBPtr&db) {
+    processTransaction(db);
 }
-Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::processTransaction() {
+Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::processTransaction(const SQLiteDBPtr&db) {
     Error error = None;
-    SQLiteDBPtr db = mParent->mDB;
     int retries=mParent->mRetries;
     int tries = retries + 1;
     while( tries > 0 ) {
-        mParent->beginTransaction(db);
+        mParent->beginSavepoint(db);
 
         error = mParent->checkCompareSet(db, *mt);
 
@@ -229,15 +307,17 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::pr
 
         // Errors during compares or reads won't be resolved by retrying
         if (error != None) {
-            mParent->rollbackTransaction(db);
+            mParent->rollbackSavepoint(db);
             break;
         }
 
         error = mParent->applyWriteSet(db, *mt, 0);
-        if (error != None)
-            mParent->rollbackTransaction(db);
-        else
-            mParent->commitTransaction(db);
+        if (error != None) {
+            mParent->rollbackSavepoint(db);
+        }else {
+            mParent->releaseSavepoint(db);
+            break;
+        }
 
         tries--;
     }
@@ -249,8 +329,6 @@ Protocol::Response::ReturnStatus SQLiteObjectStorage::ApplyTransactionWorker::pr
 }
 
 void SQLiteObjectStorage::ApplyTransactionWorker::operator() () {
-    mResponse = new Protocol::Response;
-    processTransaction();
     (*mDestroyMinitransaction)(mt);
     cb(mResponse);
     delete this;
@@ -258,8 +336,6 @@ void SQLiteObjectStorage::ApplyTransactionWorker::operator() () {
 
 
 void SQLiteObjectStorage::ApplyReadWriteWorker::operator() () {
-    mResponse = new Protocol::Response;
-    processReadWrite();
     (*mDestroyReadWrite)(rws);
     cb(mResponse);
     delete this;
@@ -269,26 +345,21 @@ SQLiteObjectStorage::ApplyTransactionMessage::ApplyTransactionMessage(SQLiteObje
     mParent=parent;
     this->mt=mt;
     this->hdr=hdr;
+    mResponse=&mMessageResponse;
 }
 void SQLiteObjectStorage::ApplyReadWriteMessage::operator() () {
-    Protocol::Response response;
-    mResponse = &response;
-    processReadWrite();
     assert(mResponse!=NULL);
     (*mDestroyReadWrite)(rws);
     hdr.swap_source_and_destination();
-    mParent->forward(hdr,response);
+    mParent->forward(hdr,mMessageResponse);
     mResponse=NULL;
     delete this;
 }
 void SQLiteObjectStorage::ApplyTransactionMessage::operator() () {
-    Protocol::Response response;
-    mResponse = &response;
-    processTransaction();
     assert(mResponse!=NULL);
     (*mDestroyMinitransaction)(mt);
     hdr.swap_source_and_destination();
-    mParent->forward(hdr,response);
+    mParent->forward(hdr,mMessageResponse);
     mResponse=NULL;
     delete this;
 }
@@ -299,6 +370,7 @@ SQLiteObjectStorage::ApplyReadWriteMessage::ApplyReadWriteMessage(SQLiteObjectSt
     mParent=parent;
     this->rws=rws;
     this->hdr=hdr;
+    mResponse=&mMessageResponse;
 }
 /*
 void SQLiteObjectStorage::handleResult(const EventPtr& evt) const {
@@ -307,58 +379,44 @@ void SQLiteObjectStorage::handleResult(const EventPtr& evt) const {
     revt->callback()(revt->error());
 }
 */
-void SQLiteObjectStorage::beginTransaction(const SQLiteDBPtr& db) {
-    String begin = "BEGIN DEFERRED TRANSACTION";
-
-    int rc;
-    char* remain;
-    sqlite3_stmt* begin_stmt;
-
-    rc = sqlite3_prepare_v2(db->db(), begin.c_str(), -1, &begin_stmt, (const char**)&remain);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing begin transaction statement");
+int SQLiteObjectStorage::execute(const SQLiteDBPtr& db, const String& sql) {
+    sqlite3_stmt* stmt = db->prepare(sql);
+    if (stmt == NULL)
+        return SQLITE_ERROR;
+    int rc = sqlite3_step(stmt);
+    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing " + sql);
+    sqlite3_reset(stmt);
+    return rc;
+}
 
-    rc = sqlite3_step(begin_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing begin statement");
-    rc = sqlite3_finalize(begin_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing begin statement");
+void SQLiteObjectStorage::beginTransaction(const SQLiteDBPtr& db) {
+    execute(db, "BEGIN DEFERRED TRANSACTION");
 }
 
 void SQLiteObjectStorage::rollbackTransaction(const SQLiteDBPtr& db) {
-    String rollback = "ROLLBACK TRANSACTION";
-
-    int rc;
-    char* remain;
-    sqlite3_stmt* rollback_stmt;
-
-    rc = sqlite3_prepare_v2(db->db(), rollback.c_str(), -1, &rollback_stmt, (const char**)&remain);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing rollback transaction statement");
-
-    rc = sqlite3_step(rollback_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing rollback statement");
-    rc = sqlite3_finalize(rollback_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing rollback statement");
+    execute(db, "ROLLBACK TRANSACTION");
 }
 
 bool SQLiteObjectStorage::commitTransaction(const SQLiteDBPtr& db) {
-    String commit = "COMMIT TRANSACTION";
-
-    int rc;
-    char* remain;
-    sqlite3_stmt* commit_stmt;
+    return execute(db, "COMMIT TRANSACTION") == SQLITE_DONE;
+}
 
-    rc = sqlite3_prepare_v2(db->db(), commit.c_str(), -1, &commit_stmt, (const char**)&remain);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing commit transaction statement");
+void SQLiteObjectStorage::beginSavepoint(const SQLiteDBPtr& db) {
+    execute(db, "SAVEPOINT request");
+}
 
-    rc = sqlite3_step(commit_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error executing commit statement");
-    rc = sqlite3_finalize(commit_stmt);
-    SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing commit statement");
+void SQLiteObjectStorage::releaseSavepoint(const SQLiteDBPtr& db) {
+    execute(db, "RELEASE SAVEPOINT request");
+}
 
-    return true;
+void SQLiteObjectStorage::rollbackSavepoint(const SQLiteDBPtr& db) {
+    // ROLLBACK TO leaves the savepoint open, so release it as well
+    execute(db, "ROLLBACK TO SAVEPOINT request");
+    execute(db, "RELEASE SAVEPOINT request");
 }
 
 template<class StorageKey> String SQLiteObjectStorage::getTableName(const StorageKey& key) {
-    return key.object_uuid().rawHexData();
+    return key.object_uuid().rawData();
 }
 
 template <class StorageKey> String SQLiteObjectStorage::getKeyName(const StorageKey& key) {
@@ -394,21 +452,19 @@ template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyRe
         retval.add_reads();
     SQLiteObjectStorage::Error databaseError=None;
     for (int rs_it=0;rs_it<num_reads;++rs_it) {
-        String object_hex = getTableName(rs.reads(rs_it));
+        String object_raw = getTableName(rs.reads(rs_it));
         String key_name = getKeyName(rs.reads(rs_it));
 
-        String value_query = "SELECT value FROM ";
-        value_query += "\"" TABLE_NAME "\"";
-        value_query += " WHERE object == x\'" + object_hex + "\' AND key == ?";
-        int rc;
-        char* remain;
-        sqlite3_stmt* value_query_stmt;
+        int rc=SQLITE_OK;
+        sqlite3_stmt* value_query_stmt = db->prepare(VALUE_QUERY);
         bool newStep=true;
         bool locked=false;
-        rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
-        if (rc==SQLITE_OK) {
-            rc = sqlite3_bind_text(value_query_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+        if (value_query_stmt) {
+            rc = sqlite3_bind_blob(value_query_stmt, 1, object_raw.data(), (int)object_raw.size(), SQLITE_TRANSIENT);
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value query statement");
+        }
+        if (value_query_stmt && rc==SQLITE_OK) {
+            rc = sqlite3_bind_text(value_query_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
             SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value query statement");
             if (rc==SQLITE_OK) {
                 int step_rc = sqlite3_step(value_query_stmt);
@@ -427,8 +483,10 @@ template <class ReadSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyRe
                 
             }
         }
-        rc = sqlite3_finalize(value_query_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+        if (value_query_stmt) {
+            rc = sqlite3_reset(value_query_stmt);
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting value query statement");
+        }
         if (locked||rc == SQLITE_LOCKED||rc==SQLITE_BUSY) {
             retval.clear_reads();
             return DatabaseLocked;
@@ -453,46 +511,32 @@ template <class WriteSet> SQLiteObjectStorage::Error SQLiteObjectStorage::applyW
     int num_writes=ws.writes_size();
     for (int ws_it=0;ws_it<num_writes;++ws_it) {
 
-        String object_hex = getTableName(ws.writes(ws_it));
+        String object_raw = getTableName(ws.writes(ws_it));
         String key_name = getKeyName(ws.writes(ws_it));
 
         int rc;
-        char* remain;
-
-        // Insert or replace the value
-
-        String value_insert = "INSERT OR REPLACE INTO ";
-        if (!ws.writes(ws_it).has_data()) {
-             value_insert = "DELETE FROM ";
-        }
-        value_insert += "\"" TABLE_NAME "\"";
-        if (!ws.writes(ws_it).has_data()) {
-            value_insert+= " WHERE object = x\'" + object_hex + "\' AND key = ?";
-        }else {
-        //if (ws.writes(ws_it).has_data()) {
-            value_insert += " (object, key, value) VALUES(x\'" + object_hex + "\', ?, ?)";
-            //}
-        }
-        sqlite3_stmt* value_insert_stmt;
 
-        rc = sqlite3_prepare_v2(db->db(), value_insert.c_str(), -1, &value_insert_stmt, (const char**)&remain);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value insert statement");
+        // Insert or replace the value, or delete it if no data was given
+        sqlite3_stmt* value_insert_stmt = db->prepare(ws.writes(ws_it).has_data() ? VALUE_INSERT : VALUE_DELETE);
+        if (value_insert_stmt == NULL)
+            return DatabaseLocked;
 
-        rc = sqlite3_bind_text(value_insert_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+        rc = sqlite3_bind_blob(value_insert_stmt, 1, object_raw.data(), (int)object_raw.size(), SQLITE_TRANSIENT);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value insert statement");
+        rc = sqlite3_bind_text(value_insert_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value insert statement");
         if (rc==SQLITE_OK) {
             if (ws.writes(ws_it).has_data()) {
-                rc = sqlite3_bind_blob(value_insert_stmt, 2, ws.writes(ws_it).data().data(), (int)ws.writes(ws_it).data().size(), SQLITE_TRANSIENT);
+                rc = sqlite3_bind_blob(value_insert_stmt, 3, ws.writes(ws_it).data().data(), (int)ws.writes(ws_it).data().size(), SQLITE_TRANSIENT);
                 SQLite::check_sql_error(db->db(), rc, NULL, "Error binding value to value insert statement");
             }
         }
 
         int step_rc = sqlite3_step(value_insert_stmt);
-        if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE)
-            sqlite3_reset(value_insert_stmt); // allow this to be cleaned up
 
-        rc = sqlite3_finalize(value_insert_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value insert statement");
+        rc = sqlite3_reset(value_insert_stmt);
+        if (step_rc != SQLITE_OK && step_rc != SQLITE_DONE)
+            SQLite::check_sql_error(db->db(), rc, NULL, "Error resetting value insert statement");
         if (step_rc == SQLITE_BUSY || step_rc == SQLITE_LOCKED)
             return DatabaseLocked;
 
@@ -505,21 +549,17 @@ template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::chec
     int num_compares=cs.compares_size();
     for (int cs_it=0;cs_it<num_compares;++cs_it) {
 
-        String object_hex = getTableName(cs.compares(cs_it));
+        String object_raw = getTableName(cs.compares(cs_it));
         String key_name = getKeyName(cs.compares(cs_it));
 
-        String value_query = "SELECT value FROM ";
-        value_query += "\"" TABLE_NAME "\"";
-        value_query += " WHERE object == x\'" + object_hex + "\' AND key == ?";
-
         int rc;
-        char* remain;
-        sqlite3_stmt* value_query_stmt;
-
-        rc = sqlite3_prepare_v2(db->db(), value_query.c_str(), -1, &value_query_stmt, (const char**)&remain);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error preparing value query statement");
+        sqlite3_stmt* value_query_stmt = db->prepare(VALUE_QUERY);
+        if (value_query_stmt == NULL)
+            return DatabaseLocked;
 
-        rc = sqlite3_bind_text(value_query_stmt, 1, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
+        rc = sqlite3_bind_blob(value_query_stmt, 1, object_raw.data(), (int)object_raw.size(), SQLITE_TRANSIENT);
+        SQLite::check_sql_error(db->db(), rc, NULL, "Error binding object to value query statement");
+        rc = sqlite3_bind_text(value_query_stmt, 2, key_name.data(), (int)key_name.size(), SQLITE_TRANSIENT);
         SQLite::check_sql_error(db->db(), rc, NULL, "Error binding key name to value query statement");
 
         int step_rc = sqlite3_step(value_query_stmt);
@@ -550,12 +590,9 @@ template <class CompareSet> SQLiteObjectStorage::Error SQLiteObjectStorage::chec
                 }
             }
         }
-        else {
-            sqlite3_reset(value_query_stmt); // allow proper clean up
-        }
 
-        rc = sqlite3_finalize(value_query_stmt);
-        SQLite::check_sql_error(db->db(), rc, NULL, "Error finalizing value query statement");
+        // the cached statement must be reset so it can be reused and releases its read lock
+        sqlite3_reset(value_query_stmt);
 
         if (step_rc == SQLITE_BUSY || step_rc == SQLITE_LOCKED)
             return DatabaseLocked;
@@ -74,24 +74,37 @@ private:
     void forward (RoutableMessageHeader&hdr, Protocol::Response&);
     SQLiteObjectStorage(bool transactional, const String& pl);
 
+    /** A request waiting on the disk thread.  process() runs inside the
+     *  group transaction, operator() delivers the response once that
+     *  transaction has committed and then deletes the worker.
+     */
+    class ApplyWorker:public Task::WorkItem{
+    protected:
+        Protocol::Response*mResponse;
+    public:
+        virtual void process(const SQLiteDBPtr&db)=0;
+        /// Reports a failure to commit the group transaction in place of the results of process.
+        void commitFailed();
+    };
     /** Worker method which will be executed in another thread to perform the
      *  application of the ReadWriteSet.
      */
-    class ApplyReadWriteWorker:public Task::WorkItem{
+    class ApplyReadWriteWorker:public ApplyWorker{
     protected:
         void (*mDestroyReadWrite)(Protocol::ReadWriteSet*);
         SQLiteObjectStorage*mParent;
         ResultCallback cb;
         Protocol::ReadWriteSet*rws;
-        Protocol::Response*mResponse;
-        Protocol::Response::ReturnStatus processReadWrite();
+        Protocol::Response::ReturnStatus processReadWrite(const SQLiteDBPtr&db);
         ApplyReadWriteWorker(){rws=NULL;mResponse=NULL;mParent=NULL;}
     public:
         ApplyReadWriteWorker(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const ResultCallback&cb,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
+        void process(const SQLiteDBPtr&db);
         void operator()();
     };
     class ApplyReadWriteMessage:public ApplyReadWriteWorker{
         RoutableMessageHeader hdr;
+        Protocol::Response mMessageResponse;
     public:
         ApplyReadWriteMessage(SQLiteObjectStorage*parent, Protocol::ReadWriteSet* rws, const RoutableMessageHeader&hdr,void (*mDestroyReadWrite)(Protocol::ReadWriteSet*));
         void operator()();
@@ -100,26 +113,39 @@ private:
     /** Worker method which will be executed in another thread to perform the
      *  application of the Minitransaction.
      */
-    class ApplyTransactionWorker:public Task::WorkItem{
+    class ApplyTransactionWorker:public ApplyWorker{
     protected:
         void (*mDestroyMinitransaction)(Protocol::Minitransaction*);
         SQLiteObjectStorage*mParent;
         ResultCallback cb;
         Protocol::Minitransaction*mt;
-        Protocol::Response*mResponse;
-        Protocol::Response::ReturnStatus processTransaction();
+        Protocol::Response::ReturnStatus processTransaction(const SQLiteDBPtr&db);
         ApplyTransactionWorker(){mt=NULL;mResponse=NULL;mParent=NULL;}
     public:
         ApplyTransactionWorker(SQLiteObjectStorage*parent, Protocol::Minitransaction* rws, const ResultCallback&cb,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
+        void process(const SQLiteDBPtr&db);
         void operator()();
     };
     class ApplyTransactionMessage:public ApplyTransactionWorker{
         RoutableMessageHeader hdr;
+        Protocol::Response mMessageResponse;
     public:
         ApplyTransactionMessage(SQLiteObjectStorage*parent, Protocol::Minitransaction* rws, const RoutableMessageHeader&,void (*mDestroyMinitransaction)(Protocol::Minitransaction*));
         void operator()();
     };
 
+    /** Applies every request that queued up while the disk thread was busy
+     *  inside a single database transaction, so they share one commit.
+     */
+    class GroupCommit:public Task::WorkItem {
+        SQLiteObjectStorage*mParent;
+    public:
+        GroupCommit(SQLiteObjectStorage*p):mParent(p){}
+        void operator()();
+    };
+    /// Queues w for the next group commit, scheduling one if none is pending.
+    void enqueueGroup(ApplyWorker*w);
+
     class AddMessageServiceMessage:public Task::WorkItem {
     protected:
         SQLiteObjectStorage*mParent;
@@ -152,6 +178,14 @@ private:
     bool commitTransaction(const SQLiteDBPtr& db);
     /** Roll back a transaction in progress. */
     void rollbackTransaction(const SQLiteDBPtr& db);
+    /** Starts a nested transaction for one request (ReadWriteSet or minitransaction) inside the group transaction. */
+    void beginSavepoint(const SQLiteDBPtr& db);
+    /** Keeps the changes made since beginSavepoint. */
+    void releaseSavepoint(const SQLiteDBPtr& db);
+    /** Discards the changes made since beginSavepoint. */
+    void rollbackSavepoint(const SQLiteDBPtr& db);
+    /** Steps a statement that returns no rows, such as BEGIN or COMMIT. */
+    int execute(const SQLiteDBPtr& db, const String& sql);
     enum Error {
         None,
         KeyMissing,
@@ -184,7 +218,7 @@ private:
      */
     template <class CompareSet> Error checkCompareSet(const SQLiteDBPtr& db, const CompareSet& cs);
 
-    /** Helper method to extract the database table name from a storage key. */
+    /** Helper method to extract the value of the object column (the raw UUID bytes) from a storage key. */
     template <class StorageKey> String getTableName(const StorageKey& key);
     /** Helper method to extract the key within a database table for a storage
      *   key.
@@ -199,6 +233,12 @@ private:
     SQLiteDBPtr mDB;
     int mRetries;
     int mBusyTimeout; // locked database timeout in milliseconds
+    uint32 mMaxGroupCommit; // maximum number of requests sharing one transaction
+
+    class UniqueLock;
+    UniqueLock *mGroupLock;
+    std::vector<ApplyWorker*> mGroupPending;
+    bool mGroupScheduled;
 };
 
 } }// namespace Sirikata::Persistence
@@ -41,6 +41,9 @@ protected:
     static void defaultCallback(const Duration&offset){
         SILOG(objecthost,debug,"New offset is "<<offset);
     }
+    static bool defaultShouldSample(){
+        return true;
+    }
 
 public:
     virtual void setCallback(const std::tr1::function<void(const Duration&)>&)=0;
@@ -44,7 +44,17 @@ template <class WeakRef> class TimeSyncImpl : public TimeSync {
     int mNumParallel;
     uint64 mSyncRound;
     std::tr1::function<void(const Duration&)>mCallback;
-    std::vector<Protocol::TimeSync>mSamples;
+    std::tr1::function<bool()>mShouldSample;
+    ///A single clock sample: the round trip the probe took and the offset it implies
+    struct Sample {
+        Duration mRoundTrip;
+        Duration mOffset;
+        Sample(const Duration&roundTrip, const Duration&offset):mRoundTrip(roundTrip),mOffset(offset){}
+    };
+    ///sliding window of the most recent samples, spanning the current and previous sync passes
+    std::deque<Sample>mSamples;
+    ///number of rounds answered during the current sync pass
+    int mRoundsThisPass;
     void sendParallelPackets() {
         RoutableMessageHeader rmh;
         rmh.set_destination_object(ObjectReference::spaceServiceID());
@@ -63,35 +73,42 @@ template <class WeakRef> class TimeSyncImpl : public TimeSync {
         if (parent&&data.size()) {
             Protocol::TimeSync sync;
             sync.ParseFromArray(&data[0],data.size());
-            if (sync.has_sync_round()&&sync.sync_round()==mSyncRound&&sync.has_server_time()&&sync.has_client_time()) {
-                sync.set_round_trip(Time::now(Duration::zero()));
-                mSamples.push_back(sync);
-                incrementSyncRound();
-                if (mSamples.size()>=(size_t)mNumAverage) {
-                    calculateDuration();
-                }else {
-                    sendParallelPackets();
+            if (sync.has_sync_round()&&sync.has_server_time()&&sync.has_client_time()) {
+                bool currentRound=sync.sync_round()==mSyncRound;
+                //the other replies of the burst that just advanced the round are still perfectly good samples
+                if (currentRound||sync.sync_round()+1==mSyncRound) {
+                    Time received=Time::now(Duration::zero());
+                    Duration roundTrip(received-sync.client_time());
+                    mSamples.push_back(Sample(roundTrip,sync.server_time()+roundTrip/2.0-received));
+                    while (mSamples.size()>(size_t)mNumAverage*2) {
+                        mSamples.pop_front();
+                    }
+                }
+                if (currentRound) {
+                    incrementSyncRound();
+                    if (++mRoundsThisPass>=mNumAverage) {
+                        calculateDuration();
+                    }else {
+                        sendParallelPackets();
+                    }
                 }
             }
 
         }
     }
+    /**
+     * NTP style clock filter: queueing delay only ever lengthens a round trip and skews its offset,
+     * so the sample with the shortest round trip in the window carries the most trustworthy offset
+     */
     void calculateDuration() {
-        std::vector<Duration> mOffsets(mSamples.size(),Duration::seconds(0));
-        for (size_t i=0,ie=mOffsets.size();i<ie;++i) {
-            Duration latency(mSamples[i].round_trip()-mSamples[i].client_time());
-            Duration halfLatency=latency/2.0;
-            mOffsets[i]=mSamples[i].server_time()+halfLatency-mSamples[i].round_trip();
-        }
-        std::sort(mOffsets.begin(),mOffsets.end());
-/*
-        for (size_t i=0,ie=mOffsets.size();i<ie;++i) {
-            SILOGNOCR(objecthost,debug,mOffsets[i]<<',');
+        std::deque<Sample>::const_iterator best=mSamples.begin();
+        for (std::deque<Sample>::const_iterator i=mSamples.begin(),ie=mSamples.end();i!=ie;++i) {
+            if (i->mRoundTrip<best->mRoundTrip) {
+                best=i;
+            }
         }
-*/
-        Duration oldOffset=mOffset;
-        mOffset=mOffsets[mOffsets.size()/2];        
-        mCallback(mOffsets[mOffsets.size()/2]);
+        mOffset=best->mOffset;
+        mCallback(mOffset);
     }
     void incrementSyncRound(){
         ++mSyncRound;
@@ -103,7 +120,7 @@ template <class WeakRef> class TimeSyncImpl : public TimeSync {
 protected:
     void internalStartSync() {//to prevent toplevel class from being instantiated
         incrementSyncRound();
-        mSamples.resize(0);
+        mRoundsThisPass=0;
         sendParallelPackets();
     }
 
@@ -112,20 +129,22 @@ protected:
     static void startSync(const std::tr1::weak_ptr<TimeSyncImpl<WeakRef> >&weak_thus, const Duration&delay) {
         std::tr1::shared_ptr<TimeSyncImpl<WeakRef> >thus (weak_thus.lock());
         if (thus&&delay==thus->mRetryDelay) {
-            thus->internalStartSync();
+            if (thus->mShouldSample()) {
+                thus->internalStartSync();
+            }
             std::tr1::function<void(std::tr1::weak_ptr<TimeSyncImpl<WeakRef> > weak_thus, Duration delay)> myfunc(&TimeSyncImpl<WeakRef>::startSync);
             IOServiceFactory::dispatchServiceMessage(thus->mWaitService,delay,std::tr1::bind(myfunc,weak_thus,delay));
         }
     }
 public:
-    TimeSyncImpl(const WeakRef& parent, IOService *waitService):mCallback(&TimeSync::defaultCallback){
+    TimeSyncImpl(const WeakRef& parent, IOService *waitService):mCallback(&TimeSync::defaultCallback),mShouldSample(&TimeSync::defaultShouldSample){
         mParent=parent;
         mWaitService=waitService;
         mStream=NULL;
         mNumParallel=0;
         mNumAverage=0;
         mRetryDelay=Duration::seconds(0);
-
+        mRoundsThisPass=0;
         mSyncRound=0;        
     }
     static void bytesReceived(const std::tr1::weak_ptr<TimeSyncImpl<WeakRef> >&weak_thus, const Network::Chunk&data) {
@@ -145,6 +164,13 @@ public:
     void setCallback(const std::tr1::function<void(const Duration&)>&cb) {
         mCallback=cb;
     }
+    /**
+     * Installs a gate consulted before every sync pass; when it returns false the pass is skipped
+     * so several connections to one endpoint can leave the sampling to whichever of them holds the claim
+     */
+    void setShouldSample(const std::tr1::function<bool()>&shouldSample) {
+        mShouldSample=shouldSample;
+    }
 
 
 };
@@ -182,6 +182,27 @@ public:
         }
         return mt;
     }
+    /**
+     * Fills rws (allocated if NULL) with a read of every field of every object, object-major: the reads of
+     * objects[i] are [i*fields.size(), (i+1)*fields.size()) in the set and in its Response.
+     * Read names are requested back so the response can be interpreted on its own.
+     */
+    template <class ReadWrite> static ReadWrite *createBulkReadSet(ReadWrite*rws, const std::vector<UUID>&objects, const std::vector<String>&fields) {
+        if (rws==NULL) rws = new ReadWrite();
+        for (size_t i=0;i<objects.size();++i) {
+            for (size_t j=0;j<fields.size();++j) {
+                rws->add_reads();
+                rws->reads(rws->reads_size()-1).set_object_uuid(objects[i]);
+                rws->reads(rws->reads_size()-1).set_field_name(fields[j]);
+            }
+        }
+        rws->set_options(ReadWrite::RETURN_READ_NAMES);
+        return rws;
+    }
+    /// Reads fields of all objects in a single apply, so restoring many objects costs one round trip. @see createBulkReadSet
+    template <class ReadWrite> void bulkRead(ReadWrite*rws, const std::vector<UUID>&objects, const std::vector<String>&fields, const ResultCallback& cb) {
+        apply(createBulkReadSet(rws,objects,fields),cb);
+    }
     template <class ReadWrite> void apply(ReadWrite*rws, const ResultCallback& cb) {
         applyInternal(rws,cb,&DestroyReadWrite<ReadWrite>::destroyReadWriteSet);
     }
@@ -186,6 +186,20 @@ public:
 		}
 	}
 
+	/**
+	 * Like getData, but only asks layers that keep data locally: a layer that would
+	 * fetch the file over the network passes the request on instead, so a miss
+	 * answers NULL without a round trip.
+	 */
+	virtual void getCachedData(const RemoteFileId &fid, const Range &requestedRange,
+			const TransferCallback&callback) {
+		if (mNext) {
+			mNext->getCachedData(fid, requestedRange, callback);
+		} else {
+			callback(NULL);
+		}
+	}
+
 };
 
 }
@@ -204,6 +204,20 @@ public:
 	virtual void getData(const RemoteFileId &fileId,
 			const Range &requestedRange,
 			const TransferCallback&callback) {
+		findData(fileId, requestedRange, callback, false);
+	}
+
+	virtual void getCachedData(const RemoteFileId &fileId,
+			const Range &requestedRange,
+			const TransferCallback&callback) {
+		findData(fileId, requestedRange, callback, true);
+	}
+
+private:
+	void findData(const RemoteFileId &fileId,
+			const Range &requestedRange,
+			const TransferCallback&callback,
+			bool cachedOnly) {
 		bool haveRange = false;
 		{
 			CacheMap::read_iterator iter(mFiles);
@@ -218,6 +232,8 @@ public:
 		}
 		if (haveRange) {
 			readDataFromDisk(fileId, requestedRange, callback);
+		} else if (cachedOnly) {
+			CacheLayer::getCachedData(fileId, requestedRange, callback);
 		} else {
 			CacheLayer::getData(fileId, requestedRange, callback);
 		}
@@ -78,6 +78,20 @@ public:
 		cb(DenseDataPtr(), false);
 	}*/
 
+	/** Like download(), but fails unless the data hashes to expected.  The
+	 * default checks the finished data; handlers that see the data arrive
+	 * should override this to hash it on the way in instead.
+	 *
+	 * @param expected The fingerprint of the whole file. Ignored for partial ranges.
+	 */
+	virtual void verifiedDownload(TransferDataPtr *ptrRef, const URI &uri, const Range &bytes, const Fingerprint &expected, const Callback &cb) {
+		if (bytes.startbyte() == 0 && bytes.goesToEndOfFile()) {
+			download(ptrRef, uri, bytes, std::tr1::bind(&DownloadHandler::verifyCallback, expected, cb, _1, _2, _3));
+		} else {
+			download(ptrRef, uri, bytes, cb);
+		}
+	}
+
 	/** Downloads the given range of a file, and calls streamCB for each packet
 	 * received. [Currently not implemented.]
 	 *
@@ -110,6 +124,16 @@ public:
 	virtual bool inOrderStream() const {
 		return false;
 	}
+
+protected:
+	static void verifyCallback(const Fingerprint &expected, const Callback &cb,
+			DenseDataPtr data, bool success, cache_usize_type fileSize) {
+		if (success && data && Fingerprint::computeDigest(data->data(), (size_t)data->length()) != expected) {
+			SILOG(transfer,warning,"Downloaded data does not hash to " << expected);
+			success = false;
+		}
+		cb(data, success, fileSize);
+	}
 };
 typedef std::tr1::shared_ptr<DownloadHandler> DownloadHandlerPtr;
 
@@ -103,6 +103,10 @@ class EventTransferManager : public TransferManager {
 		}
 	}
 
+	static void cachedDataFound(const EventListener &listener, const RemoteFileId &remoteid, const SparseData *cachedData) {
+		listener(DownloadEventPtr(new DownloadEvent(cachedData ? SUCCESS : FAIL_DOWNLOAD, remoteid, cachedData)));
+	}
+
 	void downloadNameLookupSuccess(const EventListener &listener, const Range &range, const RemoteFileId *remoteid) {
 	        doDownloadByHash(listener, range, remoteid, false);
 	}
@@ -359,6 +363,10 @@ public:
 		mFirstTransferLayer->purgeFromCache(fprint);
 	}
 
+	virtual void addToCache(const Fingerprint &fprint, const DenseDataPtr &data) {
+		mFirstTransferLayer->addToCache(fprint, data);
+	}
+
 	virtual void download(const URI &name, const EventListener &listener, const Range &range) {
 		// TODO: Handle multiple name lookups at the same time to the same filename. Is this possible? worth doing?
 		++mPendingCleanup;
@@ -376,6 +384,29 @@ public:
 		mNameLookup->lookupHash(nameURI, listener);
 	}
 
+	virtual void downloadCached(const RemoteFileId &name, const EventListener &listener, const Range &range) {
+		++mPendingCleanup;
+		CacheLayer *theCacheLayer = NULL;
+		{
+			boost::unique_lock<boost::mutex> l(mMutex);
+			if (!mCleanup) {
+				theCacheLayer = mFirstTransferLayer;
+			}
+		}
+		if (theCacheLayer) {
+			// Not shared with downloads in progress: those are waiting on the network.
+			theCacheLayer->getCachedData(name, range,
+				std::tr1::bind(&EventTransferManager::cachedDataFound, listener, name, _1));
+		} else {
+			listener(DownloadEventPtr(new DownloadEvent(FAIL_SHUTDOWN, name, NULL)));
+		}
+		if (--mPendingCleanup == 0) {
+			if (mCleanup) {
+				mCleanupCV.notify_one(); // We are the last one to finish.
+			}
+		}
+	}
+
 	virtual void upload(const URI &name,
 			const RemoteFileId &hash,
 			const DenseDataPtr &toUpload,
@@ -118,8 +118,24 @@ public:
 			const URI &uri,
 			const Range &bytes,
 			const DownloadHandler::Callback &cb) {
+		startDownload(ptrRef, HTTPRequestPtr(new HTTPRequest(uri, bytes)), cb);
+	}
+
+	/// Hashes the data as curl hands it over, so there is no second pass at the end.
+	virtual void verifiedDownload(DownloadHandler::TransferDataPtr *ptrRef,
+			const URI &uri,
+			const Range &bytes,
+			const Fingerprint &expected,
+			const DownloadHandler::Callback &cb) {
 		HTTPRequestPtr req (new HTTPRequest(uri, bytes));
+		req->setExpectedDigest(expected);
+		startDownload(ptrRef, req, cb);
+	}
 
+private:
+	void startDownload(DownloadHandler::TransferDataPtr *ptrRef,
+			const HTTPRequestPtr &req,
+			const DownloadHandler::Callback &cb) {
 
 		 //Vc9 needs this
 		req->setCallback(
@@ -137,6 +153,8 @@ public:
 
 		req->go(req);
 	}
+
+public:
 	/// FIXME: Unimplemented -- needs a better interface from HTTPRequest to work.
 	virtual void stream(DownloadHandler::TransferDataPtr *ptrRef,
 			const URI &uri,
@@ -96,10 +96,30 @@ size_t HTTPRequest::write(const unsigned char *copyFrom, size_t length) {
 	// FIXME: do not adjust the length until actually copying data.
 	unsigned char *copyTo = mData->writableData() + startByte;
 	std::copy(copyFrom, copyFrom + length, copyTo);
+	if (mDigest && mOffset == mDigestOffset) {
+		mDigest->update(copyFrom, length);
+		mDigestOffset += length;
+	}
 	mOffset += length;
 	return length;
 }
 
+bool HTTPRequest::verifyDigest() {
+	SHA256 digest;
+	if (mDigestOffset == mOffset && mData->startbyte() == 0) {
+		digest = mDigest->get();
+	} else {
+		// The body did not arrive in one piece, so hash what was assembled.
+		digest = SHA256::computeDigest(mData->data(), (size_t)mData->length());
+	}
+	if (digest != mExpectedDigest) {
+		SILOG(transfer,warning,"Data from " << mURI << " hashes to " << digest <<
+				" instead of " << mExpectedDigest);
+		return false;
+	}
+	return true;
+}
+
 size_t HTTPRequest::read(unsigned char *copyTo, size_t length) {
 	if (!mStreamUploadData) {
 		return 0;
@@ -405,6 +425,10 @@ void HTTPRequest::curlLoop () {
 				curl_multi_remove_handle(curlm, handle);
 				curl_easy_cleanup(handle);
 
+				if (success && request->mDigest && !request->verifyDigest()) {
+					success = false;
+				}
+
 				if (retry) {
 					request->initCurlHandle();
 					request->setFinalProperties();
@@ -512,6 +536,7 @@ HTTPRequest::~HTTPRequest() {
 	if (mCurlRequest) {
 		abort();
 	}
+	delete mDigest;
 	if (mHeaders) {
 		curl_slist_free_all((struct curl_slist *)mHeaders);
 	}
@@ -529,6 +554,10 @@ void HTTPRequest::initCurlHandle() {
 	mFullFilesizeOnServer = 0;
 	mData = MutableDenseDataPtr(new DenseData(mRequestedRange));
 	mUploadOffset = 0;
+	mDigestOffset = 0;
+	if (mDigest) {
+		mDigest->reset();
+	}
 
 	// Create a curl object and initialize options specific to this transfer.
 	mCurlRequest = allocDefaultCurl();
@@ -593,6 +622,19 @@ void HTTPRequest::setPUTData(const DenseDataPtr &uploadData) {
 	mStreamUploadData = uploadData;
 }
 
+void HTTPRequest::setExpectedDigest(const Fingerprint &expected) {
+	if (mState >= INPROGRESS) {
+		throw std::logic_error(go_update_error);
+	}
+	if (mRequestedRange.startbyte() != 0 || !mRequestedRange.goesToEndOfFile()) {
+		return;
+	}
+	mExpectedDigest = expected;
+	if (!mDigest) {
+		mDigest = new SHA256Context;
+	}
+}
+
 void HTTPRequest::setDELETE() {
 	if (mState >= INPROGRESS) {
 		throw std::logic_error(go_update_error);
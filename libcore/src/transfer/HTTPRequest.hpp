@@ -84,6 +84,10 @@ private:
 	Range::length_type mFullFilesizeOnServer;
 	MutableDenseDataPtr mData;
 
+	SHA256Context *mDigest; ///< hashes the body as it arrives; NULL unless setExpectedDigest()
+	Range::base_type mDigestOffset; ///< end of the bytes fed to mDigest so far
+	Fingerprint mExpectedDigest;
+
 	/** The default callback--useful for POST queries where you do not care about the response */
 	static void nullCallback(HTTPRequest*, const DenseDataPtr &, bool){
 	}
@@ -91,6 +95,8 @@ private:
 	size_t write(const unsigned char *begin, size_t amount);
 	size_t read(unsigned char *begin, size_t amount);
 	void gotHeader(const std::string &header);
+	/// Checks the finished body against mExpectedDigest.
+	bool verifyDigest();
 
 	static void curlLoop();
 	static void initCurl();
@@ -150,7 +156,8 @@ public:
 		: mState(NEW),
 		  mURI(uri), mRequestedRange(range), mCallback(&nullCallback),
 		  mCurlRequest(NULL), mHeaders(NULL),
-		  mCurlFormBegin(NULL), mCurlFormEnd(NULL), mTypeDELETE(false)
+		  mCurlFormBegin(NULL), mCurlFormEnd(NULL), mTypeDELETE(false),
+		  mDigest(NULL)
 		  {
 		initCurlHandle();
 	}
@@ -263,6 +270,13 @@ public:
 	 */
 	void setSimplePOSTString(const std::string &postString);
 
+	/**
+	 * Hashes the body while it is being received and fails the request if
+	 * it does not hash to expected once complete.  Only has an effect on
+	 * requests for a whole file.
+	 */
+	void setExpectedDigest(const Fingerprint &expected);
+
 	/** Note: you are responsible for checking the protocol
 	 * and using HTTP headers in the case of http, and valid FTP
 	 * commands in the case of FTP. Not doing so may cause a security bug.
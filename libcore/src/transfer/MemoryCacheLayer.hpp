@@ -105,6 +105,17 @@ public:
 
 	virtual void getData(const RemoteFileId &uri, const Range &requestedRange,
 			const TransferCallback&callback) {
+		findData(uri, requestedRange, callback, false);
+	}
+
+	virtual void getCachedData(const RemoteFileId &uri, const Range &requestedRange,
+			const TransferCallback&callback) {
+		findData(uri, requestedRange, callback, true);
+	}
+
+private:
+	void findData(const RemoteFileId &uri, const Range &requestedRange,
+			const TransferCallback&callback, bool cachedOnly) {
 		bool haveData = false;
 		SparseData foundData;
 		{
@@ -132,6 +143,8 @@ public:
 				CacheLayer::populateParentCaches(uri.fingerprint(), iter.getPtr());
 			}
 			callback(&foundData);
+		} else if (cachedOnly) {
+			CacheLayer::getCachedData(uri, requestedRange, callback);
 		} else {
 			CacheLayer::getData(uri, requestedRange, callback);
 		}
@@ -111,7 +111,8 @@ class NetworkCacheLayer : public CacheLayer {
 		if (mService->getNextProtocol(info.serviter,reason,info.fileId.uri(),lookupUri,params,handler)) {
 			// info IS GETTING FREED BEFORE download RETURNS TO SET info.httpreq!!!!!!!!!
 			info.httpreq = DownloadHandler::TransferDataPtr();
-			handler->download(&info.httpreq, lookupUri, info.range,
+			// Data is cached under its fingerprint, so make sure it really has it.
+			handler->verifiedDownload(&info.httpreq, lookupUri, info.range, info.fileId.fingerprint(),
 					std::tr1::bind(&NetworkCacheLayer::httpCallback, this, iter, _1, _2));
 			// info may be deleted by now (not so unlikely as it sounds -- it happens if you connect to localhost)
 		} else {
@@ -0,0 +1,94 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  PackCacheLayer.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_PackCacheLayer_HPP__
+#define SIRIKATA_PackCacheLayer_HPP__
+
+#include "CacheLayer.hpp"
+#include "PackFile.hpp"
+
+namespace Sirikata {
+/** PackCacheLayer.hpp -- PackCacheLayer -- serves assets out of a mapped PackFile. */
+namespace Transfer {
+
+/**
+ * Read-only cache layer backed by a PackFile that is mapped once at startup.
+ * Hits are answered synchronously with the mapped bytes, so there is no file open
+ * or copy per asset; misses go on to the next layer, and nothing is ever stored.
+ * Meant to sit first in the chain, or right after the memory cache.
+ */
+class PackCacheLayer : public CacheLayer {
+	PackFile mPack;
+
+public:
+	PackCacheLayer(const std::string &packPath, CacheLayer *tryNext)
+			: CacheLayer(tryNext) {
+		mPack.open(packPath);
+	}
+
+	const PackFile &getPack() const {
+		return mPack;
+	}
+
+	virtual void getData(const RemoteFileId &uri, const Range &requestedRange,
+			const TransferCallback&callback) {
+		findData(uri, requestedRange, callback, false);
+	}
+
+	virtual void getCachedData(const RemoteFileId &uri, const Range &requestedRange,
+			const TransferCallback&callback) {
+		findData(uri, requestedRange, callback, true);
+	}
+
+private:
+	void findData(const RemoteFileId &uri, const Range &requestedRange,
+			const TransferCallback&callback, bool cachedOnly) {
+		DenseDataPtr found = mPack.find(uri.fingerprint());
+		if (found) {
+			SILOG(transfer,debug,"Found " << uri.fingerprint() << " in asset pack");
+			// Not passed to parent caches: the pack is already in memory, and
+			// charging its pages to their policies would only evict other files.
+			SparseData foundData;
+			foundData.addValidData(found);
+			callback(&foundData);
+		} else if (cachedOnly) {
+			CacheLayer::getCachedData(uri, requestedRange, callback);
+		} else {
+			CacheLayer::getData(uri, requestedRange, callback);
+		}
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_PackCacheLayer_HPP__ */
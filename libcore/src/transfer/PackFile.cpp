@@ -0,0 +1,383 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  PackFile.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "PackFile.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <windows.h>
+#endif
+
+namespace Sirikata {
+namespace Transfer {
+
+const char PackFile::MAGIC[8] = {'S','I','R','I','P','A','C','K'};
+
+namespace {
+
+uint64 readLittleEndian(const unsigned char *data, int bytes) {
+	uint64 result = 0;
+	for (int i = bytes-1; i >= 0; --i) {
+		result = (result << 8) | data[i];
+	}
+	return result;
+}
+
+void writeLittleEndian(unsigned char *data, uint64 value, int bytes) {
+	for (int i = 0; i < bytes; ++i) {
+		data[i] = (unsigned char)(value & 0xff);
+		value >>= 8;
+	}
+}
+
+uint64 alignData(uint64 offset) {
+	return (offset + PackFile::DATA_ALIGNMENT - 1) & ~(uint64)(PackFile::DATA_ALIGNMENT - 1);
+}
+
+}
+
+/// Owns a read-only view of a whole file.
+class PackFile::Mapping : Noncopyable {
+#ifdef _WIN32
+	HANDLE mFile;
+	HANDLE mMap;
+#endif
+	const unsigned char *mData;
+	uint64 mLength;
+public:
+	Mapping() : mData(NULL), mLength(0) {
+#ifdef _WIN32
+		mFile = INVALID_HANDLE_VALUE;
+		mMap = NULL;
+#endif
+	}
+	~Mapping() {
+#ifndef _WIN32
+		if (mData) {
+			munmap((void*)mData, (size_t)mLength);
+		}
+#else
+		if (mData) {
+			UnmapViewOfFile(mData);
+		}
+		if (mMap) {
+			CloseHandle(mMap);
+		}
+		if (mFile != INVALID_HANDLE_VALUE) {
+			CloseHandle(mFile);
+		}
+#endif
+	}
+
+	bool map(const std::string &path) {
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+			::close(fd);
+			return false;
+		}
+		void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // the mapping keeps the file open.
+		if (addr == MAP_FAILED) {
+			return false;
+		}
+		mData = (const unsigned char*)addr;
+		mLength = st.st_size;
+		return true;
+#else
+		mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (mFile == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || size.QuadPart <= 0) {
+			return false;
+		}
+		mMap = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mMap) {
+			return false;
+		}
+		mData = (const unsigned char*)MapViewOfFile(mMap, FILE_MAP_READ, 0, 0, 0);
+		mLength = size.QuadPart;
+		return mData != NULL;
+#endif
+	}
+
+	const unsigned char *data() const {
+		return mData;
+	}
+	uint64 length() const {
+		return mLength;
+	}
+};
+
+PackFile::PackFile() {
+	close();
+}
+
+PackFile::~PackFile() {
+}
+
+void PackFile::close() {
+	mMapping.reset();
+	mIndex = NULL;
+	mCount = 0;
+	std::fill(mFanout, mFanout+257, 0);
+}
+
+bool PackFile::open(const std::string &path) {
+	close();
+	std::tr1::shared_ptr<Mapping> mapping(new Mapping);
+	if (!mapping->map(path)) {
+		SILOG(transfer,error,"Unable to map asset pack " << path);
+		return false;
+	}
+	const unsigned char *base = mapping->data();
+	uint64 fileLength = mapping->length();
+	if (fileLength < HEADER_SIZE || memcmp(base, MAGIC, sizeof(MAGIC)) != 0) {
+		SILOG(transfer,error,path << " is not an asset pack");
+		return false;
+	}
+	uint32 version = (uint32)readLittleEndian(base+8, 4);
+	uint64 count = readLittleEndian(base+12, 4);
+	uint64 indexOffset = readLittleEndian(base+16, 8);
+	uint64 recordedLength = readLittleEndian(base+24, 8);
+	if (version != VERSION) {
+		SILOG(transfer,error,"Asset pack " << path << " has unknown version " << version);
+		return false;
+	}
+	if (recordedLength != fileLength || indexOffset < HEADER_SIZE ||
+			indexOffset > fileLength || count > (fileLength - indexOffset) / ENTRY_SIZE) {
+		SILOG(transfer,error,"Asset pack " << path << " is truncated or corrupt");
+		return false;
+	}
+	const unsigned char *index = base + indexOffset;
+	// Checked once here so that lookups can trust the index.
+	for (uint64 i = 0; i < count; ++i) {
+		const unsigned char *entry = index + i*ENTRY_SIZE;
+		uint64 offset = readLittleEndian(entry+SHA256::static_size, 8);
+		uint64 length = readLittleEndian(entry+SHA256::static_size+8, 8);
+		bool sorted = (i == 0 || memcmp(entry-ENTRY_SIZE, entry, SHA256::static_size) < 0);
+		if (!sorted || offset > fileLength || length > fileLength - offset) {
+			SILOG(transfer,error,"Asset pack " << path << " has a bad index entry " << i);
+			return false;
+		}
+	}
+	mMapping = mapping;
+	mIndex = index;
+	mCount = (uint32)count;
+	uint32 entry = 0;
+	for (int b = 0; b < 256; ++b) {
+		mFanout[b] = entry;
+		while (entry < mCount && mIndex[entry*ENTRY_SIZE] == b) {
+			++entry;
+		}
+	}
+	mFanout[256] = mCount;
+	SILOG(transfer,info,"Mapped asset pack " << path << " with " << mCount << " assets");
+	return true;
+}
+
+const unsigned char *PackFile::findEntry(const Fingerprint &fileId) const {
+	const unsigned char *hash = fileId.rawData().data();
+	uint32 low = mFanout[hash[0]];
+	uint32 high = mFanout[hash[0]+1];
+	while (low < high) {
+		uint32 mid = low + (high - low) / 2;
+		const unsigned char *entry = mIndex + mid*ENTRY_SIZE;
+		int cmp = memcmp(entry, hash, SHA256::static_size);
+		if (cmp == 0) {
+			return entry;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return NULL;
+}
+
+bool PackFile::lookup(const Fingerprint &fileId, const unsigned char *&data, uint64 &length) const {
+	const unsigned char *entry = findEntry(fileId);
+	if (!entry) {
+		return false;
+	}
+	data = mMapping->data() + readLittleEndian(entry+SHA256::static_size, 8);
+	length = readLittleEndian(entry+SHA256::static_size+8, 8);
+	return true;
+}
+
+DenseDataPtr PackFile::find(const Fingerprint &fileId) const {
+	const unsigned char *data;
+	uint64 length;
+	if (!lookup(fileId, data, length)) {
+		return DenseDataPtr();
+	}
+	return DenseDataPtr(new DenseData(Range(0, length, LENGTH, true), data, mMapping));
+}
+
+
+bool PackFileWriter::addFile(const std::string &path, Fingerprint *fileId) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		SILOG(transfer,error,"Unable to read " << path);
+		return false;
+	}
+	SHA256Context digest;
+	uint64 length = 0;
+	unsigned char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+		digest.update(buffer, got);
+		length += got;
+	}
+	bool failed = ferror(fp) != 0;
+	fclose(fp);
+	if (failed) {
+		SILOG(transfer,error,"Error reading " << path);
+		return false;
+	}
+	Fingerprint hash = digest.get();
+	Source &source = mSources[hash];
+	source.mPath = path;
+	source.mData = DenseDataPtr();
+	source.mLength = length;
+	if (fileId) {
+		*fileId = hash;
+	}
+	return true;
+}
+
+void PackFileWriter::addData(const Fingerprint &fileId, const DenseDataPtr &data) {
+	Source &source = mSources[fileId];
+	source.mPath = std::string();
+	source.mData = data;
+	source.mLength = data->length();
+}
+
+bool PackFileWriter::write(const std::string &path) const {
+	// mSources is a std::map, so the index comes out sorted by fingerprint.
+	uint64 indexOffset = PackFile::HEADER_SIZE;
+	uint64 dataOffset = alignData(indexOffset + (uint64)mSources.size() * PackFile::ENTRY_SIZE);
+	std::vector<unsigned char> index(mSources.size() * PackFile::ENTRY_SIZE);
+	uint64 offset = dataOffset;
+	unsigned char *entry = index.empty() ? NULL : &index[0];
+	for (SourceMap::const_iterator iter = mSources.begin(); iter != mSources.end(); ++iter) {
+		memcpy(entry, iter->first.rawData().data(), SHA256::static_size);
+		writeLittleEndian(entry+SHA256::static_size, offset, 8);
+		writeLittleEndian(entry+SHA256::static_size+8, iter->second.mLength, 8);
+		offset = alignData(offset + iter->second.mLength);
+		entry += PackFile::ENTRY_SIZE;
+	}
+	uint64 fileLength = offset;
+
+	unsigned char header[PackFile::HEADER_SIZE];
+	memcpy(header, PackFile::MAGIC, sizeof(PackFile::MAGIC));
+	writeLittleEndian(header+8, PackFile::VERSION, 4);
+	writeLittleEndian(header+12, mSources.size(), 4);
+	writeLittleEndian(header+16, indexOffset, 8);
+	writeLittleEndian(header+24, fileLength, 8);
+
+	std::string tempPath = path + ".tmp";
+	FILE *out = fopen(tempPath.c_str(), "wb");
+	if (!out) {
+		SILOG(transfer,error,"Unable to create " << tempPath);
+		return false;
+	}
+	static const unsigned char padding[PackFile::DATA_ALIGNMENT] = {0};
+	bool ok = fwrite(header, 1, sizeof(header), out) == sizeof(header);
+	if (ok && !index.empty()) {
+		ok = fwrite(&index[0], 1, index.size(), out) == index.size();
+	}
+	uint64 written = indexOffset + index.size();
+	std::vector<unsigned char> buffer(65536);
+	for (SourceMap::const_iterator iter = mSources.begin(); ok && iter != mSources.end(); ++iter) {
+		const Source &source = iter->second;
+		size_t pad = (size_t)(alignData(written) - written);
+		ok = fwrite(padding, 1, pad, out) == pad;
+		written += pad;
+		if (ok && source.mData) {
+			ok = fwrite(source.mData->data(), 1, (size_t)source.mLength, out) == source.mLength;
+		} else if (ok) {
+			// Read back in pieces so packs larger than memory can be built.
+			FILE *in = fopen(source.mPath.c_str(), "rb");
+			uint64 remaining = source.mLength;
+			while (in && remaining) {
+				size_t want = remaining < buffer.size() ? (size_t)remaining : buffer.size();
+				size_t got = fread(&buffer[0], 1, want, in);
+				if (got == 0 || fwrite(&buffer[0], 1, got, out) != got) {
+					break;
+				}
+				remaining -= got;
+			}
+			if (in) {
+				fclose(in);
+			}
+			if (remaining) {
+				SILOG(transfer,error,"Unable to copy " << source.mPath << " into " << path);
+				ok = false;
+			}
+		}
+		written += source.mLength;
+	}
+	if (ok) {
+		size_t pad = (size_t)(fileLength - written);
+		ok = fwrite(padding, 1, pad, out) == pad;
+	}
+	if (fclose(out) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		SILOG(transfer,error,"Failed to write asset pack " << path);
+		remove(tempPath.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	remove(path.c_str()); // rename does not replace on windows.
+#endif
+	return rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+}
+}
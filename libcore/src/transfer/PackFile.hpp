@@ -0,0 +1,136 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  PackFile.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_PackFile_HPP__
+#define SIRIKATA_PackFile_HPP__
+
+#include "URI.hpp"
+#include "TransferData.hpp"
+
+namespace Sirikata {
+/** PackFile.hpp -- PackFile, PackFileWriter -- many assets in one file, indexed by hash. */
+namespace Transfer {
+
+/**
+ * A read-only pack of assets, memory-mapped and looked up by fingerprint.
+ *
+ * Layout, all integers little-endian:
+ *   header: "SIRIPACK", uint32 version, uint32 count, uint64 index offset, uint64 file size
+ *   index:  count entries of { 32-byte SHA256, uint64 offset, uint64 length }, sorted by hash
+ *   data:   each asset's bytes, starting on a 16-byte boundary
+ *
+ * Lookups binary search the part of the index that shares the first byte of the hash,
+ * and hand back the mapped bytes without copying them.
+ */
+class SIRIKATA_EXPORT PackFile : Noncopyable {
+public:
+	enum {
+		VERSION = 1,
+		HEADER_SIZE = 32,
+		ENTRY_SIZE = SHA256::static_size + 16,
+		DATA_ALIGNMENT = 16
+	};
+	static const char MAGIC[8];
+
+private:
+	class Mapping;
+	std::tr1::shared_ptr<Mapping> mMapping;
+	const unsigned char *mIndex;
+	uint32 mCount;
+	/// mFanout[b] is the first index entry whose hash starts with a byte >= b.
+	uint32 mFanout[257];
+
+	const unsigned char *findEntry(const Fingerprint &fileId) const;
+
+public:
+	PackFile();
+	~PackFile();
+
+	/** Maps path and checks its header and index.
+	 * \returns false if the file is missing or is not a valid pack; the pack is then empty.
+	 */
+	bool open(const std::string &path);
+	void close();
+
+	bool isOpen() const {
+		return mMapping.get() != NULL;
+	}
+	/// Number of assets in the pack.
+	size_t size() const {
+		return mCount;
+	}
+
+	/** Looks up an asset without copying it.
+	 * \returns false if the pack does not hold fileId.
+	 */
+	bool lookup(const Fingerprint &fileId, const unsigned char *&data, uint64 &length) const;
+
+	/** \returns the whole asset as a DenseData referring to the mapped file (which
+	 * stays mapped while it is held), or a NULL pointer if the pack does not hold it.
+	 */
+	DenseDataPtr find(const Fingerprint &fileId) const;
+};
+
+/// Collects assets and writes them out as a PackFile.
+class SIRIKATA_EXPORT PackFileWriter : Noncopyable {
+	struct Source {
+		std::string mPath; ///< empty if mData holds the contents.
+		DenseDataPtr mData;
+		uint64 mLength;
+	};
+	typedef std::map<Fingerprint, Source> SourceMap;
+	SourceMap mSources;
+
+public:
+	/** Hashes the file at path and adds it; it is read again when the pack is written.
+	 * \param fileId if not NULL, set to the file's fingerprint.
+	 * \returns false if the file could not be read.
+	 */
+	bool addFile(const std::string &path, Fingerprint *fileId=NULL);
+	/// Adds data already in memory under fileId, which should be its digest.
+	void addData(const Fingerprint &fileId, const DenseDataPtr &data);
+
+	/// Number of distinct assets added.
+	size_t size() const {
+		return mSources.size();
+	}
+
+	/** Writes every asset to path, replacing it only once the new pack is complete.
+	 * \returns false if any asset could not be read or the pack could not be written.
+	 */
+	bool write(const std::string &path) const;
+};
+
+}
+}
+
+#endif /* SIRIKATA_PackFile_HPP__ */
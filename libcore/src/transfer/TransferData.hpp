@@ -43,6 +43,8 @@ namespace Transfer {
 /// Represents a single block of data, and also knows the range of the file it came from.
 class DenseData : Noncopyable, public Range {
 	std::vector<unsigned char> mData;
+	const unsigned char *mExternal; ///< read-only data owned by mExternalOwner, or NULL.
+	std::tr1::shared_ptr<void> mExternalOwner;
 
     // All too easy to mix up string constructors (binarydata,length) with (string,startbyte)
 	DenseData(const char *str, size_t len) : Range(false) {}
@@ -51,20 +53,30 @@ class DenseData : Noncopyable, public Range {
 public:
 	/// The only constructor--the length can be changed later with setLength().
 	DenseData(const Range &range)
-			:Range(range) {
+			:Range(range), mExternal(NULL) {
 		if (range.length()) {
 			mData.resize((std::vector<unsigned char>::size_type)range.length());
 		}
 	}
 
 	DenseData(const std::string &str, Range::base_type start=0, bool wholeFile=true)
-			:Range(start, str.length(), LENGTH, wholeFile) {
+			:Range(start, str.length(), LENGTH, wholeFile), mExternal(NULL) {
 		setLength(str.length(), wholeFile);
 		std::copy(str.begin(), str.end(), writableData());
 	}
 
+	/** Refers to range.length() bytes of memory without copying them, such as a
+	 * mapped file.  owner is kept alive as long as this is; the data is read-only,
+	 * so writableData() and setLength() may not be used. */
+	DenseData(const Range &range, const unsigned char *external, const std::tr1::shared_ptr<void> &owner)
+			:Range(range), mExternal(external), mExternalOwner(owner) {
+	}
+
 	/// equals dataAt(startbyte()).
 	inline const unsigned char *data() const {
+		if (mExternal) {
+			return mExternal;
+		}
 		return &(mData[0]);
 	}
 
@@ -78,6 +90,7 @@ public:
 
 	/// Returns a non-const data, starting at startbyte().
 	inline unsigned char *writableData() {
+		assert(mExternal == NULL);
 		return &(mData[0]);
 	}
 
@@ -89,7 +102,7 @@ public:
 		if (offset >= endbyte() || offset < startbyte()) {
 			return NULL;
 		}
-		return &(mData[(std::vector<unsigned char>::size_type)(offset-startbyte())]);
+		return data() + (size_t)(offset-startbyte());
 	}
 
 	inline std::string asString() const {
@@ -98,6 +111,7 @@ public:
 
 	/// Sets the length of the range, as well as allocates more space in the data vector.
 	inline void setLength(size_t len, bool is_npos) {
+		assert(mExternal == NULL);
 		Range::setLength(len, is_npos);
 		mData.resize(len);
 		//message1.reserve(size);
@@ -188,6 +188,13 @@ public:
 	virtual void purgeFromCache(const Fingerprint &fprint) {
 	}
 
+	/** Stores data in the local caches under fprint without uploading it anywhere,
+	 * so a later downloadByHash() of fprint is answered from the cache.
+	 * Useful for data derived from a download, which is keyed by a Fingerprint
+	 * computed from the source rather than from its own contents. */
+	virtual void addToCache(const Fingerprint &fprint, const DenseDataPtr &data) {
+	}
+
 	/** Performs a name lookup, and then downloads this file.
 	 *
 	 * Uses the event system in order to ensure that multiple copies of a duplicate file
@@ -215,6 +222,18 @@ public:
 		return SubscriptionIdClass::null();
 	}
 
+	/** Like downloadByHash, but answered only from the local cache layers: a file
+	 * that is not cached fails with FAIL_DOWNLOAD rather than being fetched.
+	 * Useful for data derived from a download, which no server has.
+	 *
+	 * @param name      RemoteFileId of the hash
+	 * @param listener  An EventListener to receive a DownloadEventPtr with the cached data.
+	 * @param range     What part of the file to retrieve, or Range(true) for the whole file.
+	 */
+	virtual void downloadCached(const RemoteFileId &name, const EventListener &listener, const Range &range) {
+		listener(DownloadEventPtr(new DownloadEvent(FAIL_UNIMPLEMENTED, name, NULL)));
+	}
+
         virtual void downloadName(const URI &nameURI,
                 const std::tr1::function<void(const URI &nameURI,const RemoteFileId *fingerprint)> &listener) {
             listener(nameURI, NULL);
@@ -0,0 +1,647 @@
+/*  Sirikata Utilities -- Math Library
+ *  ColladaGeometry.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "ColladaGeometry.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace Sirikata {
+
+namespace {
+
+bool isSpace(char c) {
+    return c==' '||c=='\t'||c=='\n'||c=='\r';
+}
+
+/**
+ * Pull reader for the part of XML that COLLADA uses: elements, attributes and text.
+ * Comments, processing instructions, declarations and CDATA are skipped, and entities are
+ * left as they are since geometry ids and numbers never need them.  The buffer must end in
+ * a NUL so that numbers at the very end cannot be read past it.
+ */
+class XmlReader {
+public:
+    enum Token {START, END, DONE};
+
+    XmlReader(const char*begin, const char*end)
+        : mPos(begin),mEnd(end),mText(end),mSelfClosing(false),mError(false) {
+    }
+    /// Advances to the next start or end tag.
+    Token next() {
+        while (true) {
+            const char*open=(const char*)memchr(mPos,'<',mEnd-mPos);
+            if (!open) {
+                mPos=mEnd;
+                return DONE;
+            }
+            mPos=open+1;
+            if (startsWith("!--")) {
+                skipPast("-->");
+            } else if (startsWith("![CDATA[")) {
+                skipPast("]]>");
+            } else if (startsWith("?")) {
+                skipPast("?>");
+            } else if (startsWith("!")) {
+                skipPast(">");
+            } else if (startsWith("/")) {
+                ++mPos;
+                readName(mName);
+                skipPast(">");
+                mSelfClosing=false;
+                return END;
+            } else {
+                return readStartTag();
+            }
+            if (mError) {
+                return DONE;
+            }
+        }
+    }
+    /// Name of the last tag returned by next().
+    const String&name() const {
+        return mName;
+    }
+    /// Whether the last start tag has no content, like <input/>.
+    bool selfClosing() const {
+        return mSelfClosing;
+    }
+    /// Value of an attribute of the last start tag, or the empty string.
+    const String&attribute(const char*name) const {
+        for (size_t i=0;i<mAttributes.size();++i) {
+            if (mAttributes[i].first==name) {
+                return mAttributes[i].second;
+            }
+        }
+        return mEmpty;
+    }
+    /// Start of the text following the last start tag; the text runs to the next tag.
+    const char*text() const {
+        return mText;
+    }
+    /// Skips the rest of the element whose start tag was just returned.
+    void skipElement() {
+        if (mSelfClosing) {
+            return;
+        }
+        int depth=1;
+        while (depth) {
+            Token token=next();
+            if (token==DONE) {
+                mError=true;
+                return;
+            }
+            if (token==END) {
+                --depth;
+            } else if (!mSelfClosing) {
+                ++depth;
+            }
+        }
+    }
+    bool error() const {
+        return mError;
+    }
+    void fail() {
+        mError=true;
+    }
+private:
+    bool startsWith(const char*prefix) const {
+        size_t length=strlen(prefix);
+        return (size_t)(mEnd-mPos)>=length&&memcmp(mPos,prefix,length)==0;
+    }
+    void skipPast(const char*terminator) {
+        size_t length=strlen(terminator);
+        while (mEnd-mPos>=(ptrdiff_t)length) {
+            if (memcmp(mPos,terminator,length)==0) {
+                mPos+=length;
+                return;
+            }
+            ++mPos;
+        }
+        mPos=mEnd;
+        mError=true;
+    }
+    void readName(String&name) {
+        const char*start=mPos;
+        while (mPos<mEnd&&!isSpace(*mPos)&&*mPos!='/'&&*mPos!='>'&&*mPos!='=') {
+            ++mPos;
+        }
+        name.assign(start,mPos);
+    }
+    void skipSpace() {
+        while (mPos<mEnd&&isSpace(*mPos)) {
+            ++mPos;
+        }
+    }
+    Token readStartTag() {
+        readName(mName);
+        mAttributes.clear();
+        mSelfClosing=false;
+        while (true) {
+            skipSpace();
+            if (mPos>=mEnd) {
+                mError=true;
+                return DONE;
+            }
+            if (*mPos=='>') {
+                ++mPos;
+                break;
+            }
+            if (*mPos=='/') {
+                mSelfClosing=true;
+                skipPast(">");
+                break;
+            }
+            mAttributes.push_back(std::pair<String,String>());
+            readName(mAttributes.back().first);
+            skipSpace();
+            if (mPos>=mEnd||*mPos!='=') {
+                mError=true;
+                return DONE;
+            }
+            ++mPos;
+            skipSpace();
+            if (mPos>=mEnd||(*mPos!='"'&&*mPos!='\'')) {
+                mError=true;
+                return DONE;
+            }
+            const char*close=(const char*)memchr(mPos+1,*mPos,mEnd-mPos-1);
+            if (!close) {
+                mError=true;
+                return DONE;
+            }
+            mAttributes.back().second.assign(mPos+1,close);
+            mPos=close+1;
+        }
+        if (mError) {
+            return DONE;
+        }
+        mText=mPos;
+        return START;
+    }
+
+    const char*mPos;
+    const char*mEnd;
+    const char*mText;
+    String mName;
+    std::vector<std::pair<String,String> > mAttributes;
+    String mEmpty;
+    bool mSelfClosing;
+    bool mError;
+};
+
+void readFloats(const char*text, std::vector<float>&output) {
+    while (true) {
+        while (isSpace(*text)) {
+            ++text;
+        }
+        if (*text=='<'||*text=='\0') {
+            return;
+        }
+        char*end;
+        float value=(float)strtod(text,&end);
+        if (end==text) {
+            return;
+        }
+        output.push_back(value);
+        text=end;
+    }
+}
+
+void readIndices(const char*text, std::vector<uint32>&output) {
+    while (true) {
+        while (isSpace(*text)) {
+            ++text;
+        }
+        if (*text<'0'||*text>'9') {
+            return;
+        }
+        uint32 value=0;
+        while (*text>='0'&&*text<='9') {
+            value=value*10+(*text-'0');
+            ++text;
+        }
+        output.push_back(value);
+    }
+}
+
+String stripHash(const String&reference) {
+    return reference.empty()||reference[0]!='#'?reference:reference.substr(1);
+}
+
+struct Source {
+    std::vector<float> mData;
+    unsigned int mStride;
+    Source():mStride(1) {}
+};
+
+/// The inputs a <vertices> element bundles under the VERTEX semantic.
+struct VertexInputs {
+    String mPosition;
+    String mNormal;
+    String mTexCoord;
+};
+
+const uint32 NO_INDEX=~(uint32)0;
+
+/// Which entry of each source an output vertex was made from.
+struct VertexKey {
+    uint32 mPosition;
+    uint32 mNormal;
+    uint32 mTexCoord;
+    bool operator==(const VertexKey&other) const {
+        return mPosition==other.mPosition&&mNormal==other.mNormal&&mTexCoord==other.mTexCoord;
+    }
+    class Hasher {public:
+        size_t operator()(const VertexKey&key) const {
+            return (size_t)key.mPosition*2654435761u^(size_t)key.mNormal*40503u^(size_t)key.mTexCoord;
+        }
+    };
+};
+
+/// Reads the geometry libraries of one document into a mesh.
+class GeometryReader {
+    typedef ProgressiveMesh::SubMesh SubMesh;
+    typedef std::tr1::unordered_map<VertexKey,uint32,VertexKey::Hasher> VertexIndex;
+public:
+    GeometryReader(XmlReader&xml, std::vector<ProgressiveMesh::Vertex>&vertices,
+                   std::vector<ProgressiveMesh::SubMesh>&subMeshes)
+        : mXml(xml),mVertices(vertices),mSubMeshes(subMeshes),mScale(1),mUpAxis(1) {
+        for (size_t i=0;i<subMeshes.size();++i) {
+            mSubMeshByMaterial[subMeshes[i].mMaterial]=i;
+        }
+    }
+    /// \returns false if the document was not COLLADA or was malformed
+    bool read() {
+        bool sawRoot=false;
+        int depth=0;
+        size_t firstVertex=mVertices.size();
+        XmlReader::Token token;
+        while ((token=mXml.next())!=XmlReader::DONE) {
+            if (token==XmlReader::END) {
+                --depth;
+                continue;
+            }
+            const String&name=mXml.name();
+            if (name=="COLLADA") {
+                sawRoot=true;
+            } else if (!sawRoot) {
+                mXml.skipElement();
+                continue;
+            } else if (name=="unit") {
+                const String&meter=mXml.attribute("meter");
+                if (!meter.empty()) {
+                    mScale=(float)strtod(meter.c_str(),NULL);
+                }
+            } else if (name=="up_axis") {
+                const char*text=mXml.text();
+                while (isSpace(*text)) {
+                    ++text;
+                }
+                mUpAxis=(*text=='X'?0:*text=='Z'?2:1);
+            } else if (name=="mesh") {
+                if (!readMesh()) {
+                    return false;
+                }
+                continue;
+            } else if (name.compare(0,8,"library_")==0&&name!="library_geometries") {
+                mXml.skipElement();
+                continue;
+            }
+            if (!mXml.selfClosing()) {
+                ++depth;
+            }
+        }
+        // A document cut short ends with elements still open.
+        if (!sawRoot||depth||mXml.error()) {
+            return false;
+        }
+        computeMissingNormals(firstVertex);
+        return true;
+    }
+private:
+    /// Turns a COLLADA direction into the Y up space the rest of the system uses.
+    Vector3f toYUp(float x, float y, float z) const {
+        if (mUpAxis==2) {
+            return Vector3f(x,z,-y);
+        } else if (mUpAxis==0) {
+            return Vector3f(-y,x,z);
+        }
+        return Vector3f(x,y,z);
+    }
+    bool readMesh() {
+        mSources.clear();
+        mVertexInputs.clear();
+        mVertexIndex.clear();
+        XmlReader::Token token;
+        while ((token=mXml.next())==XmlReader::START) {
+            // copied, since reading the element's children changes mXml.name()
+            String name(mXml.name());
+            bool ok=true;
+            if (name=="source") {
+                readSource();
+            } else if (name=="vertices") {
+                readVertices();
+            } else if (name=="triangles"||name=="polylist"||name=="polygons") {
+                ok=readPrimitive(name);
+            } else {
+                mXml.skipElement();
+            }
+            if (!ok||mXml.error()) {
+                return false;
+            }
+        }
+        return token==XmlReader::END;
+    }
+    void readSource() {
+        Source&source=mSources[mXml.attribute("id")];
+        if (mXml.selfClosing()) {
+            return;
+        }
+        int depth=1;
+        while (depth) {
+            XmlReader::Token token=mXml.next();
+            if (token==XmlReader::DONE) {
+                return;
+            }
+            if (token==XmlReader::END) {
+                --depth;
+                continue;
+            }
+            if (mXml.name()=="float_array") {
+                const char*text=mXml.text();
+                const String&count=mXml.attribute("count");
+                if (!count.empty()) {
+                    // count comes from the file, so never reserve more floats than the text could hold
+                    size_t most=(strcspn(text,"<")+1)/2;
+                    source.mData.reserve(std::min((size_t)strtoul(count.c_str(),NULL,10),most));
+                }
+                readFloats(text,source.mData);
+            } else if (mXml.name()=="accessor") {
+                const String&stride=mXml.attribute("stride");
+                if (!stride.empty()) {
+                    source.mStride=(unsigned int)strtoul(stride.c_str(),NULL,10);
+                }
+            }
+            if (!mXml.selfClosing()) {
+                ++depth;
+            }
+        }
+    }
+    void readVertices() {
+        VertexInputs&inputs=mVertexInputs[mXml.attribute("id")];
+        if (mXml.selfClosing()) {
+            return;
+        }
+        XmlReader::Token token;
+        while ((token=mXml.next())==XmlReader::START) {
+            if (mXml.name()=="input") {
+                const String&semantic=mXml.attribute("semantic");
+                String source=stripHash(mXml.attribute("source"));
+                if (semantic=="POSITION") {
+                    inputs.mPosition=source;
+                } else if (semantic=="NORMAL") {
+                    inputs.mNormal=source;
+                } else if (semantic=="TEXCOORD"&&inputs.mTexCoord.empty()) {
+                    inputs.mTexCoord=source;
+                }
+            }
+            mXml.skipElement();
+        }
+    }
+    const Source*findSource(const String&id) const {
+        std::map<String,Source>::const_iterator where=mSources.find(id);
+        return where==mSources.end()?NULL:&where->second;
+    }
+    bool readPrimitive(const String&kind) {
+        const Source*positions=NULL;
+        const Source*normals=NULL;
+        const Source*texCoords=NULL;
+        unsigned int positionOffset=0,normalOffset=0,texCoordOffset=0;
+        unsigned int tupleSize=1;
+        std::vector<uint32> counts;
+        std::vector<uint32> indices;
+        std::vector<uint32> polygonCounts;
+        SubMesh&subMesh=findSubMesh(mXml.attribute("material"));
+        if (mXml.selfClosing()) {
+            return true;
+        }
+        XmlReader::Token token;
+        while ((token=mXml.next())==XmlReader::START) {
+            const String&name=mXml.name();
+            if (name=="input") {
+                const String&semantic=mXml.attribute("semantic");
+                String source=stripHash(mXml.attribute("source"));
+                unsigned int offset=(unsigned int)strtoul(mXml.attribute("offset").c_str(),NULL,10);
+                if (offset+1>tupleSize) {
+                    tupleSize=offset+1;
+                }
+                if (semantic=="VERTEX") {
+                    std::map<String,VertexInputs>::const_iterator where=mVertexInputs.find(source);
+                    if (where!=mVertexInputs.end()) {
+                        positions=findSource(where->second.mPosition);
+                        positionOffset=offset;
+                        if (!where->second.mNormal.empty()) {
+                            normals=findSource(where->second.mNormal);
+                            normalOffset=offset;
+                        }
+                        if (!where->second.mTexCoord.empty()) {
+                            texCoords=findSource(where->second.mTexCoord);
+                            texCoordOffset=offset;
+                        }
+                    }
+                } else if (semantic=="NORMAL") {
+                    normals=findSource(source);
+                    normalOffset=offset;
+                } else if (semantic=="TEXCOORD"&&!texCoords) {
+                    texCoords=findSource(source);
+                    texCoordOffset=offset;
+                }
+            } else if (name=="vcount") {
+                readIndices(mXml.text(),counts);
+            } else if (name=="p") {
+                size_t before=indices.size();
+                readIndices(mXml.text(),indices);
+                if (kind=="polygons") {
+                    polygonCounts.push_back((uint32)((indices.size()-before)/tupleSize));
+                }
+            }
+            mXml.skipElement();
+        }
+        if (token!=XmlReader::END||!positions) {
+            return token==XmlReader::END;
+        }
+        if (kind=="polygons") {
+            counts.swap(polygonCounts);
+        } else if (kind=="triangles") {
+            counts.assign(indices.size()/tupleSize/3,3);
+        }
+        size_t tuple=0;
+        size_t numTuples=indices.size()/tupleSize;
+        for (size_t polygon=0;polygon<counts.size();++polygon) {
+            uint32 count=counts[polygon];
+            if (tuple+count>numTuples) {
+                return false;
+            }
+            uint32 first=0,previous=0;
+            for (uint32 corner=0;corner<count;++corner) {
+                const uint32*entry=&indices[(tuple+corner)*tupleSize];
+                VertexKey key;
+                key.mPosition=entry[positionOffset];
+                key.mNormal=normals?entry[normalOffset]:NO_INDEX;
+                key.mTexCoord=texCoords?entry[texCoordOffset]:NO_INDEX;
+                uint32 vertex;
+                if (!findVertex(key,positions,normals,texCoords,vertex)) {
+                    return false;
+                }
+                if (corner==0) {
+                    first=vertex;
+                } else if (corner>=2) {
+                    subMesh.mIndices.push_back(first);
+                    subMesh.mIndices.push_back(previous);
+                    subMesh.mIndices.push_back(vertex);
+                }
+                previous=vertex;
+            }
+            tuple+=count;
+        }
+        return true;
+    }
+    SubMesh&findSubMesh(const String&material) {
+        std::map<String,size_t>::iterator where=mSubMeshByMaterial.find(material);
+        if (where==mSubMeshByMaterial.end()) {
+            where=mSubMeshByMaterial.insert(std::map<String,size_t>::value_type(material,mSubMeshes.size())).first;
+            mSubMeshes.push_back(SubMesh());
+            mSubMeshes.back().mMaterial=material;
+        }
+        return mSubMeshes[where->second];
+    }
+    static bool fetch(const Source*source, uint32 index, unsigned int components, const float*&values) {
+        size_t start=(size_t)index*source->mStride;
+        if (index==NO_INDEX||source->mStride<components||start+components>source->mData.size()) {
+            return false;
+        }
+        values=&source->mData[start];
+        return true;
+    }
+    bool findVertex(const VertexKey&key, const Source*positions, const Source*normals,
+                    const Source*texCoords, uint32&vertex) {
+        VertexIndex::iterator where=mVertexIndex.find(key);
+        if (where!=mVertexIndex.end()) {
+            vertex=where->second;
+            return true;
+        }
+        ProgressiveMesh::Vertex made;
+        const float*values;
+        if (!fetch(positions,key.mPosition,3,values)) {
+            return false;
+        }
+        made.mPosition=toYUp(values[0],values[1],values[2])*mScale;
+        if (normals) {
+            if (!fetch(normals,key.mNormal,3,values)) {
+                return false;
+            }
+            made.mNormal=toYUp(values[0],values[1],values[2]);
+        } else {
+            made.mNormal=Vector3f(0,0,0);
+        }
+        mMissingNormal.push_back(!normals);
+        made.mU=0;
+        made.mV=0;
+        if (texCoords) {
+            if (!fetch(texCoords,key.mTexCoord,2,values)) {
+                return false;
+            }
+            made.mU=values[0];
+            made.mV=1-values[1];
+        }
+        vertex=(uint32)mVertices.size();
+        mVertices.push_back(made);
+        mVertexIndex[key]=vertex;
+        return true;
+    }
+    /// Gives vertices read without a normal the sum of the normals of the triangles using them.
+    void computeMissingNormals(size_t firstVertex) {
+        if (std::find(mMissingNormal.begin(),mMissingNormal.end(),true)==mMissingNormal.end()) {
+            return;
+        }
+        // Vertices that were already in the output before this document have their normals.
+        std::vector<bool> missing(firstVertex,false);
+        missing.insert(missing.end(),mMissingNormal.begin(),mMissingNormal.end());
+        for (size_t s=0;s<mSubMeshes.size();++s) {
+            const std::vector<uint32>&tris=mSubMeshes[s].mIndices;
+            for (size_t i=0;i+2<tris.size();i+=3) {
+                if (!missing[tris[i]]&&!missing[tris[i+1]]&&!missing[tris[i+2]]) {
+                    continue;
+                }
+                const Vector3f&a=mVertices[tris[i]].mPosition;
+                Vector3f normal=(mVertices[tris[i+1]].mPosition-a).cross(mVertices[tris[i+2]].mPosition-a);
+                for (int corner=0;corner<3;++corner) {
+                    if (missing[tris[i+corner]]) {
+                        mVertices[tris[i+corner]].mNormal+=normal;
+                    }
+                }
+            }
+        }
+        for (size_t i=firstVertex;i<mVertices.size();++i) {
+            if (missing[i]&&mVertices[i].mNormal.lengthSquared()>0) {
+                mVertices[i].mNormal=mVertices[i].mNormal.normal();
+            }
+        }
+    }
+
+    XmlReader&mXml;
+    std::vector<ProgressiveMesh::Vertex>&mVertices;
+    std::vector<ProgressiveMesh::SubMesh>&mSubMeshes;
+    std::map<String,size_t> mSubMeshByMaterial;
+    std::map<String,Source> mSources;
+    std::map<String,VertexInputs> mVertexInputs;
+    VertexIndex mVertexIndex;
+    /// For each vertex read from this document, whether it still needs a normal
+    std::vector<bool> mMissingNormal;
+    float mScale;
+    int mUpAxis;
+};
+
+}
+
+bool ColladaGeometry::read(const char*data, size_t length,
+                           std::vector<ProgressiveMesh::Vertex>&vertices,
+                           std::vector<ProgressiveMesh::SubMesh>&subMeshes) {
+    // A copy ends in a NUL, so numbers at the end of a truncated document stop there.
+    String document(data,length);
+    XmlReader xml(document.data(),document.data()+document.length());
+    return GeometryReader(xml,vertices,subMeshes).read();
+}
+
+}
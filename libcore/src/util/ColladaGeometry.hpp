@@ -0,0 +1,64 @@
+/*  Sirikata Utilities -- Math Library
+ *  ColladaGeometry.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_COLLADA_GEOMETRY_HPP_
+#define _SIRIKATA_COLLADA_GEOMETRY_HPP_
+
+#include "ProgressiveMesh.hpp"
+
+namespace Sirikata {
+
+/**
+ * Reads the triangle geometry out of a COLLADA 1.4 document in a single pass, without building
+ * a document tree.  Every mesh in library_geometries is merged into one vertex list, in the
+ * geometry's own space: node transforms and instancing in the visual scene are ignored.
+ * The other libraries are skipped unread, which keeps large scenes cheap to scan.
+ *
+ * Triangles, polylists and polygons are read and fanned into triangles; lines and strips are
+ * ignored.  Each distinct material symbol becomes one submesh.  Positions are scaled to meters
+ * and turned Y up as the asset element asks, texture coordinates have V flipped to the top down
+ * convention Ogre uses, and vertices without normals get the area weighted average of the
+ * normals of the triangles around them.
+ */
+class SIRIKATA_EXPORT ColladaGeometry {
+public:
+    /**
+     * Appends the geometry in the document to vertices and subMeshes.
+     * \returns false if the document is not COLLADA, is malformed, or indexes past a source
+     */
+    static bool read(const char*data, size_t length,
+                     std::vector<ProgressiveMesh::Vertex>&vertices,
+                     std::vector<ProgressiveMesh::SubMesh>&subMeshes);
+};
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*  Sirikata Utilities -- Sirikata Utilities
+ *  IndexedHeap.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_INDEXED_HEAP_HPP_
+#define _SIRIKATA_INDEXED_HEAP_HPP_
+
+namespace Sirikata {
+
+/**
+ * Binary heap that remembers where each item lives, so the priority of an item already in the
+ * heap can be raised, lowered or removed in O(log n) instead of searching for it.  Like
+ * std::priority_queue, top() is the item no other item compares greater than, so std::less
+ * gives a max-heap and std::greater a min-heap.  Each item may be in the heap at most once.
+ */
+template <class T,
+          class Priority=float,
+          class Compare=std::less<Priority>,
+          class Hasher=std::tr1::hash<T> >
+class IndexedHeap {
+    typedef std::pair<Priority,T> Entry;
+    typedef std::tr1::unordered_map<T,size_t,Hasher> PositionMap;
+    std::vector<Entry> mHeap;
+    PositionMap mPositions;
+    Compare mCompare;
+
+    void place(size_t pos, const Entry&entry) {
+        mHeap[pos]=entry;
+        mPositions[entry.second]=pos;
+    }
+    void siftUp(size_t pos) {
+        Entry entry=mHeap[pos];
+        while (pos>0) {
+            size_t parent=(pos-1)/2;
+            if (!mCompare(mHeap[parent].first,entry.first))
+                break;
+            place(pos,mHeap[parent]);
+            pos=parent;
+        }
+        place(pos,entry);
+    }
+    void siftDown(size_t pos) {
+        Entry entry=mHeap[pos];
+        size_t size=mHeap.size();
+        while (true) {
+            size_t child=2*pos+1;
+            if (child>=size)
+                break;
+            if (child+1<size&&mCompare(mHeap[child].first,mHeap[child+1].first))
+                ++child;
+            if (!mCompare(entry.first,mHeap[child].first))
+                break;
+            place(pos,mHeap[child]);
+            pos=child;
+        }
+        place(pos,entry);
+    }
+    void removeAt(size_t pos) {
+        mPositions.erase(mHeap[pos].second);
+        size_t last=mHeap.size()-1;
+        if (pos!=last) {
+            Entry moved=mHeap[last];
+            mHeap.pop_back();
+            place(pos,moved);
+            if (pos>0&&mCompare(mHeap[(pos-1)/2].first,moved.first))
+                siftUp(pos);
+            else
+                siftDown(pos);
+        }else {
+            mHeap.pop_back();
+        }
+    }
+public:
+    IndexedHeap(const Compare&compare=Compare()):mCompare(compare) {}
+
+    bool empty() const {
+        return mHeap.empty();
+    }
+    size_t size() const {
+        return mHeap.size();
+    }
+    bool contains(const T&item) const {
+        return mPositions.find(item)!=mPositions.end();
+    }
+    const T&top() const {
+        assert(!mHeap.empty());
+        return mHeap.front().second;
+    }
+    const Priority&topPriority() const {
+        assert(!mHeap.empty());
+        return mHeap.front().first;
+    }
+    /// Priority of an item that must be in the heap.
+    const Priority&priority(const T&item) const {
+        typename PositionMap::const_iterator where=mPositions.find(item);
+        assert(where!=mPositions.end());
+        return mHeap[where->second].first;
+    }
+    /// Inserts item, or moves it if it is already in the heap and its priority changed.
+    void update(const T&item, const Priority&priority) {
+        typename PositionMap::iterator where=mPositions.find(item);
+        if (where==mPositions.end()) {
+            mHeap.push_back(Entry(priority,item));
+            siftUp(mHeap.size()-1);
+            return;
+        }
+        size_t pos=where->second;
+        Priority old=mHeap[pos].first;
+        mHeap[pos].first=priority;
+        if (mCompare(old,priority))
+            siftUp(pos);
+        else if (mCompare(priority,old))
+            siftDown(pos);
+    }
+    void pop() {
+        assert(!mHeap.empty());
+        removeAt(0);
+    }
+    /// Removes item if present; returns whether it was.
+    bool erase(const T&item) {
+        typename PositionMap::iterator where=mPositions.find(item);
+        if (where==mPositions.end())
+            return false;
+        removeAt(where->second);
+        return true;
+    }
+    void clear() {
+        mHeap.clear();
+        mPositions.clear();
+    }
+};
+
+}
+
+#endif
@@ -42,6 +42,7 @@ enum Ports{
     PERSISTENCE=5,
 	PHYSICS=6,
     TIMESYNC=7,
+    MESSAGE_BATCH=8, // Frame of length-prefixed messages from one object stream, unpacked by the space
     OBJECT_CONNECTIONS=16383
 };
 }
@@ -205,6 +205,175 @@ public:
     }
 };
 
+/**
+ * SlotProvider offers the Provider interface for providers that notify their few listeners very often,
+ * such as a ProxyObject's position listeners.
+ * Listeners are kept in slots in the order they were added and found by a scan instead of an index map.
+ * Removing any listener during a notification, not only the one being notified, is safe: its slot is
+ * emptied and skipped, and the emptied slots are compacted once the outermost notification returns,
+ * so a notification never copies the listeners or allocates.
+ * Listeners added during a notification are first called on the next one.
+ */
+template <typename ListenerPtr> class SlotProvider {
+    struct Slot {
+        ListenerPtr mListener;
+        bool mLive;
+        Slot(const ListenerPtr&p):mListener(p),mLive(true){}
+    };
+    typedef std::vector<Slot> SlotVector;
+    ///every listener ever added and not yet compacted away, in the order they were added
+    SlotVector mSlots;
+    size_t mNumLive;
+    ///how many notifications are on the stack; slots are only erased when this is 0
+    uint32 mNotifyDepth;
+    bool mHasEmptySlots;
+
+    class NotifyScope {
+        SlotProvider*mProvider;
+    public:
+        NotifyScope(SlotProvider*provider):mProvider(provider){
+            ++mProvider->mNotifyDepth;
+        }
+        ~NotifyScope() {
+            if (--mProvider->mNotifyDepth==0&&mProvider->mHasEmptySlots) {
+                mProvider->compact();
+            }
+        }
+    };
+    void compact() {
+        size_t kept=0;
+        for (size_t i=0;i<mSlots.size();++i) {
+            if (mSlots[i].mLive) {
+                if (kept!=i)
+                    mSlots[kept]=mSlots[i];
+                ++kept;
+            }
+        }
+        mSlots.erase(mSlots.begin()+kept,mSlots.end());
+        mHasEmptySlots=false;
+    }
+protected:
+    SlotProvider():mNumLive(0),mNotifyDepth(0),mHasEmptySlots(false){}
+    virtual ~SlotProvider(){}
+   ///This function is called with a new listener just after every listener is added to the callbacks (Override for interesting behavior, such as feeding the initial values to it)
+    virtual void listenerAdded(ListenerPtr ){}
+   ///This function is called with the dated listener just before that listener is removed from the callbacks (Override for interesting behavior)
+    virtual void listenerRemoved(ListenerPtr ){}
+   ///This function is called with a new listener when the first listener signs up (Override to propogate network requests for example)
+    virtual void firstListenerAdded(ListenerPtr ){}
+   ///This function is called with the defunct listener just before the last listener is removed frmo the callbacks. Override for interesting behavior
+    virtual void lastListenerRemoved(ListenerPtr ){}
+    /**
+     *  Calls f(listener) on every listener. The call is resolved at compile time, so small functors inline.
+     *  Listeners may add or remove any listeners during the call.
+     */
+    template <typename Functor> void notifyWith(Functor&f) {
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) {
+                f(mSlots[i].mListener);
+            }
+        }
+    }
+    /**
+     *  Calls f(*provider,listener) for every listener of every provider in [begin,end), so a batch of
+     *  updates to many providers is delivered in one loop.
+     *  \param begin iterates over pointers (or smart pointers) to providers derived from this SlotProvider
+     */
+    template <typename Iterator, typename Functor> static void notifyEach(Iterator begin, Iterator end, Functor&f) {
+        for (;begin!=end;++begin) {
+            SlotProvider<ListenerPtr>*provider=&**begin;
+            NotifyScope scope(provider);
+            for (size_t i=0,n=provider->mSlots.size();i<n;++i) {
+                if (provider->mSlots[i].mLive) {
+                    f(**begin,provider->mSlots[i].mListener);
+                }
+            }
+        }
+    }
+    /**
+     *  This function notifies all listeners. Listeners may add other listeners or remove any listener.
+     *  \param func which must be a member function of ListenerPtr gets called on all listeners
+     */
+    template <typename T> void notify(T func){
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) ((&*mSlots[i].mListener)->*func)();
+        }
+    }
+    ///@see notify(T)
+    template <typename T, typename A> void notify(T func, const A&newA){
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) ((&*mSlots[i].mListener)->*func)(newA);
+        }
+    }
+    ///@see notify(T)
+    template <typename T, typename A, typename B>
+      void notify(T func, const A&newA, const B&newB){
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) ((&*mSlots[i].mListener)->*func)(newA,newB);
+        }
+    }
+    ///@see notify(T)
+    template <typename T, typename A, typename B, typename C>
+      void notify(T func, const A&newA, const B&newB, const C&newC){
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) ((&*mSlots[i].mListener)->*func)(newA,newB,newC);
+        }
+    }
+    ///@see notify(T)
+    template <typename T, typename A, typename B, typename C, typename D>
+      void notify(T func, const A&newA, const B&newB, const C&newC, const D&newD){
+        NotifyScope scope(this);
+        for (size_t i=0,n=mSlots.size();i<n;++i) {
+            if (mSlots[i].mLive) ((&*mSlots[i].mListener)->*func)(newA,newB,newC,newD);
+        }
+    }
+public:
+    /**
+     *  This function adds a new listener to listen for notification
+     *  This may be called during a notify call, but new functions will not be called until the next notification
+     */
+    virtual void addListener(ListenerPtr p) {
+        mSlots.push_back(Slot(p));
+        if (++mNumLive==1) {
+            this->firstListenerAdded(p);
+        }
+        this->listenerAdded(p);
+    }
+    /**
+     *  This function removes a listener from listening for notification
+     *  This may be called at any time, including during a notify call on any listener
+     */
+    virtual void removeListener(ListenerPtr p) {
+        this->listenerRemoved(p);
+        typename SlotVector::iterator where=mSlots.end();
+        for (typename SlotVector::iterator i=mSlots.begin(),ie=mSlots.end();i!=ie;++i) {
+            if (i->mLive&&i->mListener==p) {
+                where=i;
+                break;
+            }
+        }
+        assert(where!=mSlots.end());
+        if (where==mSlots.end())
+            return;
+        if (mNumLive==1) {
+            this->lastListenerRemoved(p);
+        }
+        --mNumLive;
+        if (mNotifyDepth) {
+            where->mLive=false;
+            where->mListener=ListenerPtr();
+            mHasEmptySlots=true;
+        }else {
+            mSlots.erase(where);
+        }
+    }
+};
+
 /**
  * The MarkovianProvider1 provides the Provider interface 
  * The markovian provider recalls the last item sent to a listener and notifies new listeners withthis value
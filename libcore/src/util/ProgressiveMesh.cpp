@@ -0,0 +1,467 @@
+/*  Sirikata Utilities -- Math Library
+ *  ProgressiveMesh.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "ProgressiveMesh.hpp"
+#include <limits>
+
+namespace Sirikata {
+
+const char ProgressiveMesh::MAGIC[8] = {'S','I','R','I','P','M','S','H'};
+
+namespace {
+
+/// Grid cells are numbered in 20 bits per axis so a cell packs into one uint64 key.
+const unsigned int MAX_GRID_SHIFT=20;
+/// magic, version, header length, counts, radius and bounds
+const size_t FIXED_HEADER_SIZE=ProgressiveMesh::PREAMBLE_SIZE+8+4+24;
+const size_t LEVEL_ENTRY_SIZE=20;
+
+void putLittleEndian(std::string&output, uint64 value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        output+=(char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+void putFloat(std::string&output, float value) {
+    uint32 bits;
+    memcpy(&bits,&value,sizeof(bits));
+    putLittleEndian(output,bits,4);
+}
+
+void putVector(std::string&output, const Vector3f&value) {
+    putFloat(output,value.x);
+    putFloat(output,value.y);
+    putFloat(output,value.z);
+}
+
+/// Reads little endian numbers from a buffer, remembering if it ever ran past the end.
+class Reader {
+    const unsigned char*mData;
+    size_t mLength;
+    size_t mPosition;
+    bool mFailed;
+public:
+    Reader(const unsigned char*data, size_t length)
+        : mData(data),mLength(length),mPosition(0),mFailed(false) {
+    }
+    bool has(size_t bytes) const {
+        return !mFailed&&mLength-mPosition>=bytes;
+    }
+    uint64 get(int bytes) {
+        if (!has(bytes)) {
+            mFailed=true;
+            return 0;
+        }
+        uint64 result = 0;
+        for (int i = bytes-1; i >= 0; --i) {
+            result = (result << 8) | mData[mPosition+i];
+        }
+        mPosition+=bytes;
+        return result;
+    }
+    float getFloat() {
+        uint32 bits=(uint32)get(4);
+        float value;
+        memcpy(&value,&bits,sizeof(value));
+        return value;
+    }
+    Vector3f getVector() {
+        float x=getFloat();
+        float y=getFloat();
+        float z=getFloat();
+        return Vector3f(x,y,z);
+    }
+    String getString(size_t length) {
+        if (!has(length)) {
+            mFailed=true;
+            return String();
+        }
+        String result((const char*)mData+mPosition,length);
+        mPosition+=length;
+        return result;
+    }
+    bool failed() const {
+        return mFailed;
+    }
+    bool atEnd() const {
+        return !mFailed&&mPosition==mLength;
+    }
+};
+
+/// A triangle turned so its smallest index comes first, which keeps its winding.
+struct Triangle {
+    uint32 mIndex[3];
+    Triangle(uint32 a, uint32 b, uint32 c) {
+        if (b<a&&b<c) {
+            mIndex[0]=b;mIndex[1]=c;mIndex[2]=a;
+        } else if (c<a&&c<b) {
+            mIndex[0]=c;mIndex[1]=a;mIndex[2]=b;
+        } else {
+            mIndex[0]=a;mIndex[1]=b;mIndex[2]=c;
+        }
+    }
+    bool degenerate() const {
+        return mIndex[0]==mIndex[1]||mIndex[1]==mIndex[2]||mIndex[0]==mIndex[2];
+    }
+    bool operator==(const Triangle&other) const {
+        return mIndex[0]==other.mIndex[0]&&mIndex[1]==other.mIndex[1]&&mIndex[2]==other.mIndex[2];
+    }
+    class Hasher {public:
+        size_t operator()(const Triangle&t) const {
+            return (size_t)t.mIndex[0]*73856093u^(size_t)t.mIndex[1]*19349663u^(size_t)t.mIndex[2]*83492791u;
+        }
+    };
+};
+typedef std::tr1::unordered_set<Triangle,Triangle::Hasher> TriangleSet;
+
+}
+
+void ProgressiveMesh::encode(const std::vector<Vertex>&vertices, const std::vector<SubMesh>&subMeshes,
+                             unsigned int maxLevels, std::string&output) {
+    uint32 numVertices=(uint32)vertices.size();
+    Vector3f boundsMin(0,0,0);
+    Vector3f boundsMax(0,0,0);
+    float radius=0;
+    for (uint32 i=0;i<numVertices;++i) {
+        const Vector3f&pos=vertices[i].mPosition;
+        boundsMin=i?boundsMin.min(pos):pos;
+        boundsMax=i?boundsMax.max(pos):pos;
+        radius=std::max(radius,pos.length());
+    }
+    Vector3f size=boundsMax-boundsMin;
+    float extent=std::max(size.x,std::max(size.y,size.z));
+    if (!(extent>0)) {
+        extent=1;
+    }
+
+    unsigned int numCoarse=maxLevels>1?maxLevels-1:0;
+    if (numCoarse>MAX_GRID_SHIFT+1-COARSEST_GRID_SHIFT) {
+        numCoarse=MAX_GRID_SHIFT+1-COARSEST_GRID_SHIFT;
+    }
+    unsigned int numLevels=numCoarse+1;
+
+    // Cells are numbered on the finest coarse grid only and shifted down for coarser ones,
+    // so that the grids nest exactly whatever the float rounding.  The first vertex of a
+    // cell represents it, and since it is then also the first vertex of the smaller cell
+    // it lies in, every level's vertices are a subset of the next level's.
+    std::vector<std::vector<uint32> > representative(numCoarse,std::vector<uint32>(numVertices));
+    std::vector<unsigned int> firstLevel(numVertices,numCoarse);
+    if (numCoarse) {
+        unsigned int finestShift=numCoarse-1+COARSEST_GRID_SHIFT;
+        uint64 cells=(uint64)1<<finestShift;
+        std::vector<uint64> cell(numVertices);
+        for (uint32 i=0;i<numVertices;++i) {
+            Vector3f scaled=(vertices[i].mPosition-boundsMin)*(float(cells)/extent);
+            uint64 coord[3];
+            for (int axis=0;axis<3;++axis) {
+                float c=scaled[axis];
+                coord[axis]=c>0?std::min((uint64)c,cells-1):0;
+            }
+            cell[i]=coord[0]|(coord[1]<<MAX_GRID_SHIFT)|(coord[2]<<(2*MAX_GRID_SHIFT));
+        }
+        for (unsigned int level=0;level<numCoarse;++level) {
+            unsigned int shift=numCoarse-1-level;
+            uint64 mask=((uint64)1<<MAX_GRID_SHIFT)-1;
+            std::tr1::unordered_map<uint64,uint32> firstInCell;
+            for (uint32 i=0;i<numVertices;++i) {
+                uint64 key=((cell[i]&mask)>>shift)
+                    |((((cell[i]>>MAX_GRID_SHIFT)&mask)>>shift)<<MAX_GRID_SHIFT)
+                    |(((cell[i]>>(2*MAX_GRID_SHIFT))>>shift)<<(2*MAX_GRID_SHIFT));
+                uint32 rep=firstInCell.insert(std::pair<uint64,uint32>(key,i)).first->second;
+                representative[level][i]=rep;
+                if (rep==i&&firstLevel[i]>level) {
+                    firstLevel[i]=level;
+                }
+            }
+        }
+    }
+
+    // Vertices are stored in the order levels introduce them.
+    std::vector<uint32> order(numVertices);
+    std::vector<uint32> levelVertexCount(numLevels,0);
+    {
+        uint32 next=0;
+        for (unsigned int level=0;level<numLevels;++level) {
+            for (uint32 i=0;i<numVertices;++i) {
+                if (firstLevel[i]==level) {
+                    order[next++]=i;
+                }
+            }
+            levelVertexCount[level]=next;
+        }
+    }
+    std::vector<uint32> newIndex(numVertices);
+    for (uint32 i=0;i<numVertices;++i) {
+        newIndex[order[i]]=i;
+    }
+
+    std::vector<std::string> chunks(numLevels);
+    std::vector<uint32> levelTriangleCount(numLevels,0);
+    std::vector<std::vector<Triangle> > current(subMeshes.size());
+    for (unsigned int level=0;level<numLevels;++level) {
+        std::string&chunk=chunks[level];
+        uint32 firstVertex=level?levelVertexCount[level-1]:0;
+        putLittleEndian(chunk,levelVertexCount[level]-firstVertex,4);
+        for (uint32 i=firstVertex;i<levelVertexCount[level];++i) {
+            const Vertex&vert=vertices[order[i]];
+            putVector(chunk,vert.mPosition);
+            putVector(chunk,vert.mNormal);
+            putFloat(chunk,vert.mU);
+            putFloat(chunk,vert.mV);
+        }
+        for (size_t sub=0;sub<subMeshes.size();++sub) {
+            const std::vector<uint32>&indices=subMeshes[sub].mIndices;
+            std::vector<Triangle> wanted;
+            TriangleSet wantedSet;
+            for (size_t i=0;i+2<indices.size();i+=3) {
+                uint32 corner[3];
+                for (int j=0;j<3;++j) {
+                    uint32 index=indices[i+j];
+                    if (index>=numVertices) {
+                        index=0;
+                    }
+                    corner[j]=newIndex[level<numCoarse?representative[level][index]:index];
+                }
+                Triangle tri(corner[0],corner[1],corner[2]);
+                if (!tri.degenerate()&&wantedSet.insert(tri).second) {
+                    wanted.push_back(tri);
+                }
+            }
+
+            std::vector<Triangle>&have=current[sub];
+            std::vector<uint32> removed;
+            TriangleSet kept;
+            std::vector<Triangle> next;
+            for (size_t i=0;i<have.size();++i) {
+                if (wantedSet.count(have[i])) {
+                    kept.insert(have[i]);
+                    next.push_back(have[i]);
+                } else {
+                    removed.push_back((uint32)i);
+                }
+            }
+            std::vector<Triangle> added;
+            for (size_t i=0;i<wanted.size();++i) {
+                if (!kept.count(wanted[i])) {
+                    added.push_back(wanted[i]);
+                    next.push_back(wanted[i]);
+                }
+            }
+            putLittleEndian(chunk,removed.size(),4);
+            for (size_t i=0;i<removed.size();++i) {
+                putLittleEndian(chunk,removed[i],4);
+            }
+            putLittleEndian(chunk,added.size(),4);
+            for (size_t i=0;i<added.size();++i) {
+                for (int j=0;j<3;++j) {
+                    putLittleEndian(chunk,added[i].mIndex[j],4);
+                }
+            }
+            have.swap(next);
+            levelTriangleCount[level]+=(uint32)have.size();
+        }
+    }
+
+    size_t headerLength=FIXED_HEADER_SIZE+LEVEL_ENTRY_SIZE*numLevels;
+    for (size_t sub=0;sub<subMeshes.size();++sub) {
+        headerLength+=4+subMeshes[sub].mMaterial.length();
+    }
+    output.clear();
+    output.append(MAGIC,sizeof(MAGIC));
+    putLittleEndian(output,VERSION,4);
+    putLittleEndian(output,headerLength,4);
+    putLittleEndian(output,subMeshes.size(),4);
+    putLittleEndian(output,numLevels,4);
+    putFloat(output,radius);
+    putVector(output,boundsMin);
+    putVector(output,boundsMax);
+    for (size_t sub=0;sub<subMeshes.size();++sub) {
+        putLittleEndian(output,subMeshes[sub].mMaterial.length(),4);
+        output+=subMeshes[sub].mMaterial;
+    }
+    uint64 end=headerLength;
+    for (unsigned int level=0;level<numLevels;++level) {
+        end+=chunks[level].length();
+        putLittleEndian(output,end,8);
+        putLittleEndian(output,levelVertexCount[level],4);
+        putLittleEndian(output,levelTriangleCount[level],4);
+        putFloat(output,level<numCoarse?extent/float((uint64)1<<(level+COARSEST_GRID_SHIFT)):0.0f);
+    }
+    assert(output.length()==headerLength);
+    for (unsigned int level=0;level<numLevels;++level) {
+        output+=chunks[level];
+    }
+}
+
+size_t ProgressiveMesh::headerLength(const unsigned char*data, size_t length) {
+    if (length<PREAMBLE_SIZE||memcmp(data,MAGIC,sizeof(MAGIC))!=0) {
+        return 0;
+    }
+    Reader reader(data+sizeof(MAGIC),length-sizeof(MAGIC));
+    if (reader.get(4)!=VERSION) {
+        return 0;
+    }
+    return (size_t)reader.get(4);
+}
+
+ProgressiveMesh::ProgressiveMesh()
+    : mHeaderLength(0),mLevelsDecoded(0),mValid(false),mRadius(0),
+      mBoundsMin(0,0,0),mBoundsMax(0,0,0) {
+}
+
+bool ProgressiveMesh::parseHeader(const unsigned char*data, size_t length) {
+    mValid=false;
+    mLevels.clear();
+    mVertices.clear();
+    mSubMeshes.clear();
+    mLevelsDecoded=0;
+    mHeaderLength=headerLength(data,length);
+    if (mHeaderLength<FIXED_HEADER_SIZE||mHeaderLength>length) {
+        return false;
+    }
+    Reader reader(data+PREAMBLE_SIZE,mHeaderLength-PREAMBLE_SIZE);
+    uint32 numSubMeshes=(uint32)reader.get(4);
+    uint32 numLevels=(uint32)reader.get(4);
+    mRadius=reader.getFloat();
+    mBoundsMin=reader.getVector();
+    mBoundsMax=reader.getVector();
+    for (uint32 sub=0;sub<numSubMeshes&&reader.has(4);++sub) {
+        mSubMeshes.push_back(SubMesh());
+        mSubMeshes.back().mMaterial=reader.getString((size_t)reader.get(4));
+    }
+    uint64 start=mHeaderLength;
+    for (uint32 level=0;level<numLevels&&reader.has(LEVEL_ENTRY_SIZE);++level) {
+        Level entry;
+        entry.mEnd=reader.get(8);
+        entry.mVertexCount=(uint32)reader.get(4);
+        entry.mTriangleCount=(uint32)reader.get(4);
+        entry.mError=reader.getFloat();
+        if (entry.mEnd<start) {
+            return false;
+        }
+        start=entry.mEnd;
+        mLevels.push_back(entry);
+    }
+    mValid=reader.atEnd()&&mSubMeshes.size()==numSubMeshes&&mLevels.size()==numLevels;
+    return mValid;
+}
+
+bool ProgressiveMesh::refine(const unsigned char*data, uint64 offset, size_t length) {
+    while (mValid&&mLevelsDecoded<mLevels.size()) {
+        uint64 start=levelStart(mLevelsDecoded);
+        uint64 end=mLevels[mLevelsDecoded].mEnd;
+        if (start<offset||end>offset+length) {
+            break;
+        }
+        if (!decodeLevel(data+(start-offset),(size_t)(end-start))) {
+            mValid=false;
+            break;
+        }
+        ++mLevelsDecoded;
+    }
+    return mValid;
+}
+
+bool ProgressiveMesh::decodeLevel(const unsigned char*data, size_t length) {
+    // Everything is read into new lists first, so a malformed chunk leaves the last level intact.
+    const Level&level=mLevels[mLevelsDecoded];
+    Reader reader(data,length);
+    uint32 numNew=(uint32)reader.get(4);
+    if (mVertices.size()+numNew!=level.mVertexCount||!reader.has((size_t)numNew*VERTEX_SIZE)) {
+        return false;
+    }
+    std::vector<Vertex> added(numNew);
+    for (uint32 i=0;i<numNew;++i) {
+        Vertex&vert=added[i];
+        vert.mPosition=reader.getVector();
+        vert.mNormal=reader.getVector();
+        vert.mU=reader.getFloat();
+        vert.mV=reader.getFloat();
+    }
+    std::vector<std::vector<uint32> > indices(mSubMeshes.size());
+    size_t numTriangles=0;
+    for (size_t sub=0;sub<mSubMeshes.size();++sub) {
+        const std::vector<uint32>&have=mSubMeshes[sub].mIndices;
+        std::vector<uint32>&next=indices[sub];
+        size_t numHave=have.size()/3;
+        uint32 numRemoved=(uint32)reader.get(4);
+        if (numRemoved>numHave||!reader.has((size_t)numRemoved*4)) {
+            return false;
+        }
+        // Removed triangles come in increasing order, so the rest are copied in one pass.
+        next.reserve((numHave-numRemoved)*3);
+        size_t kept=0;
+        for (uint32 i=0;i<=numRemoved;++i) {
+            uint64 removed=i<numRemoved?reader.get(4):numHave;
+            if (removed<kept||removed>numHave||(removed==numHave&&i<numRemoved)) {
+                return false;
+            }
+            next.insert(next.end(),have.begin()+kept*3,have.begin()+(size_t)removed*3);
+            kept=(size_t)removed+1;
+        }
+        uint32 numAdded=(uint32)reader.get(4);
+        if (!reader.has((size_t)numAdded*12)) {
+            return false;
+        }
+        next.reserve(next.size()+(size_t)numAdded*3);
+        for (uint32 i=0;i<numAdded*3;++i) {
+            uint32 index=(uint32)reader.get(4);
+            if (index>=level.mVertexCount) {
+                return false;
+            }
+            next.push_back(index);
+        }
+        numTriangles+=next.size()/3;
+    }
+    if (!reader.atEnd()||numTriangles!=level.mTriangleCount) {
+        return false;
+    }
+    mVertices.insert(mVertices.end(),added.begin(),added.end());
+    for (size_t sub=0;sub<mSubMeshes.size();++sub) {
+        mSubMeshes[sub].mIndices.swap(indices[sub]);
+    }
+    return true;
+}
+
+unsigned int ProgressiveMesh::levelForScreenSize(float screenSize, float tolerance) const {
+    for (size_t i=0;i+1<mLevels.size();++i) {
+        // The error seen from a distance d is mError/d, and screenSize is mRadius/d.
+        if (mLevels[i].mError*screenSize<=tolerance*mRadius) {
+            return (unsigned int)i;
+        }
+    }
+    return mLevels.empty()?0:(unsigned int)(mLevels.size()-1);
+}
+
+}
@@ -0,0 +1,165 @@
+/*  Sirikata Utilities -- Math Library
+ *  ProgressiveMesh.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_PROGRESSIVE_MESH_HPP_
+#define _SIRIKATA_PROGRESSIVE_MESH_HPP_
+
+#include "Vector3.hpp"
+
+namespace Sirikata {
+
+/**
+ * Container for a triangle mesh stored as a coarse base level followed by refinement chunks,
+ * so that any prefix of the file ending on a level boundary is a complete, coarser mesh.
+ * The header lists every level with the byte offset where it ends, which lets a downloader
+ * ask for exactly the Range the wanted level needs and append the rest later.
+ *
+ * Levels are built by clustering vertices on nested grids, each half the cell size of the one
+ * before, with the finest level being the original mesh.  Every vertex of a level is also in
+ * the next one, so a refinement only carries the vertices it adds and the triangles it
+ * removes from and adds to each submesh.  All numbers are stored little endian.
+ */
+class SIRIKATA_EXPORT ProgressiveMesh {
+public:
+    struct Vertex {
+        Vector3f mPosition;
+        Vector3f mNormal;
+        float mU;
+        float mV;
+    };
+    struct SubMesh {
+        String mMaterial;
+        /// triangle list into the shared vertices
+        std::vector<uint32> mIndices;
+    };
+    struct Level {
+        /// byte offset in the file just past this level's chunk
+        uint64 mEnd;
+        uint32 mVertexCount;
+        uint32 mTriangleCount;
+        /// size of the grid cells vertices were clustered on, 0 for the original mesh
+        float mError;
+    };
+    enum {
+        VERSION=1,
+        /// magic, version and header length: enough to tell how much header to fetch
+        PREAMBLE_SIZE=16,
+        VERTEX_SIZE=32,
+        /// the coarsest level clusters vertices on 2^COARSEST_GRID_SHIFT cells along the longest side
+        COARSEST_GRID_SHIFT=2
+    };
+    static const char MAGIC[8];
+
+    /**
+     * Writes mesh as a progressive mesh of at most maxLevels levels to output.
+     * Triangles that are degenerate or repeated are dropped, even from the finest level.
+     */
+    static void encode(const std::vector<Vertex>&vertices, const std::vector<SubMesh>&subMeshes,
+                       unsigned int maxLevels, std::string&output);
+    /**
+     * Tells the length of the whole header from the first PREAMBLE_SIZE bytes of a file.
+     * \returns 0 if the data is too short or is not a progressive mesh
+     */
+    static size_t headerLength(const unsigned char*data, size_t length);
+
+    ProgressiveMesh();
+    /**
+     * Reads the header from the start of a file, forgetting any levels decoded earlier.
+     * Submesh materials are known after this, their triangles only once levels are decoded.
+     * \returns false if the data is shorter than headerLength() or malformed
+     */
+    bool parseHeader(const unsigned char*data, size_t length);
+    /**
+     * Decodes the levels after levelsDecoded() that lie wholly inside data, which holds the
+     * file's bytes starting at offset.  Stops at the first level not wholly present.
+     * \returns false if a chunk is malformed, after which no more levels are decoded
+     */
+    bool refine(const unsigned char*data, uint64 offset, size_t length);
+
+    /**
+     * Picks the coarsest level whose error seen at an angular size of screenSize (the
+     * bounding radius over the distance) is no bigger than tolerance, in radians.
+     */
+    unsigned int levelForScreenSize(float screenSize, float tolerance) const;
+
+    size_t numLevels() const {
+        return mLevels.size();
+    }
+    const Level&level(size_t which) const {
+        return mLevels[which];
+    }
+    /// Byte offset where level which starts; the first level starts right after the header.
+    uint64 levelStart(size_t which) const {
+        return which?mLevels[which-1].mEnd:mHeaderLength;
+    }
+    uint64 headerLength() const {
+        return mHeaderLength;
+    }
+    /// Number of levels applied so far, so the current mesh is level levelsDecoded()-1.
+    size_t levelsDecoded() const {
+        return mLevelsDecoded;
+    }
+    bool isValid() const {
+        return mValid;
+    }
+    /// Distance of the furthest vertex from the origin.
+    float radius() const {
+        return mRadius;
+    }
+    const Vector3f&boundsMin() const {
+        return mBoundsMin;
+    }
+    const Vector3f&boundsMax() const {
+        return mBoundsMax;
+    }
+    const std::vector<Vertex>&vertices() const {
+        return mVertices;
+    }
+    const std::vector<SubMesh>&subMeshes() const {
+        return mSubMeshes;
+    }
+private:
+    bool decodeLevel(const unsigned char*data, size_t length);
+
+    std::vector<Level> mLevels;
+    std::vector<Vertex> mVertices;
+    std::vector<SubMesh> mSubMeshes;
+    uint64 mHeaderLength;
+    size_t mLevelsDecoded;
+    bool mValid;
+    float mRadius;
+    Vector3f mBoundsMin;
+    Vector3f mBoundsMax;
+};
+
+}
+
+#endif
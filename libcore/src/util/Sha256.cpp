@@ -104,6 +104,13 @@ SHA256 SHA256::computeDigest(const std::string&data) {
     return retval;
 }
 
+bool SHA256::setAccelerated(bool enable) {
+    return SHA256_SetAccelerated(enable?1:0)!=0;
+}
+bool SHA256::isAccelerated() {
+    return SHA256_IsAccelerated()!=0;
+}
+
 SHA256Context::SHA256Context() {
     mCtx = new SHA256_CTX;
     SHA256_Init((SHA256_CTX*)mCtx);
@@ -138,6 +145,13 @@ const SHA256& SHA256Context::get() {
     return mRetval;
 }
 
+void SHA256Context::reset() {
+    if (!mCtx) {
+        mCtx = new SHA256_CTX;
+    }
+    SHA256_Init((SHA256_CTX*)mCtx);
+}
+
 SHA256Context::~SHA256Context() {
 	if (mCtx) {
         SHA256_CTX * context = (SHA256_CTX *)mCtx;
@@ -149,13 +149,27 @@ public:
         return empty;
     }
 
+    /**
+     * Chooses whether digests use the processor's SHA instructions when it has
+     * them.  They are used by default; turning them off is mostly for benchmarks.
+     * \returns whether the accelerated implementation is now in use
+     */
+    static bool setAccelerated(bool enable);
+    /**
+     * \returns whether digests are computed with the processor's SHA instructions
+     */
+    static bool isAccelerated();
+
     friend inline std::ostream &operator <<(std::ostream &os, const SHA256&shasum) {
     	return os << shasum.convertToHexString();
     }
 
 };
 
-/** Class to allow creating a shasum from sparse data and other types. */
+/** Class to allow creating a shasum from sparse data and other types.
+ * Data may be fed in as it arrives, so hashing a download or a file read
+ * overlaps with the I/O instead of taking a second pass over the data.
+ */
 class SIRIKATA_EXPORT SHA256Context {
 	/// Do not allow copying because no function exists to copy SHA256_CTX
 	SHA256Context(const SHA256Context &other);
@@ -185,6 +199,12 @@ public:
 
 	/// Returns a SHA256 sum from the updated data. Cannot update after this.
 	const SHA256& get();
+	/// Returns true if the data hashes to expected. Cannot update after this.
+	inline bool matches(const SHA256 &expected) {
+		return get() == expected;
+	}
+	/// Starts over with no data, even after get().
+	void reset();
 };
 
 }
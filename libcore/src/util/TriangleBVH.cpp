@@ -0,0 +1,315 @@
+/*  Sirikata Utilities -- Math Library
+ *  TriangleBVH.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TriangleBVH.hpp"
+#include <limits>
+
+namespace Sirikata {
+
+/// A triangle's bounds and centroid while the tree is built; mIndex is its place in the input.
+struct TriangleBVH::BuildTriangle {
+    float mMin[3];
+    float mMax[3];
+    float mCentroid[3];
+    uint32 mIndex;
+};
+
+namespace {
+/// Axis aligned box accumulated from points or other boxes, empty until something is added.
+class Bounds {
+public:
+    float mMin[3];
+    float mMax[3];
+    Bounds() {
+        for (int i=0;i<3;++i) {
+            mMin[i]=std::numeric_limits<float>::max();
+            mMax[i]=-std::numeric_limits<float>::max();
+        }
+    }
+    void add(const float*bmin, const float*bmax) {
+        for (int i=0;i<3;++i) {
+            if (bmin[i]<mMin[i]) mMin[i]=bmin[i];
+            if (bmax[i]>mMax[i]) mMax[i]=bmax[i];
+        }
+    }
+    void add(const float*point) {
+        add(point,point);
+    }
+    bool empty() const {
+        return mMin[0]>mMax[0];
+    }
+    /// Half the surface area, which is all the heuristic needs.
+    float halfArea() const {
+        if (empty()) return 0;
+        float dx=mMax[0]-mMin[0],dy=mMax[1]-mMin[1],dz=mMax[2]-mMin[2];
+        return dx*dy+dy*dz+dz*dx;
+    }
+};
+
+class CentroidLess {
+    int mAxis;
+public:
+    CentroidLess(int axis):mAxis(axis){}
+    template <class T> bool operator()(const T&a, const T&b) const {
+        return a.mCentroid[mAxis]<b.mCentroid[mAxis];
+    }
+};
+
+/// Maps a centroid to one of the heuristic's bins along an axis.
+class CentroidBin {
+    int mAxis;
+    float mMin;
+    float mScale;
+public:
+    CentroidBin(int axis, float cmin, float cmax, int numBins)
+        : mAxis(axis), mMin(cmin), mScale(numBins*(1-1.0e-5f)/(cmax-cmin)) {}
+    int operator()(const float*centroid) const {
+        return (int)((centroid[mAxis]-mMin)*mScale);
+    }
+    template <class T> bool operator()(const T&tri, int splitBin) const {
+        return (*this)(tri.mCentroid)<splitBin;
+    }
+};
+
+class LeftOfSplit {
+    const CentroidBin &mBin;
+    int mSplit;
+public:
+    LeftOfSplit(const CentroidBin&bin, int split):mBin(bin),mSplit(split){}
+    template <class T> bool operator()(const T&tri) const {
+        return mBin(tri,mSplit);
+    }
+};
+}
+
+TriangleBVH::TriangleBVH() {
+}
+
+size_t TriangleBVH::memoryUsage() const {
+    return mNodes.size()*sizeof(Node)+mTriangles.size()*sizeof(Triangle);
+}
+
+void TriangleBVH::build(std::vector<Triangle>&triangles) {
+    mNodes.clear();
+    mTriangles.clear();
+    std::vector<BuildTriangle> build(triangles.size());
+    for (size_t i=0;i<triangles.size();++i) {
+        const Triangle&tri=triangles[i];
+        BuildTriangle&bt=build[i];
+        for (int axis=0;axis<3;++axis) {
+            float a=tri.mV1[axis],b=tri.mV2[axis],c=tri.mV3[axis];
+            bt.mMin[axis]=std::min(a,std::min(b,c));
+            bt.mMax[axis]=std::max(a,std::max(b,c));
+            bt.mCentroid[axis]=(bt.mMin[axis]+bt.mMax[axis])*0.5f;
+        }
+        bt.mIndex=(uint32)i;
+    }
+    if (!build.empty()) {
+        mNodes.reserve(2*build.size()/MAX_LEAF_TRIANGLES+1);
+        buildNode(build,0,build.size(),0);
+    }
+    mTriangles.resize(build.size());
+    for (size_t i=0;i<build.size();++i) {
+        mTriangles[i]=triangles[build[i].mIndex];
+    }
+    std::vector<Triangle>().swap(triangles);
+}
+
+uint32 TriangleBVH::buildNode(std::vector<BuildTriangle>&build, size_t begin, size_t end, unsigned int depth) {
+    uint32 nodeIndex=(uint32)mNodes.size();
+    mNodes.push_back(Node());
+    Bounds bounds,centroids;
+    for (size_t i=begin;i<end;++i) {
+        bounds.add(build[i].mMin,build[i].mMax);
+        centroids.add(build[i].mCentroid);
+    }
+    for (int axis=0;axis<3;++axis) {
+        mNodes[nodeIndex].mMin[axis]=bounds.mMin[axis];
+        mNodes[nodeIndex].mMax[axis]=bounds.mMax[axis];
+    }
+    size_t count=end-begin;
+    if (count<=MAX_LEAF_TRIANGLES||depth+1>=MAX_DEPTH) {
+        mNodes[nodeIndex].mIndex=(uint32)begin;
+        mNodes[nodeIndex].mCount=(uint32)count;
+        mNodes[nodeIndex].mAxis=0;
+        return nodeIndex;
+    }
+
+    // Bin the centroids along every axis and pick the split with the lowest surface area cost.
+    int bestAxis=-1,bestSplit=0;
+    float bestCost=std::numeric_limits<float>::max();
+    for (int axis=0;axis<3;++axis) {
+        if (!(centroids.mMax[axis]>centroids.mMin[axis]))
+            continue;
+        CentroidBin bin(axis,centroids.mMin[axis],centroids.mMax[axis],NUM_SAH_BINS);
+        Bounds binBounds[NUM_SAH_BINS];
+        size_t binCount[NUM_SAH_BINS]={0};
+        for (size_t i=begin;i<end;++i) {
+            int which=bin(build[i].mCentroid);
+            binBounds[which].add(build[i].mMin,build[i].mMax);
+            ++binCount[which];
+        }
+        float rightArea[NUM_SAH_BINS];
+        size_t rightCount[NUM_SAH_BINS];
+        Bounds right;
+        size_t numRight=0;
+        for (int split=NUM_SAH_BINS-1;split>0;--split) {
+            right.add(binBounds[split].mMin,binBounds[split].mMax);
+            numRight+=binCount[split];
+            rightArea[split]=right.halfArea();
+            rightCount[split]=numRight;
+        }
+        Bounds left;
+        size_t numLeft=0;
+        for (int split=1;split<NUM_SAH_BINS;++split) {
+            left.add(binBounds[split-1].mMin,binBounds[split-1].mMax);
+            numLeft+=binCount[split-1];
+            if (numLeft==0||rightCount[split]==0)
+                continue;
+            float cost=left.halfArea()*numLeft+rightArea[split]*rightCount[split];
+            if (cost<bestCost) {
+                bestCost=cost;
+                bestAxis=axis;
+                bestSplit=split;
+            }
+        }
+    }
+    // Compare against testing every triangle here, charging one triangle test per box visited.
+    float leafCost=bounds.halfArea()*count;
+    if (count<=4*MAX_LEAF_TRIANGLES&&(bestAxis<0||bounds.halfArea()+bestCost>=leafCost)) {
+        mNodes[nodeIndex].mIndex=(uint32)begin;
+        mNodes[nodeIndex].mCount=(uint32)count;
+        mNodes[nodeIndex].mAxis=0;
+        return nodeIndex;
+    }
+    size_t mid;
+    if (bestAxis>=0) {
+        CentroidBin bin(bestAxis,centroids.mMin[bestAxis],centroids.mMax[bestAxis],NUM_SAH_BINS);
+        mid=std::partition(build.begin()+begin,build.begin()+end,LeftOfSplit(bin,bestSplit))-build.begin();
+    }else {
+        // Every centroid is in the same place: any split is as good as another.
+        bestAxis=0;
+        mid=begin+count/2;
+    }
+    if (mid==begin||mid==end) {
+        mid=begin+count/2;
+        std::nth_element(build.begin()+begin,build.begin()+mid,build.begin()+end,CentroidLess(bestAxis));
+    }
+    mNodes[nodeIndex].mCount=0;
+    mNodes[nodeIndex].mAxis=bestAxis;
+    buildNode(build,begin,mid,depth+1);
+    uint32 second=buildNode(build,mid,end,depth+1);
+    mNodes[nodeIndex].mIndex=second;
+    return nodeIndex;
+}
+
+bool TriangleBVH::intersectTriangle(const Triangle&triangle, const Vector3f&origin, const Vector3f&direction, float&distance) {
+    Vector3f edge1(triangle.mV2-triangle.mV1);
+    Vector3f edge2(triangle.mV3-triangle.mV1);
+    Vector3f p(direction.cross(edge2));
+    // det is -direction.dot(normal()), so it is positive only when the ray meets the front
+    float det=edge1.dot(p);
+    if (det<=std::numeric_limits<float>::epsilon())
+        return false;
+    float invDet=1.0f/det;
+    Vector3f s(origin-triangle.mV1);
+    float u=s.dot(p)*invDet;
+    if (u<0||u>1)
+        return false;
+    Vector3f q(s.cross(edge1));
+    float v=direction.dot(q)*invDet;
+    if (v<0||u+v>1)
+        return false;
+    float t=edge2.dot(q)*invDet;
+    if (t<0)
+        return false;
+    distance=t;
+    return true;
+}
+
+bool TriangleBVH::intersect(const Vector3f&origin, const Vector3f&direction, float maxDistance, Hit&hit) const {
+    if (mNodes.empty())
+        return false;
+    float invDir[3];
+    bool negative[3];
+    for (int axis=0;axis<3;++axis) {
+        invDir[axis]=1.0f/direction[axis];
+        negative[axis]=invDir[axis]<0;
+    }
+    const float orig[3]={origin.x,origin.y,origin.z};
+    float best=maxDistance;
+    bool found=false;
+    uint32 stack[MAX_DEPTH];
+    unsigned int stackSize=0;
+    uint32 nodeIndex=0;
+    while (true) {
+        const Node&node=mNodes[nodeIndex];
+        // Slab test; NaNs from a ray lying in a slab's plane leave the interval untouched.
+        float tmin=0,tmax=best;
+        for (int axis=0;axis<3;++axis) {
+            float t0=(node.mMin[axis]-orig[axis])*invDir[axis];
+            float t1=(node.mMax[axis]-orig[axis])*invDir[axis];
+            if (negative[axis]) std::swap(t0,t1);
+            if (t0>tmin) tmin=t0;
+            if (t1<tmax) tmax=t1;
+        }
+        if (tmin<=tmax) {
+            if (node.mCount) {
+                for (uint32 i=node.mIndex,ie=node.mIndex+node.mCount;i<ie;++i) {
+                    float distance;
+                    if (intersectTriangle(mTriangles[i],origin,direction,distance)&&distance<=best) {
+                        best=distance;
+                        hit.mDistance=distance;
+                        hit.mTriangle=i;
+                        found=true;
+                    }
+                }
+            }else {
+                // Visit the child nearer the origin first so later boxes are cut by its hits.
+                if (negative[node.mAxis]) {
+                    stack[stackSize++]=nodeIndex+1;
+                    nodeIndex=node.mIndex;
+                }else {
+                    stack[stackSize++]=node.mIndex;
+                    nodeIndex=nodeIndex+1;
+                }
+                continue;
+            }
+        }
+        if (stackSize==0)
+            break;
+        nodeIndex=stack[--stackSize];
+    }
+    return found;
+}
+
+}
@@ -0,0 +1,116 @@
+/*  Sirikata Utilities -- Math Library
+ *  TriangleBVH.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_TRIANGLE_BVH_HPP_
+#define _SIRIKATA_TRIANGLE_BVH_HPP_
+
+#include "Vector3.hpp"
+
+namespace Sirikata {
+
+/**
+ * Bounding volume hierarchy over a triangle soup, for casting rays against large meshes.
+ * The tree is built once with binned surface area heuristic splits and stored as a flat,
+ * depth first array of nodes, so every later ray only visits the boxes it passes through.
+ * It only deals in Vector3f, so graphics plugins convert their meshes into it.
+ */
+class SIRIKATA_EXPORT TriangleBVH {
+public:
+    struct Triangle {
+        Vector3f mV1;
+        Vector3f mV2;
+        Vector3f mV3;
+        Triangle() {}
+        Triangle(const Vector3f&v1, const Vector3f&v2, const Vector3f&v3):mV1(v1),mV2(v2),mV3(v3) {}
+        /// (v2-v1)x(v3-v1), not normalized: rays only hit the side it points to
+        Vector3f normal() const {
+            return (mV2-mV1).cross(mV3-mV1);
+        }
+    };
+    struct Hit {
+        /// distance along the ray, in multiples of its direction
+        float mDistance;
+        /// index of the triangle in triangles()
+        uint32 mTriangle;
+    };
+    enum {
+        MAX_LEAF_TRIANGLES=4,
+        NUM_SAH_BINS=16,
+        /// deepest level of the tree, which bounds the traversal stack
+        MAX_DEPTH=64
+    };
+
+    TriangleBVH();
+    /**
+     * Builds the tree, replacing any earlier one. The triangles are taken from the vector,
+     * which is left empty, and kept in the order the leaves need.
+     */
+    void build(std::vector<Triangle>&triangles);
+    /**
+     * Finds the nearest triangle hit by the ray origin+t*direction with 0<=t<=maxDistance.
+     * As with Ogre::Math::intersects on the positive side only, a triangle is only hit from
+     * the side its normal() points to.
+     * \returns false if nothing was hit, in which case hit is left alone
+     */
+    bool intersect(const Vector3f&origin, const Vector3f&direction, float maxDistance, Hit&hit) const;
+    /// Tests a single triangle with the same rules as intersect, setting distance on a hit.
+    static bool intersectTriangle(const Triangle&triangle, const Vector3f&origin, const Vector3f&direction, float&distance);
+
+    const std::vector<Triangle>&triangles() const {
+        return mTriangles;
+    }
+    size_t numNodes() const {
+        return mNodes.size();
+    }
+    /// Bytes used by the triangles and the tree.
+    size_t memoryUsage() const;
+private:
+    /**
+     * Leaves hold mCount triangles starting at mIndex. Interior nodes have mCount 0,
+     * their first child directly after them and their second child at mIndex.
+     */
+    struct Node {
+        float mMin[3];
+        float mMax[3];
+        uint32 mIndex;
+        uint32 mCount:30;
+        uint32 mAxis:2;
+    };
+    struct BuildTriangle;
+    uint32 buildNode(std::vector<BuildTriangle>&build, size_t begin, size_t end, unsigned int depth);
+
+    std::vector<Node> mNodes;
+    std::vector<Triangle> mTriangles;
+};
+
+}
+
+#endif
@@ -35,6 +35,19 @@
 #include <string.h>	/* memcpy()/memset() or bcopy()/bzero() */
 #include <assert.h>	/* assert() */
 #include "internal_sha2.hpp"
+
+/*
+ * The SHA-256 block function is chosen at run time: x86 processors with
+ * the SHA extensions use them, everything else uses the C transform.
+ * GCC only allows SHA intrinsics in a single function via the target
+ * attribute from 4.9 on.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__)) \
+ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SHA2_X86_SHA_EXTENSIONS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 namespace Sirikata {
 namespace Util {
 namespace Internal{
@@ -519,6 +532,128 @@ void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+/*** SHA-256 Block Dispatch: ******************************************/
+typedef void (*SHA256_BlocksFunction)(SHA256_CTX*, const sha2_byte*, size_t);
+
+static void SHA256_TransformBlocks(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	while (blocks--) {
+		SHA256_Transform(context, (const sha2_word32*)data);
+		data += SHA256_BLOCK_LENGTH;
+	}
+}
+
+#ifdef SHA2_X86_SHA_EXTENSIONS
+static int SHA256_HasSHAExtensions(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, 0) < 7) {
+		return 0;
+	}
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & bit_SSE4_1)) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1 << 29)) != 0; /* SHA */
+}
+
+/*
+ * The SHA extensions keep the state as ABEF/CDGH halves and do two rounds
+ * per sha256rnds2; each group of four rounds consumes one 128-bit word of
+ * the message schedule, which sha256msg1/sha256msg2 extend in place.
+ */
+#define SHA256_SHA_ROUNDS4(m,j)	\
+	msg = _mm_add_epi32((m), _mm_loadu_si128((const __m128i*)&K256[4 * (j)])); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+	msg = _mm_shuffle_epi32(msg, 0x0E); \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, msg)
+
+/* Extends the schedule: m0 = W[j..j+3] from the previous sixteen words. */
+#define SHA256_SHA_SCHEDULE(m0,m1,m2,m3)	\
+	(m0) = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32((m0), (m1)), \
+					          _mm_alignr_epi8((m3), (m2), 4)), (m3))
+
+__attribute__((target("sha,sse4.1")))
+static void SHA256_TransformBlocksSHA(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	const __m128i	byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i		state0, state1, tmp, msg, abef, cdgh, m0, m1, m2, m3;
+	int		j;
+
+	tmp = _mm_loadu_si128((const __m128i*)&context->state[0]);
+	state1 = _mm_loadu_si128((const __m128i*)&context->state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);		/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1B);	/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);	/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);	/* CDGH */
+
+	while (blocks--) {
+		abef = state0;
+		cdgh = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data)), byteswap);
+		SHA256_SHA_ROUNDS4(m0, 0);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), byteswap);
+		SHA256_SHA_ROUNDS4(m1, 1);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), byteswap);
+		SHA256_SHA_ROUNDS4(m2, 2);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), byteswap);
+		SHA256_SHA_ROUNDS4(m3, 3);
+		for (j = 4; j < 16; j += 4) {
+			SHA256_SHA_SCHEDULE(m0, m1, m2, m3);
+			SHA256_SHA_ROUNDS4(m0, j);
+			SHA256_SHA_SCHEDULE(m1, m2, m3, m0);
+			SHA256_SHA_ROUNDS4(m1, j + 1);
+			SHA256_SHA_SCHEDULE(m2, m3, m0, m1);
+			SHA256_SHA_ROUNDS4(m2, j + 2);
+			SHA256_SHA_SCHEDULE(m3, m0, m1, m2);
+			SHA256_SHA_ROUNDS4(m3, j + 3);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		data += SHA256_BLOCK_LENGTH;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);		/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xB1);	/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);	/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);	/* HGFE */
+	_mm_storeu_si128((__m128i*)&context->state[0], state0);
+	_mm_storeu_si128((__m128i*)&context->state[4], state1);
+}
+#endif /* SHA2_X86_SHA_EXTENSIONS */
+
+/*
+ * Selected on first use.  Racing threads all pick the same function, so
+ * no lock is needed.
+ */
+static SHA256_BlocksFunction sha256_selected = 0;
+
+static void sha256_blocks(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	if (sha256_selected == 0) {
+		SHA256_SetAccelerated(1);
+	}
+	sha256_selected(context, data, blocks);
+}
+
+int SHA256_SetAccelerated(int enable) {
+#ifdef SHA2_X86_SHA_EXTENSIONS
+	if (enable && SHA256_HasSHAExtensions()) {
+		sha256_selected = SHA256_TransformBlocksSHA;
+		return 1;
+	}
+#endif
+	sha256_selected = SHA256_TransformBlocks;
+	return 0;
+}
+
+int SHA256_IsAccelerated(void) {
+	if (sha256_selected == 0) {
+		SHA256_SetAccelerated(1);
+	}
+	return sha256_selected != SHA256_TransformBlocks;
+}
+
 void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
 
@@ -541,7 +676,7 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			SHA256_Transform(context, (sha2_word32*)context->buffer);
+			sha256_blocks(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -551,12 +686,13 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			return;
 		}
 	}
-	while (len >= SHA256_BLOCK_LENGTH) {
+	if (len >= SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		SHA256_Transform(context, (sha2_word32*)data);
-		context->bitcount += SHA256_BLOCK_LENGTH << 3;
-		len -= SHA256_BLOCK_LENGTH;
-		data += SHA256_BLOCK_LENGTH;
+		size_t blocks = len / SHA256_BLOCK_LENGTH;
+		sha256_blocks(context, data, blocks);
+		context->bitcount += (sha2_word64)blocks * SHA256_BLOCK_LENGTH << 3;
+		len -= blocks * SHA256_BLOCK_LENGTH;
+		data += blocks * SHA256_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -593,7 +729,7 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				SHA256_Transform(context, (sha2_word32*)context->buffer);
+				sha256_blocks(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, SHA256_SHORT_BLOCK_LENGTH);
@@ -609,7 +745,7 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 		*(sha2_word64*)&context->buffer[SHA256_SHORT_BLOCK_LENGTH] = context->bitcount;
 
 		/* Final transform: */
-		SHA256_Transform(context, (sha2_word32*)context->buffer);
+		sha256_blocks(context, context->buffer, 1);
 
 #if SIRIKATA_BYTE_ORDER == SIRIKATA_LITTLE_ENDIAN
 		{
@@ -411,6 +411,23 @@ public:
 		waitFor(3);
 	}
 
+	void testCachedDataStaysLocal( void ) {
+		Transfer::RemoteFileId cachedUri (SHA256::computeDigest("cached"), URI(URIContext(), SERVER_URI));
+		Transfer::RemoteFileId exampleComUri (SHA256::convertFromHex(EXAMPLE_HASH), URI(URIContext(), SERVER_URI));
+		CacheLayer *http = createTransferLayer();
+		CacheLayer *memory = createMemoryCache(http);
+		using std::tr1::placeholders::_1;
+		memory->purgeFromCache(exampleComUri.fingerprint());
+		memory->addToCache(cachedUri.fingerprint(), Transfer::DenseDataPtr(new Transfer::DenseData(std::string("cached"))));
+		memory->getCachedData(cachedUri, Transfer::Range(true),
+				std::tr1::bind(&CacheLayerTestSuite::simpleCallback, this, _1));
+		// a miss is answered right away instead of waiting on the server
+		memory->getCachedData(exampleComUri, Transfer::Range(true),
+				std::tr1::bind(&CacheLayerTestSuite::checkNullCallback, this, _1));
+		TS_ASSERT_EQUALS(finishedTest, 2);
+		waitFor(2);
+	}
+
 };
 
 using namespace Sirikata;
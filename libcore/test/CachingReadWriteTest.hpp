@@ -0,0 +1,243 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CachingReadWriteTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <oh/CachingReadWriteHandler.hpp>
+#include <util/ThreadSafeQueue.hpp>
+#include <util/KnownServices.hpp>
+#include <task/WorkQueue.hpp>
+#include "Test_Persistence.pbj.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata;
+
+/**
+ * Sets many small properties through a write-behind cache in front of a backend that counts the writes
+ * reaching it, as scripts calling setProperty do, and checks that every last value arrives.
+ */
+class CachingReadWriteTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_OBJECTS=16,
+        NUM_FIELDS=4,
+        NUM_UPDATES=10000,
+        UPDATES_PER_TICK=1000
+    };
+    typedef std::map<std::pair<UUID,String>,String> ValueMap;
+    /// What reached the backend; it outlives the backend, which the cache deletes.
+    struct Store {
+        ValueMap mValues;
+        uint64 mWrites;
+        int mFailFlushes; ///< number of flushes still to be refused
+        bool mHoldReads; ///< never answer reads
+        Store():mWrites(0),mFailFlushes(0),mHoldReads(false) {}
+    };
+    /// Answers from within processMessage, as a backend on the caller's thread does.
+    class Backend : public Persistence::ReadWriteHandler {
+        Store *mStore;
+        std::vector<MessageService*> mListeners;
+    public:
+        Backend(Store *store):mStore(store) {}
+        void destroyResponse(Persistence::Protocol::Response *res) {
+            delete res;
+        }
+        bool forwardMessagesTo(MessageService *ms) {
+            mListeners.push_back(ms);
+            return true;
+        }
+        bool endForwardingMessagesTo(MessageService *ms) {
+            std::vector<MessageService*>::iterator where=std::find(mListeners.begin(),mListeners.end(),ms);
+            if (where==mListeners.end())
+                return false;
+            mListeners.erase(where);
+            return true;
+        }
+        void processMessage(const RoutableMessageHeader &hdr, MemoryReference body) {
+            Persistence::Protocol::ReadWriteSet rws;
+            rws.ParseFromArray(body.data(),body.size());
+            Persistence::Protocol::Response response;
+            if (rws.writes_size() && mStore->mFailFlushes>0) {
+                --mStore->mFailFlushes;
+                response.set_return_status(Persistence::Protocol::Response::DATABASE_LOCKED);
+            } else {
+                if (rws.reads_size() && mStore->mHoldReads)
+                    return;
+                for (int i=0;i<rws.writes_size();++i) {
+                    std::pair<UUID,String> key(rws.writes(i).object_uuid(),rws.writes(i).field_name());
+                    if (rws.writes(i).has_data())
+                        mStore->mValues[key]=rws.writes(i).data();
+                    else
+                        mStore->mValues.erase(key);
+                    ++mStore->mWrites;
+                }
+                for (int i=0;i<rws.reads_size();++i) {
+                    response.add_reads();
+                    ValueMap::iterator where=mStore->mValues.find(std::pair<UUID,String>(rws.reads(i).object_uuid(),rws.reads(i).field_name()));
+                    if (where==mStore->mValues.end())
+                        response.mutable_reads(i).set_return_status(Persistence::Protocol::StorageElement::KEY_MISSING);
+                    else
+                        response.mutable_reads(i).set_data(where->second);
+                }
+            }
+            std::string reply;
+            response.SerializeToString(&reply);
+            RoutableMessageHeader replyHeader(hdr);
+            replyHeader.set_reply_id(hdr.id());
+            replyHeader.swap_source_and_destination();
+            for (std::vector<MessageService*>::iterator i=mListeners.begin(),ie=mListeners.end(); i!=ie; ++i) {
+                (*i)->processMessage(replyHeader,MemoryReference(reply));
+            }
+        }
+    protected:
+        void applyInternal(Persistence::Protocol::ReadWriteSet *rws, const ResultCallback &cb, void (*destroy)(Persistence::Protocol::ReadWriteSet*)) {
+            TS_FAIL("the cache should only send messages to its backend");
+            (*destroy)(rws);
+        }
+        void applyInternal(const RoutableMessageHeader &hdr, Persistence::Protocol::ReadWriteSet *rws, void (*destroy)(Persistence::Protocol::ReadWriteSet*)) {
+            TS_FAIL("the cache should only send messages to its backend");
+            (*destroy)(rws);
+        }
+    };
+    /// Counts the replies the cache sends back to the object host.
+    class Replies : public MessageService {
+    public:
+        int mReceived;
+        int mFailed;
+        Replies():mReceived(0),mFailed(0) {}
+        bool forwardMessagesTo(MessageService*) {
+            return false;
+        }
+        bool endForwardingMessagesTo(MessageService*) {
+            return false;
+        }
+        void processMessage(const RoutableMessageHeader&, MemoryReference body) {
+            Persistence::Protocol::Response response;
+            response.ParseFromArray(body.data(),body.size());
+            ++mReceived;
+            if (response.has_return_status())
+                ++mFailed;
+        }
+    };
+    Store mStore;
+    Replies mReplies;
+    Task::ThreadSafeWorkQueue mReplyQueue;
+    std::vector<UUID> mObjects;
+    ValueMap mExpected;
+
+    Persistence::CachingReadWriteHandler *makeCache() {
+        Persistence::CachingReadWriteHandler *cache=new Persistence::CachingReadWriteHandler(new Backend(&mStore),
+                                                                                             &mReplyQueue,
+                                                                                             Duration::seconds(0),
+                                                                                             NUM_OBJECTS*NUM_FIELDS*2,
+                                                                                             NUM_OBJECTS*NUM_FIELDS+1);
+        cache->forwardMessagesTo(&mReplies);
+        return cache;
+    }
+    void send(Persistence::CachingReadWriteHandler *cache, const Persistence::Protocol::ReadWriteSet &rws) {
+        static int64 sId=1;
+        std::string body;
+        rws.SerializeToString(&body);
+        RoutableMessageHeader hdr;
+        hdr.set_id(sId++);
+        hdr.set_destination_port(Services::PERSISTENCE);
+        cache->processMessage(hdr,MemoryReference(body));
+    }
+    /// Sets one field of one object per message, ticking the cache every UPDATES_PER_TICK of them.
+    void setProperties(Persistence::CachingReadWriteHandler *cache) {
+        for (uint32 i=0;i<NUM_UPDATES;++i) {
+            Persistence::Protocol::ReadWriteSet rws;
+            rws.add_writes();
+            rws.mutable_writes(0).set_object_uuid(mObjects[(i*7)%NUM_OBJECTS]);
+            rws.mutable_writes(0).set_field_name("field"+std::string(1,(char)('a'+(i/NUM_OBJECTS)%NUM_FIELDS)));
+            std::ostringstream value;
+            value<<i;
+            rws.mutable_writes(0).set_data(value.str());
+            mExpected[std::pair<UUID,String>(rws.writes(0).object_uuid(),rws.writes(0).field_name())]=value.str();
+            send(cache,rws);
+            if (i%UPDATES_PER_TICK==UPDATES_PER_TICK-1)
+                cache->tick();
+        }
+        while (mReplyQueue.dequeuePoll()) {
+        }
+    }
+public:
+    CachingReadWriteTest() {
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            mObjects.push_back(UUID::random());
+        }
+    }
+    void setUp() {
+        mStore=Store();
+        mReplies.mReceived=mReplies.mFailed=0;
+        mExpected.clear();
+    }
+    void testWriteAmplification() {
+        Persistence::CachingReadWriteHandler *cache=makeCache();
+        setProperties(cache);
+        uint64 received=cache->getWritesReceived();
+        delete cache;
+        TS_ASSERT_EQUALS(mReplies.mReceived,(int)NUM_UPDATES);
+        TS_ASSERT_EQUALS(mReplies.mFailed,0);
+        TS_ASSERT_EQUALS(received,(uint64)NUM_UPDATES);
+        TS_ASSERT(mStore.mValues==mExpected);
+        // the dirty limit is never reached, so each tick and the shutdown flush send at most one write per field
+        TS_ASSERT_LESS_THAN_EQUALS(mStore.mWrites,(uint64)(NUM_UPDATES/UPDATES_PER_TICK+1)*NUM_OBJECTS*NUM_FIELDS);
+        if (mStore.mWrites) {
+            std::cout<<std::endl<<"Write-behind cache: "<<received<<" property writes reached the backend as "
+                     <<mStore.mWrites<<", "<<(double)received/mStore.mWrites<<"x fewer"<<std::endl;
+        }
+    }
+    void testFailedFlushIsRetried() {
+        mStore.mFailFlushes=5;
+        Persistence::CachingReadWriteHandler *cache=makeCache();
+        setProperties(cache);
+        delete cache;
+        TS_ASSERT_EQUALS(mStore.mFailFlushes,0);
+        TS_ASSERT(mStore.mValues==mExpected);
+    }
+    void testShutdownFailsWaitingReads() {
+        mStore.mHoldReads=true;
+        Persistence::CachingReadWriteHandler *cache=makeCache();
+        Persistence::Protocol::ReadWriteSet rws;
+        rws.add_reads();
+        rws.mutable_reads(0).set_object_uuid(mObjects[0]);
+        rws.mutable_reads(0).set_field_name("fielda");
+        send(cache,rws);
+        while (mReplyQueue.dequeuePoll()) {
+        }
+        TS_ASSERT_EQUALS(mReplies.mReceived,0);
+        delete cache;
+        while (mReplyQueue.dequeuePoll()) {
+        }
+        TS_ASSERT_EQUALS(mReplies.mReceived,1);
+        TS_ASSERT_EQUALS(mReplies.mFailed,1);
+    }
+};
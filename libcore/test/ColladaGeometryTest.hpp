@@ -0,0 +1,190 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ColladaGeometryTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/ColladaGeometry.hpp"
+#include "task/Time.hpp"
+#include <sstream>
+using namespace Sirikata;
+
+class ColladaGeometryTest : public CxxTest::TestSuite
+{
+    typedef ProgressiveMesh::Vertex Vertex;
+    typedef ProgressiveMesh::SubMesh SubMesh;
+    std::vector<Vertex> mVertices;
+    std::vector<SubMesh> mSubMeshes;
+
+    bool read(const std::string&document) {
+        mVertices.clear();
+        mSubMeshes.clear();
+        return ColladaGeometry::read(document.data(),document.length(),mVertices,mSubMeshes);
+    }
+    static std::string wrap(const std::string&asset, const std::string&mesh) {
+        return "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+            "<COLLADA xmlns=\"http://www.collada.org/2005/11/COLLADASchema\" version=\"1.4.1\">\n"
+            "<asset>"+asset+"</asset>\n"
+            "<library_visual_scenes><visual_scene id=\"scene\"><node><instance_geometry url=\"#quad\"/></node></visual_scene></library_visual_scenes>\n"
+            "<library_geometries><geometry id=\"quad\"><mesh>\n"+mesh+"</mesh></geometry></library_geometries>\n"
+            "</COLLADA>\n";
+    }
+    static const char*quadSources() {
+        return "<source id=\"pos\"><float_array id=\"pos-array\" count=\"12\">0 0 0  1 0 0  1 1 0  0 1 0</float_array>"
+            "<technique_common><accessor source=\"#pos-array\" count=\"4\" stride=\"3\"><param name=\"X\" type=\"float\"/></accessor></technique_common></source>\n"
+            "<source id=\"uv\"><float_array id=\"uv-array\" count=\"8\">0 0 1 0 1 1 0 1</float_array>"
+            "<technique_common><accessor source=\"#uv-array\" count=\"4\" stride=\"2\"/></technique_common></source>\n"
+            "<vertices id=\"verts\"><input semantic=\"POSITION\" source=\"#pos\"/></vertices>\n";
+    }
+    /// Grid of size*size quads with normals and texture coordinates, as triangles.
+    static std::string makeGrid(int size) {
+        std::ostringstream mesh;
+        int side=size+1;
+        mesh << "<source id=\"pos\"><float_array id=\"pos-array\" count=\"" << side*side*3 << "\">";
+        for (int y=0;y<side;++y) {
+            for (int x=0;x<side;++x) {
+                mesh << x*0.25f << ' ' << y*0.25f << ' ' << ((x*7+y*3)%5)*0.1f << ' ';
+            }
+        }
+        mesh << "</float_array><technique_common><accessor source=\"#pos-array\" count=\"" << side*side << "\" stride=\"3\"/></technique_common></source>\n"
+             << "<source id=\"norm\"><float_array id=\"norm-array\" count=\"3\">0 0 1</float_array>"
+             << "<technique_common><accessor source=\"#norm-array\" count=\"1\" stride=\"3\"/></technique_common></source>\n"
+             << "<source id=\"uv\"><float_array id=\"uv-array\" count=\"" << side*side*2 << "\">";
+        for (int y=0;y<side;++y) {
+            for (int x=0;x<side;++x) {
+                mesh << float(x)/size << ' ' << float(y)/size << ' ';
+            }
+        }
+        mesh << "</float_array><technique_common><accessor source=\"#uv-array\" count=\"" << side*side << "\" stride=\"2\"/></technique_common></source>\n"
+             << "<vertices id=\"verts\"><input semantic=\"POSITION\" source=\"#pos\"/></vertices>\n"
+             << "<triangles material=\"ground\" count=\"" << size*size*2 << "\">"
+             << "<input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/>"
+             << "<input semantic=\"NORMAL\" source=\"#norm\" offset=\"1\"/>"
+             << "<input semantic=\"TEXCOORD\" source=\"#uv\" offset=\"2\" set=\"0\"/><p>";
+        for (int y=0;y<size;++y) {
+            for (int x=0;x<size;++x) {
+                int a=y*side+x,b=a+side;
+                int corners[6]={a,a+1,b,a+1,b+1,b};
+                for (int i=0;i<6;++i) {
+                    mesh << corners[i] << " 0 " << corners[i] << ' ';
+                }
+            }
+        }
+        mesh << "</p></triangles>\n";
+        return wrap("<unit meter=\"1\"/><up_axis>Y_UP</up_axis>",mesh.str());
+    }
+public:
+    void testTriangles( void ) {
+        std::string mesh=std::string(quadSources())+
+            "<!-- two triangles sharing an edge -->\n"
+            "<triangles material=\"brick\" count=\"2\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/>"
+            "<input semantic=\"TEXCOORD\" source=\"#uv\" offset=\"1\" set=\"0\"/><p>0 0 1 1 2 2  0 0 2 2 3 3</p></triangles>\n";
+        TS_ASSERT(read(wrap("<up_axis>Y_UP</up_axis>",mesh)));
+        TS_ASSERT_EQUALS(mVertices.size(),4u);
+        TS_ASSERT_EQUALS(mSubMeshes.size(),1u);
+        TS_ASSERT_EQUALS(mSubMeshes[0].mMaterial,"brick");
+        TS_ASSERT_EQUALS(mSubMeshes[0].mIndices.size(),6u);
+        TS_ASSERT_EQUALS(mVertices[2].mPosition,Vector3f(1,1,0));
+        TS_ASSERT_EQUALS(mVertices[2].mU,1.0f);
+        TS_ASSERT_EQUALS(mVertices[2].mV,0.0f);
+        TS_ASSERT_EQUALS(mVertices[3].mV,0.0f);
+        TS_ASSERT_EQUALS(mVertices[0].mV,1.0f);
+        // The quad faces +z, so the computed normals do too.
+        for (size_t i=0;i<mVertices.size();++i) {
+            TS_ASSERT_DELTA(mVertices[i].mNormal.z,1.0f,1.0e-5f);
+        }
+    }
+    void testPolylistUnitsAndUpAxis( void ) {
+        std::string mesh=std::string(quadSources())+
+            "<polylist material=\"floor\" count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/>"
+            "<vcount>4</vcount><p>0 1 2 3</p></polylist>\n"
+            "<lines count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/><p>0 2</p></lines>\n";
+        TS_ASSERT(read(wrap("<unit name=\"centimeter\" meter=\"0.01\"/><up_axis>Z_UP</up_axis>",mesh)));
+        TS_ASSERT_EQUALS(mVertices.size(),4u);
+        TS_ASSERT_EQUALS(mSubMeshes.size(),1u);
+        TS_ASSERT_EQUALS(mSubMeshes[0].mIndices.size(),6u);
+        // (1,1,0) in centimeters with Z up is (0.01,0,-0.01) in meters with Y up.
+        TS_ASSERT_DELTA(mVertices[2].mPosition.x,0.01f,1.0e-6f);
+        TS_ASSERT_DELTA(mVertices[2].mPosition.y,0.0f,1.0e-6f);
+        TS_ASSERT_DELTA(mVertices[2].mPosition.z,-0.01f,1.0e-6f);
+        TS_ASSERT_DELTA(mVertices[0].mNormal.y,1.0f,1.0e-5f);
+    }
+    void testPolygonsAndMaterials( void ) {
+        std::string mesh=std::string(quadSources())+
+            "<polygons material=\"a\" count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/><p>0 1 2 3</p></polygons>\n"
+            "<triangles material=\"b\" count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/><p>0 1 2</p></triangles>\n"
+            "<triangles material=\"a\" count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/><p>0 2 3</p></triangles>\n";
+        TS_ASSERT(read(wrap("",mesh)));
+        TS_ASSERT_EQUALS(mSubMeshes.size(),2u);
+        TS_ASSERT_EQUALS(mSubMeshes[0].mMaterial,"a");
+        TS_ASSERT_EQUALS(mSubMeshes[0].mIndices.size(),9u);
+        TS_ASSERT_EQUALS(mSubMeshes[1].mMaterial,"b");
+        TS_ASSERT_EQUALS(mSubMeshes[1].mIndices.size(),3u);
+        TS_ASSERT_EQUALS(mVertices.size(),4u);
+    }
+    void testMalformed( void ) {
+        TS_ASSERT(!read("<html><body>not a model</body></html>"));
+        std::string outOfRange=std::string(quadSources())+
+            "<triangles count=\"1\"><input semantic=\"VERTEX\" source=\"#verts\" offset=\"0\"/><p>0 1 4</p></triangles>\n";
+        TS_ASSERT(!read(wrap("",outOfRange)));
+        std::string document=wrap("",std::string(quadSources()));
+        TS_ASSERT(!read(document.substr(0,document.length()/2)));
+        TS_ASSERT(read(document));
+        TS_ASSERT(mVertices.empty());
+    }
+    /// Loads a big grid from XML as a cold load would, then from the cached binary mesh.
+    void testColdWarmBenchmark( void ) {
+        const int SIZE=200;
+        std::string document=makeGrid(SIZE);
+
+        Task::LocalTime start=Task::LocalTime::now();
+        TS_ASSERT(read(document));
+        std::string blob;
+        ProgressiveMesh::encode(mVertices,mSubMeshes,1,blob);
+        double coldSeconds=(Task::LocalTime::now()-start).toSeconds();
+        TS_ASSERT_EQUALS(mVertices.size(),size_t((SIZE+1)*(SIZE+1)));
+        TS_ASSERT_EQUALS(mSubMeshes.size(),1u);
+        TS_ASSERT_EQUALS(mSubMeshes[0].mIndices.size(),size_t(SIZE*SIZE*6));
+
+        start=Task::LocalTime::now();
+        ProgressiveMesh mesh;
+        const unsigned char*data=(const unsigned char*)blob.data();
+        TS_ASSERT(mesh.parseHeader(data,blob.length()));
+        TS_ASSERT(mesh.refine(data,0,blob.length()));
+        double warmSeconds=(Task::LocalTime::now()-start).toSeconds();
+        TS_ASSERT_EQUALS(mesh.levelsDecoded(),1u);
+        TS_ASSERT_EQUALS(mesh.vertices().size(),mVertices.size());
+        TS_ASSERT_EQUALS(mesh.subMeshes()[0].mIndices.size(),mSubMeshes[0].mIndices.size());
+
+        std::cout << "Grid of " << SIZE*SIZE*2 << " triangles: cold load from " << document.length()
+                  << " bytes of XML took " << coldSeconds*1000 << " ms, warm load from a "
+                  << blob.length() << " byte binary mesh took " << warmSeconds*1000 << " ms" << std::endl;
+    }
+};
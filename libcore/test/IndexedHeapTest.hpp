@@ -0,0 +1,127 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  IndexedHeapTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/IndexedHeap.hpp"
+using namespace Sirikata;
+
+class IndexedHeapTest : public CxxTest::TestSuite
+{
+    uint32 mSeed;
+    uint32 random(uint32 range) {
+        mSeed=mSeed*1664525+1013904223;
+        return (mSeed>>8)%range;
+    }
+public:
+    void setUp() {
+        mSeed=12345;
+    }
+    void testOrder() {
+        IndexedHeap<int> heap;
+        heap.update(1,3.0f);
+        heap.update(2,7.0f);
+        heap.update(3,5.0f);
+        TS_ASSERT_EQUALS(heap.size(),3u);
+        TS_ASSERT_EQUALS(heap.top(),2);
+        heap.pop();
+        TS_ASSERT_EQUALS(heap.top(),3);
+        heap.pop();
+        TS_ASSERT_EQUALS(heap.top(),1);
+        heap.pop();
+        TS_ASSERT(heap.empty());
+    }
+    void testMinHeap() {
+        IndexedHeap<int,float,std::greater<float> > heap;
+        heap.update(1,3.0f);
+        heap.update(2,7.0f);
+        heap.update(3,5.0f);
+        TS_ASSERT_EQUALS(heap.top(),1);
+        TS_ASSERT_EQUALS(heap.topPriority(),3.0f);
+    }
+    void testUpdateAndErase() {
+        IndexedHeap<int> heap;
+        for (int i=0;i<10;++i)
+            heap.update(i,(float)i);
+        TS_ASSERT_EQUALS(heap.top(),9);
+        heap.update(0,100.0f);
+        TS_ASSERT_EQUALS(heap.top(),0);
+        TS_ASSERT_EQUALS(heap.size(),10u);
+        heap.update(0,-1.0f);
+        TS_ASSERT_EQUALS(heap.top(),9);
+        TS_ASSERT(heap.erase(9));
+        TS_ASSERT(!heap.erase(9));
+        TS_ASSERT(!heap.contains(9));
+        TS_ASSERT_EQUALS(heap.top(),8);
+        TS_ASSERT_EQUALS(heap.priority(0),-1.0f);
+        heap.clear();
+        TS_ASSERT(heap.empty());
+        TS_ASSERT(!heap.contains(0));
+    }
+    void testRandomAgainstMap() {
+        IndexedHeap<uint32,uint32> heap;
+        std::map<uint32,uint32> reference;
+        for (int op=0;op<20000;++op) {
+            uint32 item=random(200);
+            switch (random(4)) {
+              case 0:
+              case 1:
+                {
+                    uint32 priority=random(1000)*256+item;
+                    heap.update(item,priority);
+                    reference[item]=priority;
+                }
+                break;
+              case 2:
+                TS_ASSERT_EQUALS(heap.erase(item),reference.erase(item)==1);
+                break;
+              case 3:
+                if (!reference.empty()) {
+                    std::map<uint32,uint32>::iterator best=reference.begin();
+                    for (std::map<uint32,uint32>::iterator i=reference.begin();i!=reference.end();++i)
+                        if (i->second>best->second)
+                            best=i;
+                    TS_ASSERT_EQUALS(heap.top(),best->first);
+                    TS_ASSERT_EQUALS(heap.topPriority(),best->second);
+                    heap.pop();
+                    reference.erase(best);
+                }
+                break;
+            }
+            TS_ASSERT_EQUALS(heap.size(),reference.size());
+        }
+        uint32 last=~(uint32)0;
+        while (!heap.empty()) {
+            TS_ASSERT(heap.topPriority()<=last);
+            last=heap.topPriority();
+            heap.pop();
+        }
+    }
+};
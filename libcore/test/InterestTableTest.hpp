@@ -0,0 +1,133 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  InterestTableTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <oh/InterestTable.hpp>
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata;
+
+/**
+ * Polls proxies circling at distances from 5 to 500 meters as HostedObject does, with continuous polling and
+ * with interest policies of growing full-rate size, extrapolating each from its last velocity in between.
+ * Reports the updates and bytes received, the time spent and the error the viewer sees, as radius over distance.
+ */
+class InterestTableTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_PROXIES=500,
+        SIMULATED_SECONDS=20,
+        FRAMES_PER_SECOND=60,
+        FULL_UPDATE_BYTES=64,
+        POSITION_UPDATE_BYTES=40
+    };
+    struct Result {
+        uint64 mUpdates;
+        uint64 mBytes;
+        float64 mMeanVisibleError;
+        float64 mMaxVisibleError;
+        Duration mElapsed;
+    };
+    static Vector3d orbit(float64 distance, float64 phase, float64 seconds, Vector3f*velocity) {
+        const float64 radius=4.0, speed=0.5;
+        float64 angle=speed*seconds+phase;
+        *velocity=Vector3f((float)(-radius*speed*sin(angle)),(float)(radius*speed*cos(angle)),0);
+        return Vector3d(distance+radius*cos(angle),radius*sin(angle),0);
+    }
+    static Location makeLocation(const Vector3d&position, const Vector3f&velocity) {
+        return Location(position,Quaternion::identity(),velocity,Vector3f(0,0,1),0);
+    }
+    static Result simulate(float64 fullRateSize) {
+        const float64 proxyRadius=1.0, roundTrip=0.05;
+        InterestTable table(SpaceID(UUID::random()));
+        table.setPolicy(fullRateSize,Duration::seconds(.1),Duration::seconds(2.0));
+        Location viewer=makeLocation(Vector3d(0,0,0),Vector3f(0,0,0));
+        std::vector<Location> received(NUM_PROXIES);
+        std::vector<float64> receivedAt(NUM_PROXIES,0), nextPoll(NUM_PROXIES,0);
+        float64 errorSum=0, errorMax=0;
+        Result result;
+        result.mBytes=0;
+        Task::LocalTime start=Task::LocalTime::now();
+        for (int frame=0;frame<SIMULATED_SECONDS*FRAMES_PER_SECOND;++frame) {
+            float64 now=(float64)frame/FRAMES_PER_SECOND;
+            for (int i=0;i<NUM_PROXIES;++i) {
+                float64 distance=5.0*pow(100.0,(float64)i/(NUM_PROXIES-1));
+                Vector3f velocity;
+                Vector3d truth=orbit(distance,i*0.7,now,&velocity);
+                if (now>=nextPoll[i]) {
+                    Location actual=makeLocation(truth,velocity);
+                    float64 error=frame?(received[i].extrapolate(Duration::seconds(now-receivedAt[i])).getPosition()-truth).length()/truth.length():0;
+                    uint32 fields;
+                    Duration wait=table.updateInterval(viewer,actual,proxyRadius,&fields);
+                    size_t bytes=fields?POSITION_UPDATE_BYTES:FULL_UPDATE_BYTES;
+                    table.recordUpdate(error,bytes);
+                    result.mBytes+=bytes;
+                    received[i]=actual;
+                    receivedAt[i]=now;
+                    nextPoll[i]=now+roundTrip+wait.toSeconds();
+                }
+                float64 visible=(received[i].extrapolate(Duration::seconds(now-receivedAt[i])).getPosition()-truth).length()/truth.length();
+                errorSum+=visible;
+                if (visible>errorMax)
+                    errorMax=visible;
+            }
+        }
+        result.mElapsed=Task::LocalTime::now()-start;
+        result.mUpdates=table.getUpdatesReceived();
+        result.mMeanVisibleError=errorSum/(SIMULATED_SECONDS*FRAMES_PER_SECOND*NUM_PROXIES);
+        result.mMaxVisibleError=errorMax;
+        return result;
+    }
+    static void report(const char*name, const Result&result) {
+        std::cout<<name<<": "<<result.mUpdates<<" updates, "<<result.mBytes<<" bytes, "
+                 <<result.mElapsed.toSeconds()*1000.0<<"ms, visible error mean "<<result.mMeanVisibleError
+                 <<" max "<<result.mMaxVisibleError<<std::endl;
+    }
+public:
+    void testUpdateRateVersusError() {
+        Result continuous=simulate(0);
+        Result near=simulate(.02);
+        Result paced=simulate(.05);
+        Result far=simulate(.1);
+        std::cout<<std::endl;
+        report("Continuous polling",continuous);
+        report("Full rate size .02",near);
+        report("Full rate size .05",paced);
+        report("Full rate size .1",far);
+        TS_ASSERT_LESS_THAN(near.mUpdates,continuous.mUpdates);
+        TS_ASSERT_LESS_THAN(paced.mUpdates,near.mUpdates);
+        TS_ASSERT_LESS_THAN(far.mUpdates,paced.mUpdates);
+        // the default policy should halve the traffic while keeping the extrapolated proxies within a milliradian
+        TS_ASSERT_LESS_THAN(paced.mBytes,continuous.mBytes/2);
+        TS_ASSERT_LESS_THAN(paced.mMeanVisibleError,.001);
+        TS_ASSERT_LESS_THAN(paced.mMaxVisibleError,.01);
+    }
+};
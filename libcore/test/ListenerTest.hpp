@@ -31,6 +31,7 @@
  */
 #include <cxxtest/TestSuite.h>
 #include "util/ListenerProvider.hpp"
+#include "task/Time.hpp"
 
 class ListenerTestClass {
 public:
@@ -65,7 +66,7 @@ public:
     void tearDown( void )
     {
     }
-    template <typename T> class TestCallAddRemove :public Sirikata::Provider<T>{
+    template <typename T, template<typename> class ProviderT=Sirikata::Provider> class TestCallAddRemove :public ProviderT<T>{
         int callCount;
     public:
         TestCallAddRemove() {
@@ -116,6 +117,110 @@ public:
         std::tr1::shared_ptr<ListenerTestClass> a(new Test),b(new ListenerTestClass),c(new Test),d(new Test);
         TestCallAddRemove<std::tr1::shared_ptr<ListenerTestClass> >().test(a,b,c,d);        
     }
+    void testSlotListenerCallAddRemove( void ) {
+        ListenerTestClass* a=new Test;
+        ListenerTestClass* b=new ListenerTestClass;
+        ListenerTestClass* c=new Test;
+        ListenerTestClass* d=new ListenerTestClass;
+        TestCallAddRemove<ListenerTestClass*,Sirikata::SlotProvider>().test(a,b,c,d);
+        delete a;delete b;delete c;delete d;
+    }
+    void testSharedSlotListenerCallAddRemove( void ) {
+        std::tr1::shared_ptr<ListenerTestClass> a(new Test),b(new ListenerTestClass),c(new Test),d(new Test);
+        TestCallAddRemove<std::tr1::shared_ptr<ListenerTestClass>,Sirikata::SlotProvider>().test(a,b,c,d);
+    }
+    class SlotTestProvider:public Sirikata::SlotProvider<ListenerTestClass*> {
+    public:
+        using Sirikata::SlotProvider<ListenerTestClass*>::notify;
+        template <typename Iterator, typename Functor> static void notifyAll(Iterator begin, Iterator end, Functor&f) {
+            notifyEach(begin,end,f);
+        }
+    };
+    ///removes another listener, and then itself, from the provider the first time it is notified
+    class RemovingListener :public ListenerTestClass{
+    public:
+        SlotTestProvider*mProvider;
+        ListenerTestClass*mVictim;
+        RemovingListener(SlotTestProvider*provider,ListenerTestClass*victim):mProvider(provider),mVictim(victim){}
+        virtual void notify(int i) {
+            total*=i;
+            if (mVictim) {
+                mProvider->removeListener(mVictim);
+                mProvider->removeListener(this);
+                mVictim=NULL;
+            }
+        }
+    };
+    void testSlotRemoveDuringNotify( void ) {
+        SlotTestProvider provider;
+        ListenerTestClass a,b,c;
+        RemovingListener remover(&provider,&c);
+        provider.addListener(&a);
+        provider.addListener(&remover);
+        provider.addListener(&b);
+        provider.addListener(&c);
+        provider.notify(&ListenerTestClass::notify,2);
+        provider.notify(&ListenerTestClass::notify,3);
+        TS_ASSERT_EQUALS(a.total,6);
+        TS_ASSERT_EQUALS(remover.total,2);
+        TS_ASSERT_EQUALS(b.total,6);
+        TS_ASSERT_EQUALS(c.total,1);
+        provider.removeListener(&a);
+        provider.addListener(&c);
+        provider.notify(&ListenerTestClass::notify,5);
+        TS_ASSERT_EQUALS(a.total,6);
+        TS_ASSERT_EQUALS(b.total,30);
+        TS_ASSERT_EQUALS(c.total,5);
+    }
+    struct AddToTotal {
+        int mAmount;
+        void operator()(const SlotTestProvider&, ListenerTestClass*listener) {
+            listener->total+=mAmount;
+        }
+    };
+    void testSlotNotifyEach( void ) {
+        SlotTestProvider providers[3];
+        ListenerTestClass a,b;
+        providers[0].addListener(&a);
+        providers[1].addListener(&a);
+        providers[1].addListener(&b);
+        std::vector<SlotTestProvider*> batch;
+        for (int i=0;i<3;++i)
+            batch.push_back(&providers[i]);
+        AddToTotal add={3};
+        SlotTestProvider::notifyAll(batch.begin(),batch.end(),add);
+        TS_ASSERT_EQUALS(a.total,7);
+        TS_ASSERT_EQUALS(b.total,4);
+    }
+    class BenchProvider:public Sirikata::Provider<ListenerTestClass*> {
+    public:
+        using Sirikata::Provider<ListenerTestClass*>::notify;
+    };
+    template <class ProviderT> double timeNotifications(ProviderT&provider, int count) {
+        Sirikata::Task::LocalTime start=Sirikata::Task::LocalTime::now();
+        for (int i=0;i<count;++i) {
+            provider.notify(&ListenerTestClass::notify0);
+        }
+        return (Sirikata::Task::LocalTime::now()-start).toSeconds();
+    }
+    void testNotifyBenchmark( void ) {
+        const int NUM_NOTIFICATIONS=100000;
+        ListenerTestClass a,b,c,d;
+        BenchProvider provider;
+        SlotTestProvider slotProvider;
+        provider.addListener(&a);
+        provider.addListener(&b);
+        slotProvider.addListener(&c);
+        slotProvider.addListener(&d);
+        double providerSeconds=timeNotifications(provider,NUM_NOTIFICATIONS);
+        double slotSeconds=timeNotifications(slotProvider,NUM_NOTIFICATIONS);
+        std::cout<<std::endl<<NUM_NOTIFICATIONS<<" notifications: Provider "<<providerSeconds
+                 <<"s, SlotProvider "<<slotSeconds<<"s"<<std::endl;
+        TS_ASSERT_EQUALS(a.total,NUM_NOTIFICATIONS+1);
+        TS_ASSERT_EQUALS(b.total,NUM_NOTIFICATIONS+1);
+        TS_ASSERT_EQUALS(c.total,NUM_NOTIFICATIONS+1);
+        TS_ASSERT_EQUALS(d.total,NUM_NOTIFICATIONS+1);
+    }
     void testStatelessListenerCallAddRemove( void ) {
         Test * a=(new Test),*b=(new Test),*c=(new Test),*d=(new Test);
         
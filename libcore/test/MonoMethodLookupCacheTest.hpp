@@ -0,0 +1,92 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  MonoMethodLookupCacheTest.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../liboh/plugins/monoscript/MonoMethodLookupCache.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/bind.hpp>
+
+/**
+ * Checks the per-thread polymorphic cache the C# script call sites use.  The cache only compares
+ * class and method pointers, so the tests use stand-in addresses and need no Mono runtime.
+ */
+class MonoMethodLookupCacheTest : public CxxTest::TestSuite
+{
+    enum { NUM_ENTRIES=Mono::ThreadLocalMethodLookupCache::NUM_ENTRIES };
+    char mClasses[NUM_ENTRIES+2];
+    char mMethods[NUM_ENTRIES+2];
+
+    MonoClass *klass(int i) {
+        return reinterpret_cast<MonoClass*>(&mClasses[i]);
+    }
+    MonoMethod *method(int i) {
+        return reinterpret_cast<MonoMethod*>(&mMethods[i]);
+    }
+    static void lookupFromThread(Mono::ThreadLocalMethodLookupCache *cache, MonoClass *dest, MonoMethod **result) {
+        *result=cache->lookup(dest,"Message",NULL,0);
+    }
+public:
+    void testHitAfterUpdate() {
+        Mono::ThreadLocalMethodLookupCache cache;
+        TS_ASSERT(cache.lookup(klass(0),"Message",NULL,0)==NULL);
+        for (int i=0;i<NUM_ENTRIES;++i) {
+            cache.update(klass(i),"Message",NULL,0,method(i));
+        }
+        // every receiver type seen at the site stays cached until the site sees more types than it has entries
+        for (int i=0;i<NUM_ENTRIES;++i) {
+            TS_ASSERT_EQUALS(cache.lookup(klass(i),"Message",NULL,0),method(i));
+        }
+        TS_ASSERT(cache.lookup(klass(NUM_ENTRIES),"Message",NULL,0)==NULL);
+    }
+    void testEvictsOldestEntry() {
+        Mono::ThreadLocalMethodLookupCache cache;
+        for (int i=0;i<NUM_ENTRIES+1;++i) {
+            cache.update(klass(i),"Message",NULL,0,method(i));
+        }
+        TS_ASSERT(cache.lookup(klass(0),"Message",NULL,0)==NULL);
+        for (int i=1;i<NUM_ENTRIES+1;++i) {
+            TS_ASSERT_EQUALS(cache.lookup(klass(i),"Message",NULL,0),method(i));
+        }
+        cache.update(klass(NUM_ENTRIES+1),"Message",NULL,0,method(NUM_ENTRIES+1));
+        TS_ASSERT(cache.lookup(klass(1),"Message",NULL,0)==NULL);
+        TS_ASSERT_EQUALS(cache.lookup(klass(2),"Message",NULL,0),method(2));
+        TS_ASSERT_EQUALS(cache.lookup(klass(NUM_ENTRIES+1),"Message",NULL,0),method(NUM_ENTRIES+1));
+    }
+    void testEntriesArePerThread() {
+        Mono::ThreadLocalMethodLookupCache cache;
+        cache.update(klass(0),"Message",NULL,0,method(0));
+        MonoMethod *otherThread=method(1);
+        boost::thread other(boost::bind(&MonoMethodLookupCacheTest::lookupFromThread,&cache,klass(0),&otherThread));
+        other.join();
+        TS_ASSERT(otherThread==NULL);
+        TS_ASSERT_EQUALS(cache.lookup(klass(0),"Message",NULL,0),method(0));
+    }
+};
@@ -0,0 +1,133 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ObjectHostMailboxTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <oh/ObjectHost.hpp>
+#include <oh/HostedObject.hpp>
+#include <oh/SpaceIDMap.hpp>
+#include <oh/DeadReckoningTable.hpp>
+#include <network/IOServiceFactory.hpp>
+#include <util/ThreadSafeQueue.hpp>
+#include <task/WorkQueue.hpp>
+#include <util/AtomicTypes.hpp>
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+
+/**
+ * Routes messages to hosted objects from several threads at once while other threads tick the ObjectHost,
+ * create dead reckoning tables for new spaces and create and destroy hosted objects,
+ * as happens once setMailboxThreads hands the mailboxes to worker threads.
+ */
+class ObjectHostMailboxTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_OBJECTS=64,
+        NUM_ROUTERS=4,
+        NUM_MAILBOX_THREADS=4,
+        MESSAGES_PER_ROUTER=5000
+    };
+    ObjectHost*mObjectHost;
+    Task::ThreadSafeWorkQueue*mMessageQueue;
+    std::vector<HostedObjectPtr> mObjects;
+    AtomicValue<int> mDone;
+    AtomicValue<int> mTicks;
+
+    /// Sends a message nobody handles to a random object, then runs whatever is routable. The envelopes deliver from this thread.
+    void route(uint32 seed) {
+        String body("mailbox");
+        for (uint32 i=0;i<MESSAGES_PER_ROUTER;++i) {
+            RoutableMessageHeader header;
+            header.set_source_object(ObjectReference(UUID::random()));
+            header.set_destination_object(ObjectReference(mObjects[(seed+i*7)%mObjects.size()]->getUUID()));
+            header.set_destination_port(54321);
+            mObjectHost->processMessage(header,MemoryReference(body));
+            mMessageQueue->dequeuePoll();
+        }
+        while (mMessageQueue->dequeuePoll()) {
+        }
+    }
+    void tick() {
+        while (!mDone.read()) {
+            mObjectHost->tick();
+            ++mTicks;
+        }
+    }
+    /// Adds spaces and objects that come and go while the others run; dropping an object destroys it on this thread.
+    void churn() {
+        while (!mDone.read()) {
+            mObjectHost->getDeadReckoningTable(SpaceID(UUID::random()));
+            HostedObjectPtr transient=HostedObject::construct<HostedObject>(mObjectHost,UUID::random());
+            mObjectHost->registerHostedObject(transient);
+            mObjectHost->unregisterHostedObject(transient->getUUID());
+        }
+    }
+public:
+    ObjectHostMailboxTest():mDone(0),mTicks(0) {
+    }
+    void testDeliverWhileTicking() {
+        SpaceIDMap spaceMap;
+        Network::IOService*io=Network::IOServiceFactory::makeIOService();
+        mMessageQueue=new Task::ThreadSafeWorkQueue;
+        mObjectHost=new ObjectHost(&spaceMap,mMessageQueue,io);
+        mObjectHost->setMailboxThreads(NUM_MAILBOX_THREADS);
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            mObjects.push_back(HostedObject::construct<HostedObject>(mObjectHost,UUID::random()));
+            mObjectHost->registerHostedObject(mObjects.back());
+        }
+        boost::thread ticker(std::tr1::bind(&ObjectHostMailboxTest::tick,this));
+        boost::thread churner(std::tr1::bind(&ObjectHostMailboxTest::churn,this));
+        std::vector<boost::thread*> routers;
+        for (int i=0;i<NUM_ROUTERS;++i) {
+            routers.push_back(new boost::thread(std::tr1::bind(&ObjectHostMailboxTest::route,this,(uint32)i)));
+        }
+        for (int i=0;i<NUM_ROUTERS;++i) {
+            routers[i]->join();
+            delete routers[i];
+        }
+        mDone=1;
+        ticker.join();
+        churner.join();
+        // finishes the drains still queued, then handles the error replies they sent
+        mObjectHost->setMailboxThreads(0);
+        while (mMessageQueue->dequeuePoll()) {
+        }
+        TS_ASSERT(mTicks.read()>0);
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            TS_ASSERT_EQUALS(mObjectHost->getHostedObject(mObjects[i]->getUUID()),mObjects[i]);
+        }
+        mObjects.clear();
+        delete mObjectHost;
+        delete mMessageQueue;
+        Network::IOServiceFactory::destroyIOService(io);
+    }
+};
@@ -0,0 +1,158 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ObjectScriptScalingTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <oh/ObjectHost.hpp>
+#include <oh/HostedObject.hpp>
+#include <oh/SpaceIDMap.hpp>
+#include <oh/ObjectScript.hpp>
+#include <oh/ObjectScriptManager.hpp>
+#include <oh/ObjectScriptManagerFactory.hpp>
+#include <network/IOServiceFactory.hpp>
+#include <util/ThreadSafeQueue.hpp>
+#include <task/WorkQueue.hpp>
+#include <util/AtomicTypes.hpp>
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+
+/**
+ * Sends messages to many scripted objects and times how long their scripts take to handle them all
+ * with the ObjectHost running scripts on the main thread and on growing numbers of mailbox threads.
+ * The scripts stand in for C# ones, which need a Mono runtime the tests do not load.
+ */
+class ObjectScriptScalingTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_OBJECTS=256,
+        MESSAGES_PER_OBJECT=40,
+        WORK_PER_MESSAGE=50000
+    };
+    /// Spends a fixed amount of work on state of its own for every message, as a script's handler would.
+    class BusyScript : public ObjectScript {
+        AtomicValue<int> *mHandled;
+        uint32 mState;
+    public:
+        BusyScript(AtomicValue<int> *handled, uint32 seed):mHandled(handled),mState(seed) {}
+        void tick() {}
+        bool processRPC(const RoutableMessageHeader&, const std::string&, MemoryReference, MemoryBuffer&) {
+            return false;
+        }
+        bool forwardMessagesTo(MessageService*) {
+            return false;
+        }
+        bool endForwardingMessagesTo(MessageService*) {
+            return false;
+        }
+        void processMessage(const RoutableMessageHeader&, MemoryReference) {
+            for (int i=0;i<WORK_PER_MESSAGE;++i) {
+                mState=mState*1664525u+1013904223u;
+            }
+            ++*mHandled;
+        }
+    };
+    class BusyScriptManager : public ObjectScriptManager {
+    public:
+        AtomicValue<int> mHandled;
+        BusyScriptManager():mHandled(0) {}
+        ObjectScript *createObjectScript(HostedObject *ho, const Arguments&) {
+            return new BusyScript(&mHandled,(uint32)ho->getUUID().hash());
+        }
+        void destroyObjectScript(ObjectScript *toDestroy) {
+            delete toDestroy;
+        }
+    };
+    static BusyScriptManager sManager;
+    static ObjectScriptManager *getManager(const String&) {
+        return &sManager;
+    }
+
+    /// Returns how long the scripts took to handle every message with the given number of mailbox threads.
+    static Duration run(uint32 mailboxThreads) {
+        SpaceIDMap spaceMap;
+        Network::IOService *io=Network::IOServiceFactory::makeIOService();
+        Task::ThreadSafeWorkQueue *messageQueue=new Task::ThreadSafeWorkQueue;
+        ObjectHost *objectHost=new ObjectHost(&spaceMap,messageQueue,io);
+        objectHost->setMailboxThreads(mailboxThreads);
+        std::vector<HostedObjectPtr> objects;
+        for (int i=0;i<NUM_OBJECTS;++i) {
+            objects.push_back(HostedObject::construct<HostedObject>(objectHost,UUID::random()));
+            objects.back()->initializeScript("scalingbench",ObjectScriptManager::Arguments());
+        }
+        sManager.mHandled=0;
+        String body("work");
+        Task::LocalTime start=Task::LocalTime::now();
+        for (int m=0;m<MESSAGES_PER_OBJECT;++m) {
+            for (int i=0;i<NUM_OBJECTS;++i) {
+                RoutableMessageHeader header;
+                header.set_source_object(ObjectReference(objects[(i+1)%NUM_OBJECTS]->getUUID()));
+                header.set_destination_object(ObjectReference(objects[i]->getUUID()));
+                header.set_destination_port(54321);
+                objectHost->processMessage(header,MemoryReference(body));
+            }
+            messageQueue->dequeuePoll();
+        }
+        while (sManager.mHandled.read()<NUM_OBJECTS*MESSAGES_PER_OBJECT) {
+            if (!messageQueue->dequeuePoll()) {
+                boost::this_thread::yield();
+            }
+        }
+        Duration elapsed=Task::LocalTime::now()-start;
+        TS_ASSERT_EQUALS(sManager.mHandled.read(),(int)(NUM_OBJECTS*MESSAGES_PER_OBJECT));
+        objectHost->setMailboxThreads(0);
+        while (messageQueue->dequeuePoll()) {
+        }
+        objects.clear();
+        delete objectHost;
+        delete messageQueue;
+        Network::IOServiceFactory::destroyIOService(io);
+        return elapsed;
+    }
+public:
+    void setUp() {
+        ObjectScriptManagerFactory::getSingleton().registerConstructor("scalingbench",&ObjectScriptScalingTest::getManager);
+    }
+    void tearDown() {
+        ObjectScriptManagerFactory::getSingleton().unregisterConstructor("scalingbench");
+    }
+    void testScriptScaling() {
+        const uint32 threads[]={0,1,2,4};
+        Duration elapsed[sizeof(threads)/sizeof(threads[0])];
+        std::cout<<std::endl;
+        for (size_t i=0;i<sizeof(threads)/sizeof(threads[0]);++i) {
+            elapsed[i]=run(threads[i]);
+            std::cout<<NUM_OBJECTS*MESSAGES_PER_OBJECT<<" script messages with "<<threads[i]<<" mailbox threads: "
+                     <<elapsed[i].toSeconds()*1000.0<<"ms, speedup "<<elapsed[0].toSeconds()/elapsed[i].toSeconds()<<std::endl;
+        }
+    }
+};
+ObjectScriptScalingTest::BusyScriptManager ObjectScriptScalingTest::sManager;
@@ -0,0 +1,211 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  PackFileTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "transfer/PackCacheLayer.hpp"
+#include "task/Time.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+using namespace Sirikata;
+using namespace Sirikata::Transfer;
+
+class PackFileTest : public CxxTest::TestSuite
+{
+    uint32 mSeed;
+    std::string randomData(size_t length) {
+        std::string retval(length,'\0');
+        for (size_t i=0;i<length;++i) {
+            mSeed=mSeed*1664525+1013904223;
+            retval[i]=(char)(mSeed>>24);
+        }
+        return retval;
+    }
+    static const char *packName() {
+        return "testPackFile.pack";
+    }
+    static const char *looseName() {
+        return "testPackFile.loose";
+    }
+    void removeFiles() {
+        const char*names[]={packName(),looseName()};
+        for (size_t i=0;i<sizeof(names)/sizeof(names[0]);++i) {
+            boost::filesystem::path path(names[i]);
+            if (boost::filesystem::exists(path))
+                boost::filesystem::remove(path);
+        }
+    }
+    /// Adds count random assets to writer and records their contents in contents.
+    void addRandom(PackFileWriter&writer, size_t count, size_t maxLength, std::map<Fingerprint,std::string>&contents) {
+        for (size_t i=0;i<count;++i) {
+            std::string data=randomData(1+mSeed%maxLength);
+            Fingerprint fp=Fingerprint::computeDigest(data);
+            contents[fp]=data;
+            writer.addData(fp,DenseDataPtr(new DenseData(data)));
+        }
+    }
+
+    const SparseData *mResult;
+    bool mCalled;
+    std::string mResultString;
+    void gotData(const SparseData*data) {
+        mCalled=true;
+        mResult=data;
+        if (data) {
+            mResultString=data->DenseDataList::begin()->asString();
+        }
+    }
+public:
+    void setUp() {
+        mSeed=1234;
+        mCalled=false;
+        mResult=NULL;
+        removeFiles();
+    }
+    void tearDown() {
+        removeFiles();
+    }
+    void testRoundTrip() {
+        std::string loose=randomData(100000);
+        {
+            std::ofstream out(looseName(),std::ios::binary);
+            out.write(loose.data(),loose.length());
+        }
+        PackFileWriter writer;
+        std::map<Fingerprint,std::string> contents;
+        addRandom(writer,300,5000,contents);
+        Fingerprint looseId;
+        TS_ASSERT(writer.addFile(looseName(),&looseId));
+        TS_ASSERT_EQUALS(looseId,Fingerprint::computeDigest(loose));
+        contents[looseId]=loose;
+        TS_ASSERT_EQUALS(writer.size(),contents.size());
+        TS_ASSERT(writer.write(packName()));
+
+        PackFile pack;
+        TS_ASSERT(pack.open(packName()));
+        TS_ASSERT_EQUALS(pack.size(),contents.size());
+        for (std::map<Fingerprint,std::string>::iterator iter=contents.begin();iter!=contents.end();++iter) {
+            DenseDataPtr found=pack.find(iter->first);
+            TS_ASSERT(found);
+            if (found) {
+                TS_ASSERT_EQUALS(found->asString(),iter->second);
+                TS_ASSERT_EQUALS((size_t)(found->data()-(const unsigned char*)0)%PackFile::DATA_ALIGNMENT,0u);
+            }
+        }
+        TS_ASSERT(!pack.find(Fingerprint::computeDigest("not in the pack")));
+        TS_ASSERT(!pack.find(Fingerprint::null()));
+    }
+    void testDataOutlivesPack() {
+        PackFileWriter writer;
+        std::map<Fingerprint,std::string> contents;
+        addRandom(writer,10,1000,contents);
+        TS_ASSERT(writer.write(packName()));
+        DenseDataPtr held;
+        {
+            PackFile pack;
+            TS_ASSERT(pack.open(packName()));
+            held=pack.find(contents.begin()->first);
+        }
+        TS_ASSERT(held);
+        if (held)
+            TS_ASSERT_EQUALS(held->asString(),contents.begin()->second);
+    }
+    void testEmptyAndCorrupt() {
+        PackFileWriter empty;
+        TS_ASSERT(empty.write(packName()));
+        PackFile pack;
+        TS_ASSERT(pack.open(packName()));
+        TS_ASSERT_EQUALS(pack.size(),0u);
+        TS_ASSERT(!pack.find(Fingerprint::null()));
+
+        PackFileWriter writer;
+        std::map<Fingerprint,std::string> contents;
+        addRandom(writer,20,1000,contents);
+        TS_ASSERT(writer.write(packName()));
+        boost::filesystem::resize_file(boost::filesystem::path(packName()),
+                                       boost::filesystem::file_size(boost::filesystem::path(packName()))-1);
+        TS_ASSERT(!pack.open(packName()));
+        TS_ASSERT(!pack.isOpen());
+        TS_ASSERT(!pack.open("testPackFile.missing"));
+    }
+    void testCacheLayer() {
+        PackFileWriter writer;
+        std::map<Fingerprint,std::string> contents;
+        addRandom(writer,50,1000,contents);
+        TS_ASSERT(writer.write(packName()));
+        PackCacheLayer layer(packName(),NULL);
+        TS_ASSERT_EQUALS(layer.getPack().size(),contents.size());
+
+        const Fingerprint &fp=contents.rbegin()->first;
+        layer.getData(RemoteFileId(fp,URI(URIContext(),"")),Range(true),
+                      std::tr1::bind(&PackFileTest::gotData,this,std::tr1::placeholders::_1));
+        TS_ASSERT(mCalled); // answered synchronously
+        TS_ASSERT(mResult!=NULL);
+        TS_ASSERT_EQUALS(mResultString,contents.rbegin()->second);
+
+        mCalled=false;
+        layer.getData(RemoteFileId(Fingerprint::computeDigest("missing"),URI(URIContext(),"")),Range(true),
+                      std::tr1::bind(&PackFileTest::gotData,this,std::tr1::placeholders::_1));
+        TS_ASSERT(mCalled);
+        TS_ASSERT(mResult==NULL); // no next layer to ask
+    }
+    void testLookupLatency() {
+        const size_t COUNT=50000;
+        PackFileWriter writer;
+        std::map<Fingerprint,std::string> contents;
+        addRandom(writer,COUNT,256,contents);
+        TS_ASSERT(writer.write(packName()));
+        PackFile pack;
+        TS_ASSERT(pack.open(packName()));
+        std::vector<Fingerprint> keys;
+        for (std::map<Fingerprint,std::string>::iterator iter=contents.begin();iter!=contents.end();++iter)
+            keys.push_back(iter->first);
+        for (size_t i=0;i<keys.size();++i)
+            std::swap(keys[i],keys[(mSeed=mSeed*1664525+1013904223)%keys.size()]);
+
+        const size_t LOOKUPS=1000000;
+        uint64 bytes=0;
+        Task::LocalTime start=Task::LocalTime::now();
+        for (size_t i=0;i<LOOKUPS;++i) {
+            const unsigned char *data;
+            uint64 length;
+            if (pack.lookup(keys[i%keys.size()],data,length))
+                bytes+=data[0]+length;
+        }
+        double rawSeconds=(Task::LocalTime::now()-start).toSeconds();
+        start=Task::LocalTime::now();
+        for (size_t i=0;i<LOOKUPS;++i)
+            bytes+=pack.find(keys[i%keys.size()])->length();
+        double findSeconds=(Task::LocalTime::now()-start).toSeconds();
+        TS_ASSERT(bytes>0);
+        std::cout<<std::endl<<"Pack of "<<COUNT<<" assets: lookup "<<rawSeconds*1.0e9/LOOKUPS
+                 <<"ns, find "<<findSeconds*1.0e9/LOOKUPS<<"ns"<<std::endl;
+    }
+};
@@ -0,0 +1,235 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ProgressiveMeshTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cxxtest/TestSuite.h>
+#include "util/ProgressiveMesh.hpp"
+using namespace Sirikata;
+
+class ProgressiveMeshTest : public CxxTest::TestSuite
+{
+    typedef ProgressiveMesh::Vertex Vertex;
+    typedef ProgressiveMesh::SubMesh SubMesh;
+    std::vector<Vertex> mVertices;
+    std::vector<SubMesh> mSubMeshes;
+    std::string mFile;
+
+    const unsigned char*data() const {
+        return (const unsigned char*)mFile.data();
+    }
+    /// Sphere of rings*segments quads, split in two submeshes by hemisphere.
+    void makeSphere(int rings, int segments, float radius) {
+        mVertices.clear();
+        mSubMeshes.clear();
+        mSubMeshes.resize(2);
+        mSubMeshes[0].mMaterial="meru://test@/sphere.os:north";
+        mSubMeshes[1].mMaterial="meru://test@/sphere.os:south";
+        for (int r=0;r<=rings;++r) {
+            float theta=3.14159265f*r/rings;
+            for (int s=0;s<=segments;++s) {
+                float phi=2*3.14159265f*s/segments;
+                Vertex vert;
+                vert.mNormal=Vector3f(std::sin(theta)*std::cos(phi),std::cos(theta),std::sin(theta)*std::sin(phi));
+                vert.mPosition=vert.mNormal*radius;
+                vert.mU=float(s)/segments;
+                vert.mV=float(r)/rings;
+                mVertices.push_back(vert);
+            }
+        }
+        for (int r=0;r<rings;++r) {
+            std::vector<uint32>&indices=mSubMeshes[r<rings/2?0:1].mIndices;
+            for (int s=0;s<segments;++s) {
+                uint32 a=r*(segments+1)+s,b=a+segments+1;
+                uint32 tris[6]={a,a+1,b,a+1,b+1,b};
+                for (int i=0;i<6;++i) {
+                    indices.push_back(tris[i]);
+                }
+            }
+        }
+    }
+    /// Triangles of a submesh as position triples turned to start at their smallest corner.
+    static std::set<std::vector<float> > triangleSet(const std::vector<Vertex>&vertices, const std::vector<uint32>&indices) {
+        std::set<std::vector<float> > result;
+        for (size_t i=0;i+2<indices.size();i+=3) {
+            std::vector<std::vector<float> > corners;
+            for (int j=0;j<3;++j) {
+                const Vector3f&pos=vertices[indices[i+j]].mPosition;
+                std::vector<float> corner;
+                corner.push_back(pos.x);
+                corner.push_back(pos.y);
+                corner.push_back(pos.z);
+                corners.push_back(corner);
+            }
+            if (corners[0]==corners[1]||corners[1]==corners[2]||corners[0]==corners[2]) {
+                continue;
+            }
+            int first=(int)(std::min_element(corners.begin(),corners.end())-corners.begin());
+            std::vector<float> tri;
+            for (int j=0;j<3;++j) {
+                tri.insert(tri.end(),corners[(first+j)%3].begin(),corners[(first+j)%3].end());
+            }
+            result.insert(tri);
+        }
+        return result;
+    }
+public:
+    void setUp( void ) {
+        makeSphere(24,32,2.0f);
+        ProgressiveMesh::encode(mVertices,mSubMeshes,5,mFile);
+    }
+    void testHeader( void ) {
+        size_t header=ProgressiveMesh::headerLength(data(),mFile.length());
+        TS_ASSERT(header>(size_t)ProgressiveMesh::PREAMBLE_SIZE);
+        TS_ASSERT_EQUALS(ProgressiveMesh::headerLength(data(),ProgressiveMesh::PREAMBLE_SIZE),header);
+        TS_ASSERT_EQUALS(ProgressiveMesh::headerLength(data(),ProgressiveMesh::PREAMBLE_SIZE-1),0u);
+        std::string notMesh(mFile);
+        notMesh[0]='X';
+        TS_ASSERT_EQUALS(ProgressiveMesh::headerLength((const unsigned char*)notMesh.data(),notMesh.length()),0u);
+
+        ProgressiveMesh mesh;
+        TS_ASSERT(!mesh.parseHeader(data(),header-1));
+        TS_ASSERT(mesh.parseHeader(data(),header));
+        TS_ASSERT_EQUALS(mesh.headerLength(),(uint64)header);
+        TS_ASSERT_EQUALS(mesh.numLevels(),5u);
+        TS_ASSERT_EQUALS(mesh.levelsDecoded(),0u);
+        TS_ASSERT_EQUALS(mesh.subMeshes().size(),2u);
+        TS_ASSERT_EQUALS(mesh.subMeshes()[0].mMaterial,mSubMeshes[0].mMaterial);
+        TS_ASSERT_EQUALS(mesh.subMeshes()[1].mMaterial,mSubMeshes[1].mMaterial);
+        TS_ASSERT_DELTA(mesh.radius(),2.0f,1.0e-5f);
+        TS_ASSERT_EQUALS(mesh.level(4).mEnd,(uint64)mFile.length());
+        TS_ASSERT_EQUALS(mesh.level(4).mVertexCount,mVertices.size());
+        TS_ASSERT_EQUALS(mesh.level(4).mError,0.0f);
+        for (size_t i=1;i<mesh.numLevels();++i) {
+            TS_ASSERT(mesh.level(i).mEnd>mesh.level(i-1).mEnd);
+            TS_ASSERT(mesh.level(i).mVertexCount>mesh.level(i-1).mVertexCount);
+            TS_ASSERT(mesh.level(i).mError<mesh.level(i-1).mError);
+        }
+        // the coarse base is a small part of the file
+        TS_ASSERT(mesh.level(0).mEnd*8<mFile.length());
+    }
+    void testWholeFile( void ) {
+        ProgressiveMesh mesh;
+        TS_ASSERT(mesh.parseHeader(data(),mFile.length()));
+        TS_ASSERT(mesh.refine(data(),0,mFile.length()));
+        TS_ASSERT_EQUALS(mesh.levelsDecoded(),mesh.numLevels());
+        TS_ASSERT_EQUALS(mesh.vertices().size(),mVertices.size());
+        for (size_t sub=0;sub<mSubMeshes.size();++sub) {
+            std::set<std::vector<float> > expected=triangleSet(mVertices,mSubMeshes[sub].mIndices);
+            TS_ASSERT_EQUALS(mesh.subMeshes()[sub].mIndices.size(),mSubMeshes[sub].mIndices.size());
+            TS_ASSERT(triangleSet(mesh.vertices(),mesh.subMeshes()[sub].mIndices)==expected);
+        }
+    }
+    void testPrefixes( void ) {
+        ProgressiveMesh full;
+        TS_ASSERT(full.parseHeader(data(),mFile.length()));
+        ProgressiveMesh incremental;
+        TS_ASSERT(incremental.parseHeader(data(),full.headerLength()));
+        for (size_t level=0;level<full.numLevels();++level) {
+            // a prefix ending just short of the level only decodes the ones before it
+            ProgressiveMesh prefix;
+            TS_ASSERT(prefix.parseHeader(data(),mFile.length()));
+            TS_ASSERT(prefix.refine(data(),0,(size_t)full.level(level).mEnd-1));
+            TS_ASSERT_EQUALS(prefix.levelsDecoded(),level);
+            TS_ASSERT(prefix.refine(data(),0,(size_t)full.level(level).mEnd));
+            TS_ASSERT_EQUALS(prefix.levelsDecoded(),level+1);
+            TS_ASSERT_EQUALS(prefix.vertices().size(),full.level(level).mVertexCount);
+            size_t triangles=0;
+            for (size_t sub=0;sub<prefix.subMeshes().size();++sub) {
+                triangles+=prefix.subMeshes()[sub].mIndices.size()/3;
+            }
+            TS_ASSERT_EQUALS(triangles,full.level(level).mTriangleCount);
+
+            // the same level from only the bytes fetched for it
+            uint64 start=incremental.levelStart(level);
+            TS_ASSERT(incremental.refine(data()+start,start,(size_t)(full.level(level).mEnd-start)));
+            TS_ASSERT_EQUALS(incremental.levelsDecoded(),level+1);
+            for (size_t sub=0;sub<prefix.subMeshes().size();++sub) {
+                TS_ASSERT(incremental.subMeshes()[sub].mIndices==prefix.subMeshes()[sub].mIndices);
+            }
+        }
+        // bytes that start after the next level are not enough to decode it
+        ProgressiveMesh gap;
+        TS_ASSERT(gap.parseHeader(data(),mFile.length()));
+        uint64 start=gap.levelStart(1);
+        TS_ASSERT(gap.refine(data()+start,start,mFile.length()-(size_t)start));
+        TS_ASSERT_EQUALS(gap.levelsDecoded(),0u);
+    }
+    void testCorrupt( void ) {
+        ProgressiveMesh mesh;
+        TS_ASSERT(mesh.parseHeader(data(),mFile.length()));
+        std::string broken(mFile);
+        // an index past the vertices in the last triangle of the file
+        for (int i=0;i<4;++i) {
+            broken[broken.length()-1-i]=(char)0xff;
+        }
+        TS_ASSERT(!mesh.refine((const unsigned char*)broken.data(),0,broken.length()));
+        TS_ASSERT(!mesh.isValid());
+        TS_ASSERT_EQUALS(mesh.levelsDecoded(),mesh.numLevels()-1);
+        // the level before the broken one is left as it was
+        TS_ASSERT_EQUALS(mesh.vertices().size(),mesh.level(mesh.numLevels()-2).mVertexCount);
+
+        std::string truncated(mFile,0,(size_t)mesh.level(0).mEnd);
+        truncated.resize(truncated.length()-4);
+        ProgressiveMesh shortLevel;
+        TS_ASSERT(shortLevel.parseHeader(data(),mFile.length()));
+        TS_ASSERT(shortLevel.refine((const unsigned char*)truncated.data(),0,truncated.length()));
+        TS_ASSERT_EQUALS(shortLevel.levelsDecoded(),0u);
+    }
+    void testEmptyAndSingleLevel( void ) {
+        std::string file;
+        ProgressiveMesh::encode(std::vector<Vertex>(),std::vector<SubMesh>(),4,file);
+        ProgressiveMesh empty;
+        TS_ASSERT(empty.parseHeader((const unsigned char*)file.data(),file.length()));
+        TS_ASSERT(empty.refine((const unsigned char*)file.data(),0,file.length()));
+        TS_ASSERT_EQUALS(empty.levelsDecoded(),empty.numLevels());
+        TS_ASSERT(empty.vertices().empty());
+
+        ProgressiveMesh::encode(mVertices,mSubMeshes,1,file);
+        ProgressiveMesh single;
+        TS_ASSERT(single.parseHeader((const unsigned char*)file.data(),file.length()));
+        TS_ASSERT_EQUALS(single.numLevels(),1u);
+        TS_ASSERT(single.refine((const unsigned char*)file.data(),0,file.length()));
+        TS_ASSERT_EQUALS(single.vertices().size(),mVertices.size());
+    }
+    void testLevelForScreenSize( void ) {
+        ProgressiveMesh mesh;
+        TS_ASSERT(mesh.parseHeader(data(),mFile.length()));
+        TS_ASSERT_EQUALS(mesh.levelForScreenSize(0.0f,0.001f),0u);
+        TS_ASSERT_EQUALS(mesh.levelForScreenSize(1.0f,0.001f),4u);
+        unsigned int last=0;
+        for (float size=0.001f;size<1.0f;size*=1.5f) {
+            unsigned int level=mesh.levelForScreenSize(size,0.01f);
+            TS_ASSERT(level>=last);
+            last=level;
+            TS_ASSERT(level==4||mesh.level(level).mError*size<=0.01f*mesh.radius());
+        }
+    }
+};
@@ -39,6 +39,7 @@
 #include "ReadWriteHandlerTest.hpp"
 
 #include "util/AtomicTypes.hpp"
+#include "task/Time.hpp"
 #include "Test_Persistence.pbj.hpp"
 using namespace Sirikata;
 using namespace Sirikata::Persistence;
@@ -197,6 +198,77 @@ void stress_test_read_write_handler(SetupReadWriteHandlerFunction _setup, Create
 }
 
 
+void test_read_write_handler_recovery(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                      String pl, TeardownReadWriteHandlerFunction _teardown,
+                                      uint32 num_fills)
+{
+    using namespace Sirikata::Persistence::Protocol;
+    _setup();
+    ReadWriteHandler* handler = create_handler(pl);
+    for(uint32 i = 0; i < num_fills; i++)
+        fill_read_write_handler(handler);
+    delete handler;
+
+    handler = create_handler(pl);
+    ReadWriteSet* trans = handler->createReadWriteSet((ReadWriteSet*)NULL,OBJECT_STORAGE_GENERATED_PAIRS,0);
+    StorageSet expected;
+    for(int i = 0; i < OBJECT_STORAGE_GENERATED_PAIRS; i++) {
+        copyStorageKey(trans->mutable_reads(i),keyvalues()[i]);
+        expected.add_reads();
+        copyStorageElement(expected.mutable_reads(i),keyvalues()[i]);
+    }
+    test_read_write(handler, trans, Response::SUCCESS, expected, 1);
+    delete handler;
+    _teardown();
+}
+
+double benchmark_read_write_handler(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                    String pl, TeardownReadWriteHandlerFunction _teardown,
+                                    uint32 num_sets, uint32 num_readswrites)
+{
+    using namespace Sirikata::Persistence::Protocol;
+    assert(num_readswrites <= OBJECT_STORAGE_GENERATED_PAIRS);
+
+    ReadWriteHandlerTestFixture fixture(_setup, create_handler, pl, _teardown);
+    fill_read_write_handler(fixture.handler);
+
+    std::vector<ReadWriteSet*> transactions;
+    std::vector<int> last_written(num_readswrites);
+    int counter=0;
+    for(uint32 i = 0; i < num_sets; i++) {
+        ReadWriteSet* trans = fixture.handler->createReadWriteSet((ReadWriteSet*)NULL,num_readswrites,num_readswrites);
+        for(uint32 j = 0; j < num_readswrites; j++) {
+            copyStorageKey(trans->mutable_reads(j),keyvalues()[j]);
+
+            last_written[j]=(counter+=5)%keyvalues().size();
+            copyStorageKey(trans->mutable_writes(j),keyvalues()[j]);
+            copyStorageValue(trans->mutable_writes(j),keyvalues()[last_written[j]]);
+        }
+        transactions.push_back(trans);
+    }
+
+    AtomicValue<Sirikata::uint32> done(0);
+    Task::LocalTime start = Task::LocalTime::now();
+    for(uint32 i = 0; i < num_sets; i++)
+        fixture.handler->apply(transactions[i], std::tr1::bind(check_stress_test_result, fixture.handler, _1, &done));
+
+    while( done.read() < num_sets )
+        pollReadWrite();
+    double seconds = (Task::LocalTime::now() - start).toSeconds();
+
+    // every set was applied in order, so the keys hold what the last one wrote
+    ReadWriteSet* check = fixture.handler->createReadWriteSet((ReadWriteSet*)NULL,num_readswrites,0);
+    StorageSet expected;
+    for(uint32 j = 0; j < num_readswrites; j++) {
+        copyStorageKey(check->mutable_reads(j),keyvalues()[j]);
+        expected.add_reads();
+        copyStorageValue(expected.mutable_reads(j),keyvalues()[last_written[j]]);
+    }
+    test_read_write(fixture.handler, check, Response::SUCCESS, expected, num_sets);
+
+    return seconds > 0 ? num_sets / seconds : 0;
+}
+
 void test_read_write_handler_order(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
                                    String pl, TeardownReadWriteHandlerFunction _teardown) {
     ReadWriteHandlerTestFixture fixture(_setup, create_handler, pl, _teardown);
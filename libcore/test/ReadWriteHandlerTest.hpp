@@ -68,4 +68,31 @@ void stress_test_read_write_handler(SetupReadWriteHandlerFunction _setup, Create
                                     Sirikata::String pl, TeardownReadWriteHandlerFunction _teardown,
                                     Sirikata::uint32 num_sets, Sirikata::uint32 num_readswrites);
 
+/** Checks that a ReadWriteHandler keeps its contents when it is destroyed and
+ *  recreated with the same parameters.
+ *  \param _setup function to perform any implementation specific setup
+ *  \param create_handler function for creating the handler
+ *  \param pl parameters to create the handler with
+ *  \param _teardown function to perform any implementation specific teardown
+ *  \param num_fills the number of times every generated pair is written before recreating
+ */
+void test_read_write_handler_recovery(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                      Sirikata::String pl, TeardownReadWriteHandlerFunction _teardown,
+                                      Sirikata::uint32 num_fills);
+
+/** Measures the throughput of a ReadWriteHandler by submitting many ReadWriteSets
+ *  at once, as stress_test_read_write_handler does, and timing until all complete.
+ *  Afterwards it checks that the keys hold the values the last set wrote.
+ *  \param _setup function to perform any implementation specific setup
+ *  \param create_handler function for creating the handler
+ *  \param pl parameters to create the handler with
+ *  \param _teardown function to perform any implementation specific teardown
+ *  \param num_sets the number of ReadWriteSets to submit
+ *  \param num_readwrites the number of reads and writes in each set
+ *  \returns the number of ReadWriteSets applied per second
+ */
+double benchmark_read_write_handler(SetupReadWriteHandlerFunction _setup, CreateReadWriteHandlerFunction create_handler,
+                                    Sirikata::String pl, TeardownReadWriteHandlerFunction _teardown,
+                                    Sirikata::uint32 num_sets, Sirikata::uint32 num_readswrites);
+
 #endif //_READ_WRITE_HANDLER_TEST_HPP_
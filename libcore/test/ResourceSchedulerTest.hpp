@@ -0,0 +1,266 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ResourceSchedulerTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../liboh/plugins/ogre/resourceManager/ResourceScheduler.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Meru;
+
+namespace {
+const float MB=1024.0f*1024.0f;
+/// ResourceScheduler::MAX_SKIPPED_PER_TICK
+const int MAX_SKIPPED=16;
+
+/// Parses, loads and unloads on the spot, counting loads and unloads.
+class MockResource : public GraphicsResource {
+public:
+    int mLoads;
+    int mUnloads;
+    MockResource(const String&id, Type type, float cost):GraphicsResource(id,type),mLoads(0),mUnloads(0) {
+        if (cost)
+            setCost(cost);
+    }
+protected:
+    virtual void doParse() {
+        parsed(true);
+    }
+    virtual void doLoad() {
+        ++mLoads;
+        loaded(true,mLoadEpoch);
+    }
+    virtual void doUnload() {
+        ++mUnloads;
+        unloaded(true,mLoadEpoch);
+    }
+};
+
+/// Stands in for GraphicsResourceEntity: its benefit and value slack are set by the test.
+class MockEntity : public MockResource {
+public:
+    float mWanted;
+    float mSlack;
+    int mRefreshes;
+    MockEntity(const String&id):MockResource(id,ENTITY,0),mWanted(0),mSlack(0),mRefreshes(0) {
+    }
+    virtual float getValueSlack() const {
+        return mSlack;
+    }
+protected:
+    virtual float calcBenefit() {
+        ++mRefreshes;
+        return mWanted;
+    }
+};
+typedef std::tr1::shared_ptr<MockResource> MockResourcePtr;
+typedef std::tr1::shared_ptr<MockEntity> MockEntityPtr;
+}
+
+/**
+ * Drives the ResourceScheduler with mock entities, each showing a mock mesh, and checks which
+ * of them end up loaded and what the budget is charged.
+ */
+class ResourceSchedulerTest : public CxxTest::TestSuite
+{
+    ResourceScheduler*mScheduler;
+    std::vector<MockEntityPtr> mEntities;
+    std::vector<MockResourcePtr> mMeshes;
+
+    MockResourcePtr mesh(float megabytes) {
+        std::ostringstream id;
+        id<<"mesh"<<mMeshes.size();
+        mMeshes.push_back(GraphicsResource::construct<MockResource>(id.str(),GraphicsResource::MESH,megabytes*MB));
+        return mMeshes.back();
+    }
+    MockEntityPtr entity(const MockResourcePtr&shows, float benefit) {
+        std::ostringstream id;
+        id<<"entity"<<mEntities.size();
+        mEntities.push_back(GraphicsResource::construct<MockEntity>(id.str()));
+        MockEntityPtr result=mEntities.back();
+        result->addDependency(shows);
+        result->mWanted=benefit;
+        mScheduler->trackValue(result.get());
+        return result;
+    }
+    void setBenefit(const MockEntityPtr&which, float benefit) {
+        which->mWanted=benefit;
+        mScheduler->valueChanged(which.get());
+    }
+    static bool isLoaded(const MockResourcePtr&resource) {
+        return resource->getLoadState()==GraphicsResource::LOAD_LOADED;
+    }
+public:
+    void setUp() {
+        mScheduler=new ResourceScheduler(8*MB,.25f);
+    }
+    void tearDown() {
+        mEntities.clear();
+        mMeshes.clear();
+        delete mScheduler;
+    }
+
+    void testSharedDependencyChargedOnce() {
+        MockResourcePtr shared=mesh(4);
+        MockEntityPtr first=entity(shared,1);
+        MockEntityPtr second=entity(shared,1);
+        mScheduler->schedule(0);
+        TS_ASSERT(isLoaded(shared));
+        TS_ASSERT_EQUALS(shared->mLoads,1);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),4.0f);
+
+        // Each entity holds its share until the last one goes; nothing needs the room yet.
+        mEntities.clear();
+        first.reset();
+        mScheduler->schedule(0);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),4.0f);
+        second.reset();
+        mScheduler->schedule(0);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),4.0f);
+        TS_ASSERT(isLoaded(shared));
+
+        // Worth nothing now, so it goes first once the budget shrinks, and is not loaded again.
+        mScheduler->setBudget(2);
+        mScheduler->schedule(0);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),0.0f);
+        TS_ASSERT_EQUALS(shared->mUnloads,1);
+        mScheduler->setBudget(8);
+        mScheduler->schedule(0);
+        TS_ASSERT_EQUALS(shared->mLoads,1);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),0.0f);
+    }
+
+    void testHysteresis() {
+        mScheduler->setBudget(4);
+        MockResourcePtr firstMesh=mesh(4);
+        MockResourcePtr secondMesh=mesh(4);
+        MockEntityPtr first=entity(firstMesh,1);
+        MockEntityPtr second=entity(secondMesh,0);
+        mScheduler->schedule(0);
+        TS_ASSERT(isLoaded(firstMesh));
+        TS_ASSERT(!isLoaded(secondMesh));
+
+        // Not worth 25% more, so the loaded mesh stays.
+        setBenefit(second,1.1f);
+        mScheduler->schedule(0);
+        TS_ASSERT(isLoaded(firstMesh));
+        TS_ASSERT(!isLoaded(secondMesh));
+        TS_ASSERT_EQUALS(firstMesh->mUnloads,0);
+
+        setBenefit(second,2);
+        mScheduler->schedule(0);
+        TS_ASSERT(!isLoaded(firstMesh));
+        TS_ASSERT(isLoaded(secondMesh));
+        TS_ASSERT_EQUALS(firstMesh->mUnloads,1);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),4.0f);
+
+        // Overtaking by a little does not swap them back.
+        setBenefit(first,2.1f);
+        mScheduler->schedule(0);
+        TS_ASSERT(!isLoaded(firstMesh));
+        TS_ASSERT(isLoaded(secondMesh));
+        TS_ASSERT_EQUALS(secondMesh->mUnloads,0);
+        TS_ASSERT_EQUALS(firstMesh->mLoads,1);
+    }
+
+    void testMakeRoomRollsBack() {
+        MockResourcePtr cheapMesh=mesh(4);
+        MockResourcePtr dearMesh=mesh(4);
+        MockResourcePtr bigMesh=mesh(8);
+        entity(cheapMesh,1);
+        entity(dearMesh,4);
+        MockEntityPtr big=entity(bigMesh,0);
+        enum {NUM_FILLERS=MAX_SKIPPED/2};
+        std::vector<MockEntityPtr> fillers;
+        for (int i=0;i<NUM_FILLERS;++i) {
+            fillers.push_back(entity(mesh(8),0));
+        }
+        mScheduler->schedule(0);
+        TS_ASSERT(isLoaded(cheapMesh));
+        TS_ASSERT(isLoaded(dearMesh));
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),8.0f);
+
+        // Worth evicting cheapMesh for, but that alone does not free enough, and dearMesh is
+        // worth too much to evict, so cheapMesh must be put back untouched.  The fillers do not
+        // fit either, and end the tick before cheapMesh could be admitted again had it not been.
+        setBenefit(big,4);
+        for (int i=0;i<NUM_FILLERS;++i) {
+            setBenefit(fillers[i],2.4f);
+        }
+        mScheduler->schedule(0);
+        TS_ASSERT(!isLoaded(bigMesh));
+        TS_ASSERT_EQUALS(bigMesh->mLoads,0);
+        TS_ASSERT(isLoaded(cheapMesh));
+        TS_ASSERT(isLoaded(dearMesh));
+        TS_ASSERT_EQUALS(cheapMesh->mUnloads,0);
+        TS_ASSERT_EQUALS(dearMesh->mUnloads,0);
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),8.0f);
+
+        // Nor is anything double charged once the residents it would displace are gone.
+        mScheduler->setBudget(16);
+        mScheduler->schedule(0);
+        TS_ASSERT(isLoaded(bigMesh));
+        TS_ASSERT_EQUALS(mScheduler->getBudgetUsed(),16.0f);
+    }
+
+    void testRefreshesOnlyChangedEntities() {
+        mScheduler->setBudget(1024);
+        enum {NUM_ENTITIES=100};
+        for (int i=0;i<NUM_ENTITIES;++i) {
+            entity(mesh(1),1.0f+i)->mSlack=1.0f+i;
+        }
+        mScheduler->schedule(0);
+        for (int i=0;i<NUM_ENTITIES;++i) {
+            TS_ASSERT(isLoaded(mMeshes[i]));
+            mEntities[i]->mRefreshes=0;
+        }
+
+        mScheduler->schedule(0);
+        mScheduler->valueChanged(mEntities[7].get());
+        mScheduler->valueChanged(mEntities[42].get());
+        mScheduler->schedule(0);
+        for (int i=0;i<NUM_ENTITIES;++i) {
+            TS_ASSERT_EQUALS(mEntities[i]->mRefreshes,i==7||i==42?1:0);
+            mEntities[i]->mRefreshes=0;
+        }
+
+        // Entity i stands its value for i+1 of viewer travel.
+        mScheduler->schedule(10.5);
+        for (int i=0;i<NUM_ENTITIES;++i) {
+            TS_ASSERT_EQUALS(mEntities[i]->mRefreshes,i<10?1:0);
+            mEntities[i]->mRefreshes=0;
+        }
+
+        mScheduler->viewersChanged();
+        mScheduler->schedule(0);
+        for (int i=0;i<NUM_ENTITIES;++i) {
+            TS_ASSERT_EQUALS(mEntities[i]->mRefreshes,1);
+        }
+    }
+};
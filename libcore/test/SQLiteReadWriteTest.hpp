@@ -74,6 +74,24 @@ public:
                                            &ReadWriteTestNs::teardownReadWritealHandler);
     }
 
+    void testGroupCommitBenchmark( void ) {
+        double single=benchmark_read_write_handler(&ReadWriteTestNs::setupReadWritealHandler,
+                                                   &SQLiteReadWriteTest::createReadWritealHandlerFunction,
+                                                   " --groupcommit 1",
+                                                   &ReadWriteTestNs::teardownReadWritealHandler,
+                                                   200,
+                                                   4);
+        double grouped=benchmark_read_write_handler(&ReadWriteTestNs::setupReadWritealHandler,
+                                                    &SQLiteReadWriteTest::createReadWritealHandlerFunction,
+                                                    "",
+                                                    &ReadWriteTestNs::teardownReadWritealHandler,
+                                                    200,
+                                                    4);
+        std::cout << "SQLite ReadWriteSets/s: one per transaction "<<single<<", group commit "<<grouped<<std::endl;
+        TS_ASSERT(single>0);
+        TS_ASSERT(grouped>0);
+    }
+
     void xestStressReadWriteHandlerOrder( void ) {
         stress_test_read_write_handler(&ReadWriteTestNs::setupReadWritealHandler,
                                             &SQLiteReadWriteTest::createReadWritealHandlerFunction,
@@ -0,0 +1,118 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  Sha256Test.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/Sha256.hpp"
+#include "task/Time.hpp"
+using namespace Sirikata;
+
+class Sha256Test : public CxxTest::TestSuite
+{
+    uint32 mSeed;
+    std::string randomData(size_t length) {
+        std::string retval(length,'\0');
+        for (size_t i=0;i<length;++i) {
+            mSeed=mSeed*1664525+1013904223;
+            retval[i]=(char)(mSeed>>24);
+        }
+        return retval;
+    }
+public:
+    void setUp() {
+        mSeed=4321;
+    }
+    void tearDown() {
+        SHA256::setAccelerated(true);
+    }
+    void testKnownDigests() {
+        for (int accelerated=0;accelerated<2;++accelerated) {
+            SHA256::setAccelerated(accelerated!=0);
+            TS_ASSERT_EQUALS(SHA256::computeDigest("").convertToHexString(),
+                             "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+            TS_ASSERT_EQUALS(SHA256::computeDigest("abc").convertToHexString(),
+                             "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+            TS_ASSERT_EQUALS(SHA256::computeDigest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq").convertToHexString(),
+                             "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+            SHA256Context context;
+            std::string thousand(1000,'a');
+            for (int i=0;i<1000;++i)
+                context.update(thousand);
+            TS_ASSERT_EQUALS(context.get().convertToHexString(),
+                             "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        }
+    }
+    void testStreamingMatchesWhole() {
+        std::string data=randomData(100000);
+        SHA256::setAccelerated(false);
+        SHA256 generic=SHA256::computeDigest(data);
+        SHA256::setAccelerated(true);
+        TS_ASSERT_EQUALS(SHA256::computeDigest(data),generic);
+
+        // Feed it in uneven pieces, as they would come off a socket.
+        SHA256Context context;
+        size_t offset=0;
+        for (size_t piece=1;offset<data.length();piece=piece*7%1031+1) {
+            size_t length=std::min(piece,data.length()-offset);
+            context.update(data.data()+offset,length);
+            offset+=length;
+        }
+        TS_ASSERT(context.matches(generic));
+        TS_ASSERT_EQUALS(context.get(),generic);
+
+        context.reset();
+        context.update(data.data(),data.length()-1);
+        TS_ASSERT(!context.matches(generic));
+    }
+    void testUpdateZeros() {
+        SHA256Context zeros;
+        zeros.updateZeros(1500);
+        TS_ASSERT_EQUALS(zeros.get(),SHA256::computeDigest(std::string(1500,'\0')));
+    }
+    void testThroughput() {
+        const size_t SIZE=32*1024*1024;
+        std::string data=randomData(SIZE);
+        double seconds[2];
+        SHA256 digests[2];
+        for (int accelerated=0;accelerated<2;++accelerated) {
+            SHA256::setAccelerated(accelerated!=0);
+            Task::LocalTime start=Task::LocalTime::now();
+            digests[accelerated]=SHA256::computeDigest(data);
+            seconds[accelerated]=(Task::LocalTime::now()-start).toSeconds();
+        }
+        TS_ASSERT_EQUALS(digests[0],digests[1]);
+        bool accelerated=SHA256::setAccelerated(true);
+        std::cout<<std::endl<<"SHA256 of "<<SIZE/(1024*1024)<<"MB: generic "
+                 <<SIZE/seconds[0]/(1024*1024)<<"MB/s";
+        if (accelerated)
+            std::cout<<", SHA extensions "<<SIZE/seconds[1]/(1024*1024)<<"MB/s";
+        std::cout<<std::endl;
+    }
+};
@@ -0,0 +1,277 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SubscriptionFanoutTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "Test_Subscription.pbj.hpp"
+#include <subscription/Platform.hpp>
+#include "subscription/BroadcastFrame.hpp"
+#include "subscription/SubscriptionState.hpp"
+#include "subscription/Server.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+
+class SubscriptionFanoutTest : public CxxTest::TestSuite
+{
+    ///Stream that swallows everything sent on it, remembering how much went out and optionally what
+    class CountingStream :public Network::Stream {
+    public:
+        size_t mBytesSent;
+        size_t mPacketsSent;
+        bool mRecord;
+        std::vector<Network::Chunk> mSent;
+        CountingStream(bool record=false):mBytesSent(0),mPacketsSent(0),mRecord(record){}
+        virtual void connect(const Network::Address&,const SubstreamCallback&,const ConnectionCallback&,const BytesReceivedCallback&){}
+        virtual void prepareOutboundConnection(const SubstreamCallback&,const ConnectionCallback&,const BytesReceivedCallback&){}
+        virtual void connect(const Network::Address&){}
+        virtual Stream*factory(){return new CountingStream;}
+        virtual Stream*clone(const SubstreamCallback&){return NULL;}
+        virtual Stream*clone(const ConnectionCallback&,const BytesReceivedCallback&){return NULL;}
+        virtual void send(MemoryReference data, Network::StreamReliability reliability) {
+            send(data,MemoryReference::null(),reliability);
+        }
+        virtual void send(MemoryReference first, MemoryReference second, Network::StreamReliability) {
+            mBytesSent+=first.size()+second.size();
+            ++mPacketsSent;
+            if (mRecord) {
+                mSent.push_back(Network::Chunk((const uint8*)first.data(),(const uint8*)first.data()+first.size()));
+            }
+        }
+        virtual void send(const Network::Chunk&data,Network::StreamReliability reliability) {
+            send(MemoryReference(data),reliability);
+        }
+        virtual void close(){}
+    };
+    ///Listener that hands its substream callback to the test instead of opening a port
+    class CapturingListener :public Network::StreamListener {
+    public:
+        Network::Stream::SubstreamCallback mNewStreamCallback;
+        virtual bool listen(const Network::Address&,const Network::Stream::SubstreamCallback&newStreamCallback) {
+            mNewStreamCallback=newStreamCallback;
+            return true;
+        }
+        virtual String listenAddressName()const{return "loopback:0";}
+        virtual Network::Address listenAddress()const{return Network::Address("loopback","0");}
+        virtual void close(){}
+        ///connects a stream to the server, returning the callback that feeds it incoming bytes
+        Network::Stream::BytesReceivedCallback accept(Network::Stream*stream) {
+            class SetCallbacks:public Network::Stream::SetCallbacks {
+            public:
+                Network::Stream::BytesReceivedCallback mBytesReceivedCallback;
+                virtual void operator()(const Network::Stream::ConnectionCallback&,
+                                        const Network::Stream::BytesReceivedCallback&bytesReceivedCallback) {
+                    mBytesReceivedCallback=bytesReceivedCallback;
+                }
+            } cb;
+            mNewStreamCallback(stream,cb);
+            return cb.mBytesReceivedCallback;
+        }
+    };
+    template <class Message> static Network::Chunk serialize(const Message&message) {
+        std::string serialized;
+        message.SerializeToString(&serialized);
+        return Network::Chunk(serialized.begin(),serialized.end());
+    }
+    enum {
+        NUM_SHARDED_BROADCASTERS=64,
+        NUM_SHARDED_SUBSCRIBERS=32,
+        NUM_SHARDED_UPDATES=200,
+        NUM_SUBSCRIBERS=10000,
+        NUM_UPDATES=32,
+        UPDATE_SIZE=1024
+    };
+    ///a payload where a handful of fields change on each update, like an avatar's state
+    static void mutate(Network::Chunk&payload, unsigned int update) {
+        for (unsigned int i=0;i<8;++i) {
+            payload[(update*131+i*97)%payload.size()]=(uint8)(update*7+i);
+        }
+    }
+    /**
+     * Broadcasts NUM_UPDATES updates to NUM_SUBSCRIBERS subscribers and reports the time and bytes spent.
+     * The first subscriber records what it was sent into observed so the caller can check it.
+     */
+    double fanout(uint32 keyframeInterval, std::vector<Network::Chunk>&observed, size_t&totalBytes, std::vector<Network::Chunk>&payloads) {
+        Subscription::SubscriptionState state(new CountingStream);
+        std::vector<std::tr1::shared_ptr<Network::Stream> > subscribers;
+        Subscription::Protocol::Subscribe subscribe;
+        if (keyframeInterval)
+            subscribe.set_keyframe_interval(keyframeInterval);
+        for (unsigned int i=0;i<NUM_SUBSCRIBERS;++i) {
+            std::tr1::shared_ptr<Network::Stream> stream(new CountingStream(i==0));
+            subscribers.push_back(stream);
+            state.registerSubscriber(stream,subscribe);
+        }
+        Network::Chunk payload(UPDATE_SIZE);
+        for (unsigned int i=0;i<UPDATE_SIZE;++i) {
+            payload[i]=(uint8)(i*13);
+        }
+        Duration elapsed=Duration::seconds(0);
+        for (unsigned int update=0;update<NUM_UPDATES;++update) {
+            mutate(payload,update);
+            payloads.push_back(payload);
+            //subscribers are rescheduled relative to the broadcast time, so make sure every one is due again
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            Task::LocalTime start=Task::LocalTime::now();
+            state.broadcast(NULL,Subscription::BroadcastFrame::makeShared(MemoryReference(payload)));
+            elapsed+=Task::LocalTime::now()-start;
+        }
+        totalBytes=0;
+        for (unsigned int i=0;i<NUM_SUBSCRIBERS;++i) {
+            totalBytes+=static_cast<CountingStream*>(&*subscribers[i])->mBytesSent;
+        }
+        observed.swap(static_cast<CountingStream*>(&*subscribers[0])->mSent);
+        return elapsed.toSeconds();
+    }
+    /**
+     * Feeds NUM_SHARDED_UPDATES updates from each of NUM_SHARDED_BROADCASTERS broadcasters through a Server
+     * with the given number of shards, each run by its own thread, and returns the seconds the shards took.
+     */
+    double shardedLoad(unsigned int numShards, size_t&packetsDelivered) {
+        std::vector<Network::IOService*> ios;
+        for (unsigned int i=0;i<numShards;++i) {
+            ios.push_back(Network::IOServiceFactory::makeIOService());
+        }
+        CapturingListener*broadcastListener=new CapturingListener;
+        CapturingListener*subscriberListener=new CapturingListener;
+        std::tr1::shared_ptr<Subscription::Server> server(new Subscription::Server(ios,
+                                                                                   broadcastListener,
+                                                                                   Network::Address("loopback","0"),
+                                                                                   subscriberListener,
+                                                                                   Network::Address("loopback","0"),
+                                                                                   Duration::seconds(30.0),
+                                                                                   1024*1024));
+        std::vector<Network::Stream::BytesReceivedCallback> broadcasters;
+        std::vector<CountingStream*> subscribers;
+        //the server's callbacks own its subscriber streams, just as a real stream would
+        std::vector<Network::Stream::BytesReceivedCallback> subscriberConnections;
+        for (unsigned int i=0;i<NUM_SHARDED_BROADCASTERS;++i) {
+            UUID name=UUID::random();
+            Subscription::Protocol::Broadcast registration;
+            registration.set_broadcast_name(name);
+            broadcasters.push_back(broadcastListener->accept(new CountingStream));
+            broadcasters.back()(serialize(registration));
+            Subscription::Protocol::Subscribe subscribe;
+            subscribe.set_broadcast_name(name);
+            Network::Chunk subscribeMessage(serialize(subscribe));
+            for (unsigned int j=0;j<NUM_SHARDED_SUBSCRIBERS;++j) {
+                subscribers.push_back(new CountingStream);
+                subscriberConnections.push_back(subscriberListener->accept(subscribers.back()));
+                subscriberConnections.back()(subscribeMessage);
+            }
+        }
+        for (unsigned int i=0;i<numShards;++i) {
+            Network::IOServiceFactory::runService(ios[i]);
+            Network::IOServiceFactory::resetService(ios[i]);
+        }
+        Network::Chunk payload(256);
+        for (unsigned int update=0;update<NUM_SHARDED_UPDATES;++update) {
+            mutate(payload,update);
+            for (unsigned int i=0;i<NUM_SHARDED_BROADCASTERS;++i) {
+                broadcasters[i](payload);
+            }
+        }
+        Task::LocalTime start=Task::LocalTime::now();
+        std::vector<boost::thread*> threads;
+        for (unsigned int i=0;i<numShards;++i) {
+            threads.push_back(new boost::thread(std::tr1::bind(&Network::IOServiceFactory::runService,ios[i])));
+        }
+        for (unsigned int i=0;i<numShards;++i) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        Duration elapsed=Task::LocalTime::now()-start;
+        packetsDelivered=0;
+        for (size_t i=0;i<subscribers.size();++i) {
+            packetsDelivered+=subscribers[i]->mPacketsSent;
+        }
+        server=std::tr1::shared_ptr<Subscription::Server>();
+        for (unsigned int i=0;i<numShards;++i) {
+            Network::IOServiceFactory::destroyIOService(ios[i]);
+        }
+        return elapsed.toSeconds();
+    }
+public:
+    void testShardedServerLoad() {
+        std::cout<<std::endl;
+        for (unsigned int numShards=1;numShards<=4;numShards*=2) {
+            size_t delivered=0;
+            double seconds=shardedLoad(numShards,delivered);
+            TS_ASSERT_EQUALS(delivered,(size_t)NUM_SHARDED_BROADCASTERS*NUM_SHARDED_SUBSCRIBERS*NUM_SHARDED_UPDATES);
+            std::cout<<"Sharded server with "<<numShards<<" threads: "
+                     <<NUM_SHARDED_BROADCASTERS*NUM_SHARDED_UPDATES/seconds<<" broadcasts/s to "
+                     <<NUM_SHARDED_SUBSCRIBERS<<" subscribers each"<<std::endl;
+        }
+    }
+    void testDeltaRoundTrip() {
+        using namespace Sirikata::Subscription;
+        Network::Chunk previous(300,1),current(previous),decoded(previous);
+        uint16 epoch=1;
+        for (uint16 update=2;update<40;++update) {
+            mutate(current,update);
+            current.resize(300+update%7);
+            SharedFrame frame=BroadcastFrame::encodeDelta(update-1,MemoryReference(previous),update,MemoryReference(current));
+            TS_ASSERT_LESS_THAN(frame->size(),current.size());
+            TS_ASSERT(BroadcastFrame::decode(*frame,epoch,decoded));
+            TS_ASSERT_EQUALS(epoch,update);
+            TS_ASSERT(decoded==current);
+            previous=current;
+        }
+        //a delta against the wrong epoch must be rejected so the subscriber waits for a keyframe
+        SharedFrame stale=BroadcastFrame::encodeDelta(7,MemoryReference(previous),8,MemoryReference(current));
+        TS_ASSERT(!BroadcastFrame::decode(*stale,epoch,decoded));
+        SharedFrame key=BroadcastFrame::encodeKeyframe(9,MemoryReference(current));
+        TS_ASSERT(BroadcastFrame::decode(*key,epoch,decoded));
+        TS_ASSERT_EQUALS(epoch,9);
+        TS_ASSERT(decoded==current);
+    }
+    void testFanoutBenchmark() {
+        size_t rawBytes,deltaBytes;
+        std::vector<Network::Chunk> rawObserved,deltaObserved,rawPayloads,deltaPayloads;
+        double rawSeconds=fanout(0,rawObserved,rawBytes,rawPayloads);
+        TS_ASSERT_EQUALS(rawObserved.size(),(size_t)NUM_UPDATES);
+        TS_ASSERT(rawObserved==rawPayloads);
+        double deltaSeconds=fanout(16,deltaObserved,deltaBytes,deltaPayloads);
+        TS_ASSERT_EQUALS(deltaObserved.size(),(size_t)NUM_UPDATES);
+        Network::Chunk decoded;
+        uint16 epoch=0;
+        for (size_t i=0;i<deltaObserved.size()&&i<deltaPayloads.size();++i) {
+            TS_ASSERT(Subscription::BroadcastFrame::decode(deltaObserved[i],epoch,decoded));
+            TS_ASSERT(decoded==deltaPayloads[i]);
+        }
+        TS_ASSERT_LESS_THAN(deltaBytes,rawBytes);
+        std::cout<<std::endl<<"Fanout of "<<NUM_UPDATES<<" updates to "<<NUM_SUBSCRIBERS<<" subscribers: "
+                 <<"raw "<<rawSeconds*1000.0/NUM_UPDATES<<"ms/update "<<rawBytes<<" bytes, "
+                 <<"delta "<<deltaSeconds*1000.0/NUM_UPDATES<<"ms/update "<<deltaBytes<<" bytes"<<std::endl;
+    }
+};
@@ -0,0 +1,225 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SubscriptionRelayTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "network/Stream.hpp"
+#include "network/StreamListener.hpp"
+#include "network/StreamFactory.hpp"
+#include "network/StreamListenerFactory.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "Test_Subscription.pbj.hpp"
+#include "util/PluginManager.hpp"
+#include <subscription/Platform.hpp>
+#include "subscription/Server.hpp"
+#include "subscription/SubscriptionClient.hpp"
+#include "subscription/Broadcast.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+
+/**
+ * An origin server and a relay server, each with its own IOService and thread as if they were separate processes,
+ * talking to each other and to their subscribers over loopback.
+ */
+class SubscriptionRelayTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_UPDATES=200,
+        DIRECT=0,
+        REDIRECTED=1
+    };
+    Network::IOService*mOriginIO;
+    Network::IOService*mRelayIO;
+    Network::IOService*mClientIO;
+    boost::thread*mOriginThread;
+    boost::thread*mRelayThread;
+    boost::thread*mClientThread;
+    std::tr1::shared_ptr<Subscription::Server> mOrigin;
+    std::tr1::shared_ptr<Subscription::Server> mRelay;
+    Subscription::SubscriptionClient*mRelayUpstream;
+    Subscription::SubscriptionClient*mDirectClient;
+    Subscription::SubscriptionClient*mRedirectedClient;
+    Subscription::Broadcast*mBroad;
+    Network::Address mOriginBroadcastAddress;
+    Network::Address mOriginSubscriptionAddress;
+    Network::Address mRelayBroadcastAddress;
+    Network::Address mRelaySubscriptionAddress;
+    UUID mName;
+    boost::mutex mLatencyLock;
+    std::vector<Task::LocalTime> mSendTimes;
+    Duration mLatency[2];
+    uint32 mReceived[2];
+    static void run(Network::IOService*io) {
+        Network::IOServiceFactory::runService(io);
+    }
+    static void sleepMilliseconds(int ms) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+    }
+    static void ignoreBroadcastStatus(Subscription::Broadcast::BroadcastStream*,Network::Stream::ConnectionStatus,const std::string&) {
+    }
+    static void ignoreDisconnection() {
+    }
+    ///updates carry their index so the receive time can be matched to the send time
+    void received(int which, const Network::Chunk&c) {
+        uint32 index;
+        if (c.size()!=sizeof(index)+4||memcmp(&c[0],"time",4)!=0) {
+            return;
+        }
+        memcpy(&index,&c[4],sizeof(index));
+        Task::LocalTime now=Task::LocalTime::now();
+        boost::lock_guard<boost::mutex> lok(mLatencyLock);
+        if (index<mSendTimes.size()) {
+            mLatency[which]+=now-mSendTimes[index];
+            ++mReceived[which];
+        }
+    }
+    Network::StreamListener*makeListener(Network::IOService*io) {
+        return Network::StreamListenerFactory::getSingleton().getDefaultConstructor()(io);
+    }
+public:
+    SubscriptionRelayTest():mOriginBroadcastAddress("127.0.0.1","7959"),
+                            mOriginSubscriptionAddress("127.0.0.1","7958"),
+                            mRelayBroadcastAddress("127.0.0.1","7969"),
+                            mRelaySubscriptionAddress("127.0.0.1","7968"),
+                            mName(UUID::random()) {
+        Sirikata::PluginManager plugins;
+        plugins.load( Sirikata::DynamicLibrary::filename("tcpsst") );
+        mLatency[DIRECT]=mLatency[REDIRECTED]=Duration::seconds(0);
+        mReceived[DIRECT]=mReceived[REDIRECTED]=0;
+        mOriginIO=Network::IOServiceFactory::makeIOService();
+        mRelayIO=Network::IOServiceFactory::makeIOService();
+        mClientIO=Network::IOServiceFactory::makeIOService();
+        std::tr1::shared_ptr<Subscription::Server> origin(new Subscription::Server(mOriginIO,
+                                                                                   makeListener(mOriginIO),
+                                                                                   mOriginBroadcastAddress,
+                                                                                   makeListener(mOriginIO),
+                                                                                   mOriginSubscriptionAddress,
+                                                                                   Duration::seconds(3.0),
+                                                                                   1024*1024));
+        mOrigin=origin;
+        std::tr1::shared_ptr<Subscription::Server> relay(new Subscription::Server(mRelayIO,
+                                                                                  makeListener(mRelayIO),
+                                                                                  mRelayBroadcastAddress,
+                                                                                  makeListener(mRelayIO),
+                                                                                  mRelaySubscriptionAddress,
+                                                                                  Duration::seconds(3.0),
+                                                                                  1024*1024));
+        mRelay=relay;
+        mRelayUpstream=new Subscription::SubscriptionClient(mRelayIO);
+        mDirectClient=new Subscription::SubscriptionClient(mClientIO);
+        mRedirectedClient=new Subscription::SubscriptionClient(mClientIO);
+        mBroad=new Subscription::Broadcast(mClientIO);
+        mOriginThread=new boost::thread(std::tr1::bind(&SubscriptionRelayTest::run,mOriginIO));
+        mRelayThread=new boost::thread(std::tr1::bind(&SubscriptionRelayTest::run,mRelayIO));
+        mClientThread=new boost::thread(std::tr1::bind(&SubscriptionRelayTest::run,mClientIO));
+    }
+    static SubscriptionRelayTest*createSuite() {
+        return new SubscriptionRelayTest;
+    }
+    static void destroySuite(SubscriptionRelayTest*st) {
+        delete st;
+    }
+    ~SubscriptionRelayTest() {
+        sleepMilliseconds(300);
+        Network::IOServiceFactory::stopService(mClientIO);
+        Network::IOServiceFactory::stopService(mRelayIO);
+        Network::IOServiceFactory::stopService(mOriginIO);
+        mClientThread->join();
+        mRelayThread->join();
+        mOriginThread->join();
+        mRelay=std::tr1::shared_ptr<Subscription::Server>();
+        mOrigin=std::tr1::shared_ptr<Subscription::Server>();
+        delete mBroad;
+        delete mRedirectedClient;
+        delete mDirectClient;
+        delete mRelayUpstream;
+        Network::IOServiceFactory::destroyIOService(mClientIO);
+        Network::IOServiceFactory::destroyIOService(mRelayIO);
+        Network::IOServiceFactory::destroyIOService(mOriginIO);
+        delete mClientThread;
+        delete mRelayThread;
+        delete mOriginThread;
+    }
+    void testRelayHopLatency() {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        using std::tr1::placeholders::_3;
+        Subscription::Broadcast::BroadcastStream*broadcast
+            =mBroad->establishBroadcast(mOriginBroadcastAddress,
+                                        mName,
+                                        std::tr1::bind(&SubscriptionRelayTest::ignoreBroadcastStatus,_1,_2,_3));
+        (*broadcast)->send(MemoryReference("hello",5),Network::ReliableOrdered);
+        sleepMilliseconds(500);
+        mRelay->relay(mRelayUpstream,mOriginSubscriptionAddress,mName,mRelaySubscriptionAddress);
+        sleepMilliseconds(500);
+
+        Subscription::Protocol::Subscribe subscription;
+        subscription.set_broadcast_name(mName);
+        std::tr1::shared_ptr<Subscription::SubscriptionClient::IndividualSubscription> direct
+            =mDirectClient->subscribe(mOriginSubscriptionAddress,
+                                      subscription,
+                                      std::tr1::bind(&SubscriptionRelayTest::received,this,(int)DIRECT,_1),
+                                      &SubscriptionRelayTest::ignoreDisconnection);
+        sleepMilliseconds(500);
+        //the origin now serves the relay and the direct subscriber while the relay serves nobody, so this one is sent to the relay
+        subscription.set_accept_redirect(true);
+        std::tr1::shared_ptr<Subscription::SubscriptionClient::IndividualSubscription> redirected
+            =mRedirectedClient->subscribe(mOriginSubscriptionAddress,
+                                          subscription,
+                                          std::tr1::bind(&SubscriptionRelayTest::received,this,(int)REDIRECTED,_1),
+                                          &SubscriptionRelayTest::ignoreDisconnection);
+        sleepMilliseconds(1000);
+
+        char payload[sizeof(uint32)+4]={'t','i','m','e'};
+        for (uint32 i=0;i<NUM_UPDATES;++i) {
+            memcpy(payload+4,&i,sizeof(i));
+            {
+                boost::lock_guard<boost::mutex> lok(mLatencyLock);
+                mSendTimes.push_back(Task::LocalTime::now());
+            }
+            (*broadcast)->send(MemoryReference(payload,sizeof(payload)),Network::ReliableOrdered);
+            sleepMilliseconds(5);
+        }
+        sleepMilliseconds(1000);
+        {
+            boost::lock_guard<boost::mutex> lok(mLatencyLock);
+            TS_ASSERT_EQUALS(mReceived[DIRECT],(uint32)NUM_UPDATES);
+            TS_ASSERT_EQUALS(mReceived[REDIRECTED],(uint32)NUM_UPDATES);
+            if (mReceived[DIRECT]&&mReceived[REDIRECTED]) {
+                double direct=mLatency[DIRECT].toSeconds()*1000.0/mReceived[DIRECT];
+                double relayed=mLatency[REDIRECTED].toSeconds()*1000.0/mReceived[REDIRECTED];
+                std::cout<<std::endl<<"Subscription latency: direct "<<direct<<"ms, through relay "<<relayed
+                         <<"ms, added per hop "<<relayed-direct<<"ms"<<std::endl;
+            }
+        }
+        delete broadcast;
+    }
+};
@@ -0,0 +1,188 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TriangleBVHTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <cxxtest/TestSuite.h>
+#include "util/TriangleBVH.hpp"
+#include "task/Time.hpp"
+#include <limits>
+using namespace Sirikata;
+
+class TriangleBVHTest : public CxxTest::TestSuite
+{
+    typedef TriangleBVH::Triangle Triangle;
+    uint32 mSeed;
+    float random(float low, float high) {
+        mSeed=mSeed*1664525+1013904223;
+        return low+(high-low)*((mSeed>>8)/16777216.0f);
+    }
+    Vector3f randomPoint(float extent) {
+        float x=random(-extent,extent);
+        float y=random(-extent,extent);
+        float z=random(-extent,extent);
+        return Vector3f(x,y,z);
+    }
+    /// Closed sphere of 2*rings*segments triangles facing outward.
+    static void makeSphere(std::vector<Triangle>&tris, int rings, int segments, float radius) {
+        std::vector<Vector3f> verts;
+        for (int r=0;r<=rings;++r) {
+            float theta=3.14159265f*r/rings;
+            for (int s=0;s<=segments;++s) {
+                float phi=2*3.14159265f*s/segments;
+                verts.push_back(Vector3f(radius*std::sin(theta)*std::cos(phi),
+                                         radius*std::cos(theta),
+                                         radius*std::sin(theta)*std::sin(phi)));
+            }
+        }
+        for (int r=0;r<rings;++r) {
+            for (int s=0;s<segments;++s) {
+                int a=r*(segments+1)+s,b=a+segments+1;
+                tris.push_back(Triangle(verts[a],verts[a+1],verts[b]));
+                tris.push_back(Triangle(verts[a+1],verts[b+1],verts[b]));
+            }
+        }
+    }
+    static bool bruteForce(const std::vector<Triangle>&tris, const Vector3f&origin, const Vector3f&dir, float&best) {
+        bool found=false;
+        best=std::numeric_limits<float>::max();
+        for (size_t i=0;i<tris.size();++i) {
+            float distance;
+            if (TriangleBVH::intersectTriangle(tris[i],origin,dir,distance)&&distance<best) {
+                best=distance;
+                found=true;
+            }
+        }
+        return found;
+    }
+public:
+    void setUp( void ) {
+        mSeed=12345;
+    }
+    void testSingleTriangle( void ) {
+        std::vector<Triangle> tris;
+        tris.push_back(Triangle(Vector3f(0,0,0),Vector3f(1,0,0),Vector3f(0,1,0)));
+        TriangleBVH bvh;
+        bvh.build(tris);
+        TS_ASSERT(tris.empty());
+        TriangleBVH::Hit hit;
+        TS_ASSERT(bvh.intersect(Vector3f(.25f,.25f,2),Vector3f(0,0,-1),1.0e30f,hit));
+        TS_ASSERT_DELTA(hit.mDistance,2.0f,1.0e-5f);
+        TS_ASSERT_EQUALS(hit.mTriangle,0u);
+        // from behind, past the end of the ray, outside the triangle, and pointing away
+        TS_ASSERT(!bvh.intersect(Vector3f(.25f,.25f,-2),Vector3f(0,0,1),1.0e30f,hit));
+        TS_ASSERT(!bvh.intersect(Vector3f(.25f,.25f,2),Vector3f(0,0,-1),1.5f,hit));
+        TS_ASSERT(!bvh.intersect(Vector3f(.75f,.75f,2),Vector3f(0,0,-1),1.0e30f,hit));
+        TS_ASSERT(!bvh.intersect(Vector3f(.25f,.25f,2),Vector3f(0,0,1),1.0e30f,hit));
+    }
+    void testEmpty( void ) {
+        std::vector<Triangle> tris;
+        TriangleBVH bvh;
+        bvh.build(tris);
+        TriangleBVH::Hit hit;
+        TS_ASSERT(!bvh.intersect(Vector3f(0,0,0),Vector3f(0,0,1),1.0e30f,hit));
+        TS_ASSERT_EQUALS(bvh.numNodes(),0u);
+    }
+    void testMatchesBruteForce( void ) {
+        std::vector<Triangle> tris;
+        for (int i=0;i<3000;++i) {
+            Vector3f center(randomPoint(10));
+            tris.push_back(Triangle(center+randomPoint(1),center+randomPoint(1),center+randomPoint(1)));
+        }
+        // identical triangles must not send the build into a loop
+        for (int i=0;i<100;++i) {
+            tris.push_back(tris[0]);
+        }
+        std::vector<Triangle> copy(tris);
+        TriangleBVH bvh;
+        bvh.build(tris);
+        TS_ASSERT_EQUALS(bvh.triangles().size(),copy.size());
+        int hits=0;
+        for (int i=0;i<2000;++i) {
+            Vector3f origin(randomPoint(15));
+            Vector3f dir(randomPoint(1));
+            if (i%7==0) dir.x=0;
+            float expected;
+            bool expectHit=bruteForce(copy,origin,dir,expected);
+            TriangleBVH::Hit hit;
+            bool gotHit=bvh.intersect(origin,dir,1.0e30f,hit);
+            TS_ASSERT_EQUALS(gotHit,expectHit);
+            if (gotHit&&expectHit) {
+                ++hits;
+                TS_ASSERT_EQUALS(hit.mDistance,expected);
+                float check;
+                TS_ASSERT(TriangleBVH::intersectTriangle(bvh.triangles()[hit.mTriangle],origin,dir,check));
+            }
+        }
+        TS_ASSERT(hits>100);
+    }
+    void testSphereBenchmark( void ) {
+        std::vector<Triangle> tris;
+        makeSphere(tris,316,316,10);
+        std::vector<Triangle> copy(tris);
+        TriangleBVH bvh;
+        Task::LocalTime start=Task::LocalTime::now();
+        bvh.build(tris);
+        double buildSeconds=(Task::LocalTime::now()-start).toSeconds();
+
+        const int NUM_RAYS=10000,NUM_BRUTE_RAYS=50;
+        std::vector<Vector3f> origins,dirs;
+        for (int i=0;i<NUM_RAYS;++i) {
+            Vector3f origin(randomPoint(30));
+            origins.push_back(origin);
+            dirs.push_back(randomPoint(8)-origin);
+        }
+        int hits=0;
+        std::vector<float> distances(NUM_RAYS,-1);
+        start=Task::LocalTime::now();
+        for (int i=0;i<NUM_RAYS;++i) {
+            TriangleBVH::Hit hit;
+            if (bvh.intersect(origins[i],dirs[i],1.0e30f,hit)) {
+                distances[i]=hit.mDistance;
+                ++hits;
+            }
+        }
+        double bvhSeconds=(Task::LocalTime::now()-start).toSeconds();
+        start=Task::LocalTime::now();
+        for (int i=0;i<NUM_BRUTE_RAYS;++i) {
+            float expected;
+            if (bruteForce(copy,origins[i],dirs[i],expected)) {
+                TS_ASSERT_EQUALS(distances[i],expected);
+            }else {
+                TS_ASSERT_EQUALS(distances[i],-1);
+            }
+        }
+        double bruteSeconds=(Task::LocalTime::now()-start).toSeconds();
+        TS_ASSERT(hits>0);
+        std::cout<<std::endl<<copy.size()<<" triangles: build "<<buildSeconds<<"s, "
+                 <<bvh.numNodes()<<" nodes, "<<bvh.memoryUsage()/1024<<"kB; per ray: bvh "
+                 <<bvhSeconds*1.0e6/NUM_RAYS<<"us, brute force "
+                 <<bruteSeconds*1.0e6/NUM_BRUTE_RAYS<<"us"<<std::endl;
+    }
+};
@@ -0,0 +1,179 @@
+/*  Sirikata liboh -- Object Host
+ *  CachingReadWriteHandler.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_CACHING_READ_WRITE_HANDLER_HPP_
+#define _SIRIKATA_CACHING_READ_WRITE_HANDLER_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/RoutableMessageHeader.hpp>
+#include <task/WorkQueue.hpp>
+#include <persistence/ObjectStorage.hpp>
+
+namespace Sirikata {
+namespace Persistence {
+
+/**
+ * Write-behind cache in front of another ReadWriteHandler.  Reads are served from memory when
+ * every key they ask for is cached; writes only update the cache and are answered at once.
+ * Dirty values are sent to the backend in one ReadWriteSet per flush, so a property that is
+ * set many times between flushes reaches the backend once.
+ *
+ * The backend is only spoken to through serialized messages, so it may live in a plugin
+ * compiled against its own copy of the persistence protocol.  A value stays dirty, and in
+ * memory, until the backend acknowledges the flush that carried it; values whose flush failed
+ * are sent again by the next one.  Messages are handed to the backend outside the cache's lock,
+ * so the backend may reply from within processMessage.
+ */
+class SIRIKATA_OH_EXPORT CachingReadWriteHandler : public ReadWriteHandler {
+public:
+    /**
+     * \param backend handler that stores the data; it is deleted along with this
+     * \param replyQueue queue on which responses served from the cache are delivered, so
+     *        callers never see their reply before the request returns
+     * \param flushInterval dirty values are sent to the backend at least this often by tick()
+     * \param maxEntries number of values kept in memory; clean ones are evicted least
+     *        recently used first
+     * \param maxDirty number of dirty values that forces a flush before the interval is up
+     */
+    CachingReadWriteHandler(ReadWriteHandler *backend,
+                            Task::WorkQueue *replyQueue,
+                            const Duration &flushInterval,
+                            size_t maxEntries,
+                            size_t maxDirty);
+    /// Flushes every dirty value and waits for the backend to acknowledge it, then fails reads still waiting on the backend.
+    virtual ~CachingReadWriteHandler();
+
+    virtual void destroyResponse(Protocol::Response*);
+
+    bool forwardMessagesTo(MessageService*);
+    bool endForwardingMessagesTo(MessageService*);
+    void processMessage(const RoutableMessageHeader&,MemoryReference);
+
+    /// Flushes dirty values if the flush interval has passed; call regularly.
+    void tick();
+    /// Sends every dirty value to the backend now.
+    void flush();
+
+    /// Number of writes received from clients.
+    uint64 getWritesReceived() const;
+    /// Number of writes sent to the backend; writes received / flushed is the amplification saved.
+    uint64 getWritesFlushed() const;
+protected:
+    virtual void applyInternal(Protocol::ReadWriteSet* rws, const ResultCallback& cb,void(*)(Protocol::ReadWriteSet*));
+    virtual void applyInternal(const RoutableMessageHeader&hdr,Protocol::ReadWriteSet*,void(*)(Protocol::ReadWriteSet*));
+private:
+    struct Key {
+        UUID mObject;
+        uint64 mFieldId;
+        String mFieldName;
+        bool operator==(const Key&other) const {
+            return mObject==other.mObject&&mFieldId==other.mFieldId&&mFieldName==other.mFieldName;
+        }
+        class Hasher {public:
+            size_t operator()(const Key&k) const {
+                return UUID::Hasher()(k.mObject)^std::tr1::hash<std::string>()(k.mFieldName)^(size_t)k.mFieldId;
+            }
+        };
+    };
+    typedef std::list<Key> LruList;
+    struct Entry {
+        String mValue;
+        bool mPresent; ///< false caches a missing or deleted key
+        bool mDirty; ///< written since the backend last acknowledged this key
+        bool mUnflushed; ///< written since the last flush was sent
+        uint64 mVersion; ///< counts writes so an acknowledgement can tell whether it carried the latest value
+        LruList::iterator mLru;
+    };
+    typedef std::tr1::unordered_map<Key,Entry,Key::Hasher> EntryMap;
+
+    class Request;
+    class Deliver;
+    class BackendListener : public MessageService {
+        CachingReadWriteHandler *mParent;
+    public:
+        BackendListener(CachingReadWriteHandler *parent):mParent(parent){}
+        bool forwardMessagesTo(MessageService*){return false;}
+        bool endForwardingMessagesTo(MessageService*){return false;}
+        void processMessage(const RoutableMessageHeader&,MemoryReference);
+    };
+    friend class BackendListener;
+    friend class Deliver;
+    typedef std::map<int64, Request*> PendingMap;
+    typedef std::vector<std::pair<Key,uint64> > FlushedVersions;
+    typedef std::map<int64, FlushedVersions> FlushMap;
+    typedef std::deque<std::pair<int64,std::string> > OutgoingQueue;
+
+    template <class StorageElement> static Key getKey(const StorageElement&el);
+    /// Answers req from the cache or asks the backend for its misses; applies its writes.
+    void handle(Request *req);
+    void backendReply(const RoutableMessageHeader&hdr, MemoryReference body);
+    /// Hands a finished request to mReplyQueue.
+    void deliver(Request *req);
+    /// Queues a serialized ReadWriteSet for the backend and returns its id.  Must hold mLock.
+    int64 queueBackend(const std::string &body);
+    /// Hands queued messages to the backend in order.  Must not hold mLock.
+    void sendQueued();
+    /// Marks the keys of an acknowledged flush clean, or queues them for the next flush if it failed.  Must hold mLock.
+    void flushAcknowledged(const FlushedVersions &flushed, bool failed);
+    Entry &touch(const Key&key);
+    void evict();
+    /// Queues every unflushed value for the backend in one ReadWriteSet.  Must hold mLock.
+    void flushLocked();
+
+    ReadWriteHandler *mBackend;
+    BackendListener mBackendListener;
+    Task::WorkQueue *mReplyQueue;
+    Duration mFlushInterval;
+    Task::LocalTime mLastFlush;
+    size_t mMaxEntries;
+    size_t mMaxDirty;
+
+    class UniqueLock;
+    UniqueLock *mLock;
+    class Condition;
+    Condition *mFlushed;
+    EntryMap mEntries;
+    LruList mLru;
+    size_t mNumUnflushed;
+    PendingMap mPending; ///< reads waiting on the backend by message id
+    FlushMap mFlushes; ///< flushes waiting on the backend by message id
+    OutgoingQueue mOutgoing;
+    bool mSending; ///< a thread is handing mOutgoing to the backend
+    int64 mNextId;
+    std::vector<MessageService*> mInterestedParties;
+    uint64 mWritesReceived;
+    uint64 mWritesFlushed;
+};
+
+}
+}
+
+#endif
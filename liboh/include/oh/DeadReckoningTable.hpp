@@ -0,0 +1,105 @@
+/*  Sirikata liboh -- Object Host
+ *  DeadReckoningTable.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_DEAD_RECKONING_TABLE_HPP_
+#define _SIRIKATA_DEAD_RECKONING_TABLE_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/SpaceID.hpp>
+#include <util/Time.hpp>
+
+namespace Sirikata {
+class HostedObject;
+class ProxyObject;
+typedef std::tr1::shared_ptr<ProxyObject> ProxyObjectPtr;
+
+/**
+ * Tracks, for every hosted object connected to one space, the location the space was last told
+ * about next to the location the object really has, laid out as a structure of arrays.
+ * Each tick refreshes the real locations, runs one vectorized pass to compare them against what
+ * the space extrapolates from the last update and sends an ObjLoc only for the rows that drifted
+ * past their threshold, sharing one message header for the whole space.
+ * Rows come and go from whichever mailbox thread runs their object while the ObjectHost's tick
+ * thread sends the updates, so every call takes the table's lock.
+ */
+class SIRIKATA_OH_EXPORT DeadReckoningTable {
+public:
+    typedef size_t Row;
+    DeadReckoningTable(const SpaceID&space);
+    ~DeadReckoningTable();
+    const SpaceID&space()const {return mSpace;}
+    size_t size()const;
+    /**
+     * Starts tracking proxy on behalf of owner, assuming the space last heard loc at time now
+     * \param rowHandle is kept up to date with the row index as other rows are removed, and must outlive the row
+     */
+    void insert(HostedObject*owner, const ProxyObjectPtr&proxy, Row*rowHandle, const Time&now, const Location&loc);
+    ///Stops tracking the row rowHandle points to. The handle is read under the lock since removing other rows moves it
+    void remove(const Row*rowHandle);
+    ///Records that the space was told loc at time now, with no velocity, without sending anything
+    void reset(const Row*rowHandle, const Time&now, const Location&loc);
+    ///Sets how far (in space units) the extrapolated position may drift from the real one before an update is sent
+    void setThreshold(const Row*rowHandle, float64 distance);
+    ///Refreshes every row at now and sends updates for those that drifted
+    void tick(const Time&now);
+private:
+    DeadReckoningTable(const DeadReckoningTable&);
+    DeadReckoningTable&operator=(const DeadReckoningTable&);
+    class UniqueLock;
+    UniqueLock *mLock;
+    float64 secondsSinceEpoch(const Time&t)const;
+    ///fills mStaleRows with the rows whose error exceeds their thresholds at tnow seconds since mEpoch
+    void findStaleRows(float64 tnow);
+    void sendUpdates(float64 tnow);
+    void storeSent(Row row, float64 t, const Location&loc);
+    void resetRow(Row row, const Time&now, const Location&loc);
+    SpaceID mSpace;
+    Time mEpoch;
+
+    std::vector<HostedObject*>mOwners;
+    std::vector<ProxyObjectPtr>mProxies;
+    std::vector<Row*>mRowHandles;
+    ///the real location of each row, refreshed at every tick
+    std::vector<float64>mPosX,mPosY,mPosZ;
+    std::vector<float64>mVelX,mVelY,mVelZ;
+    std::vector<float64>mRotX,mRotY,mRotZ,mRotW;
+    ///the location the space was last sent, and when
+    std::vector<float64>mSentPosX,mSentPosY,mSentPosZ;
+    std::vector<float64>mSentVelX,mSentVelY,mSentVelZ;
+    std::vector<float64>mSentRotX,mSentRotY,mSentRotZ,mSentRotW;
+    std::vector<float64>mSentTime;
+    ///squared distance threshold of each row
+    std::vector<float64>mThreshold2;
+    std::vector<Row>mStaleRows;
+};
+
+}
+#endif
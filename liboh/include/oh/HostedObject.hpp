@@ -37,6 +37,7 @@
 #include "oh/TopLevelSpaceConnection.hpp"
 #include "oh/ProxyObject.hpp"
 #include "util/QueryTracker.hpp"
+#include "oh/Mailbox.hpp"
 
 namespace Sirikata {
 class ObjectHost;
@@ -49,6 +50,11 @@ class TopLevelSpaceConnection;
 namespace Protocol {
 class ObjLoc;
 }
+namespace Persistence {
+namespace Protocol {
+class Response;
+}
+}
 using Protocol::ObjLoc;
 
 class ObjectScript;
@@ -72,6 +78,9 @@ protected:
     ObjectScript *mObjectScript;
     ObjectHost *mObjectHost;
     UUID mInternalObjectReference;
+    /// Messages routed to this object waiting for its turn on an ObjectHost mailbox thread.
+    Mailbox mMailbox;
+    friend class ObjectHost;
 
 //------- Constructors/Destructors
 private:
@@ -100,6 +109,11 @@ public:
     void initializeScript(const String&script, const std::map<String,String> &args);
     /// Attempt to restore this item from database including script [not implemented]
     void initializeRestoreFromDatabase(const SpaceID&spaceID, const HostedObjectPtr&spaceConnectionHint=HostedObjectPtr());
+    /** Restores this item from fields already fetched from the database, e.g. in bulk with ReadWriteHandler::createBulkReadSet.
+        response.reads(firstRead) onwards must answer getRestoreFieldNames() for this object, in order. */
+    void initializeRestoreFromReads(const SpaceID&spaceID, const Persistence::Protocol::Response&response, int firstRead, const HostedObjectPtr&spaceConnectionHint=HostedObjectPtr());
+    /// The database fields read to restore an object.
+    static const std::vector<String>&getRestoreFieldNames();
     /** Gets the ObjectHost (usually one per host).
         See getProxy(space)->getProxyManger() for the per-space object.
     */
@@ -180,6 +194,8 @@ public:
 
     /** Handles an incoming message, then passes the message to the scripting language. */
     void processRoutableMessage(const RoutableMessageHeader &hdr, MemoryReference body);
+    /// True for replies, RPCs and persistence messages, whose handlers reach proxies or graphics and so must run on the ObjectHost's message queue.
+    static bool handledOnMessageQueue(const RoutableMessageHeader &hdr);
 
     /** Sends directly via an attached space, without going through the ObjectHost.
         No messages with a null SpaceId (i.e. for a local object or message service)
@@ -0,0 +1,105 @@
+/*  Sirikata liboh -- Object Host
+ *  InterestTable.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_INTEREST_TABLE_HPP_
+#define _SIRIKATA_INTEREST_TABLE_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/SpaceID.hpp>
+#include <util/Time.hpp>
+
+namespace Sirikata {
+template <class Body> class SentMessageBody;
+class HostedObject;
+
+/**
+ * Paces the LocRequests an object host keeps outstanding for the proxies its objects can see in one space.
+ * A proxy that looks large from its viewer is polled again as soon as its last answer arrives;
+ * smaller or more distant ones wait longer and ask for fewer fields, while ProxyObject's
+ * extrapolator animates them from their last velocity in between.
+ * The table also keeps statistics on how far those extrapolations were off when the next update came in.
+ * Everything but tick() may be called from any thread; tick() runs on the ObjectHost's tick thread.
+ */
+class SIRIKATA_OH_EXPORT InterestTable {
+public:
+    typedef SentMessageBody<RoutableMessageBody> Request;
+    InterestTable(const SpaceID&space);
+    ///deletes the requests still waiting to be resent whose owners are alive
+    ~InterestTable();
+    const SpaceID&space()const {return mSpace;}
+    /**
+     * \param fullRateSize apparent size (radius over distance) at or above which a proxy is polled continuously
+     * \param falloff extra delay per multiple of fullRateSize a proxy is smaller than that
+     * \param maxInterval longest a proxy goes without being polled
+     */
+    void setPolicy(float64 fullRateSize, const Duration&falloff, const Duration&maxInterval);
+    /**
+     * Picks how long to wait before polling a proxy of the given radius again
+     * \param fields set to the LocRequest::Fields to ask for, or 0 for all of them
+     */
+    Duration updateInterval(const Location&viewer, const Location&target, float64 radius, uint32*fields)const;
+    /**
+     * Takes ownership of request and sends it from tick() once now reaches due.
+     * If owner, whose QueryTracker the request belongs to, is gone by then, the request is dropped.
+     */
+    void schedule(const std::tr1::weak_ptr<HostedObject>&owner, Request*request, const Time&due);
+    /**
+     * Records one position update
+     * \param angularError distance between the extrapolated and the received position over the distance to the viewer
+     */
+    void recordUpdate(float64 angularError, size_t bytes);
+    ///Sends every request that has come due and forgets those whose owner has died
+    void tick(const Time&now);
+
+    uint64 getUpdatesReceived()const;
+    uint64 getBytesReceived()const;
+    float64 getMeanAngularError()const;
+    float64 getMaxAngularError()const;
+private:
+    SpaceID mSpace;
+    float64 mFullRateSize;
+    Duration mFalloff;
+    Duration mMaxInterval;
+
+    class UniqueLock;
+    UniqueLock *mLock;
+    typedef std::pair<std::tr1::weak_ptr<HostedObject>,Request*> Waiting;
+    typedef std::multimap<Time,Waiting> WaitingMap;
+    WaitingMap mWaiting;
+    std::vector<Waiting> mDue;
+    uint64 mUpdates;
+    uint64 mBytes;
+    float64 mErrorSum;
+    float64 mMaxError;
+};
+
+}
+#endif
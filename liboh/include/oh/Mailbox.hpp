@@ -0,0 +1,108 @@
+/*  Sirikata liboh -- Object Host
+ *  Mailbox.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_MAILBOX_HPP_
+#define _SIRIKATA_MAILBOX_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/RoutableMessageHeader.hpp>
+#include <task/WorkQueue.hpp>
+
+namespace Sirikata {
+class ObjectHost;
+class EnvelopePool;
+class Mailbox;
+
+/**
+ * A message on its way through the ObjectHost: the header and a private copy of the body.
+ * It is first run on the ObjectHost's message queue, where it is routed, and may then wait in
+ * the destination HostedObject's Mailbox. Envelopes come from and return to an EnvelopePool,
+ * so the body's buffer is reused and steady traffic does not allocate.
+ */
+class SIRIKATA_OH_EXPORT Envelope : public Task::WorkItem {
+    friend class EnvelopePool;
+    friend class Mailbox;
+    ObjectHost *mParent;
+    Envelope *mNext;
+public:
+    RoutableMessageHeader mHeader;
+    std::string mBody;
+    Envelope():mParent(NULL),mNext(NULL){}
+    virtual ~Envelope(){}
+    ///Routes the message to its destination (implemented by ObjectHost)
+    virtual void operator()();
+};
+
+/**
+ * Thread safe free list of Envelopes. Up to maxFree envelopes are kept around for reuse,
+ * the rest are deleted when released.
+ */
+class SIRIKATA_OH_EXPORT EnvelopePool {
+    class UniqueLock;
+    UniqueLock *mLock;
+    Envelope *mFree;
+    size_t mNumFree;
+    size_t mMaxFree;
+    EnvelopePool(const EnvelopePool&);
+    EnvelopePool&operator=(const EnvelopePool&);
+public:
+    EnvelopePool(size_t maxFree=1024);
+    ~EnvelopePool();
+    Envelope *allocate(ObjectHost *parent, const RoutableMessageHeader&header, MemoryReference body);
+    void release(Envelope *envelope);
+};
+
+/**
+ * Intrusive FIFO of Envelopes waiting for one HostedObject.
+ * The mailbox remembers whether a drain is pending so that exactly one is scheduled at a time,
+ * which keeps an object's messages in order however many threads run mailboxes.
+ */
+class SIRIKATA_OH_EXPORT Mailbox {
+    class UniqueLock;
+    UniqueLock *mLock;
+    Envelope *mHead;
+    Envelope *mTail;
+    bool mScheduled;
+    Mailbox(const Mailbox&);
+    Mailbox&operator=(const Mailbox&);
+public:
+    Mailbox();
+    ~Mailbox();
+    ///Appends envelope and returns true if the mailbox was idle, in which case the caller must schedule a drain
+    bool push(Envelope *envelope);
+    ///Takes the oldest envelope, or returns NULL and marks the mailbox idle so the next push schedules it again
+    Envelope *pop();
+    ///Returns every waiting envelope to pool
+    void clear(EnvelopePool &pool);
+};
+
+}
+#endif
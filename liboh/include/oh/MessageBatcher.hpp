@@ -0,0 +1,93 @@
+/*  Sirikata liboh -- Object Host
+ *  MessageBatcher.hpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_MESSAGE_BATCHER_HPP_
+#define _SIRIKATA_MESSAGE_BATCHER_HPP_
+
+#include <oh/Platform.hpp>
+#include <util/SelfWeakPtr.hpp>
+
+namespace Sirikata {
+namespace Task {
+class WorkQueue;
+}
+
+/**
+ * Coalesces the messages hosted objects send through one TopLevelSpaceConnection.
+ * Messages queued on an object's stream are held until the next flush, which sends
+ * a lone message unchanged and several as one Services::MESSAGE_BATCH frame of
+ * vuint32 length-prefixed records for the space to unpack in order.
+ * The space knows an object by its stream, so each stream gets its own frame.
+ * A flush is scheduled on the object host's work queue when the first message arrives,
+ * so everything sent while that queue drains goes out together; ObjectHost::tick flushes as well.
+ * Messages to latency sensitive ports skip the batch after sending whatever their stream had queued.
+ * All methods are thread safe.
+ */
+class SIRIKATA_OH_EXPORT MessageBatcher : public SelfWeakPtr<MessageBatcher> {
+    friend class ::Sirikata::SelfWeakPtr<MessageBatcher>;
+/// Private: Use "SelfWeakPtr<MessageBatcher>::construct<MessageBatcher>(flushQueue)"
+    MessageBatcher(Task::WorkQueue *flushQueue);
+public:
+    ///flushes anything still queued
+    ~MessageBatcher();
+    /// Queues a message with an already serialized header for stream, or sends it now if port must not wait.
+    void send(Network::Stream *stream, MessagePort port, MemoryReference header, MemoryReference body);
+    /// Sends everything queued.
+    void flush();
+    /// Number of messages and of stream writes so far; their ratio is the coalescing achieved.
+    uint64 getMessagesQueued() const;
+    uint64 getWritesSent() const;
+private:
+    class FlushItem;
+    struct Pending {
+        std::string mRecords; ///< vuint32 length followed by header and body, per message
+        size_t mFirstLength; ///< bytes taken by the first record's length prefix
+        size_t mCount;
+        Pending():mFirstLength(0),mCount(0){}
+    };
+    typedef std::tr1::unordered_map<Network::Stream*,Pending> PendingMap;
+    static bool bypassesBatch(MessagePort port);
+    /// Sends one stream's queue and forgets the stream, which may be gone by the next flush. Must hold mLock.
+    void flushStream(PendingMap::iterator where);
+
+    Task::WorkQueue *mFlushQueue;
+    class UniqueLock;
+    UniqueLock *mLock;
+    PendingMap mPending;
+    std::vector<Network::Stream*> mDirty;
+    bool mFlushScheduled;
+    std::string mBatchHeader;
+    uint64 mMessagesQueued;
+    uint64 mWritesSent;
+};
+
+}
+#endif
@@ -43,20 +43,31 @@ class SpaceIDMap;
 class TopLevelSpaceConnection;
 class SpaceConnection;
 class ObjectScriptManager;
+class DeadReckoningTable;
+class InterestTable;
+class Envelope;
+class EnvelopePool;
+class Mailbox;
 namespace Task {
 class WorkQueue;
+class WorkQueueThread;
 }
 class HostedObject;
 typedef std::tr1::weak_ptr<HostedObject> HostedObjectWPtr;
 typedef std::tr1::shared_ptr<HostedObject> HostedObjectPtr;
 
 class SIRIKATA_OH_EXPORT ObjectHost :public MessageService{
+    class UniqueLock;
+    /// Guards the object, space connection, dead reckoning and interest maps, which mailbox threads reach while tick runs.
+    UniqueLock *mLock;
     SpaceIDMap *mSpaceIDMap;
     typedef std::tr1::unordered_multimap<SpaceID,std::tr1::weak_ptr<TopLevelSpaceConnection>,SpaceID::Hasher> SpaceConnectionMap;
     typedef std::tr1::unordered_map<Network::Address,std::tr1::weak_ptr<TopLevelSpaceConnection>,Network::Address::Hasher> AddressConnectionMap;
 
     typedef std::tr1::unordered_map<UUID, HostedObjectPtr, UUID::Hasher> HostedObjectMap;
     typedef std::map<MessagePort, MessageService *> ServicesMap;
+    typedef std::tr1::unordered_map<SpaceID, std::tr1::shared_ptr<DeadReckoningTable>, SpaceID::Hasher> DeadReckoningMap;
+    typedef std::tr1::unordered_map<SpaceID, InterestTable*, SpaceID::Hasher> InterestMap;
     
     SpaceConnectionMap mSpaceConnections;
     AddressConnectionMap mAddressConnections;
@@ -71,6 +82,22 @@ class SIRIKATA_OH_EXPORT ObjectHost :public MessageService{
 
     HostedObjectMap mHostedObjects;
     ServicesMap mServices;
+    DeadReckoningMap mDeadReckoning;
+    InterestMap mInterest;
+    float64 mInterestFullRateSize;
+    Duration mInterestFalloff;
+    Duration mInterestMaxInterval;
+
+    friend class Envelope;
+    class MailboxDrain;
+    EnvelopePool *mEnvelopes;
+    std::vector<Task::WorkQueue*> mMailboxQueues;
+    std::vector<Task::WorkQueueThread*> mMailboxThreads;
+    /// Hands envelope to dest, directly if no mailbox threads run, otherwise through dest's mailbox.
+    void deliver(const HostedObjectPtr &dest, Envelope *envelope);
+    /** The queue whose thread must handle envelope for dest: the message queue for handlers that reach proxies or graphics,
+        otherwise the mailbox thread dest is pinned to. NULL if no mailbox threads run, or if the message queue is gone. */
+    Task::WorkQueue *handlerQueue(const HostedObjectPtr &dest, const Envelope *envelope) const;
 public:
 
     /** Caller is responsible for starting a thread
@@ -127,7 +154,6 @@ public:
     /// Returns the SpaceID -> Network::Address lookup map.
     SpaceIDMap*spaceIDMap(){return mSpaceIDMap;}
 
-    class MessageProcessor;
     ///This method checks if the message is destined for any named mServices. If not, it gives it to mRouter
     void processMessage(const RoutableMessageHeader&header,
                         MemoryReference message_body);
@@ -136,7 +162,31 @@ public:
     ///immediately returns a usable stream for the spaceID. The stream may or may not connect successfully, but will allow queueing messages. The stream will be deallocated if the return value is discarded. In most cases, this should not be called directly.
     std::tr1::shared_ptr<TopLevelSpaceConnection> connectToSpaceAddress(const SpaceID&, const Network::Address&);
 
+    /** Runs the mailboxes of hosted objects on numThreads worker threads rather than on the message queue's thread.
+        Each object is pinned to one thread by its UUID, so its messages keep their order while independent objects
+        run in parallel. Replies, RPCs and persistence messages, whose handlers reach proxies and graphics, still run
+        on the message queue's thread: the object's mailbox moves there for them and back afterwards.
+        With 0 (the default) messages are handled on the message queue's thread as they are routed, and messages
+        from a space on the connection's thread as they arrive. Any nonzero value requires scripts to be thread safe.
+    */
+    void setMailboxThreads(int numThreads);
+    /// Hands a message that arrived over a space connection to dest, in order with the messages routed to it.
+    void deliver(const HostedObjectPtr &dest, const RoutableMessageHeader &header, MemoryReference body);
+    /// Returns the envelopes still waiting in a dying HostedObject's mailbox. Done automatically by ~HostedObject.
+    void releaseMailbox(Mailbox &mailbox);
+    /// Sends location updates for every hosted object that has drifted from what its space extrapolates,
+    /// and the location requests for proxies whose next update has come due, then flushes every MessageBatcher.
     void tick();
+    /** Returns the table batching location updates of the hosted objects connected to space, creating it on first use.
+        Rows should hold on to it weakly: the tables go away with the ObjectHost even if some HostedObject outlives it.
+    */
+    std::tr1::shared_ptr<DeadReckoningTable> getDeadReckoningTable(const SpaceID&space);
+    /// Returns the table pacing location requests for proxies seen in space, creating it on first use. Thread safe.
+    InterestTable *getInterestTable(const SpaceID&space);
+    /** Sets how quickly proxies that look small from their viewers are polled for location updates.
+        @see InterestTable::setPolicy. A fullRateSize of 0 polls every proxy continuously.
+    */
+    void setInterestPolicy(float64 fullRateSize, const Duration&falloff, const Duration&maxInterval);
 
     /** Gets an IO service corresponding to this object host.
         This can be used to schedule timeouts that are guaranteed
@@ -60,6 +60,9 @@ class SIRIKATA_OH_EXPORT LocationAuthority {
 public:
     virtual ~LocationAuthority() {}
     virtual void requestLocation (Time timestamp, const Protocol::ObjLoc& reqLoc) = 0;
+    /** Called after the proxy's location was set by someone other than the authority
+        (ProxyObject::setLocations is how the authority writes back without this call). */
+    virtual void locationChanged (Time timestamp, const Location &newLocation) {}
 };
 }
 #endif
@@ -51,7 +51,7 @@ class ProxyManager;
 
 typedef double AbsTime;
 
-typedef Provider<PositionListener*> PositionProvider;
+typedef SlotProvider<PositionListener*> PositionProvider;
 
 /**
  * This class represents a generic object on a remote server
@@ -162,6 +162,20 @@ public:
     void setLocation(TemporalValue<Location>::Time timeStamp,
                              const Location&location);
 
+    /// One proxy's new location, for setLocations.
+    struct LocationUpdate {
+        ProxyObject *mProxy;
+        TemporalValue<Location>::Time mTime;
+        Location mLocation;
+        LocationUpdate(ProxyObject *proxy, TemporalValue<Location>::Time timeStamp, const Location &location)
+            : mProxy(proxy), mTime(timeStamp), mLocation(location) {}
+    };
+    typedef std::vector<LocationUpdate> LocationUpdateVector;
+    /** Sets the location of every proxy in updates as setLocation would, but only notifies
+        listeners once all of them are set, in a single pass over the batch. Unlike setLocation,
+        this does not call LocationAuthority::locationChanged, so authorities use it to write back. */
+    static void setLocations(const LocationUpdateVector &updates);
+
     static void updateLocationWithObjLoc(
         Location&location,
         const Protocol::ObjLoc& reqLoc);
@@ -34,11 +34,20 @@
 #include <util/Singleton.hpp>
 
 namespace Sirikata {
+namespace Network {
+class TimeSync;
+}
 class SIRIKATA_OH_EXPORT SpaceTimeOffsetManager :public AutoSingleton<SpaceTimeOffsetManager>{public:
     static SpaceTimeOffsetManager&getSingleton();
     static void destroy();
     static const Duration&getSpaceTimeOffset(const SpaceID&);
     static void setSpaceTimeOffset(const SpaceID&, const Duration&);
+    /**
+     * Elects one sampler per space for the whole process so that several connections to a space
+     * do not each probe its clock. Returns true if sampler holds (or has just taken) the claim on the space.
+     * The claim lapses when the claiming sampler is destroyed, at which point the next sampler to ask takes over.
+     */
+    static bool claimSpaceTimeSync(const SpaceID&, const std::tr1::weak_ptr<Network::TimeSync>&sampler);
     SpaceTimeOffsetManager();
     ~SpaceTimeOffsetManager();
     static Time now(const SpaceID&id);
@@ -43,6 +43,7 @@ class HostedObject;
 typedef std::tr1::weak_ptr<HostedObject> HostedObjectWPtr;
 typedef std::tr1::shared_ptr<HostedObject> HostedObjectPtr;
 class ObjectHost;
+class MessageBatcher;
 
 class SIRIKATA_OH_EXPORT TopLevelSpaceConnection :public ObjectHostProxyManager {
     typedef std::tr1::unordered_map<ObjectReference,HostedObjectWPtr,ObjectReference::Hasher> HostedObjectMap;
@@ -50,11 +51,15 @@ class SIRIKATA_OH_EXPORT TopLevelSpaceConnection :public ObjectHostProxyManager
     ObjectHost*mParent;
     Network::Address mRegisteredAddress;
     Network::Stream *mTopLevelStream;
+    class UniqueLock;
+    ///guards mHostedObjects, which objects join from their mailbox threads while messages are routed through it
+    UniqueLock *mHostedObjectsLock;
     HostedObjectMap mHostedObjects;
 
     void removeFromMap();
     static void connectToAddress(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,ObjectHost*oh,const Network::Address*addy);
     std::tr1::shared_ptr<Network::TimeSync> mTimeSync;
+    std::tr1::shared_ptr<MessageBatcher> mBatcher;
   public:
     TopLevelSpaceConnection(Network::IOService*);
     ~TopLevelSpaceConnection();
@@ -71,7 +76,11 @@ class SIRIKATA_OH_EXPORT TopLevelSpaceConnection :public ObjectHostProxyManager
     void registerHostedObject(const ObjectReference &mRef, const HostedObjectPtr &hostedObj);
     void unregisterHostedObject(const ObjectReference &mRef);
     HostedObjectPtr getHostedObject(const ObjectReference &mref) const;
-    const Duration& getServerTimeOffset()const {return mTimeSync->getOffset();};
+    const Duration& getServerTimeOffset()const;
+    ///coalesces what hosted objects send over this connection; NULL until connect is called
+    MessageBatcher *getBatcher() const {
+        return mBatcher.get();
+    }
 };
 /*
 class HostedObjectListener {
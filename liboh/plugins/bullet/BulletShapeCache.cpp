@@ -0,0 +1,425 @@
+/*  Sirikata liboh -- Bullet Graphics Plugin
+ *  BulletShapeCache.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn & Daniel Braxton Miller
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Platform.hpp>
+#include "BulletShapeCache.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <ctime>
+
+namespace Sirikata {
+
+namespace {
+
+/// Starts every block; the vertices follow it, then the indices, then the BVH.
+struct BlockHeader {
+    char mMagic[8];
+    uint32 mEndian;         ///< ENDIAN_MARK as written by this machine
+    uint32 mScalarSize;     ///< sizeof(btScalar), which differs in double precision builds
+    uint32 mNumVertices;
+    uint32 mNumIndices;
+    uint32 mBvhOffset;
+    uint32 mBvhSize;
+    unsigned char mHash[Transfer::Fingerprint::static_size];
+};
+const char BLOCK_MAGIC[8] = {'S','I','R','I','B','V','H','1'};
+const uint32 ENDIAN_MARK = 0x01020304;
+const size_t BLOCK_ALIGNMENT = 16;    ///< Bullet requires it of vertices and of serialized BVHs
+const size_t VERTEX_OFFSET = (sizeof(BlockHeader)+BLOCK_ALIGNMENT-1)&~(BLOCK_ALIGNMENT-1);
+const size_t VERTEX_STRIDE = 4*sizeof(btScalar);
+
+size_t alignBlock(size_t offset) {
+    return (offset+BLOCK_ALIGNMENT-1)&~(BLOCK_ALIGNMENT-1);
+}
+
+const BlockHeader *header(const unsigned char *block) {
+    return reinterpret_cast<const BlockHeader*>(block);
+}
+
+size_t indexOffset(const BlockHeader *hdr) {
+    return VERTEX_OFFSET+hdr->mNumVertices*VERTEX_STRIDE;
+}
+
+}
+
+BulletMesh::BulletMesh(const Transfer::Fingerprint &hash, unsigned char *block, size_t blockSize)
+ :  mHash(hash),
+    mBlock(block),
+    mBlockSize(blockSize),
+    mIndexArray(NULL),
+    mShape(NULL),
+    mBvhInBlock(false) {
+}
+
+BulletMesh::~BulletMesh() {
+    delete mShape;
+    delete mIndexArray;
+    btAlignedFree(mBlock);      /// also holds a deserialized BVH, which owns no memory of its own
+}
+
+int BulletMesh::getNumTriangles() const {
+    return header(mBlock)->mNumIndices/3;
+}
+
+void BulletMesh::createShape(btOptimizedBvh *bvh) {
+    const BlockHeader *hdr = header(mBlock);
+    mIndexArray = new btTriangleIndexVertexArray(
+        hdr->mNumIndices/3,
+        reinterpret_cast<int*>(mBlock+indexOffset(hdr)),
+        sizeof(int)*3,
+        hdr->mNumVertices,
+        reinterpret_cast<btScalar*>(mBlock+VERTEX_OFFSET),
+        VERTEX_STRIDE);
+    if (bvh) {
+        mShape = new btBvhTriangleMeshShape(mIndexArray, true, false);
+        mShape->setOptimizedBvh(bvh);
+        mBvhInBlock = true;
+    }
+    else {
+        /// quantized, with the quantization bounds taken from the mesh itself
+        mShape = new btBvhTriangleMeshShape(mIndexArray, true, true);
+    }
+}
+
+BulletMesh *BulletMesh::build(const Transfer::Fingerprint &hash, const std::vector<double> &vertices, const std::vector<int> &indices) {
+    uint32 numVertices = vertices.size()/3;
+    uint32 numIndices = indices.size()-indices.size()%3;
+    if (numVertices==0 || numIndices==0)
+        return NULL;
+    for (uint32 i=0; i<numIndices; i++) {
+        if (indices[i]<0 || indices[i]>=(int)numVertices) {
+            SILOG(bullet,warning,"BulletMesh: mesh " << hash << " has an index out of range, not building it");
+            return NULL;
+        }
+    }
+    size_t bvhOffset = alignBlock(VERTEX_OFFSET+numVertices*VERTEX_STRIDE+numIndices*sizeof(int));
+    unsigned char *block = (unsigned char*)btAlignedAlloc(bvhOffset, BLOCK_ALIGNMENT);
+    memset(block, 0, bvhOffset);
+    BlockHeader *hdr = reinterpret_cast<BlockHeader*>(block);
+    memcpy(hdr->mMagic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC));
+    hdr->mEndian = ENDIAN_MARK;
+    hdr->mScalarSize = sizeof(btScalar);
+    hdr->mNumVertices = numVertices;
+    hdr->mNumIndices = numIndices;
+    hdr->mBvhOffset = bvhOffset;
+    hdr->mBvhSize = 0;
+    memcpy(hdr->mHash, hash.rawData().data(), sizeof(hdr->mHash));
+    btScalar *vert = reinterpret_cast<btScalar*>(block+VERTEX_OFFSET);
+    for (uint32 i=0; i<numVertices; i++) {
+        vert[i*4] = vertices[i*3];
+        vert[i*4+1] = vertices[i*3+1];
+        vert[i*4+2] = vertices[i*3+2];
+        vert[i*4+3] = 1;
+    }
+    memcpy(block+indexOffset(hdr), &indices[0], numIndices*sizeof(int));
+
+    BulletMesh *mesh = new BulletMesh(hash, block, bvhOffset);
+    mesh->createShape(NULL);
+    return mesh;
+}
+
+BulletMesh *BulletMesh::load(const Transfer::Fingerprint &hash, const std::string &filename) {
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return NULL;
+    BlockHeader hdr;
+    size_t fileSize = 0;
+    bool valid = fread(&hdr, sizeof(hdr), 1, fp)==1
+        && memcmp(hdr.mMagic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC))==0
+        && hdr.mEndian==ENDIAN_MARK
+        && hdr.mScalarSize==sizeof(btScalar)
+        && memcmp(hdr.mHash, hash.rawData().data(), sizeof(hdr.mHash))==0
+        && hdr.mBvhSize>0
+        && hdr.mNumVertices<(1u<<28) && hdr.mNumIndices<(1u<<30)
+        && hdr.mBvhOffset==alignBlock(indexOffset(&hdr)+hdr.mNumIndices*sizeof(int));
+    if (valid) {
+        fseek(fp, 0, SEEK_END);
+        fileSize = ftell(fp);
+        valid = (fileSize==(size_t)hdr.mBvhOffset+hdr.mBvhSize);
+    }
+    unsigned char *block = NULL;
+    if (valid) {
+        block = (unsigned char*)btAlignedAlloc(fileSize, BLOCK_ALIGNMENT);
+        fseek(fp, 0, SEEK_SET);
+        valid = fread(block, fileSize, 1, fp)==1;
+    }
+    fclose(fp);
+    if (!valid) {
+        if (block)
+            btAlignedFree(block);
+        SILOG(bullet,warning,"BulletShapeCache: ignoring stale or corrupt " << filename);
+        return NULL;
+    }
+    const int *indices = reinterpret_cast<const int*>(block+indexOffset(&hdr));
+    for (uint32 i=0; i<hdr.mNumIndices; i++) {
+        if (indices[i]<0 || indices[i]>=(int)hdr.mNumVertices) {
+            btAlignedFree(block);
+            return NULL;
+        }
+    }
+    btQuantizedBvh *bvh = btQuantizedBvh::deSerializeInPlace(block+hdr.mBvhOffset, hdr.mBvhSize, false);
+    if (!bvh) {
+        btAlignedFree(block);
+        return NULL;
+    }
+    BulletMesh *mesh = new BulletMesh(hash, block, fileSize);
+    mesh->createShape(static_cast<btOptimizedBvh*>(bvh));
+    return mesh;
+}
+
+bool BulletMesh::save(const std::string &filename) const {
+    const BlockHeader *hdr = header(mBlock);
+    size_t bvhOffset = hdr->mBvhOffset;
+    unsigned char *out = mBlock;
+    size_t outSize = mBlockSize;
+    if (!mBvhInBlock) {
+        btOptimizedBvh *bvh = mShape->getOptimizedBvh();
+        unsigned bvhSize = bvh->calculateSerializeBufferSize();
+        outSize = bvhOffset+bvhSize;
+        out = (unsigned char*)btAlignedAlloc(outSize, BLOCK_ALIGNMENT);
+        memcpy(out, mBlock, bvhOffset);
+        reinterpret_cast<BlockHeader*>(out)->mBvhSize = bvhSize;
+        if (!bvh->serialize(out+bvhOffset, bvhSize, false)) {
+            btAlignedFree(out);
+            return false;
+        }
+    }
+    std::string tempname = filename+".tmp";
+    FILE *fp = fopen(tempname.c_str(), "wb");
+    bool ok = false;
+    if (fp) {
+        ok = fwrite(out, outSize, 1, fp)==1;
+        ok = (fclose(fp)==0) && ok;
+    }
+    if (out!=mBlock)
+        btAlignedFree(out);
+    if (ok) {
+        std::remove(filename.c_str());
+        ok = std::rename(tempname.c_str(), filename.c_str())==0;
+    }
+    else {
+        std::remove(tempname.c_str());
+    }
+    return ok;
+}
+
+
+BulletMeshShape::BulletMeshShape(const BulletMeshPtr &mesh, const Vector3f &scale)
+ :  mMesh(mesh),
+    mScaled(NULL) {
+    if (scale.x!=1 || scale.y!=1 || scale.z!=1) {
+        mScaled = new btScaledBvhTriangleMeshShape(mesh->getShape(), btVector3(scale.x, scale.y, scale.z));
+    }
+}
+
+BulletMeshShape::~BulletMeshShape() {
+    delete mScaled;
+}
+
+
+BulletShapeCache::BulletShapeCache(const std::string &directory, size_t diskLimit)
+ :  mDirectory(directory),
+    mDiskBytes(0),
+    mDiskLimit(diskLimit),
+    mMemoryHits(0),
+    mDiskHits(0),
+    mBuilds(0),
+    mPurgeAt(64) {
+    if (!mDirectory.empty()) {
+        try {
+            boost::filesystem::create_directories(boost::filesystem::path(mDirectory));
+        }
+        catch (std::exception &e) {
+            SILOG(bullet,error,"BulletShapeCache: not keeping shapes in " << mDirectory << ": " << e.what());
+            mDirectory = std::string();
+        }
+    }
+    if (!mDirectory.empty()) {
+        scanDirectory();
+        trimDirectory();
+    }
+}
+
+void BulletShapeCache::scanDirectory() {
+    using namespace boost::filesystem;
+    std::vector<std::pair<std::time_t, std::string> > found;
+    try {
+        path dir(mDirectory);
+        directory_iterator end;
+        for (directory_iterator di(dir); di!=end; ++di) {
+            if (!is_regular_file(di->status()))
+                continue;
+            std::string name = di->path().string();
+            name = name.substr(name.find_last_of("/\\")+1);
+            if (name.size()>4 && name.compare(name.size()-4, 4, ".tmp")==0) {
+                /// left behind by a run that stopped while saving
+                remove(di->path());
+            }
+            else if (name.size()>4 && name.compare(name.size()-4, 4, ".bvh")==0) {
+                found.push_back(std::pair<std::time_t, std::string>(last_write_time(di->path()), name));
+            }
+        }
+        std::sort(found.begin(), found.end());
+        for (size_t i=0; i<found.size(); i++) {
+            addFile(found[i].second, file_size(dir/found[i].second));
+        }
+    }
+    catch (std::exception &e) {
+        SILOG(bullet,warning,"BulletShapeCache: unable to scan " << mDirectory << ": " << e.what());
+    }
+}
+
+void BulletShapeCache::touchFile(const std::string &name) {
+    DiskMap::iterator where = mDiskFiles.find(name);
+    if (where!=mDiskFiles.end())
+        mDiskOrder.splice(mDiskOrder.end(), mDiskOrder, where->second.mOrder);
+    try {
+        boost::filesystem::last_write_time(boost::filesystem::path(mDirectory)/name, std::time(NULL));
+    }
+    catch (std::exception &) {
+        /// only costs this file its place in the order on the next run
+    }
+}
+
+void BulletShapeCache::addFile(const std::string &name, size_t size) {
+    DiskMap::iterator where = mDiskFiles.find(name);
+    if (where!=mDiskFiles.end()) {
+        mDiskBytes -= where->second.mSize;
+        mDiskOrder.erase(where->second.mOrder);
+        mDiskFiles.erase(where);
+    }
+    DiskFile file;
+    file.mOrder = mDiskOrder.insert(mDiskOrder.end(), name);
+    file.mSize = size;
+    mDiskFiles[name] = file;
+    mDiskBytes += size;
+}
+
+void BulletShapeCache::trimDirectory() {
+    if (mDiskLimit==0)
+        return;
+    while (mDiskBytes>mDiskLimit && !mDiskOrder.empty()) {
+        std::string name = mDiskOrder.front();
+        DiskMap::iterator where = mDiskFiles.find(name);
+        mDiskBytes -= where->second.mSize;
+        mDiskFiles.erase(where);
+        mDiskOrder.pop_front();
+        /// a mesh loaded from the file keeps its own copy of the block
+        std::remove((mDirectory+"/"+name).c_str());
+    }
+}
+
+std::string BulletShapeCache::filename(const Transfer::Fingerprint &hash) const {
+    return mDirectory+"/"+hash.convertToHexString()+".bvh";
+}
+
+void BulletShapeCache::purgeExpired() {
+    if (mMeshes.size()+mShapes.size()<mPurgeAt)
+        return;
+    for (MeshMap::iterator i=mMeshes.begin(); i!=mMeshes.end();) {
+        if (i->second.expired())
+            mMeshes.erase(i++);
+        else
+            ++i;
+    }
+    for (ShapeMap::iterator i=mShapes.begin(); i!=mShapes.end();) {
+        if (i->second.expired())
+            mShapes.erase(i++);
+        else
+            ++i;
+    }
+    mPurgeAt = 2*(mMeshes.size()+mShapes.size())+64;
+}
+
+BulletMeshPtr BulletShapeCache::findMesh(const Transfer::Fingerprint &hash) {
+    MeshMap::iterator where = mMeshes.find(hash);
+    if (where!=mMeshes.end()) {
+        BulletMeshPtr mesh = where->second.lock();
+        if (mesh) {
+            ++mMemoryHits;
+            return mesh;
+        }
+    }
+    if (mDirectory.empty())
+        return BulletMeshPtr();
+    BulletMeshPtr mesh(BulletMesh::load(hash, filename(hash)));
+    if (mesh) {
+        ++mDiskHits;
+        purgeExpired();
+        mMeshes[hash] = mesh;
+        touchFile(hash.convertToHexString()+".bvh");
+    }
+    return mesh;
+}
+
+BulletMeshPtr BulletShapeCache::buildMesh(const Transfer::Fingerprint &hash, const std::vector<double> &vertices, const std::vector<int> &indices) {
+    BulletMeshPtr mesh(BulletMesh::build(hash, vertices, indices));
+    if (!mesh)
+        return mesh;
+    ++mBuilds;
+    purgeExpired();
+    mMeshes[hash] = mesh;
+    if (!mDirectory.empty()) {
+        std::string file = filename(hash);
+        if (mesh->save(file)) {
+            try {
+                addFile(hash.convertToHexString()+".bvh", boost::filesystem::file_size(boost::filesystem::path(file)));
+            }
+            catch (std::exception &) {
+                addFile(hash.convertToHexString()+".bvh", 0);
+            }
+            trimDirectory();
+        }
+        else {
+            SILOG(bullet,warning,"BulletShapeCache: unable to write " << file);
+        }
+    }
+    return mesh;
+}
+
+BulletMeshShapePtr BulletShapeCache::getShape(const BulletMeshPtr &mesh, const Vector3f &scale) {
+    ScaleKey key;
+    key.mHash = mesh->getHash();
+    key.mScale = scale;
+    ShapeMap::iterator where = mShapes.find(key);
+    if (where!=mShapes.end()) {
+        BulletMeshShapePtr shape = where->second.lock();
+        if (shape)
+            return shape;
+    }
+    BulletMeshShapePtr shape(new BulletMeshShape(mesh, scale));
+    purgeExpired();
+    mShapes[key] = shape;
+    return shape;
+}
+
+}
@@ -0,0 +1,178 @@
+/*  Sirikata liboh -- Bullet Graphics Plugin
+ *  BulletShapeCache.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn & Daniel Braxton Miller
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_BULLET_SHAPE_CACHE_
+#define _SIRIKATA_BULLET_SHAPE_CACHE_
+
+#include <util/Platform.hpp>
+#include <transfer/TransferData.hpp>
+#include <transfer/URI.hpp>
+#include "btBulletDynamicsCommon.h"
+#include "BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h"
+
+namespace Sirikata {
+
+/**
+ * The triangles of one mesh and the BVH built over them, unscaled, shared by every
+ * object that uses the mesh.  Vertices, indices and BVH all live in one aligned
+ * block laid out exactly as the block is stored on disk, so a mesh loaded from the
+ * shape cache directory is used in place.
+ */
+class BulletMesh : Noncopyable {
+    Transfer::Fingerprint mHash;
+    unsigned char *mBlock;
+    size_t mBlockSize;
+    btTriangleIndexVertexArray *mIndexArray;
+    btBvhTriangleMeshShape *mShape;
+    bool mBvhInBlock;    ///< the BVH was deserialized into mBlock rather than built by Bullet
+
+    BulletMesh(const Transfer::Fingerprint &hash, unsigned char *block, size_t blockSize);
+    void createShape(btOptimizedBvh *bvh);
+public:
+    ~BulletMesh();
+    /// Builds the BVH over a parsed mesh; returns NULL if the mesh has no triangles.
+    static BulletMesh *build(const Transfer::Fingerprint &hash, const std::vector<double> &vertices, const std::vector<int> &indices);
+    /// Uses a block previously written by save(); returns NULL if it is stale or corrupt.
+    static BulletMesh *load(const Transfer::Fingerprint &hash, const std::string &filename);
+    /// Writes the block, including the quantized BVH in Bullet's serialized form.
+    bool save(const std::string &filename) const;
+
+    const Transfer::Fingerprint &getHash() const {
+        return mHash;
+    }
+    btBvhTriangleMeshShape *getShape() const {
+        return mShape;
+    }
+    int getNumTriangles() const;
+};
+typedef std::tr1::shared_ptr<BulletMesh> BulletMeshPtr;
+
+/// A mesh at one scale: the shared mesh shape itself, or a scaled wrapper around it.
+class BulletMeshShape : Noncopyable {
+    BulletMeshPtr mMesh;
+    btScaledBvhTriangleMeshShape *mScaled;
+public:
+    BulletMeshShape(const BulletMeshPtr &mesh, const Vector3f &scale);
+    ~BulletMeshShape();
+    const BulletMeshPtr &getMesh() const {
+        return mMesh;
+    }
+    btCollisionShape *getShape() const {
+        if (mScaled)
+            return mScaled;
+        return mMesh->getShape();
+    }
+};
+typedef std::tr1::shared_ptr<BulletMeshShape> BulletMeshShapePtr;
+
+/**
+ * Hands out collision shapes for meshes keyed by mesh fingerprint and scale, so objects
+ * sharing a mesh share its triangles and BVH, and objects sharing a scale as well share
+ * the shape.  Entries go away with the last object using them.  Built meshes are written
+ * to a directory so that later runs skip both parsing and the BVH build; the directory is
+ * kept under a size limit by deleting the least recently used files.
+ */
+class BulletShapeCache : Noncopyable {
+    struct ScaleKey {
+        Transfer::Fingerprint mHash;
+        Vector3f mScale;
+        bool operator<(const ScaleKey &other) const {
+            if (mHash != other.mHash)
+                return mHash < other.mHash;
+            if (mScale.x != other.mScale.x)
+                return mScale.x < other.mScale.x;
+            if (mScale.y != other.mScale.y)
+                return mScale.y < other.mScale.y;
+            return mScale.z < other.mScale.z;
+        }
+    };
+    typedef std::tr1::unordered_map<Transfer::Fingerprint, std::tr1::weak_ptr<BulletMesh>, Transfer::Fingerprint::Hasher> MeshMap;
+    typedef std::map<ScaleKey, std::tr1::weak_ptr<BulletMeshShape> > ShapeMap;
+    /// file names in the directory, least recently used first
+    typedef std::list<std::string> DiskOrder;
+    struct DiskFile {
+        DiskOrder::iterator mOrder;
+        size_t mSize;
+    };
+    typedef std::tr1::unordered_map<std::string, DiskFile> DiskMap;
+    MeshMap mMeshes;
+    ShapeMap mShapes;
+    std::string mDirectory;     ///< empty if built meshes are not kept on disk
+    DiskOrder mDiskOrder;
+    DiskMap mDiskFiles;
+    size_t mDiskBytes;
+    size_t mDiskLimit;          ///< 0 for no limit
+    size_t mMemoryHits;
+    size_t mDiskHits;
+    size_t mBuilds;
+    size_t mPurgeAt;            ///< map size at which expired entries are next dropped
+
+    std::string filename(const Transfer::Fingerprint &hash) const;
+    void purgeExpired();
+    void scanDirectory();
+    /// Marks the file as the most recently used, both here and in its modification time for later runs.
+    void touchFile(const std::string &name);
+    void addFile(const std::string &name, size_t size);
+    /// Deletes least recently used files until the directory fits in mDiskLimit.
+    void trimDirectory();
+public:
+    /**
+     * \param directory where built meshes are kept between runs; empty to keep them only in memory
+     * \param diskLimit bytes of meshes kept in directory, 0 for no limit
+     */
+    BulletShapeCache(const std::string &directory, size_t diskLimit);
+
+    /// \returns the mesh with this hash if it is in memory or on disk, or else NULL.
+    BulletMeshPtr findMesh(const Transfer::Fingerprint &hash);
+    /** Builds the mesh with this hash from its parsed vertices and indices, and
+     * writes it to disk for next time.
+     * \returns NULL if the mesh has no triangles
+     */
+    BulletMeshPtr buildMesh(const Transfer::Fingerprint &hash, const std::vector<double> &vertices, const std::vector<int> &indices);
+    /// \returns the shape for mesh at scale, creating it if no other object uses it.
+    BulletMeshShapePtr getShape(const BulletMeshPtr &mesh, const Vector3f &scale);
+
+    size_t getMemoryHits() const {
+        return mMemoryHits;
+    }
+    size_t getDiskHits() const {
+        return mDiskHits;
+    }
+    size_t getBuilds() const {
+        return mBuilds;
+    }
+    size_t getDiskBytes() const {
+        return mDiskBytes;
+    }
+};
+
+}
+#endif
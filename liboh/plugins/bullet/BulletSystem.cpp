@@ -31,6 +31,7 @@
  */
 
 #include <fstream>
+#include <algorithm>
 #include <oh/Platform.hpp>
 #include <oh/SimulationFactory.hpp>
 #include <oh/ProxyObject.hpp>
@@ -113,9 +114,11 @@ void BulletObj::scaleChanged (const Vector3f &newScale) {
     mSizeX = newScale.x;
     mSizeY = newScale.y;
     mSizeZ = newScale.z;
+    if (!mBulletBodyPtr)                /// no shape could be built for this object
+        return;
     float mass;
     btVector3 localInertia(0,0,0);
-    buildBulletShape(NULL, 0, mass);        /// null, 0 means re-use original vertices
+    buildBulletShape(BulletMeshPtr(), mass);        /// null means re-use the current mesh
     if (mDynamic) {                          /// inertia meaningless for static objects
         if (!mShape==ShapeMesh) {
             mColShape->calculateLocalInertia(mass,localInertia);
@@ -211,9 +214,15 @@ void BulletObj::setBulletState(positionOrientation po) {
     mBulletBodyPtr->activate(true);      /// wake up, you lazy slob!
 }
 
-void BulletObj::buildBulletShape(const unsigned char* meshdata, int meshbytes, float &mass) {
-    /// if meshbytes = 0, reuse vertices & indices (for rescaling)
-    if (mColShape) delete mColShape;
+void BulletObj::buildBulletShape(const BulletMeshPtr &mesh, float &mass) {
+    /// if mesh is NULL, reuse the current mesh (for rescaling)
+    BulletMeshPtr source = mesh;
+    if (mMeshShape) {
+        if (!source) source = mMeshShape->getMesh();
+        mMeshShape.reset();                 /// shared; the cache frees it with its last user
+    }
+    else if (mColShape) delete mColShape;
+    mColShape = NULL;
     if (mDynamic) {
         if (mShape == ShapeSphere) {
             DEBUG_OUTPUT(cout << "dbm: shape=sphere " << endl);
@@ -239,75 +248,34 @@ void BulletObj::buildBulletShape(const unsigned char* meshdata, int meshbytes, f
     else {
         /// create a mesh-based static (not dynamic ie forces, though kinematic, ie movable) object
         /// assuming !dynamic; in future, may support dynamic mesh through gimpact collision
-        vector<double> bounds;
-        if (mBtVertices)
-            btAlignedFree(mBtVertices);
-        mBtVertices=NULL;
-        unsigned int i,j;
-
-        if (meshbytes) {
-            mVertices.clear();
-            mIndices.clear();
-            parseOgreMesh parser;
-            parser.parseData(meshdata, meshbytes, mVertices, mIndices, bounds);
-        }
-        DEBUG_OUTPUT (cout << "dbm:mesh " << mVertices.size() << " vertices:" << endl);
-        mBtVertices=(btScalar*)btAlignedAlloc(mVertices.size()/3*sizeof(btScalar)*4,16);
-        for (i=0; i<mVertices.size()/3; i+=1) {
-            DEBUG_OUTPUT ( cout << "dbm:mesh");
-            for (j=0; j<3; j+=1) {
-                DEBUG_OUTPUT (cout <<" " << mVertices[i*3+j]);
-            }
-            mBtVertices[i*4]=mVertices[i*3]*mSizeX;
-            mBtVertices[i*4+1]=mVertices[i*3+1]*mSizeY;
-            mBtVertices[i*4+2]=mVertices[i*3+2]*mSizeZ;
-            mBtVertices[i*4+3]=1;
-            DEBUG_OUTPUT (cout << endl);
-        }
-        DEBUG_OUTPUT (cout << endl);
-        DEBUG_OUTPUT (cout << "dbm:mesh " << mIndices.size() << " indices:");
-        for (i=0; i<mIndices.size(); i++) {
-            DEBUG_OUTPUT (cout << " " << mIndices[i]);
+        /// the triangles and BVH are shared by every object with this mesh; other scales wrap them
+        if (source) {
+            mMeshShape = system->getShapeCache().getShape(source, Vector3f(mSizeX, mSizeY, mSizeZ));
+            mColShape = mMeshShape->getShape();
+            DEBUG_OUTPUT(cout << "dbm: shape=trimesh mColShape: " << mColShape <<
+                         " triangles: " << source->getNumTriangles() << endl);
         }
-        DEBUG_OUTPUT (cout << endl);
-        DEBUG_OUTPUT (cout << "dbm:mesh bounds:");
-        for (i=0; i<bounds.size(); i++) {
-            DEBUG_OUTPUT (cout << " " << bounds[i]);
-        }
-        DEBUG_OUTPUT (cout << endl);
-
-        if (mIndexArray) delete mIndexArray;
-        mIndexArray = new btTriangleIndexVertexArray(
-            mIndices.size()/3,                       // # of triangles (int)
-            &(mIndices[0]),                          // ptr to list of indices (int)
-            sizeof(int)*3,                          // index stride, in bytes (typically 3X sizeof(int) = 12
-            mVertices.size()/3,                      // # of vertices (int)
-            mBtVertices,         // (btScalar*) pointer to vertex list
-            sizeof(btScalar)*4);                     // vertex stride, in bytes
-        btVector3 aabbMin(-10000,-10000,-10000),aabbMax(10000,10000,10000);
-        mColShape  = new btBvhTriangleMeshShape(mIndexArray,false, aabbMin, aabbMax);
-        DEBUG_OUTPUT(cout << "dbm: shape=trimesh mColShape: " << mColShape <<
-                     " triangles: " << mIndices.size()/3 << " verts: " << mVertices.size()/3 << endl);
         mass = 0.0;
     }
 }
 BulletObj::~BulletObj() {
     DEBUG_OUTPUT(cout << "dbm: BulletObj destructor " << this << endl);
-    if (mBtVertices!=NULL)
-        btAlignedFree(mBtVertices);
     if (mMotionState!=NULL) delete mMotionState;
-    if (mIndexArray!=NULL) delete mIndexArray;
-    if (mColShape!=NULL) delete mColShape;
+    if (mColShape!=NULL && !mMeshShape) delete mColShape;
     if (mBulletBodyPtr!=NULL) delete mBulletBodyPtr;
 }
 
-void BulletObj::buildBulletBody(const unsigned char* meshdata, int meshbytes) {
+void BulletObj::buildBulletBody(const BulletMeshPtr &mesh) {
     float mass;
     btTransform startTransform;
     btVector3 localInertia(0,0,0);
     btRigidBody* body;
 
-    buildBulletShape(meshdata, meshbytes, mass);
+    buildBulletShape(mesh, mass);
+    if (!mColShape) {
+        cout << "BulletObj::buildBulletBody: no collision shape for " << mName << ", bullet object will not be built" << endl;
+        return;
+    }
 
     DEBUG_OUTPUT(cout << "dbm: mass = " << mass << endl;)
     if (mDynamic) {
@@ -316,7 +284,7 @@ void BulletObj::buildBulletBody(const unsigned char* meshdata, int meshbytes) {
     startTransform.setIdentity();
     startTransform.setOrigin(btVector3(mInitialPo.p.x, mInitialPo.p.y, mInitialPo.p.z));
     startTransform.setRotation(btQuaternion(mInitialPo.o.x, mInitialPo.o.y, mInitialPo.o.z, mInitialPo.o.w));
-    mMotionState = new btDefaultMotionState(startTransform);
+    mMotionState = new BulletMotionState(this, startTransform);
     btRigidBody::btRigidBodyConstructionInfo rbInfo(mass,mMotionState,mColShape,localInertia);
     body = new btRigidBody(rbInfo);
     body->setFriction(mFriction);
@@ -336,6 +304,9 @@ void BulletObj::buildBulletBody(const unsigned char* meshdata, int meshbytes) {
     mBulletBodyPtr=body;
     mActive=true;
     system->bt2siri[body]=this;
+    /// the proxy may have moved while the mesh was downloading
+    mDirty=true;
+    system->queueObject(this);
 }
 
 void BulletObj::requestLocation(TemporalValue<Location>::Time timeStamp, const Protocol::ObjLoc& reqLoc) {
@@ -360,6 +331,24 @@ void BulletObj::requestLocation(TemporalValue<Location>::Time timeStamp, const P
 //        mBulletBodyPtr->setAngularVelocity(btangvel);
         mDesiredAngularVelocity = btangvel;
     }
+    system->queueObject(this);
+}
+
+void BulletObj::locationChanged(TemporalValue<Location>::Time timeStamp, const Location& newLocation) {
+    /// moved by the user or the network; picked up before the next step
+    mDirty = true;
+    system->queueObject(this);
+}
+
+void BulletMotionState::setWorldTransform(const btTransform& centerOfMassWorldTrans) {
+    /// bullet calls this for sleeping bodies too; only awake ones (or ones that just fell asleep) moved
+    btTransform old = m_graphicsWorldTrans;
+    btDefaultMotionState::setWorldTransform(centerOfMassWorldTrans);
+    btRigidBody* body = mObj->mBulletBodyPtr;
+    if (!mObj->mMoved && body && (body->isActive() || !(old == m_graphicsWorldTrans))) {
+        mObj->mMoved = true;
+        mObj->system->mMovedObjects.push_back(mObj);
+    }
 }
 
 Task::EventResponse BulletSystem::downloadFinished(Task::EventPtr evbase, BulletObj* bullobj) {
@@ -372,10 +361,34 @@ Task::EventResponse BulletSystem::downloadFinished(Task::EventPtr evbase, Bullet
         cout << "BulletSystem::downloadFinished failed, bullet object will not be built" << endl;
     }
     else {
-        Transfer::DenseDataPtr flatData = ev->data().flatten();
-        const unsigned char* realData = flatData->data();
-        DEBUG_OUTPUT (cout << "dbm downloadFinished: data: " << (char*)&realData[2] << endl);
-        bullobj->buildBulletBody(realData, ev->data().length());
+        /// objects sharing a mesh share its shape, and meshes built in earlier runs are read back
+        /// with their BVH instead of being parsed and built again
+        Transfer::Fingerprint hash = ev->fingerprint();
+        Transfer::DenseDataPtr flatData;
+        if (hash == Transfer::Fingerprint::null()) {
+            flatData = ev->data().flatten();
+            hash = Transfer::Fingerprint::computeDigest(flatData->data(), ev->data().length());
+        }
+        BulletMeshPtr mesh = mShapeCache->findMesh(hash);
+        if (!mesh) {
+            if (!flatData) flatData = ev->data().flatten();
+            const unsigned char* realData = flatData->data();
+            DEBUG_OUTPUT (cout << "dbm downloadFinished: data: " << (char*)&realData[2] << endl);
+            vector<double> vertices;
+            vector<int> indices;
+            vector<double> bounds;
+            parseOgreMesh parser;
+            parser.parseData(realData, ev->data().length(), vertices, indices, bounds);
+            mesh = mShapeCache->buildMesh(hash, vertices, indices);
+        }
+        DEBUG_OUTPUT (cout << "dbm: shape cache: memory hits " << mShapeCache->getMemoryHits()
+                      << " disk hits " << mShapeCache->getDiskHits() << " built " << mShapeCache->getBuilds() << endl);
+        if (mesh) {
+            bullobj->buildBulletBody(mesh);
+        }
+        else {
+            cout << "BulletSystem::downloadFinished: mesh has no usable triangles, bullet object will not be built" << endl;
+        }
     }
     return Task::EventResponse::del();
 }
@@ -397,7 +410,7 @@ void BulletSystem::addPhysicalObject(BulletObj* obj,
     DEBUG_OUTPUT(cout << "dbm: adding active object: " << obj << " shape: " << (int)obj->mShape << endl);
     if (obj->mDynamic) {
         /// create the object now
-        obj->buildBulletBody(NULL, 0);                /// no mesh data
+        obj->buildBulletBody(BulletMeshPtr());        /// no mesh data
     }
     else {
         /// set up a mesh download; callback (downloadFinished) calls buildBulletBody and completes object
@@ -417,12 +430,25 @@ void BulletSystem::removePhysicalObject(BulletObj* obj) {
             if (objects[i]->mActive) {
                 dynamicsWorld->removeRigidBody(obj->mBulletBodyPtr);
             }
+            if (obj->mQueued) {
+                mQueuedObjects.erase(std::find(mQueuedObjects.begin(), mQueuedObjects.end(), obj));
+            }
+            if (obj->mMoved) {
+                mMovedObjects.erase(std::find(mMovedObjects.begin(), mMovedObjects.end(), obj));
+            }
             delete obj;
             break;
         }
     }
 }
 
+void BulletSystem::queueObject(BulletObj* obj) {
+    if (!obj->mQueued) {
+        obj->mQueued = true;
+        mQueuedObjects.push_back(obj);
+    }
+}
+
 float btMagSq(const btVector3& v) {
     return v.x() * v.x()
            + v.y() * v.y()
@@ -444,53 +470,74 @@ bool BulletSystem::tick() {
         lasttime = now;
         if ((now-mStartTime) > Duration::seconds(20.0)) {
 
-            /// main object loop
-            for (unsigned int i=0; i<objects.size(); i++) {
-                if (objects[i]->mActive) {
-
-                    /// if object has been moved, reset bullet position accordingly
-                    if (objects[i]->mMeshptr->getPosition() != objects[i]->getBulletState().p ||
-                            objects[i]->mMeshptr->getOrientation() != objects[i]->getBulletState().o) {
-                        DEBUG_OUTPUT(cout << "    dbm: object, " << objects[i]->mName << " moved by user!"
-                                     << " meshpos: " << objects[i]->mMeshptr->getPosition()
-                                     << " bulletpos before reset: " << objects[i]->getBulletState().p;)
-                        objects[i]->setBulletState(
+            /// only objects moved from outside or under PID control need attention before the step
+            unsigned int kept=0;
+            for (unsigned int i=0; i<mQueuedObjects.size(); i++) {
+                BulletObj* obj=mQueuedObjects[i];
+                if (!obj->mActive) {            /// no body (yet); buildBulletBody queues it again
+                    obj->mQueued=false;
+                    continue;
+                }
+
+                /// if object has been moved, reset bullet position accordingly
+                if (obj->mDirty) {
+                    obj->mDirty=false;
+                    po = obj->getBulletState();
+                    if (obj->mMeshptr->getPosition() != po.p ||
+                            obj->mMeshptr->getOrientation() != po.o) {
+                        DEBUG_OUTPUT(cout << "    dbm: object, " << obj->mName << " moved by user!"
+                                     << " meshpos: " << obj->mMeshptr->getPosition()
+                                     << " bulletpos before reset: " << po.p;)
+                        obj->setBulletState(
                             positionOrientation (
-                                objects[i]->mMeshptr->getPosition(),
-                                objects[i]->mMeshptr->getOrientation()
+                                obj->mMeshptr->getPosition(),
+                                obj->mMeshptr->getOrientation()
                             ));
-                        DEBUG_OUTPUT(cout << "bulletpos after reset: " << objects[i]->getBulletState().p << endl;)
+                        DEBUG_OUTPUT(cout << "bulletpos after reset: " << obj->getBulletState().p << endl;)
                     }
+                }
 
-                    /// if object under PID control, control it
-                    if (objects[i]->mPIDControlEnabled) {
+                /// if object under PID control, control it
+                if (obj->mPIDControlEnabled) {
 
-                        /// this is not yet a real PID controller!  YMMV
-                        objects[i]->mBulletBodyPtr->setLinearVelocity(objects[i]->mDesiredLinearVelocity);
-                        objects[i]->mBulletBodyPtr->setAngularVelocity(objects[i]->mDesiredAngularVelocity);
+                    /// this is not yet a real PID controller!  YMMV
+                    obj->mBulletBodyPtr->setLinearVelocity(obj->mDesiredLinearVelocity);
+                    obj->mBulletBodyPtr->setAngularVelocity(obj->mDesiredAngularVelocity);
+                    obj->mBulletBodyPtr->activate(true);
 
-                        /// bit of a hack: if both linear & angular vel are zero, release control (so gravity & inertia can have fun)
-                        if ( (btMagSq(objects[i]->mDesiredLinearVelocity) < 0.001f) &&
-                                (btMagSq(objects[i]->mDesiredAngularVelocity) < 0.001f) ) {
-                            objects[i]->mPIDControlEnabled=false;
-                        }
+                    /// bit of a hack: if both linear & angular vel are zero, release control (so gravity & inertia can have fun)
+                    if ( (btMagSq(obj->mDesiredLinearVelocity) < 0.001f) &&
+                            (btMagSq(obj->mDesiredAngularVelocity) < 0.001f) ) {
+                        obj->mPIDControlEnabled=false;
                     }
                 }
+                if (obj->mPIDControlEnabled) {
+                    mQueuedObjects[kept++]=obj;
+                }
+                else {
+                    obj->mQueued=false;
+                }
             }
+            mQueuedObjects.resize(kept);
+
+            /// BulletMotionState fills mMovedObjects with the bodies that were awake for this step
             dynamicsWorld->stepSimulation(delta.toSeconds(),Duration::seconds(10).toSeconds());
 
-            for (unsigned int i=0; i<objects.size(); i++) {
-                if (objects[i]->mActive) {
-                    po = objects[i]->getBulletState();
-                    DEBUG_OUTPUT(cout << "    dbm: object, " << objects[i]->mName << ", delta, "
-                                 << delta.toSeconds() << ", newpos, " << po.p << "obj: " << objects[i] << endl);
-                    Time remoteNow=Time::convertFrom(now,SpaceTimeOffsetManager::getSingleton().getSpaceTimeOffset(objects[i]->mMeshptr->getObjectReference().space()));
-                    Location loc (objects[i]->mMeshptr->globalLocation(remoteNow));
-                    loc.setPosition(po.p);
-                    loc.setOrientation(po.o);
-                    objects[i]->mMeshptr->setLocation(remoteNow, loc);
-                }
+            mLocationUpdates.clear();
+            for (unsigned int i=0; i<mMovedObjects.size(); i++) {
+                BulletObj* obj=mMovedObjects[i];
+                obj->mMoved=false;
+                po = obj->getBulletState();
+                DEBUG_OUTPUT(cout << "    dbm: object, " << obj->mName << ", delta, "
+                             << delta.toSeconds() << ", newpos, " << po.p << "obj: " << obj << endl);
+                Time remoteNow=Time::convertFrom(now,SpaceTimeOffsetManager::getSingleton().getSpaceTimeOffset(obj->getSpaceID()));
+                Location loc (obj->mMeshptr->globalLocation(remoteNow));
+                loc.setPosition(po.p);
+                loc.setOrientation(po.o);
+                mLocationUpdates.push_back(ProxyObject::LocationUpdate(&*obj->mMeshptr, remoteNow, loc));
             }
+            mMovedObjects.clear();
+            ProxyObject::setLocations(mLocationUpdates);
 
             /// test queryRay
             /*
@@ -506,12 +553,9 @@ bool BulletSystem::tick() {
             */
 
             /// collision messages
-            std::map<ObjectReference,RoutableMessageBody> mBeginCollisionMessagesToSend;
-            std::map<ObjectReference,RoutableMessageBody> mEndCollisionMessagesToSend;
-            BulletObj* anExampleCollidingMesh=NULL;
             for (customDispatch::CollisionPairMap::iterator i=dispatcher->collisionPairs.begin();
                     i != dispatcher->collisionPairs.end(); /*increment in if*/) {
-                BulletObj* b0=anExampleCollidingMesh=i->first.getLower();
+                BulletObj* b0=i->first.getLower();
                 BulletObj* b1=i->first.getHigher();
                 ObjectReference b0id=b0->getObjectReference();
                 ObjectReference b1id=b1->getObjectReference();
@@ -520,8 +564,6 @@ bool BulletSystem::tick() {
                 if (i->second.collidedThisFrame()) {             /// recently colliding; send msg & change mode
                     if (!i->second.collidedLastFrame()) {
                         if (b1->colMsg & b0->colMask) {
-                            RoutableMessageBody *body=&mBeginCollisionMessagesToSend[b1id];
-
                             Physics::Protocol::CollisionBegin collide;
                             collide.set_timestamp(spaceNow);
                             collide.set_other_object_reference(b0id.getAsUUID());
@@ -532,13 +574,12 @@ bool BulletSystem::tick() {
                                 collide.add_impulse(iter->mAppliedImpulse);
 
                             }
-                            collide.SerializeToString(body->add_message("BegCol"));
+                            mCollisionMessages.push_back(CollisionMessage(false, b1->mMeshptr->getObjectReference()));
+                            collide.SerializeToString(&mCollisionMessages.back().mBody);
                             cout << "   begin collision msg: " << b0->mName << " --> " << b1->mName
                             << " time: " << (Task::LocalTime::now()-mStartTime).toSeconds() << endl;
                         }
                         if (b0->colMsg & b1->colMask) {
-                            RoutableMessageBody *body=&mBeginCollisionMessagesToSend[b0id];
-
                             Physics::Protocol::CollisionBegin collide;
                             collide.set_timestamp(spaceNow);
                             collide.set_other_object_reference(b1id.getAsUUID());
@@ -549,7 +590,8 @@ bool BulletSystem::tick() {
                                 collide.add_impulse(iter->mAppliedImpulse);
 
                             }
-                            collide.SerializeToString(body->add_message("BegCol"));
+                            mCollisionMessages.push_back(CollisionMessage(false, b0->mMeshptr->getObjectReference()));
+                            collide.SerializeToString(&mCollisionMessages.back().mBody);
                             cout << "   begin collision msg: " << b1->mName << " --> " << b0->mName
                             << " time: " << (Task::LocalTime::now()-mStartTime).toSeconds() << endl;
                         }
@@ -560,50 +602,56 @@ bool BulletSystem::tick() {
                 else {        /// didn't get flagged again; collision now over
                     assert(i->second.collidedLastFrame());
                     if (b1->colMsg & b0->colMask) {
-                        RoutableMessageBody *body=&mEndCollisionMessagesToSend[b1id];
-
                         Physics::Protocol::CollisionEnd collide;
                         collide.set_timestamp(spaceNow);
                         collide.set_other_object_reference(b0id.getAsUUID());
-                        collide.SerializeToString(body->add_message("EndCol"));
+                        mCollisionMessages.push_back(CollisionMessage(true, b1->mMeshptr->getObjectReference()));
+                        collide.SerializeToString(&mCollisionMessages.back().mBody);
 
                         cout << "     end collision msg: " << b0->mName << " --> " << b1->mName
                         << " time: " << (Task::LocalTime::now()-mStartTime).toSeconds() << endl;
                     }
                     if (b0->colMsg & b1->colMask) {
-                        RoutableMessageBody *body=&mEndCollisionMessagesToSend[b0id];
-
                         Physics::Protocol::CollisionEnd collide;
                         collide.set_timestamp(spaceNow);
                         collide.set_other_object_reference(b1id.getAsUUID());
-                        collide.SerializeToString(body->add_message("EndCol"));
+                        mCollisionMessages.push_back(CollisionMessage(true, b0->mMeshptr->getObjectReference()));
+                        collide.SerializeToString(&mCollisionMessages.back().mBody);
                         cout << "     end collision msg: " << b1->mName << " --> " << b0->mName
                         << " time: " << (Task::LocalTime::now()-mStartTime).toSeconds() << endl;
                     }
                     dispatcher->collisionPairs.erase(i++);
                 }
-                for (std::map<ObjectReference,RoutableMessageBody>*whichMessages=&mBeginCollisionMessagesToSend;true;whichMessages=&mEndCollisionMessagesToSend) {//send all items from map 1, then all items from map 2 (for loop of size 2)
-                    for (std::map<ObjectReference,RoutableMessageBody>::iterator iter=whichMessages->begin(),iterend=whichMessages->end();iter!=iterend;++iter) {
-                        RoutableMessageHeader hdr;
-                        hdr.set_destination_object(iter->first);
-                        hdr.set_destination_space(anExampleCollidingMesh->getSpaceID());
-                        hdr.set_source_object(ObjectReference::spaceServiceID());
-                        hdr.set_source_port(Services::PHYSICS);
-                        std::string body;
-                        iter->second.SerializeToString(&body);
-                        sendMessage(hdr,MemoryReference(body));
-                    }
-                    if (whichMessages==&mEndCollisionMessagesToSend) {
-                        break;
-                    }
-                }
             }
+            sendCollisionMessages();
         }
     }
     DEBUG_OUTPUT(cout << endl;)
     return true;
 }
 
+void BulletSystem::sendCollisionMessages() {
+    /// one sort puts all begin messages before all end messages, grouped by destination
+    std::sort(mCollisionMessages.begin(), mCollisionMessages.end());
+    for (vector<CollisionMessage>::const_iterator iter=mCollisionMessages.begin(),iterend=mCollisionMessages.end();iter!=iterend;) {
+        RoutableMessageBody body;
+        vector<CollisionMessage>::const_iterator next=iter;
+        for (; next!=iterend && next->mEnd==iter->mEnd && next->mDestination==iter->mDestination; ++next) {
+            body.add_message(next->mEnd?"EndCol":"BegCol", next->mBody);
+        }
+        RoutableMessageHeader hdr;
+        hdr.set_destination_object(iter->mDestination.object());
+        hdr.set_destination_space(iter->mDestination.space());
+        hdr.set_source_object(ObjectReference::spaceServiceID());
+        hdr.set_source_port(Services::PHYSICS);
+        std::string serialized;
+        body.SerializeToString(&serialized);
+        sendMessage(hdr,MemoryReference(serialized));
+        iter=next;
+    }
+    mCollisionMessages.clear();
+}
+
 void customDispatch::ActiveCollisionState::collide(BulletObj* first, BulletObj* second, btPersistentManifold *currentCollisionManifold) {
     bool flipped= !(first<second);
     //so we can save the normals
@@ -676,10 +724,13 @@ bool BulletSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, con
     mTempTferManager = new OptionValue("transfermanager","0", OptionValueType<void*>(),"dummy");
     mWorkQueue = new OptionValue("workqueue","0",OptionValueType<void*>(),"Memory address of the WorkQueue");
     mEventManager = new OptionValue("eventmanager","0",OptionValueType<void*>(),"Memory address of the EventManager<Event>");
-    InitializeClassOptions("bulletphysics",this, mTempTferManager, mWorkQueue, mEventManager, NULL);
+    mShapeCacheDirectory = new OptionValue("shape-cache","Cache/bullet",OptionValueType<String>(),"Directory where mesh collision shapes are kept between runs; empty to rebuild them every run");
+    mShapeCacheSize = new OptionValue("shape-cache-size","256",OptionValueType<uint32>(),"Megabytes of collision shapes kept in the shape cache directory, least recently used dropped first; 0 for no limit");
+    InitializeClassOptions("bulletphysics",this, mTempTferManager, mWorkQueue, mEventManager, mShapeCacheDirectory, mShapeCacheSize, NULL);
     OptionSet::getOptions("bulletphysics",this)->parse(options);
     Transfer::TransferManager* tm = (Transfer::TransferManager*)mTempTferManager->as<void*>();
     this->transferManager = tm;
+    mShapeCache = new BulletShapeCache(mShapeCacheDirectory->as<String>(), (size_t)mShapeCacheSize->as<uint32>()*1024*1024);
 
     groundlevel = 0.0;
     btTransform groundTransform;
@@ -720,7 +771,8 @@ bool BulletSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, con
 
 BulletSystem::BulletSystem() :
         mGravity(0, GRAVITY, 0),
-        mStartTime(Task::LocalTime::now()) {
+        mStartTime(Task::LocalTime::now()),
+        mShapeCache(NULL) {
     DEBUG_OUTPUT(cout << "dbm: I am the BulletSystem constructor!" << endl);
 }
 
@@ -734,6 +786,7 @@ BulletSystem::~BulletSystem() {
     delete collisionConfiguration;
     delete groundBody;
     delete groundShape;
+    delete mShapeCache;         /// objects still holding shapes keep them alive
     DEBUG_OUTPUT(cout << "dbm: BulletSystem destructor finished" << endl;)
 }
 
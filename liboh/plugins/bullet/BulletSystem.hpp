@@ -46,6 +46,7 @@
 #include <options/Options.hpp>
 #include <transfer/TransferManager.hpp>
 #include "btBulletDynamicsCommon.h"
+#include "BulletShapeCache.hpp"
 
 #define GRAVITY (-9.8f)
 
@@ -221,11 +222,8 @@ public:
         this->vertices = &vertices;
         this->indices = &indices;
         this->bounds = &bounds;
-        data.clear();
+        data.assign(rawdata, rawdata+bytes);
         ix=0;
-        for (int i=0; i<bytes; i++) {
-            data.push_back(rawdata[i]);
-        }
 //        data.pop_back();                                    // why? whence extra byte?
         printf("read data %d bytes\n", (int32)data.size());
         read_chunks(data.size());
@@ -281,7 +279,20 @@ Vector3f normalFromBullet(const btVector3&bt) {
     return Vector3f(bt.x(),bt.y(),bt.z());
 }
 
+class BulletObj;
+/// motion state that tells the BulletSystem which awake bodies bullet moved during a step
+class BulletMotionState : public btDefaultMotionState {
+    BulletObj* mObj;
+public:
+    BulletMotionState(BulletObj* obj, const btTransform& startTrans) :
+            btDefaultMotionState(startTrans),
+            mObj(obj) {
+    }
+    virtual void setWorldTransform(const btTransform& centerOfMassWorldTrans);
+};
+
 class BulletObj : public MeshListener, LocationAuthority, Noncopyable {
+    friend class BulletMotionState;
     friend class BulletSystem;
     enum shapeID {
         ShapeMesh,
@@ -293,18 +304,19 @@ class BulletObj : public MeshListener, LocationAuthority, Noncopyable {
     BulletSystem* system;
 
     void requestLocation(TemporalValue<Location>::Time timeStamp, const Protocol::ObjLoc& reqLoc);
+    void locationChanged(TemporalValue<Location>::Time timeStamp, const Location& newLocation);
 
-    /// these guys seem to need to stay around for the lifetime of the object.  Otherwise we crash
-    btScalar* mBtVertices;//<-- this dude must be aligned on 16 byte boundaries
-    vector<double> mVertices;
-    vector<int> mIndices;
-    btTriangleIndexVertexArray* mIndexArray;
+    /// mesh shape shared with every object of the same mesh and scale; mColShape points into it
+    BulletMeshShapePtr mMeshShape;
     btDefaultMotionState* mMotionState;
     float mDensity;
     float mFriction;
     float mBounce;
     bool mActive;              /// anything that bullet sees is active
     bool mDynamic;             /// but only some are dynamic (affected by forces)
+    bool mDirty;               /// moved by someone other than bullet since the last tick
+    bool mQueued;              /// in BulletSystem::mQueuedObjects
+    bool mMoved;               /// in BulletSystem::mMovedObjects
     shapeID mShape;
     positionOrientation mInitialPo;
     Vector3d mVelocity;
@@ -331,11 +343,12 @@ public:
 
     /// public methods
     BulletObj(BulletSystem* sys) :
-            mBtVertices(NULL),
-            mIndexArray(NULL),
             mMotionState(NULL),
             mActive(false),
             mDynamic(false),
+            mDirty(false),
+            mQueued(false),
+            mMoved(false),
             mVelocity(Vector3d()),
             mBulletBodyPtr(NULL),
             mColShape(NULL),
@@ -352,8 +365,10 @@ public:
     const SpaceID& getSpaceID()const;
     positionOrientation getBulletState();
     void setBulletState(positionOrientation pq);
-    void buildBulletBody(const unsigned char*, int);
-    void buildBulletShape(const unsigned char* meshdata, int meshbytes, float& mass);
+    /// mesh is NULL for dynamic objects, whose shapes are primitives
+    void buildBulletBody(const BulletMeshPtr &mesh);
+    /// a NULL mesh reuses the current one (for rescaling)
+    void buildBulletShape(const BulletMeshPtr &mesh, float& mass);
     BulletSystem * getBulletSystem() {
         return system;
     }
@@ -451,6 +466,7 @@ public:
 };
 
 class BulletSystem: public TimeSteppedQueryableSimulation {
+    friend class BulletMotionState;
     bool initialize(Provider<ProxyCreationListener*>*proxyManager,
                     const String&options);
     Vector3f mGravity;
@@ -458,7 +474,10 @@ class BulletSystem: public TimeSteppedQueryableSimulation {
     OptionValue* mTempTferManager;
     OptionValue* mWorkQueue;
     OptionValue* mEventManager;
+    OptionValue* mShapeCacheDirectory;
+    OptionValue* mShapeCacheSize;
     Task::LocalTime mStartTime;
+    BulletShapeCache* mShapeCache;
 
     ///local bullet stuff:
     btDefaultCollisionConfiguration* collisionConfiguration;
@@ -467,11 +486,35 @@ class BulletSystem: public TimeSteppedQueryableSimulation {
     btSequentialImpulseConstraintSolver* solver;
     btCollisionShape* groundShape;
     btRigidBody* groundBody;
+    ///new locations of the moved objects, reused every tick to notify their listeners in one batch
+    ProxyObject::LocationUpdateVector mLocationUpdates;
+    ///objects moved from outside or under PID control; only these are looked at before a step
+    vector<BulletObj*> mQueuedObjects;
+    ///awake bodies bullet moved during the last step; only these are written back
+    vector<BulletObj*> mMovedObjects;
+    /// one collision message; sorted by kind and destination so each destination gets one body per kind
+    struct CollisionMessage {
+        bool mEnd;
+        SpaceObjectReference mDestination;
+        std::string mBody;
+        CollisionMessage(bool end, const SpaceObjectReference& destination) :
+                mEnd(end),
+                mDestination(destination) {
+        }
+        bool operator < (const CollisionMessage& other) const {
+            if (mEnd!=other.mEnd) return other.mEnd;
+            return mDestination<other.mDestination;
+        }
+    };
+    ///collision messages of the current tick, reused every tick
+    vector<CollisionMessage> mCollisionMessages;
+    void sendCollisionMessages();
 
 
 public:
     BulletSystem();
     Vector3f getGravity() { return mGravity; };
+    BulletShapeCache& getShapeCache() { return *mShapeCache; }
     std::tr1::unordered_map<btCollisionObject*, BulletObj*> bt2siri;  /// map bullet bodies (what we get in the callbacks) to BulletObj's
     btDiscreteDynamicsWorld* dynamicsWorld;
     vector<BulletObj*>objects;
@@ -482,6 +525,8 @@ public:
                            float density, float friction, float bounce, Vector3f hull,
                            float sizx, float sizy, float sizz);
     void removePhysicalObject(BulletObj*);
+    /// make sure obj is looked at before the next step (it was moved externally or is PID controlled)
+    void queueObject(BulletObj* obj);
     static TimeSteppedQueryableSimulation* create(Provider<ProxyCreationListener*>*proxyManager,
             const String&options) {
         BulletSystem*os= new BulletSystem;
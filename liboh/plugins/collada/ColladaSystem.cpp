@@ -34,29 +34,269 @@
 
 //#include <oh/SimulationFactory.hpp>
 //#include <oh/ProxyObject.hpp>
-//#include <options/Options.hpp>
-//#include <transfer/TransferManager.hpp>
+#include <options/Options.hpp>
+#include <util/ColladaGeometry.hpp>
 
+#include <boost/thread.hpp>
 #include <iostream>
 
 namespace Sirikata { namespace Models {
 
+/// Lets a callback use the system only while it exists, and makes its destruction wait for callbacks using it.
+class ColladaSystem::Alive {
+        boost::mutex mLock;
+        boost::condition_variable mIdle;
+        ColladaSystem* mSystem;
+        int mUsers;
+    public:
+        Alive ( ColladaSystem* system )
+            :   mSystem ( system ), mUsers ( 0 )
+        {
+        }
+
+        /// Waits for callbacks using the system to return; later ones find it gone.
+        void kill ()
+        {
+            boost::unique_lock< boost::mutex > lock ( mLock );
+            mSystem = NULL;
+            while ( mUsers )
+                mIdle.wait ( lock );
+        }
+
+        /// The system for as long as this is in scope, or NULL if it was destroyed.
+        class Use {
+                AlivePtr mAlive;
+                ColladaSystem* mSystem;
+            public:
+                Use ( AlivePtr const& alive )
+                    :   mAlive ( alive )
+                {
+                    boost::unique_lock< boost::mutex > lock ( mAlive->mLock );
+                    mSystem = mAlive->mSystem;
+                    if ( mSystem )
+                        ++mAlive->mUsers;
+                }
+
+                ~Use ()
+                {
+                    if ( !mSystem )
+                        return;
+                    boost::unique_lock< boost::mutex > lock ( mAlive->mLock );
+                    if ( --mAlive->mUsers == 0 )
+                        mAlive->mIdle.notify_all ();
+                }
+
+                ColladaSystem* get () const
+                {
+                    return mSystem;
+                }
+        };
+};
+
+/// Parses a downloaded document or decodes a cached mesh off the thread that delivered it.
+class ColladaSystem::LoadTask : public Task::WorkItem {
+        AlivePtr mAlive;
+        MeshCallback mCallback;
+        Transfer::RemoteFileId mDocument;
+        Transfer::DenseDataPtr mData;
+        bool mIsDocument;
+    public:
+        LoadTask ( AlivePtr const& alive, MeshCallback const& callback, Transfer::RemoteFileId const& document,
+                   Transfer::DenseDataPtr const& data, bool isDocument )
+            :   mAlive ( alive ), mCallback ( callback ), mDocument ( document ), mData ( data ), mIsDocument ( isDocument )
+        {
+        }
+
+        virtual void operator () ()
+        {
+            AutoPtr deleteMe ( this );
+            Alive::Use use ( mAlive );
+            if ( use.get () )
+                use.get ()->load ( mCallback, mDocument, mData, mIsDocument );
+        }
+};
+
 ColladaSystem::ColladaSystem ()
+    :   mTransferManagerOption ( NULL ),
+        mParseThreads ( NULL ),
+        mMeshLevels ( NULL ),
+        mTransferManager ( NULL ),
+        mParseQueueThreads ( NULL ),
+        mAlive ( new Alive ( this ) )
 {
-        
+
 }
-    
+
 ColladaSystem::~ColladaSystem ()
 {
-    std::cout << "MCB: CollataSystem::~ColladaSystem() entered" << std::endl;        
+    // load tasks still queued run after this and find the system gone
+    mAlive->kill ();
+    if ( mParseQueueThreads )
+        mParseQueue.destroyWorkerThreads ( mParseQueueThreads );
+}
+
+bool ColladaSystem::initialize ( String const& options )
+{
+    mTransferManagerOption = new OptionValue ( "transfermanager", "0", OptionValueType< void* > (), "Memory address of the TransferManager" );
+    mParseThreads = new OptionValue ( "parse-threads", "1", OptionValueType< int > (), "Number of threads documents are parsed on" );
+    mMeshLevels = new OptionValue ( "mesh-levels", "1", OptionValueType< int > (), "Number of progressive levels meshes are cached with" );
+    InitializeClassOptions ( "colladamodels", this, mTransferManagerOption, mParseThreads, mMeshLevels, NULL );
+    OptionSet::getOptions ( "colladamodels", this )->parse ( options );
+
+    mTransferManager = static_cast< Transfer::TransferManager* > ( mTransferManagerOption->as< void* > () );
+    if ( !mTransferManager )
+    {
+        SILOG ( collada, error, "ColladaSystem needs a transfermanager option" );
+        return false;
+    }
+    int threads = mParseThreads->as< int > ();
+    mParseQueueThreads = mParseQueue.createWorkerThreads ( threads > 0 ? threads : 1 );
+    return true;
 }
 
 ColladaSystem* ColladaSystem::create ( String const& options )
 {
-    std::cout << "MCB: CollataSystem::create( " << options << ") entered" << std::endl; throw;
-    return new ColladaSystem;
+    ColladaSystem* system = new ColladaSystem;
+    if ( system->initialize ( options ) )
+        return system;
+    delete system;
+    return NULL;
+}
+
+Transfer::Fingerprint ColladaSystem::meshFingerprint ( Transfer::Fingerprint const& document ) const
+{
+    // the level count is part of the key so meshes cached with other settings are not reused
+    std::ostringstream key;
+    key << "colladamodels/pmesh/" << mMeshLevels->as< int > () << '/' << document.convertToHexString ();
+    return Transfer::Fingerprint::computeDigest ( key.str () );
+}
+
+void ColladaSystem::loadMesh ( Transfer::URI const& uri, MeshCallback const& callback )
+{
+    // despite its name, isNameURI is true of hash URIs, which need no lookup
+    if ( mTransferManager->isNameURI ( uri ) )
+    {
+        Transfer::RemoteFileId document;
+        try
+        {
+            document = Transfer::RemoteFileId ( uri );
+        }
+        catch ( std::invalid_argument& )
+        {
+            documentNamed ( callback, uri, NULL );
+            return;
+        }
+        documentNamed ( callback, uri, &document );
+    }
+    else
+    {
+        mTransferManager->downloadName ( uri,
+            std::tr1::bind ( &ColladaSystem::named, mAlive, callback, _1, _2 ) );
+    }
+}
+
+void ColladaSystem::named ( AlivePtr alive, MeshCallback callback, Transfer::URI const& uri, Transfer::RemoteFileId const* document )
+{
+    Alive::Use use ( alive );
+    if ( use.get () )
+        use.get ()->documentNamed ( callback, uri, document );
+}
+
+Task::EventResponse ColladaSystem::downloaded ( AlivePtr alive, DownloadHandler handler, MeshCallback callback,
+                                                Transfer::RemoteFileId document, Task::EventPtr evbase )
+{
+    Alive::Use use ( alive );
+    if ( use.get () )
+        return ( use.get ()->*handler ) ( callback, document, evbase );
+    return Task::EventResponse::del ();
+}
+
+void ColladaSystem::documentNamed ( MeshCallback const& callback, Transfer::URI const& uri, Transfer::RemoteFileId const* document )
+{
+    if ( !document )
+    {
+        SILOG ( collada, error, "ColladaSystem could not look up " << uri );
+        callback ( std::tr1::shared_ptr< ProgressiveMesh > () );
+        return;
+    }
+    // the mesh is only ever in the local caches, so there is no point asking the network for it
+    Transfer::RemoteFileId mesh ( meshFingerprint ( document->fingerprint () ), document->uri ().context () );
+    mTransferManager->downloadCached ( mesh,
+        std::tr1::bind ( &ColladaSystem::downloaded, mAlive, &ColladaSystem::cachedMeshDownloaded, callback, *document, _1 ),
+        Transfer::Range ( true ) );
+}
+
+void ColladaSystem::downloadDocument ( MeshCallback const& callback, Transfer::RemoteFileId const& document )
+{
+    mTransferManager->downloadByHash ( document,
+        std::tr1::bind ( &ColladaSystem::downloaded, mAlive, &ColladaSystem::documentDownloaded, callback, document, _1 ),
+        Transfer::Range ( true ) );
+}
+
+Task::EventResponse ColladaSystem::cachedMeshDownloaded ( MeshCallback callback, Transfer::RemoteFileId document, Task::EventPtr evbase )
+{
+    Transfer::DownloadEventPtr ev = std::tr1::static_pointer_cast< Transfer::DownloadEvent > ( evbase );
+    if ( ev->getStatus () == Transfer::TransferManager::SUCCESS )
+        mParseQueue.enqueue ( new LoadTask ( mAlive, callback, document, ev->data ().flatten (), false ) );
+    else
+        downloadDocument ( callback, document );
+    return Task::EventResponse::del ();
+}
+
+Task::EventResponse ColladaSystem::documentDownloaded ( MeshCallback callback, Transfer::RemoteFileId document, Task::EventPtr evbase )
+{
+    Transfer::DownloadEventPtr ev = std::tr1::static_pointer_cast< Transfer::DownloadEvent > ( evbase );
+    if ( ev->getStatus () == Transfer::TransferManager::SUCCESS )
+    {
+        mParseQueue.enqueue ( new LoadTask ( mAlive, callback, document, ev->data ().flatten (), true ) );
+    }
+    else
+    {
+        SILOG ( collada, error, "ColladaSystem could not download " << document.uri () );
+        callback ( std::tr1::shared_ptr< ProgressiveMesh > () );
+    }
+    return Task::EventResponse::del ();
+}
+
+void ColladaSystem::load ( MeshCallback const& callback, Transfer::RemoteFileId const& document,
+                           Transfer::DenseDataPtr const& data, bool isDocument )
+{
+    Transfer::DenseDataPtr blob = data;
+    if ( isDocument )
+    {
+        std::vector< ProgressiveMesh::Vertex > vertices;
+        std::vector< ProgressiveMesh::SubMesh > subMeshes;
+        if ( !ColladaGeometry::read ( (const char*)data->data (), data->length (), vertices, subMeshes ) )
+        {
+            SILOG ( collada, error, "ColladaSystem could not parse " << document.uri () );
+            callback ( std::tr1::shared_ptr< ProgressiveMesh > () );
+            return;
+        }
+        int levels = mMeshLevels->as< int > ();
+        std::string encoded;
+        ProgressiveMesh::encode ( vertices, subMeshes, levels > 0 ? levels : 1, encoded );
+        blob = Transfer::DenseDataPtr ( new Transfer::DenseData ( encoded ) );
+        mTransferManager->addToCache ( meshFingerprint ( document.fingerprint () ), blob );
+    }
+
+    std::tr1::shared_ptr< ProgressiveMesh > mesh ( new ProgressiveMesh );
+    if ( mesh->parseHeader ( blob->data (), blob->length () ) &&
+         mesh->refine ( blob->data (), 0, blob->length () ) &&
+         mesh->levelsDecoded () == mesh->numLevels () )
+    {
+        callback ( mesh );
+    }
+    else if ( !isDocument )
+    {
+        // a cached mesh we can not read is rebuilt from the document and cached again
+        SILOG ( collada, warning, "ColladaSystem ignoring unreadable cached mesh for " << document.uri () );
+        downloadDocument ( callback, document );
+    }
+    else
+    {
+        callback ( std::tr1::shared_ptr< ProgressiveMesh > () );
+    }
 }
-    
 
 } // namespace Models
 } // namespace Sirikata
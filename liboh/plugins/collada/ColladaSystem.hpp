@@ -34,26 +34,74 @@
 #define _SIRIKATA_COLLADA_SYSTEM_
 
 #include <oh/Platform.hpp>
+#include <transfer/TransferManager.hpp>
+#include <task/WorkQueue.hpp>
+#include <util/ProgressiveMesh.hpp>
 
 //#include <task/EventManager.hpp>
 
 namespace Sirikata { namespace Models {
 
+/**
+ * Loads the geometry of Collada documents.  Documents are fetched through the TransferManager
+ * and parsed on this system's own worker threads, and the resulting mesh is put in the transfer
+ * cache as a ProgressiveMesh under a fingerprint derived from the document's.  Loading the
+ * same document again then fetches that binary mesh instead and never reads the XML.
+ */
 class ColladaSystem
 //    :   public // MCB: don't know yet
 {
     public:
+        /// Receives the loaded mesh on a worker thread, or a null pointer if loading failed.
+        /// Loads still in flight when the system is destroyed never call it.
+        typedef std::tr1::function< void ( std::tr1::shared_ptr< ProgressiveMesh > ) > MeshCallback;
+
         ColladaSystem ();
         ~ColladaSystem ();
 
         static ColladaSystem* create ( String const& options );
-    
+
+        /// Loads the document named by uri, from the mesh cache when it was loaded before.
+        void loadMesh ( Transfer::URI const& uri, MeshCallback const& callback );
+
+        /// The fingerprint the mesh built from a document is cached under.
+        Transfer::Fingerprint meshFingerprint ( Transfer::Fingerprint const& document ) const;
+
     protected:
 
     private:
         ColladaSystem ( ColladaSystem const& );
         ColladaSystem& operator = ( ColladaSystem const & );
 
+        class LoadTask;
+        friend class LoadTask;
+        class Alive;
+        typedef std::tr1::shared_ptr< Alive > AlivePtr;
+        typedef Task::EventResponse ( ColladaSystem::*DownloadHandler ) ( MeshCallback, Transfer::RemoteFileId, Task::EventPtr );
+
+        bool initialize ( String const& options );
+
+        /// Transfer callbacks go through these, which drop the callback once the system is destroyed.
+        static void named ( AlivePtr alive, MeshCallback callback, Transfer::URI const& uri, Transfer::RemoteFileId const* document );
+        static Task::EventResponse downloaded ( AlivePtr alive, DownloadHandler handler, MeshCallback callback,
+                                                Transfer::RemoteFileId document, Task::EventPtr evbase );
+
+        void documentNamed ( MeshCallback const& callback, Transfer::URI const& uri, Transfer::RemoteFileId const* document );
+        void downloadDocument ( MeshCallback const& callback, Transfer::RemoteFileId const& document );
+        Task::EventResponse cachedMeshDownloaded ( MeshCallback callback, Transfer::RemoteFileId document, Task::EventPtr evbase );
+        Task::EventResponse documentDownloaded ( MeshCallback callback, Transfer::RemoteFileId document, Task::EventPtr evbase );
+        /// Builds the mesh from a document, caching it, or decodes a cached mesh.  Runs on a worker thread.
+        void load ( MeshCallback const& callback, Transfer::RemoteFileId const& document,
+                    Transfer::DenseDataPtr const& data, bool isDocument );
+
+        OptionValue* mTransferManagerOption;
+        OptionValue* mParseThreads;
+        OptionValue* mMeshLevels;
+        Transfer::TransferManager* mTransferManager;
+        Task::ThreadSafeWorkQueue mParseQueue;
+        Task::WorkQueueThread* mParseQueueThreads;
+        /// Shared with every callback in flight so none reaches the system after it is destroyed.
+        AlivePtr mAlive;
 };
 
 } // namespace Models
@@ -5,6 +5,7 @@
 #include "MonoDomain.hpp"
 #include "MonoObject.hpp"
 #include "MonoContext.hpp"
+#include "MonoThread.hpp"
 AUTO_SINGLETON_INSTANCE(Sirikata::MonoContext);
 
 namespace Sirikata {
@@ -22,6 +23,12 @@ void MonoContext::initializeThread() {
 
     assert( mThreadContext.get() != NULL );
 }
+void MonoContext::attachThread() {
+    if (mThreadContext.get() != NULL)
+        return;
+    mThreadAttachment.reset( new Mono::Thread(Mono::Domain::root()) );
+    initializeThread();
+}
 
 MonoContextData& MonoContext::current() {
     ContextStack* ctx_stack = mThreadContext.get();
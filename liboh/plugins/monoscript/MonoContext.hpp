@@ -37,6 +37,13 @@ public:
      *  All context state will have default values.
      */
     void initializeThread();
+    /** Make the calling thread able to run scripts: attach it to the Mono
+     *  runtime and give it an empty context.  Does nothing on a thread that
+     *  was initialized before, so it may be called on every entry into a
+     *  script from a thread the object host owns.  The thread is detached
+     *  from the runtime when it exits.
+     */
+    void attachThread();
     static  MonoContext&getSingleton();
     /** Get the current context data. */
     MonoContextData& current();
@@ -77,6 +84,7 @@ public:
 private:
     typedef std::stack<MonoContextData> ContextStack;
     boost::thread_specific_ptr<ContextStack> mThreadContext;
+    boost::thread_specific_ptr<Mono::Thread> mThreadAttachment;
 }; // class Context
 
 
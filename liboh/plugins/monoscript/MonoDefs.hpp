@@ -45,6 +45,7 @@ class Array;
 class Assembly;
 class Domain;
 class Exception;
+class Thread;
 class IList;
 class IDictionary;
 
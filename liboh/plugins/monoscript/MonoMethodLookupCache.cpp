@@ -84,4 +84,48 @@ void ThreadSafeSingleMethodLookupCache::update(MonoClass* dest_class, const char
 }
 
 
+
+
+ThreadLocalMethodLookupCache::Entries::Entries()
+ : mNextReplaced(0)
+{
+    for (unsigned int i = 0; i < NUM_ENTRIES; i++) {
+        mDestClass[i] = NULL;
+        mResolvedMethod[i] = NULL;
+    }
+}
+
+ThreadLocalMethodLookupCache::ThreadLocalMethodLookupCache() {
+}
+
+ThreadLocalMethodLookupCache::~ThreadLocalMethodLookupCache() {
+}
+
+ThreadLocalMethodLookupCache::Entries* ThreadLocalMethodLookupCache::entries() {
+    Entries* result = mEntries.get();
+    if (result == NULL) {
+        result = new Entries;
+        mEntries.reset(result);
+    }
+    return result;
+}
+
+MonoMethod* ThreadLocalMethodLookupCache::lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs) {
+    Entries* cached = entries();
+    for (unsigned int i = 0; i < NUM_ENTRIES; i++) {
+        if (cached->mDestClass[i] == dest_class)
+            return cached->mResolvedMethod[i];
+    }
+    return NULL;
+}
+
+void ThreadLocalMethodLookupCache::update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved) {
+    Entries* cached = entries();
+    unsigned int slot = cached->mNextReplaced;
+    cached->mNextReplaced = (slot + 1) % NUM_ENTRIES;
+    cached->mDestClass[slot] = dest_class;
+    cached->mResolvedMethod[slot] = resolved;
+}
+
+
 } // namespace Mono
@@ -93,6 +93,37 @@ private:
     MonoMethod* mResolvedMethod;
 };
 
+/** A polymorphic inline cache that every thread keeps separately.  Like
+ *  SingleMethodLookupCache it only checks the receiver type, but it
+ *  remembers the last few receiver types seen at the call site, so a site
+ *  that is sent to several types (e.g. Delegate::invoke) does not miss on
+ *  every change of type.  Since no entry is shared, lookups and updates
+ *  never lock and threads running different scripts never evict each
+ *  other's entries.
+ */
+class ThreadLocalMethodLookupCache : public MethodLookupCache {
+public:
+    enum { NUM_ENTRIES = 4 };
+
+    ThreadLocalMethodLookupCache();
+    virtual ~ThreadLocalMethodLookupCache();
+
+    virtual MonoMethod* lookup(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs);
+    virtual void update(MonoClass* dest_class, const char* message, MonoObject* args[], int nargs, MonoMethod* resolved);
+
+private:
+    struct Entries {
+        MonoClass* mDestClass[NUM_ENTRIES];
+        MonoMethod* mResolvedMethod[NUM_ENTRIES];
+        unsigned int mNextReplaced;
+        Entries();
+    };
+    /** Get the calling thread's entries, creating them on first use. */
+    Entries* entries();
+
+    boost::thread_specific_ptr<Entries> mEntries;
+};
+
 } // namespace Mono
 
 #endif //_MONO_METHOD_LOOKUP_CACHE_
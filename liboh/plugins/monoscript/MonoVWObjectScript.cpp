@@ -39,10 +39,16 @@
 #include "MonoException.hpp"
 #include "util/RoutableMessageHeader.hpp"
 #include "MonoContext.hpp"
+#include "MonoMethodLookupCache.hpp"
+#include <boost/thread.hpp>
 namespace Sirikata {
 
-MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObject*ho, const ObjectScriptManager::Arguments&args):mDomain(mono_system->createDomain()){
+class MonoVWObjectScript::UniqueLock : public boost::recursive_mutex {};
+
+MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObject*ho, const ObjectScriptManager::Arguments&args):mDomain(mono_system->createDomain()),mRunning(new UniqueLock){
     mParent=ho;
+    MonoContext::getSingleton().attachThread();
+    boost::lock_guard<boost::recursive_mutex> running(*mRunning);
     int ignored_args=0;
     String reserved_string_assembly="Assembly";
     String reserved_string_class="Class";
@@ -105,6 +111,9 @@ MonoVWObjectScript::MonoVWObjectScript(Mono::MonoSystem*mono_system, HostedObjec
     }
 }
 MonoVWObjectScript::~MonoVWObjectScript(){
+    // the ObjectHost may drop the last reference to our object on any of its threads, and freeing mObject's handle needs the runtime
+    MonoContext::getSingleton().attachThread();
+    delete mRunning;
 
     //mono_jit_cleanup(mDomain.domain());
 }
@@ -117,12 +126,15 @@ bool MonoVWObjectScript::endForwardingMessagesTo(MessageService*){
     return false;
 }
 bool MonoVWObjectScript::processRPC(const RoutableMessageHeader &receivedHeader, const std::string &name, MemoryReference args, MemoryBuffer &returnValue){
+    static Mono::ThreadLocalMethodLookupCache rpc_cache;
+    MonoContext::getSingleton().attachThread();
+    boost::lock_guard<boost::recursive_mutex> running(*mRunning);
     MonoContext::getSingleton().push(MonoContextData());
     MonoContext::getSingleton().setVWObject(mParent,mDomain);
     std::string header;
     receivedHeader.SerializeToString(&header);
     try {
-        Mono::Object retval=mObject.send("processRPC",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.String(name),mDomain.ByteArray((const char*)args.data(),(int)args.size()));
+        Mono::Object retval=mObject.send(&rpc_cache,"processRPC",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.String(name),mDomain.ByteArray((const char*)args.data(),(int)args.size()));
         if (!retval.null()) {
             returnValue=retval.unboxByteArray();
             MonoContext::getSingleton().pop();
@@ -139,22 +151,28 @@ bool MonoVWObjectScript::processRPC(const RoutableMessageHeader &receivedHeader,
     return true;
 }
 void MonoVWObjectScript::tick(){
+    static Mono::ThreadLocalMethodLookupCache tick_cache;
+    MonoContext::getSingleton().attachThread();
+    boost::lock_guard<boost::recursive_mutex> running(*mRunning);
     MonoContext::getSingleton().push(MonoContextData());
     MonoContext::getSingleton().setVWObject(mParent,mDomain);
     try {
-        Mono::Object retval=mObject.send("tick",mDomain.Time(Time::now(Duration::zero())));
+        Mono::Object retval=mObject.send(&tick_cache,"tick",mDomain.Time(Time::now(Duration::zero())));
     }catch (Mono::Exception&e) {
         SILOG(mono,debug,"Tick Exception "<<e);
     }
     MonoContext::getSingleton().pop();
 }
 void MonoVWObjectScript::processMessage(const RoutableMessageHeader&receivedHeader , MemoryReference body){
+    static Mono::ThreadLocalMethodLookupCache message_cache;
     std::string header;
     receivedHeader.SerializeToString(&header);
+    MonoContext::getSingleton().attachThread();
+    boost::lock_guard<boost::recursive_mutex> running(*mRunning);
     MonoContext::getSingleton().push(MonoContextData());
     MonoContext::getSingleton().setVWObject(mParent,mDomain);
     try {
-        Mono::Object retval=mObject.send("processMessage",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.ByteArray((const char*)body.data(),(unsigned int)body.size()));
+        Mono::Object retval=mObject.send(&message_cache,"processMessage",mDomain.ByteArray(header.data(),(unsigned int)header.size()),mDomain.ByteArray((const char*)body.data(),(unsigned int)body.size()));
     }catch (Mono::Exception&e) {
         SILOG(mono,debug,"Message Exception "<<e);
     }
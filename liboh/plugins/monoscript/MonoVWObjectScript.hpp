@@ -44,10 +44,19 @@ class MonoSystem;
 namespace Sirikata {
 class HostedObject;
 
+/**
+ * Runs a C# object script for a HostedObject.  The script is entered from whichever thread
+ * delivers to its object: the main thread, or the ObjectHost mailbox thread the object is
+ * pinned to.  Each such thread is attached to the Mono runtime on first use, and the script
+ * is only ever entered by one thread at a time.
+ */
 class MonoVWObjectScript : public ObjectScript{
     HostedObject*mParent;
     Mono::Domain mDomain;
     Mono::Object mObject;
+    class UniqueLock;
+    ///held while a thread runs this script
+    UniqueLock *mRunning;
 public:
     MonoVWObjectScript(Mono::MonoSystem*, HostedObject*, const ObjectScriptManager::Arguments&args);
     ~MonoVWObjectScript();
@@ -73,6 +73,16 @@ MeshEntity::~MeshEntity() {
 
 }
 
+void MeshEntity::updateLocation(Time ti, const Location &newLocation) {
+    Entity::updateLocation(ti, newLocation);
+    mResource->entityChanged();
+}
+
+void MeshEntity::resetLocation(Time ti, const Location &newLocation) {
+    Entity::resetLocation(ti, newLocation);
+    mResource->entityChanged();
+}
+
 void MeshEntity::loadMesh(const String& meshname)
 {
 
@@ -96,6 +96,9 @@ public:
         mResource = resourcePtr;
     }
 
+    virtual void updateLocation(Time ti, const Location &newLocation);
+    virtual void resetLocation(Time ti, const Location &newLocation);
+
 /*
     virtual bool loadMesh(const String&name){
         return false;
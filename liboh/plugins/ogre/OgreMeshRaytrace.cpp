@@ -4,6 +4,7 @@
 #include "OgreSubMesh.h"
 #include "OgreEntity.h"
 #include "OgreNode.h"
+#include "OgreRay.h"
 
 //using Ogre::RenderOperation;
 using Ogre::SubMesh;
@@ -27,19 +28,15 @@ using Ogre::Real;
 //using Ogre::AxisAlignedBox;
 
 namespace Sirikata { namespace Graphics {
-OgreMesh::OgreMesh(Ogre::Entity *entity, Ogre::SubMesh *subMesh)
+OgreMesh::OgreMesh(Ogre::SubMesh *subMesh)
 {
-    syncFromOgreMesh(entity,subMesh);
+    syncFromOgreMesh(subMesh);
 }
 int64 OgreMesh::size() const{
-    return mTriangles.size()*sizeof(Triangle);
+    return mBVH.memoryUsage();
 }
-void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
+void OgreMesh::syncFromOgreMesh(Ogre::SubMesh*subMesh)
 {
-  const Ogre::Vector3 &position = entity->getParentNode()->_getDerivedPosition();
-  const Ogre::Quaternion &orient = entity->getParentNode()->_getDerivedOrientation();
-  const Ogre::Vector3 &scale = entity->getParentNode()->_getDerivedScale();
-
   VertexData *vertexData = subMesh->vertexData;
   if (vertexData) {
       VertexDeclaration *vertexDecl = vertexData->vertexDeclaration;
@@ -51,7 +48,8 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
       VertexBufferBinding *bufferBinding = vertexData->vertexBufferBinding;
       HardwareVertexBuffer *buffer = bufferBinding->getBuffer(element->getSource()).get();
       unsigned char *pVert = static_cast<unsigned char*>(buffer->lock(HardwareBuffer::HBL_READ_ONLY));
-      std::vector<Ogre::Vector3> lvertices;
+      std::vector<Vector3f> lvertices;
+      lvertices.reserve(vertexData->vertexCount);
       for (size_t vert = 0; vert < vertexData->vertexCount; vert++) {
           Real *vertex = 0;
           Real x, y, z;
@@ -59,10 +57,7 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
           x = *vertex++;
           y = *vertex++;
           z = *vertex++;
-          Ogre::Vector3 vec(x, y, z);
-          vec = (orient * (vec * scale)) + position;
-          
-          lvertices.push_back(vec);
+          lvertices.push_back(Vector3f(x, y, z));
           
           pVert += buffer->getVertexSize();
       }
@@ -72,6 +67,8 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
       IndexData * indexData = subMesh->indexData;
       HardwareIndexBuffer *indexBuffer = indexData->indexBuffer.get();
       void *pIndex = static_cast<unsigned char *>(indexBuffer->lock(HardwareBuffer::HBL_READ_ONLY));
+      std::vector<TriangleBVH::Triangle> triangles;
+      triangles.reserve(indexData->indexCount/3);
       if (indexBuffer->getType() == HardwareIndexBuffer::IT_16BIT) {
           for (size_t index = indexData->indexStart; index < indexData->indexCount; ) {
               uint16 *uint16Buffer = (uint16 *) pIndex;
@@ -79,7 +76,7 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
               uint16 v2 = uint16Buffer[index++];
               uint16 v3 = uint16Buffer[index++];
               
-              mTriangles.push_back(Triangle(lvertices[v1], lvertices[v2], lvertices[v3]));
+              triangles.push_back(TriangleBVH::Triangle(lvertices[v1], lvertices[v2], lvertices[v3]));
           }
       } else if (indexBuffer->getType() == HardwareIndexBuffer::IT_32BIT) {
           for (size_t index = indexData->indexStart; index < indexData->indexCount; ) {
@@ -88,34 +85,106 @@ void OgreMesh::syncFromOgreMesh(Ogre::Entity *entity,Ogre::SubMesh*subMesh)
               uint32 v2 = uint16Buffer[index++];
               uint32 v3 = uint16Buffer[index++];
               
-              mTriangles.push_back(Triangle(lvertices[v1], lvertices[v2], lvertices[v3]));
+              triangles.push_back(TriangleBVH::Triangle(lvertices[v1], lvertices[v2], lvertices[v3]));
           }
       } else {
           assert(0);
       }
       indexBuffer->unlock();
+      mBVH.build(triangles);
   }
 }
 
-std::pair<bool, std::pair< double, Vector3f> > OgreMesh::intersect(const Ogre::Ray &ray)
+std::pair<bool, std::pair< double, Vector3f> > OgreMesh::intersect(Ogre::Entity *entity, const Ogre::Ray &ray) const
 {
   std::pair<bool, std::pair< double, Vector3f> > rtn(false,std::pair<double,Vector3f>(std::numeric_limits<Real>::max(),Vector3f(0,0,0)));
-  std::vector<Triangle>::iterator itr,itere=mTriangles.end();
 
-  for (itr = mTriangles.begin(); itr != itere; itr++) {
-    std::pair<bool, Real> hit = Ogre::Math::intersects(ray,
-      itr->mV1, itr->mV2,itr->mV3, true, false);
-    if (hit.first && hit.second < rtn.second.first) {
-      rtn.first = hit.first;
-      rtn.second.first = hit.second;
-      Ogre::Vector3 nml=(itr->mV1-itr->mV2).crossProduct(itr->mV3-itr->mV2);
-      rtn.second.second.x=nml.x;
-      rtn.second.second.y=nml.y;
-      rtn.second.second.z=nml.z;
-    }
+  // Bring the ray into the mesh's coordinates instead of moving every vertex into the world's.
+  // The mapping is affine, so distances along the ray stay the same.
+  const Ogre::Vector3 &position = entity->getParentNode()->_getDerivedPosition();
+  const Ogre::Quaternion &orient = entity->getParentNode()->_getDerivedOrientation();
+  const Ogre::Vector3 &scale = entity->getParentNode()->_getDerivedScale();
+  Ogre::Quaternion inverseOrient = orient.Inverse();
+  Ogre::Vector3 origin = (inverseOrient * (ray.getOrigin() - position)) / scale;
+  Ogre::Vector3 direction = (inverseOrient * ray.getDirection()) / scale;
+
+  TriangleBVH::Hit hit;
+  if (mBVH.intersect(Vector3f(origin.x, origin.y, origin.z),
+                     Vector3f(direction.x, direction.y, direction.z),
+                     std::numeric_limits<float>::max(), hit)) {
+    rtn.first = true;
+    rtn.second.first = hit.mDistance;
+    // Same orientation as the (v1-v2)x(v3-v2) normal this used to return, brought back to world coordinates.
+    Vector3f localNml = -mBVH.triangles()[hit.mTriangle].normal();
+    Ogre::Vector3 nml = orient * (Ogre::Vector3(localNml.x, localNml.y, localNml.z) / scale);
+    rtn.second.second.x=nml.x;
+    rtn.second.second.y=nml.y;
+    rtn.second.second.z=nml.z;
   }
 
   return rtn;
 }
 
+OgreMeshRaytraceCache::OgreMeshRaytraceCache(size_t maxBytes)
+ : mBytes(0), mMaxBytes(maxBytes) {
+}
+
+OgreMeshRaytraceCache::~OgreMeshRaytraceCache() {
+  clear();
+}
+
+void OgreMeshRaytraceCache::destroy(MeshMap::iterator where) {
+  CachedMesh *cached = where->second;
+  for (size_t i = 0; i < cached->mSubMeshes.size(); ++i) {
+    delete cached->mSubMeshes[i];
+  }
+  mBytes -= cached->mBytes;
+  mLru.erase(cached->mLru);
+  delete cached;
+  mMeshes.erase(where);
+}
+
+void OgreMeshRaytraceCache::evict() {
+  while (mBytes > mMaxBytes && mLru.size() > 1) {
+    destroy(mMeshes.find(mLru.back()));
+  }
+}
+
+const OgreMesh *OgreMeshRaytraceCache::get(const Ogre::MeshPtr &mesh, unsigned short subMesh) {
+  MeshMap::iterator where = mMeshes.find(mesh->getHandle());
+  if (where != mMeshes.end() && where->second->mStateCount != mesh->getStateCount()) {
+    destroy(where);
+    where = mMeshes.end();
+  }
+  if (where == mMeshes.end()) {
+    CachedMesh *cached = new CachedMesh;
+    cached->mStateCount = mesh->getStateCount();
+    cached->mBytes = 0;
+    cached->mSubMeshes.resize(mesh->getNumSubMeshes(), NULL);
+    mLru.push_front(mesh->getHandle());
+    cached->mLru = mLru.begin();
+    where = mMeshes.insert(MeshMap::value_type(mesh->getHandle(), cached)).first;
+  } else {
+    mLru.splice(mLru.begin(), mLru, where->second->mLru);
+  }
+  std::vector<OgreMesh*> &subMeshes = where->second->mSubMeshes;
+  if (subMesh >= subMeshes.size()) {
+    return NULL;
+  }
+  OgreMesh *result = subMeshes[subMesh];
+  if (result == NULL) {
+    result = subMeshes[subMesh] = new OgreMesh(mesh->getSubMesh(subMesh));
+    where->second->mBytes += (size_t)result->size();
+    mBytes += (size_t)result->size();
+    evict();
+  }
+  return result;
+}
+
+void OgreMeshRaytraceCache::clear() {
+  while (!mMeshes.empty()) {
+    destroy(mMeshes.begin());
+  }
+}
+
 } }
@@ -4,6 +4,8 @@
 #include <vector>
 #include "MeruDefs.hpp"
 #include "OgreVector3.h"
+#include "OgreMesh.h"
+#include <util/TriangleBVH.hpp>
 namespace Ogre {
   class Entity;
   class SubMesh;
@@ -12,51 +14,55 @@ namespace Ogre {
 
 namespace Sirikata { namespace Graphics {
 
-class Triangle {
-public:
-  Triangle(const Ogre::Vector3 &v1, const Ogre::Vector3 &v2, const Ogre::Vector3 &v3) : mV1(v1), mV2(v2), mV3(v3)
-  {
-  }
-
-  Ogre::Vector3 mV1;
-  Ogre::Vector3 mV2;
-  Ogre::Vector3 mV3;
-};
-
 /**
- * This class syncs Ogre::Meshes from the hardware and does ray intersection tests.
+ * This class syncs an Ogre::SubMesh from the hardware once and does ray intersection tests
+ * against it. The triangles are kept in the mesh's own coordinates in a TriangleBVH, so every
+ * entity showing the mesh can share it, wherever the entity is placed.
  */
 class OgreMesh {
-    class EntitySubmeshPair {
-        void *mEntity;
-        void *mSubmesh;
-      public:
-        EntitySubmeshPair() {
-            mEntity=NULL;
-            mSubmesh=NULL;
-        }
-        EntitySubmeshPair(Ogre::Entity*entity,Ogre::SubMesh*submesh){
-            this->mEntity=entity;
-            this->mSubmesh=submesh;
-        }
-        bool operator==(const EntitySubmeshPair&b)const {
-            return mEntity==b.mEntity&&this->mSubmesh==b.mSubmesh;
-        }
-        bool operator<(const EntitySubmeshPair&b)const {
-            if (mEntity==b.mEntity) return this->mSubmesh<b.mSubmesh;
-            return mEntity<b.mEntity;
-        }
-    };
 public:
-  std::pair<bool, std::pair< double, Vector3f> > intersect(const Ogre::Ray &ray);
-  OgreMesh(Ogre::Entity *entity, Ogre::SubMesh *submesh);
+  /** Intersects a ray in world coordinates with the submesh as placed by entity's node.
+   *  \returns whether it hit, the distance along the ray and the hit face's normal in world coordinates
+   */
+  std::pair<bool, std::pair< double, Vector3f> > intersect(Ogre::Entity *entity, const Ogre::Ray &ray) const;
+  OgreMesh(Ogre::SubMesh *submesh);
 protected:
-  void syncFromOgreMesh(Ogre::Entity *entity,  Ogre::SubMesh *mSubMesh);
-  std::vector<Triangle> mTriangles;
+  void syncFromOgreMesh(Ogre::SubMesh *mSubMesh);
+  TriangleBVH mBVH;
 public:
   int64 size()const;
 };
 
+/**
+ * OgreMeshes for the meshes that have been ray traced recently, so the trees are built once per
+ * mesh rather than once per query. Entries are keyed by resource handle and hold no reference to
+ * their mesh, so Ogre may unload or destroy it: a reloaded mesh is rebuilt when next traced, and
+ * the least recently traced meshes are dropped once the trees take more than the byte limit.
+ */
+class OgreMeshRaytraceCache {
+  typedef std::list<Ogre::ResourceHandle> LruList;
+  struct CachedMesh {
+      size_t mStateCount;
+      size_t mBytes;
+      std::vector<OgreMesh*> mSubMeshes;
+      LruList::iterator mLru;
+  };
+  typedef std::map<Ogre::ResourceHandle, CachedMesh*> MeshMap;
+  MeshMap mMeshes;
+  LruList mLru;
+  size_t mBytes;
+  size_t mMaxBytes;
+  void destroy(MeshMap::iterator where);
+  /// Drops the least recently traced meshes until the trees fit, but never the most recent one.
+  void evict();
+public:
+  OgreMeshRaytraceCache(size_t maxBytes);
+  ~OgreMeshRaytraceCache();
+  /// Returns the tree of submesh number subMesh of mesh, building the mesh's trees if needed.
+  const OgreMesh *get(const Ogre::MeshPtr &mesh, unsigned short subMesh);
+  void clear();
+};
+
 } }
 
 #endif
@@ -138,6 +138,7 @@ OgreSystem::OgreSystem():mLastFrameTime(Task::LocalTime::now()),mFloatingPointOf
     mRenderTarget=NULL;
     mMouseHandler=NULL;
     mRayQuery=NULL;
+    mRaytraceCache=NULL;
 }
 namespace {
 class FrequencyType{public:
@@ -351,6 +352,7 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
     OptionValue*renderBufferAutoMipmap;
     OptionValue*transferManager,*workQueue,*eventManager;
     OptionValue*grabCursor;
+    OptionValue*raytraceCacheSize;
     InitializeClassOptions("ogregraphics",this,
                            pluginFile=new OptionValue("pluginfile","plugins.cfg",OptionValueType<String>(),"sets the file ogre should read options from."),
                            configFile=new OptionValue("configfile","ogre.cfg",OptionValueType<String>(),"sets the ogre config file for config options"),
@@ -358,6 +360,7 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
                            purgeConfig=new OptionValue("purgeconfig","false",OptionValueType<bool>(),"Pops up the dialog asking for the screen resolution no matter what"),
                            createWindow=new OptionValue("window","true",OptionValueType<bool>(),"Render to a onscreen window"),
                            grabCursor=new OptionValue("grabcursor","false",OptionValueType<bool>(),"Grab cursor"),
+                           raytraceCacheSize=new OptionValue("raytracecachesize","64",OptionValueType<uint32>(),"Megabytes of per-mesh ray tracing trees kept for picking"),
                            windowTitle=new OptionValue("windowtitle","Sirikata",OptionValueType<String>(),"Window title name"),
                            mOgreRootDir=new OptionValue("ogretoplevel",".",OptionValueType<String>(),"Directory with ogre plugins"),
                            ogreSceneManager=new OptionValue("scenemanager","OctreeSceneManager",OptionValueType<String>(),"Which scene manager to use to arrange objects"),
@@ -380,6 +383,7 @@ bool OgreSystem::initialize(Provider<ProxyCreationListener*>*proxyManager, const
     bool userAccepted=true;
 
     (mOptions=OptionSet::getOptions("ogregraphics",this))->parse(options);
+    mRaytraceCache=new OgreMeshRaytraceCache((size_t)raytraceCacheSize->as<uint32>()*1024*1024);
 
     mTransferManager = (Transfer::TransferManager*)transferManager->as<void*>();
 
@@ -646,6 +650,7 @@ OgreSystem::~OgreSystem() {
             delete current;
         }
     }
+    delete mRaytraceCache;
     if (mSceneManager) {
         Ogre::Root::getSingleton().destroySceneManager(mSceneManager);
     }
@@ -799,11 +804,12 @@ Entity *OgreSystem::internalRayTrace(const Vector3d &position, const Vector3f &d
             bool passed=aabbOnly&&result.distance > 0;
             if (aabbOnly==false) {
                 rtr.mDistance=3.0e38f;
-                Ogre::Mesh *mesh = foundEntity->getMesh().get();
+                const Ogre::MeshPtr &mesh = foundEntity->getMesh();
                 uint16 numSubMeshes = mesh->getNumSubMeshes();
                 for (uint16 ndx = 0; ndx < numSubMeshes; ndx++) {
-                    OgreMesh ogreMesh(foundEntity, mesh->getSubMesh(ndx));
-                    std::pair<bool, std::pair<double, Vector3f> > curHit = ogreMesh.intersect(traceFrom);
+                    const OgreMesh *ogreMesh = mRaytraceCache->get(mesh, ndx);
+                    if (!ogreMesh) continue;
+                    std::pair<bool, std::pair<double, Vector3f> > curHit = ogreMesh->intersect(foundEntity, traceFrom);
                     if (curHit.first && curHit.second.first < rtr.mDistance && curHit.second.first > 0 ) {
                         rtr.mMovableObject = result.movable;
                         rtr.mDistance=curHit.second.first;
@@ -887,12 +893,10 @@ struct UploadRequest {
     OgreSystem *parent;
     Transfer::TransferManager *mTransferManager;
     void perform() {
-        std::vector<Meru::ResourceFileUpload> allDeps =
-            Meru::ProcessOgreMeshMaterialDependencies(filenames, opts);
-        Meru::UploadFilesAndConfirmReplacement(mTransferManager,
-                                           allDeps,
-                                           opts.uploadHashContext,
-                                           std::tr1::bind(&OgreSystem::uploadFinished,parent,_1));
+        Meru::ProcessAndUploadOgreMeshMaterialDependencies(mTransferManager,
+                                                           filenames,
+                                                           opts,
+                                                           std::tr1::bind(&OgreSystem::uploadFinished,parent,_1));
         delete this;
     }
 };
@@ -75,6 +75,7 @@ class Entity;
 using Input::SDLInputManager;
 class CameraEntity;
 class CubeMap;
+class OgreMeshRaytraceCache;
 
 /** Represents one OGRE SceneManager, a single environment. */
 class OgreSystem: public TimeSteppedQueryableSimulation {
@@ -122,6 +123,8 @@ class OgreSystem: public TimeSteppedQueryableSimulation {
     Vector3d mFloatingPointOffset;
     Ogre::RaySceneQuery* mRayQuery;
     CubeMap *mCubeMap;
+    ///ray tracing trees of the meshes hit recently, kept for later queries up to the raytracecachesize option
+    OgreMeshRaytraceCache *mRaytraceCache;
     Entity* internalRayTrace(const Vector3d &position,
                      const Vector3f &direction,
                      bool aabbOnly,
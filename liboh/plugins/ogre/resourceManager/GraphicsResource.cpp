@@ -30,7 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "GraphicsResource.hpp"
-#include "GraphicsResourceManager.hpp"
+#include "ResourceScheduler.hpp"
 
 using namespace std;
 
@@ -40,57 +40,64 @@ unsigned int GraphicsResource::sCostPropEpoch = 0;
 
 GraphicsResource::GraphicsResource(const String &id, Type type)
 : mID(id), mParseState(PARSE_INVALID), mLoadState(LOAD_NEW),
-  mType(type), mCostEpoch(0), mLoadEpoch(0), mRemoveEpoch(0),
+  mType(type), mLoadEpoch(0),
   mCostPropEpoch(0), mBenefit(0), mDepBenefit(0),
-  mCurCost(0), mCost(0), mDepCost(0)
+  mCurCost(0), mCost(0), mDepCost(0), mScreenSize(0)
 {
 
 }
 
 GraphicsResource::~GraphicsResource()
 {
-  GraphicsResourceManager::getSingleton().unregisterResource(this);
+  if (tricklesUp())
+    dependenciesChanged();
+  ResourceScheduler::getSingleton().unregisterResource(this);
 }
 
-void GraphicsResource::updateValue(unsigned int epoch)
+void GraphicsResource::refreshValue()
 {
-  assert(mType == ENTITY);
-
-  float oldValue = value();
-  mBenefit = calcBenefit();
-  mCurCost = mCost + mDepCost;
-
-  if (mLoadState != LOAD_NEW && mLoadState != LOAD_FAILED)
-    GraphicsResourceManager::getSingleton().registerLoad(this, oldValue);
-
-  if (mCost == 0.0f && mDependencies.size() == 1) { // we can trickle up benefit
-    (*(mDependencies.begin()))->addDepBenefit(mBenefit, epoch);
+  if (mType == ENTITY) {
+    mBenefit = calcBenefit();
+  }
+  else {
+    // Dependents that trickle up have this as their only dependency.
+    float depBenefit = 0.0f;
+    float screenSize = 0.0f;
+    set<WeakResourcePtr>::iterator itr;
+    for (itr = mDependents.begin(); itr != mDependents.end(); ++itr) {
+      SharedResourcePtr dependent = itr->lock();
+      if (dependent && dependent->tricklesUp()) {
+        depBenefit += dependent->mBenefit + dependent->mDepBenefit;
+        screenSize = std::max(screenSize, dependent->mScreenSize);
+      }
+    }
+    mDepBenefit = depBenefit;
+    mScreenSize = screenSize;
   }
-}
-
-void GraphicsResource::addDepBenefit(float benefit, unsigned int epoch)
-{
-  float oldValue = value();
-
-  if (mCostEpoch != epoch)
-    mDepBenefit = 0.0f;
-  mCostEpoch = epoch;
-  mDepBenefit += benefit;
   mCurCost = mCost + mDepCost;
 
   if (mLoadState != LOAD_NEW && mLoadState != LOAD_FAILED
    && (mType == MESH || mType == ENTITY))
-    GraphicsResourceManager::getSingleton().registerLoad(this, oldValue);
+    ResourceScheduler::getSingleton().registerLoad(this);
 
-  if (mCost == 0.0f && mDependencies.size() == 1) { // we can trickle up benefit
-    (*(mDependencies.begin()))->addDepBenefit(benefit, epoch);
-  }
+  if (tricklesUp())
+    dependenciesChanged();
+}
+
+void GraphicsResource::dependenciesChanged()
+{
+  set<SharedResourcePtr>::iterator itr;
+  for (itr = mDependencies.begin(); itr != mDependencies.end(); ++itr)
+    ResourceScheduler::getSingleton().valueChanged(itr->get());
 }
 
 void GraphicsResource::setCost(float cost)
 {
   assert(mCost == 0); // we should not be setting cost more than once
+  bool trickled = tricklesUp();
   mCost = cost;
+  if (trickled)
+    dependenciesChanged();
 }
 
 float GraphicsResource::getDepCost(unsigned int epoch)
@@ -109,25 +116,6 @@ float GraphicsResource::getDepCost(unsigned int epoch)
   return cost;
 }
 
-void GraphicsResource::updateCurCost(float cost, unsigned int epoch)
-{
-  if (mCostPropEpoch != epoch) {
-    mCostPropEpoch = epoch;
-    float oldValue = value();
-    mCurCost -= cost;
-
-    if (mType == MESH || mType == ENTITY)
-      GraphicsResourceManager::getSingleton().updateLoadValue(this, oldValue);
-
-    set<WeakResourcePtr>::iterator itr, eitr;
-    for (itr = mDependents.begin(), eitr = mDependents.end(); itr != eitr; ++itr) {
-      SharedResourcePtr resourcePtr = itr->lock();
-      if (resourcePtr)
-        resourcePtr->updateCurCost(cost, epoch);
-    }
-  }
-}
-
 float GraphicsResource::cost()
 {
   return mCurCost;
@@ -201,6 +189,8 @@ void GraphicsResource::fullyParsed()
   for (itr = mDependencies.begin(), eitr = mDependencies.end(); itr != eitr; ++itr) {
     mDepCost += (*itr)->getDepCost(sCostPropEpoch);
   }
+  // Now loadable, and at a new cost.
+  ResourceScheduler::getSingleton().valueChanged(this);
 }
 
 void GraphicsResource::dependencyParsed(bool success)
@@ -227,6 +217,8 @@ void GraphicsResource::clearDependencies()
   for (itr = mDependencies.begin(); itr != mDependencies.end(); itr++) {
     (*itr)->removeDependent(weakPtr);
   }
+  if (tricklesUp())
+    dependenciesChanged();
   mDependencies.clear();
   mParseState = PARSE_INVALID;
 }
@@ -244,30 +236,6 @@ void GraphicsResource::load(unsigned int epoch)
   checkDependenciesLoaded();
 }
 
-void GraphicsResource::removeLoadDependencies(unsigned int epoch)
-{
-  if (mRemoveEpoch != epoch) {
-    mRemoveEpoch = epoch;
-
-    if (mCost > 0) {
-      sCostPropEpoch++;
-      set<WeakResourcePtr>::iterator itr, eitr;
-      for (itr = mDependents.begin(), eitr = mDependents.end(); itr != eitr; ++itr) {
-        SharedResourcePtr resourcePtr = itr->lock();
-        if (resourcePtr) {
-          resourcePtr->updateCurCost(mCost, sCostPropEpoch);
-        }
-      }
-    }
-
-    GraphicsResourceManager::getSingleton().unregisterLoad(this);
-    set<SharedResourcePtr>::iterator ditr;
-    for (ditr = mDependencies.begin(); ditr != mDependencies.end(); ditr++) {
-      (*ditr)->removeLoadDependencies(epoch);
-    }
-  }
-}
-
 void GraphicsResource::loadDependencies()
 {
   set<SharedResourcePtr>::iterator itr;
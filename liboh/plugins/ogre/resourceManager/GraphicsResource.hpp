@@ -83,12 +83,25 @@ public:
   void load(unsigned int epoch);
   void unload(unsigned int epoch);
 
-  void updateValue(unsigned int epoch);
-  void updateCurCost(float cost, unsigned int epoch);
+  /// Recomputes the benefit: an entity's own, anything else's from what its dependents
+  /// trickle up to it.  Passes the result on if this trickles up itself.
+  virtual void refreshValue();
+  /// How far the viewers may travel before the value needs refreshing.
+  virtual float getValueSlack() const {
+    return 0.0f;
+  }
   float cost();
+  /// Cost of this resource alone, without its dependencies.
+  float getOwnCost() const {
+    return mCost;
+  }
   void setCost(float cost);
   float getDepCost(unsigned int epoch);
   float value() const;
+  /// Largest angular size (bounding radius over distance) any dependent is seen at.
+  float getScreenSize() const {
+    return mScreenSize;
+  }
 
   virtual void parsed(bool success);
   virtual void loaded(bool success, unsigned int epoch);
@@ -97,18 +110,29 @@ public:
   virtual void resolveName(const URI& id, const URI& hash) {
   }
 
-  void removeLoadDependencies(unsigned int epoch);
-
   void addDependency(SharedResourcePtr newResource) {
     assert(newResource);
+    bool trickled = tricklesUp();
     mDependencies.insert(newResource);
     newResource->addDependent(getWeakPtr());
+    if (trickled || tricklesUp())
+      dependenciesChanged();
   }
 
   Type getType() {
     return mType;
   }
 
+  const std::set<SharedResourcePtr>& getDependencies() const {
+    return mDependencies;
+  }
+
+  /// Whether benefit and screen size are passed on to the single dependency, which is what
+  /// actually costs something.
+  bool tricklesUp() const {
+    return mCost == 0.0f && mDependencies.size() == 1;
+  }
+
   ParseState getParseState();
   LoadState getLoadState();
 
@@ -130,8 +154,8 @@ protected:
     mDependents.erase(parent);
   }
 
-  void addDepBenefit(float benefit, unsigned int epoch);
-  //void addDepCost(float cost, unsigned int epoch);
+  /// Has the dependencies regather what their dependents trickle up on the next tick.
+  void dependenciesChanged();
 
   void clearDependencies();
   void parseDependencies();
@@ -159,15 +183,14 @@ protected:
   std::set<SharedResourcePtr> mDependencies;
   std::set<WeakResourcePtr> mDependents;
 
-  unsigned int mCostEpoch;
   unsigned int mLoadEpoch;
-  unsigned int mRemoveEpoch;
   unsigned int mCostPropEpoch;
   float mBenefit;
   float mDepBenefit;
   float mCurCost;
   float mCost;
   float mDepCost;
+  float mScreenSize; ///< entities set their own in calcBenefit
 };
 
 }
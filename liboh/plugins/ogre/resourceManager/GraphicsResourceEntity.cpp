@@ -33,7 +33,7 @@
 #include "GraphicsResourceAsset.hpp"
 #include "GraphicsResourceEntity.hpp"
 #include "GraphicsResourceName.hpp"
-#include "GraphicsResourceManager.hpp"
+#include "ResourceScheduler.hpp"
 #include "../OgreSystem.hpp"
 #include "../CameraEntity.hpp"
 #include "../MeshEntity.hpp"
@@ -43,8 +43,15 @@ using std::set;
 
 namespace Meru {
 
+OptionValue*OPTION_VIDEO_MEMORY_REFRESH_DISTANCE = new OptionValue("video-memory-refresh-distance",".05",OptionValueType<float>(),"The value of a still entity is recomputed once a camera moved this fraction of its distance to it");
+
+InitializeGlobalOptions graphicsresourceentityopts("ogregraphics",
+    OPTION_VIDEO_MEMORY_REFRESH_DISTANCE,
+    NULL);
+
 GraphicsResourceEntity::GraphicsResourceEntity(const SpaceObjectReference &id, GraphicsEntity *graphicsEntity)
-    : GraphicsResource(id.toString(), ENTITY), mGraphicsEntity(graphicsEntity), mLoadTime(Sirikata::Task::LocalTime::now())
+    : GraphicsResource(id.toString(), ENTITY), mGraphicsEntity(graphicsEntity), mLoadTime(Sirikata::Task::LocalTime::now()),
+      mValueSlack(0)
 {
 }
 
@@ -56,13 +63,28 @@ GraphicsResourceEntity::~GraphicsResourceEntity()
 {
 }
 
+void GraphicsResourceEntity::entityDestroyed()
+{
+  mGraphicsEntity = NULL;
+  entityChanged();
+}
+
+void GraphicsResourceEntity::entityChanged()
+{
+  ResourceScheduler::getSingleton().valueChanged(this);
+}
+
 float GraphicsResourceEntity::calcBenefit()
 {
+  mScreenSize = 0.0f;
+  mValueSlack = std::numeric_limits<float>::max(); // until a camera or the entity changes
   if (!mGraphicsEntity) {
     return 0.0f;
   }
   if (MESH_DISTANCE_IS_KING || STANDARD_COST_BENEFIT) {
-    const Location& curLoc = mGraphicsEntity->getProxy().extrapolateLocation(Sirikata::SpaceTimeOffsetManager::getSingleton().now(mGraphicsEntity->getProxy().getObjectReference().space()));
+    Sirikata::Time now = Sirikata::SpaceTimeOffsetManager::getSingleton().now(mGraphicsEntity->getProxy().getObjectReference().space());
+    const Location& curLoc = mGraphicsEntity->getProxy().extrapolateLocation(now);
+    float slackFraction = mGraphicsEntity->getProxy().isStatic(now) ? OPTION_VIDEO_MEMORY_REFRESH_DISTANCE->as<float>() : 0.0f;
 
     /*****************
      *  Loop through all OgreSystem's, and loop through the list of attached cameras
@@ -82,10 +104,13 @@ float GraphicsResourceEntity::calcBenefit()
         float dist = (curLoc.getPosition() - avatarLoc.getPosition()).length();
         float radius = mGraphicsEntity->getBoundingInfo().radius();
 
+        mValueSlack = std::min(mValueSlack, slackFraction * dist);
         if (dist == 0) {
+          mScreenSize = std::numeric_limits<float>::max();
           return std::numeric_limits<float>::max();
         }
-        else if (STANDARD_COST_BENEFIT) {
+        mScreenSize = std::max(mScreenSize, radius / dist);
+        if (STANDARD_COST_BENEFIT) {
           if (dist > radius) {
             float scaled = radius / (dist * dist);
           //int64 elapsed = (CURRENT_TIME - mLoadTime).asMilliseconds();
@@ -152,6 +177,7 @@ void GraphicsResourceEntity::setMeshResource(SharedResourcePtr newMeshPtr)
 
   clearDependencies();
   addDependency(newMeshPtr);
+  entityChanged(); // reparsed on the next tick
   std::tr1::shared_ptr<GraphicsResourceAsset> assetPtr (
     std::tr1::dynamic_pointer_cast<GraphicsResourceAsset>(newMeshPtr));
   if (assetPtr) {
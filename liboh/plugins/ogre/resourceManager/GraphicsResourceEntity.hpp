@@ -50,18 +50,25 @@ public:
 
   void setMeshResource(SharedResourcePtr newMeshPtr);
 
-  void entityDestroyed() {
-    mGraphicsEntity = NULL;
+  void entityDestroyed();
+  /// The entity moved or changed in a way that changes its value.
+  void entityChanged();
+
+  /// Zero while the entity moves, otherwise a fraction of the distance to the nearest camera.
+  virtual float getValueSlack() const {
+    return mValueSlack;
   }
 
 protected:
 
+  /// Also sets mScreenSize to the largest angular size any camera sees the entity at.
   virtual float calcBenefit();
 
   GraphicsEntity *mGraphicsEntity;
   URI mMeshID;
   SharedResourcePtr mCurMesh;
   Sirikata::Task::LocalTime mLoadTime;
+  float mValueSlack; ///< set in calcBenefit
 };
 
 }
@@ -41,6 +41,9 @@
 #include "ResourceManager.hpp"
 #include "Event.hpp"
 #include "EventSource.hpp"
+#include "../OgreSystem.hpp"
+#include "../CameraEntity.hpp"
+#include "oh/SpaceTimeOffsetManager.hpp"
 
 using std::map;
 using std::set;
@@ -49,17 +52,19 @@ using std::vector;
 
 namespace Meru {
 
-MANUAL_SINGLETON_STORAGE(GraphicsResourceManager);
-
 OptionValue*OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE = new OptionValue("video-memory-cache-size","1024",OptionValueType<int>(),"Number of megabytes to store from CDN in video memory");
+OptionValue*OPTION_VIDEO_MEMORY_HYSTERESIS = new OptionValue("video-memory-hysteresis",".25",OptionValueType<float>(),"A loaded resource is only unloaded for one worth this fraction more than it");
 
 InitializeGlobalOptions graphicsresourcemanageropts("ogregraphics",
     OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE,
+    OPTION_VIDEO_MEMORY_HYSTERESIS,
     NULL);
 
 
 GraphicsResourceManager::GraphicsResourceManager(Sirikata::Task::WorkQueue *dependencyQueue)
-: mEpoch(0), mEnabled(true)
+: ResourceScheduler(OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE->as<int>() * 1024.0f * 1024.0f,
+                    OPTION_VIDEO_MEMORY_HYSTERESIS->as<float>()),
+  mEnabled(true)
 {
   this->mTickListener = EventSource::getSingleton().subscribeId(
     EventID(EventTypes::Tick),
@@ -67,13 +72,14 @@ GraphicsResourceManager::GraphicsResourceManager(Sirikata::Task::WorkQueue *depe
   );
 
   mDependencyManager = new DependencyManager(dependencyQueue);
-  mBudget = OPTION_VIDEO_MEMORY_RESOURCE_CACHE_SIZE->as<int>() * 1024 * 1024;
 }
 
 GraphicsResourceManager::~GraphicsResourceManager()
 {
   EventSource::getSingleton().unsubscribe(this->mTickListener,false);
 
+  releaseAll();
+
   delete mDependencyManager;
 }
 
@@ -95,7 +101,7 @@ SharedResourcePtr GraphicsResourceManager::getResourceEntity(const SpaceObjectRe
   else {
     curSharedPtr = GraphicsResource::construct<GraphicsResourceEntity>(id, graphicsEntity);
     mIDResourceMap[id.toString()] = curSharedPtr;
-    mEntities.insert(curSharedPtr.get());
+    trackValue(curSharedPtr.get());
 
     return curSharedPtr;
   }
@@ -162,91 +168,41 @@ SharedResourcePtr DEBUGME(std::set<SharedResourcePtr>&x) {
 void GraphicsResourceManager::computeLoadedSet()
 {
 //  MERU_BENCH("computeLoadedSet");
-  assert(mQueue.empty());
-
   if (!mEnabled)
     return;
 
-  mEpoch++;
-  mToUnload = mResources;
-
-  set<GraphicsResource *>::iterator itr;
-  for (itr = mEntities.begin(); itr != mEntities.end(); itr++) {
-    GraphicsResource* resource = *itr;
-
-    GraphicsResource::ParseState parseState = resource->getParseState();
-    if (parseState == GraphicsResource::PARSE_INVALID)
-      resource->parse();
-
-    resource->updateValue(mEpoch);
-  }
-
-  float budgetUsed = 0;
-  while (mQueue.size() > 0) {
-    GraphicsResource* resource = mQueue.begin()->second;
-    mQueue.erase(mQueue.begin());
-
-    float cost = resource->cost();
-    //assert(cost >= 0);
-    ////////////////SILOG(resource,error,"Cost " << resource->cost() << " for "<<resource->getID()<<" is less than 0.");
-
-    if (budgetUsed + cost <= mBudget) {
-      GraphicsResource::LoadState loadState = resource->getLoadState();
-      if (loadState != GraphicsResource::LOAD_LOADING
-       && loadState != GraphicsResource::LOAD_LOADED
-       && loadState != GraphicsResource::LOAD_WAITING_LOAD) {
-        resource->load(mEpoch);
-      }
-      resource->removeLoadDependencies(mEpoch);
-      budgetUsed += cost;
-    }
-  }
-
-  set<GraphicsResource *>::iterator vitr;
-  for (vitr = mToUnload.begin(); vitr != mToUnload.end(); vitr++) {
-    GraphicsResource::LoadState loadState = (*vitr)->getLoadState();
-    if (loadState != GraphicsResource::LOAD_UNLOADED
-     && loadState != GraphicsResource::LOAD_UNLOADING
-     && loadState != GraphicsResource::LOAD_NEW
-     && loadState != GraphicsResource::LOAD_WAITING_UNLOAD)
-      (*vitr)->unload(mEpoch);
-  }
-  mToUnload.clear();
-
+  schedule(viewerTravel());
 //  MERU_BENCH("ecomputeLoadedSet");
 }
 
-void GraphicsResourceManager::updateLoadValue(GraphicsResource* resource, float oldValue)
-{
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(oldValue, resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
-    mQueue.insert(pair<float, GraphicsResource*>(resource->value(), resource));
-  }
-}
-
-void GraphicsResourceManager::registerLoad(GraphicsResource* resource, float oldValue)
+double GraphicsResourceManager::viewerTravel()
 {
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(oldValue, resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
-  }
-  mQueue.insert(pair<float, GraphicsResource*>(resource->value(), resource));
-}
-
-void GraphicsResourceManager::unregisterLoad(GraphicsResource* resource)
-{
-  ResourcePriorityQueue::iterator itr;
-  itr = mQueue.find(pair<float, GraphicsResource*>(resource->value(), resource));
-  if (itr != mQueue.end()) {
-    mQueue.erase(itr);
+  std::map<CameraEntity*, Vector3d> viewers;
+  double travel = 0;
+  bool changed = false;
+  std::list<OgreSystem*>::const_iterator systemIter = OgreSystem::sActiveOgreScenes.begin(),
+    systemEnd = OgreSystem::sActiveOgreScenes.end();
+  for (; systemIter != systemEnd; ++systemIter) {
+    std::list<CameraEntity*>::const_iterator cameraIter = (*systemIter)->mAttachedCameras.begin(),
+      cameraEnd = (*systemIter)->mAttachedCameras.end();
+    for (; cameraIter != cameraEnd; ++cameraIter) {
+      CameraEntity *camera = *cameraIter;
+      Vector3d position = camera->getProxy().extrapolateLocation(Sirikata::SpaceTimeOffsetManager::getSingleton().now(camera->getProxy().getObjectReference().space())).getPosition();
+      viewers[camera] = position;
+      std::map<CameraEntity*, Vector3d>::const_iterator last = mViewers.find(camera);
+      if (last == mViewers.end())
+        changed = true;
+      else
+        travel = std::max(travel, (position - last->second).length());
+    }
   }
+  if (viewers.size() != mViewers.size())
+    changed = true;
+  mViewers.swap(viewers);
 
-  set<GraphicsResource*>::iterator uitr = mToUnload.find(resource);
-  if (uitr != mToUnload.end())
-    mToUnload.erase(uitr);
+  if (changed)
+    viewersChanged();
+  return travel;
 }
 
 void GraphicsResourceManager::unregisterResource(GraphicsResource* resource)
@@ -254,13 +210,7 @@ void GraphicsResourceManager::unregisterResource(GraphicsResource* resource)
   mIDResourceMap.erase(mIDResourceMap.find(resource->getID()));
   mResources.erase(resource);
 
-  std::set<GraphicsResource *>::iterator eitr = mEntities.find(resource);
-  if (eitr != mEntities.end())
-    mEntities.erase(eitr);
-
-  std::set<GraphicsResource *>::iterator qitr = mToUnload.find(resource);
-  if (qitr != mToUnload.end())
-    mToUnload.erase(qitr);
+  ResourceScheduler::unregisterResource(resource);
 }
 
 EventResponse GraphicsResourceManager::tick(const EventPtr &evtPtr)
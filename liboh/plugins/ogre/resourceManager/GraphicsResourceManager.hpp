@@ -32,10 +32,9 @@
 #ifndef _GRAPHICS_RESOURCE_MANAGER_HPP_
 #define _GRAPHICS_RESOURCE_MANAGER_HPP_
 
-#include "GraphicsResource.hpp"
+#include "ResourceScheduler.hpp"
 #include "MeruDefs.hpp"
 #include <oh/ProxyObject.hpp>
-#include "Singleton.hpp"
 #include "Event.hpp"
 
 namespace Sirikata {
@@ -48,25 +47,24 @@ namespace Meru {
 
 class DependencyManager;
 
-class GraphicsResourceManager : public ManualSingleton<GraphicsResourceManager>
+/**
+ * Creates and looks up graphics resources, and drives the ResourceScheduler that decides which
+ * of them are loaded from the graphics tick, telling it how far the cameras moved.
+ */
+class GraphicsResourceManager : public ResourceScheduler
 {
-protected:
-  struct GraphicsResourcePriorityLessThanFunctor
-  {
-    bool operator()(const std::pair<float, GraphicsResource*>& key1, const std::pair<float, GraphicsResource*>& key2) const {
-      if (key1.first != key2.first)
-        return key1.first > key2.first;
-      return key1.second < key2.second;
-    }
-  };
-
-  typedef std::set<std::pair<float, GraphicsResource *>, GraphicsResourcePriorityLessThanFunctor> ResourcePriorityQueue;
-
 public:
 
   GraphicsResourceManager(Sirikata::Task::WorkQueue *dependencyQueue);
   virtual ~GraphicsResourceManager();
 
+  static GraphicsResourceManager& getSingleton() {
+    return static_cast<GraphicsResourceManager&>(ResourceScheduler::getSingleton());
+  }
+  static GraphicsResourceManager* getSingletonPtr() {
+    return static_cast<GraphicsResourceManager*>(ResourceScheduler::getSingletonPtr());
+  }
+
   //virtual void loadMesh(WeakProxyPtr proxy, const String &meshName);
 
   void computeLoadedSet();
@@ -78,19 +76,8 @@ public:
     return mDependencyManager;
   }
 
-  void unregisterResource(GraphicsResource* resource);
-
-  float getBudget() {
-    return mBudget / (1024.0f * 1024.0f);
-  }
-
-  void setBudget(float budget) {
-    mBudget = budget * (1024.0f * 1024.0f);
-  }
+  virtual void unregisterResource(GraphicsResource* resource);
 
-  void updateLoadValue(GraphicsResource* resource, float oldValue);
-  void registerLoad(GraphicsResource* resource, float oldValue);
-  void unregisterLoad(GraphicsResource* resource);
   void setEnabled(bool enabled) {
     mEnabled = enabled;
   }
@@ -99,17 +86,15 @@ protected:
 
   WeakResourcePtr getResource(const String &id);
   EventResponse tick(const EventPtr &evtPtr);
+  /// Furthest any camera moved since the last call; refreshes every value if cameras came or went.
+  double viewerTravel();
 
   std::map<String, WeakResourcePtr> mIDResourceMap;
   std::set<GraphicsResource *> mResources;
-  std::set<GraphicsResource *> mToUnload;
-  std::set<GraphicsResource *> mEntities;
   //std::set<GraphicsResource *> mMeshes;
-  ResourcePriorityQueue mQueue;
+  std::map<CameraEntity*, Vector3d> mViewers;
 
-  unsigned int mEpoch;
   DependencyManager *mDependencyManager;
-  float mBudget;
   SubscriptionId mTickListener;
   bool mEnabled;
 };
@@ -30,11 +30,14 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "CDNArchive.hpp"
+#include "DependencyManager.hpp"
+#include "Event.hpp"
 #include "GraphicsResourceManager.hpp"
 #include "GraphicsResourceMesh.hpp"
 #include "ResourceDependencyTask.hpp"
 #include "ResourceLoadTask.hpp"
 #include "ResourceLoadingQueue.hpp"
+#include "ResourceTransfer.hpp"
 #include "ResourceUnloadTask.hpp"
 #include "SequentialWorkQueue.hpp"
 #include <boost/bind.hpp>
@@ -44,8 +47,13 @@ namespace Meru {
 
 OptionValue*OPTION_ENABLE_TEXTURES = new OptionValue("enable-textures","true",OptionValueType<bool>(),"Enable or disable texture rendering");
 
+OptionValue*OPTION_PROGRESSIVE_MESH_TOLERANCE = new OptionValue("progressive-mesh-tolerance","0.002",OptionValueType<float>(),"Radians a progressive mesh may be off by on screen before finer levels are downloaded");
+OptionValue*OPTION_PROGRESSIVE_MESH_HEADER = new OptionValue("progressive-mesh-header","4096",OptionValueType<int>(),"Bytes first downloaded to read the header of a progressive mesh");
+
 InitializeGlobalOptions graphicsresourcemeshopts("ogregraphics",
     OPTION_ENABLE_TEXTURES,
+    OPTION_PROGRESSIVE_MESH_TOLERANCE,
+    OPTION_PROGRESSIVE_MESH_HEADER,
     NULL);
 
 class MeshDependencyTask : public ResourceDependencyTask
@@ -55,6 +63,13 @@ public:
   virtual ~MeshDependencyTask();
 
   virtual void operator()();
+
+protected:
+  /// Reads the header of a progressive mesh, downloading the rest of it if it was cut short.
+  void parseProgressive(SharedResourcePtr resourcePtr);
+  EventResponse headerDownloadHandler(const EventPtr &event);
+
+  bool mHeaderRequested;
 };
 
 class MeshLoadTask : public ResourceLoadTask
@@ -65,6 +80,16 @@ public:
   virtual void doRun();
 };
 
+/// Downloads more levels of a loaded progressive mesh and swaps them in.
+class MeshRefineTask : public ResourceLoadTask
+{
+public:
+  MeshRefineTask(DependencyManager *mgr, SharedResourcePtr resource, const String &hash, unsigned int epoch);
+  virtual ~MeshRefineTask();
+
+  virtual void doRun();
+};
+
 class MeshUnloadTask : public ResourceUnloadTask
 {
 public:
@@ -76,8 +101,68 @@ protected:
   //bool mainThreadUnload(String name);
 };
 
+/// Replaces the vertex and index buffers of mesh with the levels decoded so far.
+static void writeProgressiveBuffers(Ogre::Mesh *mesh, const Sirikata::ProgressiveMesh &levels)
+{
+  const std::vector<Sirikata::ProgressiveMesh::Vertex> &vertices = levels.vertices();
+  Ogre::VertexData *vertexData = new Ogre::VertexData();
+  Ogre::VertexDeclaration *decl = vertexData->vertexDeclaration;
+  size_t offset = 0;
+  decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+  offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+  decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL);
+  offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
+  decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0);
+  offset += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT2);
+
+  Ogre::HardwareVertexBufferSharedPtr vertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+      offset, std::max(vertices.size(), (size_t)1), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+  float *vertexDest = static_cast<float*>(vertexBuffer->lock(Ogre::HardwareBuffer::HBL_DISCARD));
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const Sirikata::ProgressiveMesh::Vertex &vert = vertices[i];
+    *vertexDest++ = vert.mPosition.x;
+    *vertexDest++ = vert.mPosition.y;
+    *vertexDest++ = vert.mPosition.z;
+    *vertexDest++ = vert.mNormal.x;
+    *vertexDest++ = vert.mNormal.y;
+    *vertexDest++ = vert.mNormal.z;
+    *vertexDest++ = vert.mU;
+    *vertexDest++ = vert.mV;
+  }
+  vertexBuffer->unlock();
+  vertexData->vertexBufferBinding->setBinding(0, vertexBuffer);
+  vertexData->vertexCount = vertices.size();
+  // Entities built from the mesh read these when they render, so they pick up the new level.
+  delete mesh->sharedVertexData;
+  mesh->sharedVertexData = vertexData;
+
+  bool wideIndices = vertices.size() > 65536;
+  const std::vector<Sirikata::ProgressiveMesh::SubMesh> &subMeshes = levels.subMeshes();
+  for (size_t sub = 0; sub < subMeshes.size(); ++sub) {
+    const std::vector<Sirikata::uint32> &indices = subMeshes[sub].mIndices;
+    Ogre::IndexData *indexData = mesh->getSubMesh(sub)->indexData;
+    Ogre::HardwareIndexBufferSharedPtr indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+        wideIndices ? Ogre::HardwareIndexBuffer::IT_32BIT : Ogre::HardwareIndexBuffer::IT_16BIT,
+        std::max(indices.size(), (size_t)1), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+    void *indexDest = indexBuffer->lock(Ogre::HardwareBuffer::HBL_DISCARD);
+    if (wideIndices) {
+      std::copy(indices.begin(), indices.end(), static_cast<Ogre::uint32*>(indexDest));
+    }
+    else {
+      Ogre::uint16 *shortDest = static_cast<Ogre::uint16*>(indexDest);
+      for (size_t i = 0; i < indices.size(); ++i)
+        shortDest[i] = (Ogre::uint16)indices[i];
+    }
+    indexBuffer->unlock();
+    indexData->indexBuffer = indexBuffer;
+    indexData->indexStart = 0;
+    indexData->indexCount = indices.size();
+  }
+}
+
 GraphicsResourceMesh::GraphicsResourceMesh(const RemoteFileId &resourceID)
-: GraphicsResourceAsset(resourceID, GraphicsResource::MESH)
+: GraphicsResourceAsset(resourceID, GraphicsResource::MESH),
+  mProgressive(false), mRefineTask(NULL)
 {
 
 }
@@ -121,8 +206,104 @@ void GraphicsResourceMesh::setMaterialNames(GraphicsResourceMesh* resourcePtr)
   }
 }
 
+bool GraphicsResourceMesh::isProgressiveName(const URI& id)
+{
+  const String &name = id.filename();
+  return name.length() > 6 && name.compare(name.length() - 6, 6, ".pmesh") == 0;
+}
+
+void GraphicsResourceMesh::setProgressive()
+{
+  if (mParseState == PARSE_INVALID)
+    mProgressive = true;
+}
+
+unsigned int GraphicsResourceMesh::wantedLevel() const
+{
+  return mLevels.levelForScreenSize(getScreenSize(), OPTION_PROGRESSIVE_MESH_TOLERANCE->as<float>());
+}
+
+void GraphicsResourceMesh::refreshValue()
+{
+  GraphicsResourceAsset::refreshValue();
+  if (mProgressive && mLoadState == LOAD_LOADED && !mRefineTask
+   && mLevels.isValid() && wantedLevel() >= mLevels.levelsDecoded())
+    refine();
+}
+
+void GraphicsResourceMesh::refine()
+{
+  DependencyManager* depMgr = GraphicsResourceManager::getSingletonPtr()->getDependencyManager();
+
+  mRefineTask = new MeshRefineTask(depMgr, getSharedPtr(), mResourceID.toString(), mLoadEpoch);
+  Sirikata::Transfer::Range range(mLevels.levelStart(mLevels.levelsDecoded()),
+                                  mLevels.level(wantedLevel()).mEnd, Sirikata::Transfer::BOUNDS);
+  ResourceDownloadTask *downloadTask = new ResourceDownloadTask(depMgr, mResourceID, mRefineTask, range);
+  depMgr->establishDependencyRelationship(mRefineTask, downloadTask);
+  downloadTask->go();
+}
+
+bool GraphicsResourceMesh::loadProgressive(const DenseDataPtr &data)
+{
+  // Start over from the header, since levels decoded before an unload are gone from Ogre.
+  mLevels.parseHeader((const unsigned char*)mProgressiveHeader.data(), mProgressiveHeader.length());
+  mLevels.refine(data->data(), data->startbyte(), data->length());
+  if (mLevels.levelsDecoded() == 0) {
+    SILOG(ogre,error,"Progressive mesh "<<mResourceID.toString()<<" is missing its first level");
+    return false;
+  }
+
+  Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(getID(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+  const std::vector<Sirikata::ProgressiveMesh::SubMesh> &subMeshes = mLevels.subMeshes();
+  for (size_t sub = 0; sub < subMeshes.size(); ++sub) {
+    Ogre::SubMesh *subMesh = mesh->createSubMesh();
+    subMesh->useSharedVertices = true;
+    subMesh->operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+    subMesh->setMaterialName(subMeshes[sub].mMaterial);
+  }
+  writeProgressiveBuffers(mesh.getPointer(), mLevels);
+  const Sirikata::Vector3f &boundsMin = mLevels.boundsMin();
+  const Sirikata::Vector3f &boundsMax = mLevels.boundsMax();
+  mesh->_setBounds(Ogre::AxisAlignedBox(boundsMin.x, boundsMin.y, boundsMin.z, boundsMax.x, boundsMax.y, boundsMax.z));
+  mesh->_setBoundingSphereRadius(mLevels.radius());
+  mesh->load();
+  return true;
+}
+
+void GraphicsResourceMesh::refineProgressive(const DenseDataPtr &data)
+{
+  size_t decoded = mLevels.levelsDecoded();
+  if (!mLevels.refine(data->data(), data->startbyte(), data->length())) {
+    SILOG(ogre,error,"Progressive mesh "<<mResourceID.toString()<<" has a malformed level "<<mLevels.levelsDecoded());
+  }
+  if (mLevels.levelsDecoded() == decoded)
+    return;
+
+  Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().getByName(getID());
+  if (!mesh.isNull())
+    writeProgressiveBuffers(mesh.getPointer(), mLevels);
+}
+
+void GraphicsResourceMesh::doUnload()
+{
+  if (mRefineTask) {
+    mRefineTask->cancel();
+    mRefineTask = NULL;
+  }
+  GraphicsResourceAsset::doUnload();
+}
+
 ResourceDownloadTask* GraphicsResourceMesh::createDownloadTask(DependencyManager *manager, ResourceRequestor *resourceRequestor)
 {
+  if (mProgressive) {
+    if (resourceRequestor == mParseTask) {
+      // Parsing only needs the header, which is usually all in the first few kilobytes.
+      return new ResourceDownloadTask(manager, mResourceID, resourceRequestor,
+          Sirikata::Transfer::Range(0, OPTION_PROGRESSIVE_MESH_HEADER->as<int>(), Sirikata::Transfer::LENGTH));
+    }
+    return new ResourceDownloadTask(manager, mResourceID, resourceRequestor,
+        Sirikata::Transfer::Range(mLevels.headerLength(), mLevels.level(wantedLevel()).mEnd, Sirikata::Transfer::BOUNDS));
+  }
   return new ResourceDownloadTask(manager, mResourceID, resourceRequestor);
 }
 
@@ -144,7 +325,7 @@ ResourceUnloadTask* GraphicsResourceMesh::createUnloadTask(DependencyManager *ma
 /***************************** MESH DEPENDENCY TASK *************************/
 
 MeshDependencyTask::MeshDependencyTask(DependencyManager *mgr, WeakResourcePtr resource, const String& hash)
-: ResourceDependencyTask(mgr, resource, hash)
+: ResourceDependencyTask(mgr, resource, hash), mHeaderRequested(false)
 {
 
 }
@@ -162,6 +343,11 @@ void MeshDependencyTask::operator()()
     return;
   }
 
+  if (static_cast<GraphicsResourceMesh*>(resourcePtr.get())->isProgressive()) {
+    parseProgressive(resourcePtr);
+    return;
+  }
+
   if (OPTION_ENABLE_TEXTURES->as<bool>()) {
     GraphicsResourceManager *grm = GraphicsResourceManager::getSingletonPtr();
 
@@ -196,6 +382,59 @@ void MeshDependencyTask::operator()()
 
   finish(true);
 }
+
+void MeshDependencyTask::parseProgressive(SharedResourcePtr resourcePtr)
+{
+  GraphicsResourceMesh* meshPtr = static_cast<GraphicsResourceMesh*>(resourcePtr.get());
+  DenseDataPtr header = mBuffer.flatten();
+  size_t headerLength = Sirikata::ProgressiveMesh::headerLength(header->data(), header->length());
+  if (header->startbyte() == 0 && headerLength > header->length() && !mHeaderRequested) {
+    // Long material names pushed the header past the first download.
+    mHeaderRequested = true;
+    ResourceManager::getSingleton().request(meshPtr->getRemoteFileId(),
+        std::tr1::bind(&MeshDependencyTask::headerDownloadHandler, this, _1),
+        Sirikata::Transfer::Range(0, headerLength, Sirikata::Transfer::LENGTH));
+    return;
+  }
+
+  Sirikata::ProgressiveMesh &levels = meshPtr->mLevels;
+  if (header->startbyte() != 0 || !levels.parseHeader(header->data(), header->length())
+   || levels.numLevels() == 0) {
+    SILOG(ogre,error,"Could not read the progressive mesh header of "<<mHash);
+    resourcePtr->parsed(false);
+    finish(false);
+    return;
+  }
+  meshPtr->mProgressiveHeader.assign((const char*)header->data(), headerLength);
+
+  if (OPTION_ENABLE_TEXTURES->as<bool>()) {
+    GraphicsResourceManager *grm = GraphicsResourceManager::getSingletonPtr();
+    const std::vector<Sirikata::ProgressiveMesh::SubMesh> &subMeshes = levels.subMeshes();
+    for (size_t sub = 0; sub < subMeshes.size(); ++sub) {
+      const String &material = subMeshes[sub].mMaterial;
+      String::size_type pos = material.find_last_of(':');
+      if (material.compare(0, 7, "meru://") == 0 && pos > 7) {
+        SharedResourcePtr hashResource = grm->getResourceAsset(URI(material.substr(0, pos)), GraphicsResource::MATERIAL);
+        resourcePtr->addDependency(hashResource);
+      }
+    }
+  }
+
+  // Charged for the whole mesh, since refinements are downloaded without asking for room.
+  resourcePtr->setCost(levels.level(levels.numLevels() - 1).mEnd);
+  resourcePtr->parsed(true);
+
+  finish(true);
+}
+
+EventResponse MeshDependencyTask::headerDownloadHandler(const EventPtr &event)
+{
+  std::tr1::shared_ptr<DownloadCompleteEvent> transferEvent = DowncastEvent<DownloadCompleteEvent>(event);
+  if (transferEvent->success())
+    mBuffer = transferEvent->data();
+  (*this)();
+  return EventResponse::del();
+}
 /*
   if (curResource) {
     Ogre::ResourcePtr meshResource = Ogre::MeshManager::getSingleton().getByName(CDNArchive::canonicalMhashName(mHash));
@@ -218,6 +457,17 @@ MeshLoadTask::MeshLoadTask(DependencyManager *mgr, SharedResourcePtr resourcePtr
 
 void MeshLoadTask::doRun()
 {
+  GraphicsResourceMesh *meshPtr = static_cast<GraphicsResourceMesh *>(mResource.get());
+  if (meshPtr->isProgressive()) {
+    bool success = meshPtr->loadProgressive(mBuffer);
+    if (success)
+      GraphicsResourceMesh::setMaterialNames(meshPtr);
+    mResource->loaded(success, mEpoch);
+    // The screen size may already want finer levels than were loaded.
+    GraphicsResourceManager::getSingleton().valueChanged(meshPtr);
+    return;
+  }
+
   String hash = mHash; //CDNArchive::canonicalMhashName(mHash);
   int archive = CDNArchive::addArchive(hash, mBuffer);
   Ogre::MeshManager::getSingleton().load(hash, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
@@ -233,6 +483,31 @@ void MeshLoadTask::doRun()
   mResource->loaded(true, mEpoch);
 }
 
+/***************************** MESH REFINE TASK *************************/
+
+MeshRefineTask::MeshRefineTask(DependencyManager *mgr, SharedResourcePtr resourcePtr, const String &hash, unsigned int epoch)
+: ResourceLoadTask(mgr, resourcePtr, hash, epoch)
+{
+}
+
+MeshRefineTask::~MeshRefineTask()
+{
+  // Also reached without running when the download fails.
+  GraphicsResourceMesh *meshPtr = static_cast<GraphicsResourceMesh *>(mResource.get());
+  if (meshPtr->mRefineTask == this) {
+    meshPtr->mRefineTask = NULL;
+    // Checks on the next tick whether the screen size grew while this was downloading.
+    GraphicsResourceManager::getSingleton().valueChanged(meshPtr);
+  }
+}
+
+void MeshRefineTask::doRun()
+{
+  GraphicsResourceMesh *meshPtr = static_cast<GraphicsResourceMesh *>(mResource.get());
+  if (meshPtr->getLoadState() == GraphicsResource::LOAD_LOADED && meshPtr->mLoadEpoch == mEpoch)
+    meshPtr->refineProgressive(mBuffer);
+}
+
 /***************************** MESH UNLOAD TASK *************************/
 
 MeshUnloadTask::MeshUnloadTask(DependencyManager *mgr, WeakResourcePtr resource, const String &hash, unsigned int epoch)
@@ -253,14 +528,16 @@ void MeshUnloadTask::doRun()
   /*I REALLY wish this were true*/
   // SequentialWorkQueue::getSingleton().queueWork(std::tr1::bind(&MeshUnloadTask::mainThreadUnload, this, mHash));
 
+  SharedResourcePtr resource = mResource.lock();
   String hash = mHash; //CDNArchive::canonicalMhashName(mHash);
+  if (resource && static_cast<GraphicsResourceMesh *>(resource.get())->isProgressive())
+    hash = resource->getID();
   Ogre::MeshManager* meshManager = Ogre::MeshManager::getSingletonPtr();
   meshManager->remove(hash);
 
   Ogre::ResourcePtr meshResource = meshManager->getByName(hash);
   assert(meshResource.isNull());
 
-  SharedResourcePtr resource = mResource.lock();
   if (resource)
     resource->unloaded(true, mEpoch);
 }
@@ -34,15 +34,24 @@
 
 #include "MeruDefs.hpp"
 #include "GraphicsResourceAsset.hpp"
+#include <util/ProgressiveMesh.hpp>
 
 namespace Meru {
 
+/**
+ * An Ogre mesh.  Meshes named with a ".pmesh" extension are Sirikata::ProgressiveMesh files:
+ * parsing them only downloads the header, loading downloads the levels needed for the screen
+ * size of the entities showing them, and more levels are downloaded and swapped into the
+ * loaded mesh whenever the screen size asks for them.
+ */
 class GraphicsResourceMesh : public GraphicsResourceAsset {
 public:
   GraphicsResourceMesh(const RemoteFileId &resourceID);
   virtual ~GraphicsResourceMesh();
 
   virtual void resolveName(const URI& id, const URI& hash);
+  /// Also refines a loaded progressive mesh if its screen size grew.
+  virtual void refreshValue();
 
   virtual ResourceDownloadTask * createDownloadTask(DependencyManager *manager, ResourceRequestor *resourceRequestor);
   virtual ResourceDependencyTask * createDependencyTask(DependencyManager *manager);
@@ -51,8 +60,36 @@ public:
 
   static void setMaterialNames(GraphicsResourceMesh* resourcePtr);
 
+  static bool isProgressiveName(const URI& id);
+  /// Treats this mesh as a progressive mesh; has no effect once it has been parsed.
+  void setProgressive();
+  bool isProgressive() const {
+    return mProgressive;
+  }
+
 protected:
+  friend class MeshDependencyTask;
+  friend class MeshLoadTask;
+  friend class MeshRefineTask;
+
+  virtual void doUnload();
+
+  /// Level of the progressive mesh the current screen size needs.
+  unsigned int wantedLevel() const;
+  /// Downloads the levels up to wantedLevel() that are not loaded yet.
+  void refine();
+  /// Creates the Ogre mesh from the levels in data, which starts after the header.
+  bool loadProgressive(const DenseDataPtr &data);
+  /// Adds the levels in data to the loaded Ogre mesh.
+  void refineProgressive(const DenseDataPtr &data);
+
   std::map<String, String> mMaterialNames;
+
+  bool mProgressive;
+  /// Bytes of the progressive mesh header, kept to start over on every load.
+  String mProgressiveHeader;
+  Sirikata::ProgressiveMesh mLevels;
+  ResourceLoadTask* mRefineTask;
 };
 
 }
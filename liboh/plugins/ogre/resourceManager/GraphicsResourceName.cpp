@@ -31,6 +31,7 @@
  */
 #include "GraphicsResourceManager.hpp"
 #include "GraphicsResourceAsset.hpp"
+#include "GraphicsResourceMesh.hpp"
 #include "GraphicsResourceName.hpp"
 #include "ResourceManager.hpp"
 #include <boost/bind.hpp>
@@ -84,6 +85,12 @@ void GraphicsResourceName::hashLookupCallback(WeakResourcePtr resourcePtr, Type
       try {
         GraphicsResourceManager *grm = GraphicsResourceManager::getSingletonPtr();
         SharedResourcePtr hashResource = grm->getResourceAsset(hash->uri(), refType);
+        if (refType == MESH && GraphicsResourceMesh::isProgressiveName(id)) {
+          std::tr1::shared_ptr<GraphicsResourceMesh> meshPtr =
+              std::tr1::dynamic_pointer_cast<GraphicsResourceMesh>(hashResource);
+          if (meshPtr)
+            meshPtr->setProgressive();
+        }
         resource->addDependency(hashResource);
         resource->parsed(true);
       }
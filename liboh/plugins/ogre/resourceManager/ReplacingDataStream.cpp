@@ -33,8 +33,8 @@
 #include "ReplacingDataStream.hpp"
 
 #include "CDNArchive.hpp"
-#include <boost/regex.hpp>
 #include <vector>
+#include <algorithm>
 
 namespace Meru{
 namespace MangleTextureName {
@@ -106,7 +106,7 @@ void ReplacingDataStream::find_lexeme (const Ogre::String&input,
     }*/
   while (where_lexeme_start!=return_lexeme_end) {
     char c =input[where_lexeme_start];
-    if (!isspace(c)) {
+    if (!isspace((unsigned char)c)) {
       if (c=='/'&&where_lexeme_start+1!=return_lexeme_end&&input[where_lexeme_start+1]=='/') {
         //comment: find end of line
         while (where_lexeme_start++!=return_lexeme_end) {
@@ -128,7 +128,7 @@ void ReplacingDataStream::find_lexeme (const Ogre::String&input,
         //if (return_lexeme_end==where_lexeme_start)
         //    ++where_lexeme_start;
     }
-    if (isspace(c)||c=='{'||(c=='/'&&comment_immunity==false&&return_lexeme_end+1<input.length()&&input[return_lexeme_end+1]=='/'&&(return_lexeme_end==where_lexeme_start||input[return_lexeme_end-1]!=':'))) {
+    if (isspace((unsigned char)c)||c=='{'||(c=='/'&&comment_immunity==false&&return_lexeme_end+1<input.length()&&input[return_lexeme_end+1]=='/'&&(return_lexeme_end==where_lexeme_start||input[return_lexeme_end-1]!=':'))) {
       //if (return_lexeme_end>where_lexeme_start)
       //  --return_lexeme_end;
       break;
@@ -208,50 +208,128 @@ Ogre::String ReplacingDataStream::full_replace_lexeme(const Ogre::String &input,
                                                       Ogre::String::size_type &return_lexeme_end,
                                                       const Ogre::String &filename) {
   find_lexeme(input,where_lexeme_start,return_lexeme_end);
+  Ogre::String retval;
   if (where_lexeme_start<return_lexeme_end) {
       Ogre::String depended=input.substr(where_lexeme_start,return_lexeme_end-where_lexeme_start);
       if (depended.find_first_of('*')==Ogre::String::npos) {
           if (depended.find("://")==Ogre::String::npos) {
               depended=mangleTextureName(filename,depended);
-              return "\""+possibleMhashCanonicalization(replaceColonSlashSlash(depended))+"\"";
+              retval+='\"';
+              append_aliased(retval,possibleMhashCanonicalization(replaceColonSlashSlash(depended)));
+              retval+='\"';
           }else {
-              return possibleMhashCanonicalization(replaceColonSlashSlash(depended));
+              append_aliased(retval,possibleMhashCanonicalization(replaceColonSlashSlash(depended)));
           }
+          depends_on.push_back(depended);
       }else {
-          return possibleMhashCanonicalization(depended);
+          append_aliased(retval,possibleMhashCanonicalization(depended));
       }
-  }else {
-      return Ogre::String();
   }
+  return retval;
+}
+
+namespace {
+/// What replaceData does with a line that starts with a given keyword
+enum ScriptKeyword {
+    NOT_A_KEYWORD,
+    PROVIDES_KEYWORD,//material, vertex_program, fragment_program
+    DEPENDS_KEYWORD,//program references and delegate
+    IMPORT_KEYWORD,
+    SOURCE_KEYWORD,
+    TEXTURE_KEYWORD,
+    MULTI_TEXTURE_KEYWORD//anim_texture, cubic_texture
+};
+struct ScriptKeywordEntry {
+    const char *name;
+    size_t length;
+    ScriptKeyword keyword;
+};
+#define SCRIPT_KEYWORD(name,keyword) {name,sizeof(name)-1,keyword}
+const ScriptKeywordEntry scriptKeywords[]={
+    SCRIPT_KEYWORD("material",PROVIDES_KEYWORD),
+    SCRIPT_KEYWORD("vertex_program",PROVIDES_KEYWORD),
+    SCRIPT_KEYWORD("fragment_program",PROVIDES_KEYWORD),
+    SCRIPT_KEYWORD("vertex_program_ref",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("fragment_program_ref",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("shadow_caster_vertex_program_ref",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("shadow_receiver_vertex_program_ref",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("shadow_receiver_fragment_program_ref",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("delegate",DEPENDS_KEYWORD),
+    SCRIPT_KEYWORD("import",IMPORT_KEYWORD),
+    SCRIPT_KEYWORD("source",SOURCE_KEYWORD),
+    SCRIPT_KEYWORD("texture",TEXTURE_KEYWORD),
+    SCRIPT_KEYWORD("anim_texture",MULTI_TEXTURE_KEYWORD),
+    SCRIPT_KEYWORD("cubic_texture",MULTI_TEXTURE_KEYWORD)
+};
+#undef SCRIPT_KEYWORD
+ScriptKeyword classifyKeyword(const char *word, size_t length) {
+    for (size_t i=0;i<sizeof(scriptKeywords)/sizeof(scriptKeywords[0]);++i) {
+        if (scriptKeywords[i].length==length&&memcmp(scriptKeywords[i].name,word,length)==0)
+            return scriptKeywords[i].keyword;
+    }
+    return NOT_A_KEYWORD;
+}
+}
+
+void ReplacingDataStream::append_aliased(Ogre::String&retval, const Ogre::String&name) const{
+    Ogre::String::size_type start=0,end=name.length();
+    if (!mCanonicalTextureAliases.empty()&&start<end) {
+        if (name[start]=='\"') ++start;
+        if (end>start&&name[end-1]=='\"') --end;
+        CanonicalNameMap::const_iterator where=mCanonicalTextureAliases.find(name.substr(start,end-start));
+        if (where==mCanonicalTextureAliases.end()) {
+            //a reference to something inside another file, e.g. meru://foo@bar/baz:Foo
+            Ogre::String::size_type scheme=name.find("://",start);
+            Ogre::String::size_type colon=name.rfind(':',end-1);
+            if (scheme!=Ogre::String::npos&&colon!=Ogre::String::npos&&colon>scheme+2&&colon<end) {
+                where=mCanonicalTextureAliases.find(name.substr(start,colon-start));
+                end=colon;
+            }
+        }
+        if (where!=mCanonicalTextureAliases.end()) {
+            retval.append(name,0,start);
+            retval+=where->second;
+            retval.append(name,end,Ogre::String::npos);
+            return;
+        }
+    }
+    retval+=name;
 }
 
-static boost::regex mondo_regex("(?:^(?:\t|[[:space:]])*(material[[:space:]]+|vertex_program[[:space:]]+|fragment_program[[:space:]]+))|(?:^(?:\t|[[:space:]])*(vertex_program_ref[[:space:]]+|fragment_program_ref[[:space:]]+|shadow_caster_vertex_program_ref[[:space:]]+|shadow_receiver_vertex_program_ref[[:space:]]+|shadow_receiver_fragment_program_ref[[:space:]]+|delegate[[:space:]]+))|(?:(?:\t|[[:space:]])*(import[[:space:]].*?from[[:space:]]+))|(?:^(?:\t|[[:space:]])*(source[[:space:]]+))|(?:^(?:\t|[[:space:]])*(texture[[:space:]]+))|(?:^(?:\t|[[:space:]])*(anim_texture[[:space:]]+|cubic_texture[[:space:]]+))");
-  //"([[:word:]])"
-  //  "([[:space:]]|//)";
 const static std::string myquote("\"");
 void ReplacingDataStream::replace_reference(Ogre::String&retval, const Ogre::String&input, Ogre::String::size_type&pwhere,Ogre::String::const_iterator second_input, const Ogre::String&filename) {
       Ogre::String::size_type lexeme_start=second_input-input.begin(),return_lexeme_end;
 
       find_lexeme(input,lexeme_start,return_lexeme_end);
       if (lexeme_start<return_lexeme_end) {
-          Ogre::String dep=input.substr(lexeme_start,return_lexeme_end-lexeme_start);
-          retval+=input.substr(pwhere,lexeme_start-pwhere);
-          if (dep[0]=='\"') {
-              dep=myquote+CDN_REPLACING_MATERIAL_STREAM_HINT+dep.substr(1);
+          retval.append(input,pwhere,lexeme_start-pwhere);
+          if (input[lexeme_start]=='\"') {
+              retval+=myquote;
+              retval+=CDN_REPLACING_MATERIAL_STREAM_HINT;
+              append_aliased(retval,input.substr(lexeme_start+1,return_lexeme_end-lexeme_start-1));
           }else {
-              dep=CDN_REPLACING_MATERIAL_STREAM_HINT+dep;
+              retval+=CDN_REPLACING_MATERIAL_STREAM_HINT;
+              append_aliased(retval,input.substr(lexeme_start,return_lexeme_end-lexeme_start));
           }
-          retval+=dep;
           pwhere=return_lexeme_end;
       }
 }
 void ReplacingDataStream::replace_texture_reference(Ogre::String&retval, const Ogre::String&input, Ogre::String::size_type&pwhere,Ogre::String::const_iterator second_input, bool texture_instead_of_source,const Ogre::String&filename) {
+    if (mCanonicalTextureAliases.empty())
+        return;
+    Ogre::String::size_type lexeme_start=second_input-input.begin(),return_lexeme_end;
 
+    find_lexeme(input,lexeme_start,return_lexeme_end);
+    if (lexeme_start<return_lexeme_end) {
+        retval.append(input,pwhere,lexeme_start-pwhere);
+        append_aliased(retval,input.substr(lexeme_start,return_lexeme_end-lexeme_start));
+        pwhere=return_lexeme_end;
+    }
 }
 Ogre::String::size_type find_space_colon_space(const Ogre::String &input, Ogre::String::size_type start) {
     Ogre::String::size_type len=input.length();
     bool ok1=false,ok2=false,ok3=false;
-    while (start<len&&isspace(input[start])) {
+    while (start<len&&isspace((unsigned char)input[start])) {
         start++;
         ok1=true;
     }
@@ -259,7 +337,7 @@ Ogre::String::size_type find_space_colon_space(const Ogre::String &input, Ogre::
         ok2=true;
         start++;
     }
-    while (start<len&&isspace(input[start])) {
+    while (start<len&&isspace((unsigned char)input[start])) {
         start++;
         ok3=true;
     }
@@ -268,38 +346,64 @@ Ogre::String::size_type find_space_colon_space(const Ogre::String &input, Ogre::
 }
 
 
-Ogre::String ReplacingDataStream::replaceData(Ogre::String input) {
-  std::string::const_iterator start, end;
-  start = input.begin();
-  end = input.end();
-  boost::match_results<std::string::const_iterator> what;
-  boost::match_flag_type flags = boost::match_default;
+Ogre::String ReplacingDataStream::replaceData(const Ogre::String &input) {
+  mCanonicalTextureAliases.clear();
+  if (mTextureAliases) {
+      for (Ogre::NameValuePairList::const_iterator iter=mTextureAliases->begin(),iterend=mTextureAliases->end();iter!=iterend;++iter) {
+          mCanonicalTextureAliases[iter->first]=CDNArchive::canonicalMhashName(iter->second);
+      }
+  }
+  const char *data=input.data();
+  Ogre::String::size_type len=input.length();
   Ogre::String midval;
-  Ogre::String::size_type pwhere=0,temp_size;
-
-
-  while(boost::regex_search(start, end, what, mondo_regex, flags)) {
-    start=what[0].second;
-    if (what[1].matched) {//provides
-      midval+=input.substr(pwhere,(what[0].second-input.begin())-pwhere);
+  midval.reserve(len+len/4);//names only get longer when they are mangled
+  Ogre::String::size_type pwhere=0,temp_size,line=0;
 
-      midval+=replace_lexeme(input,what[0].second-input.begin(),pwhere,mName);
-      start=input.begin()+pwhere;
-
-      if ((temp_size=find_space_colon_space(input,pwhere))) {//depends on material
-          midval+=input.substr(pwhere,temp_size-pwhere);
+  while (line<len) {
+    //a keyword is the first word of its line and must be followed by whitespace
+    Ogre::String::size_type keyword_start=line;
+    while (keyword_start<len&&isspace((unsigned char)data[keyword_start])) ++keyword_start;
+    Ogre::String::size_type keyword_end=keyword_start;
+    while (keyword_end<len&&!isspace((unsigned char)data[keyword_end])) ++keyword_end;
+    ScriptKeyword keyword=NOT_A_KEYWORD;
+    if (keyword_end<len)
+        keyword=classifyKeyword(data+keyword_start,keyword_end-keyword_start);
+    if (keyword==IMPORT_KEYWORD) {//import <what> from <file>
+        Ogre::String::size_type from=keyword_end+1;
+        while ((from=input.find("from",from))!=Ogre::String::npos&&from+4<len&&!isspace((unsigned char)data[from+4]))
+            from+=4;
+        if (from==Ogre::String::npos||from+4>=len)
+            keyword=NOT_A_KEYWORD;
+        else
+            keyword_end=from+4;
+    }
+    Ogre::String::size_type lexeme=keyword_end;//where the name after the keyword may start
+    while (lexeme<len&&isspace((unsigned char)data[lexeme])) ++lexeme;
 
-          midval+=full_replace_lexeme(input,temp_size,pwhere,mName);
-          start=input.begin()+pwhere;
-      }
-    }else if (what[3].matched) {//depends on imported file
-        replace_reference(midval,input,pwhere,what[0].second,mName);
-    }else if (what[4].matched) {//depends on source file
-        replace_texture_reference(midval,input,pwhere,what[0].second,false,mName);
-    }else if (what[5].matched) {//depends on texture file
-        replace_texture_reference(midval,input,pwhere,what[0].second,true,mName);
-    }else if (what[6].matched) {//depends on anim_ or cubic_ files
-        Ogre::String::size_type whereend=what[0].second-input.begin();
+    switch (keyword) {
+      case PROVIDES_KEYWORD:
+        midval.append(input,pwhere,lexeme-pwhere);
+        midval+=replace_lexeme(input,lexeme,pwhere,mName);
+        if ((temp_size=find_space_colon_space(input,pwhere))) {//depends on material
+            midval.append(input,pwhere,temp_size-pwhere);
+            midval+=full_replace_lexeme(input,temp_size,pwhere,mName);
+        }
+        break;
+      case DEPENDS_KEYWORD://depends on material
+        midval.append(input,pwhere,lexeme-pwhere);
+        midval+=full_replace_lexeme(input,lexeme,pwhere,mName);
+        break;
+      case IMPORT_KEYWORD://depends on imported file
+        replace_reference(midval,input,pwhere,input.begin()+lexeme,mName);
+        break;
+      case SOURCE_KEYWORD://depends on source file
+        replace_texture_reference(midval,input,pwhere,input.begin()+lexeme,false,mName);
+        break;
+      case TEXTURE_KEYWORD://depends on texture file
+        replace_texture_reference(midval,input,pwhere,input.begin()+lexeme,true,mName);
+        break;
+      case MULTI_TEXTURE_KEYWORD: {//depends on anim_ or cubic_ files
+        Ogre::String::size_type whereend=lexeme;
         //kwhere keeps track of location in stream without modifying the pwhere
         //it just seeks through the line until it finds the end....and if the replace_texture_reference modifies pwhere kwhere is updated to match
         Ogre::String::size_type kwhere=whereend;
@@ -313,60 +417,17 @@ Ogre::String ReplacingDataStream::replaceData(Ogre::String input) {
                 kwhere=pwhere;
             }
         }
-    }else if (what[2].matched) {//depends on material
-      midval+=input.substr(pwhere,(what[0].second-input.begin())-pwhere);
-
-      midval+=full_replace_lexeme(input,what[0].second-input.begin(),pwhere,mName);
-      start=input.begin()+pwhere;
-    }
-  }
-  midval+=input.substr(pwhere);
-
-  start=midval.begin();
-  end=midval.end();
-  std::string retval;
-  std::string cur_expr;
-  size_t num_texture_aliases=mTextureAliases?mTextureAliases->size():0;
-  if (num_texture_aliases!=0) {
-      for (Ogre::NameValuePairList::const_iterator iter=mTextureAliases->begin(),iterend=mTextureAliases->end();iter!=iterend;++iter) {
-          if (cur_expr.length())
-              cur_expr+='|';
-          cur_expr+='(';
-          cur_expr+='\\';
-          cur_expr+='Q';
-          cur_expr+=iter->first;
-          cur_expr+='\\';
-          cur_expr+='E';
-          cur_expr+=')';
+        break;
       }
-
-      boost::regex expression(cur_expr);
-      pwhere=0;
-      while(boost::regex_search(start, end, what, expression, flags)) {
-          start=what[0].second;
-
-          for (size_t i=1;i<=num_texture_aliases;++i) {
-              if (what[i].matched) {
-                  Ogre::NameValuePairList::const_iterator where=mTextureAliases->find(Ogre::String(what[i].first,what[i].second));
-                  if (where!=mTextureAliases->end()) {
-                      retval+=midval.substr(pwhere,(what[0].first-midval.begin())-pwhere);
-                      retval+=CDNArchive::canonicalMhashName(where->second);
-                      start=what[0].second;
-                      pwhere=start-midval.begin();
-                  }else {
-                      SILOG(resource,error, "Unable to find string "<<Ogre::String(what[i].first,what[i].second)<<" in NameValuePairList");
-                  }
-                  break;
-              }
-          }
-      }
-      retval+=midval.substr(pwhere);
-  }else {
-      return midval;
+      case NOT_A_KEYWORD:
+        break;
+    }
+    //carry on with the line after whatever was consumed
+    Ogre::String::size_type eol=input.find('\n',std::max(keyword_end,pwhere));
+    line=(eol==Ogre::String::npos)?len:eol+1;
   }
-
-
-  return retval;
+  midval.append(input,pwhere,Ogre::String::npos);
+  return midval;
 }
 void ReplacingDataStream::verifyData() const{
   if (helper.isNull()) {
@@ -57,6 +57,14 @@ protected:
   std::vector<Ogre::String> provides;//materials and programs this provides
   std::vector<Ogre::String> depends_on;//materials and programs this depends on
   const Ogre::NameValuePairList*mTextureAliases;  
+  typedef std::tr1::unordered_map<Ogre::String,Ogre::String> CanonicalNameMap;
+  ///mTextureAliases with their values already run through CDNArchive::canonicalMhashName, built by replaceData
+  CanonicalNameMap mCanonicalTextureAliases;
+  /**
+   * Appends name to retval, replacing it with its canonical texture alias if it has one.
+   * Quotes around name are kept, and a name of the form uri:suffix is looked up by its uri.
+   */
+  void append_aliased(Ogre::String&retval, const Ogre::String&name)const;
   ///loads in and replaces the data
   void verifyData()const;
     /**
@@ -125,8 +133,11 @@ protected:
  *   vertex_program_ref badf00d__swirl
  *   fragment_program_ref beefd00d__hair
  * }
+ * The script is read in a single pass: keywords are only looked for as the first word of a line,
+ * the output is written into one preallocated string and texture aliases are substituted as
+ * their references are passed, filling provides and depends_on along the way.
  */
-  virtual Ogre::String replaceData(Ogre::String);
+  virtual Ogre::String replaceData(const Ogre::String&input);
 public:
     ///This function accelerates the precomputation of material mangling and returns depends and provides lists to boot
   void preprocessData(std::vector<Ogre::String>&provides,std::vector<Ogre::String>&depends_on);
@@ -54,6 +54,9 @@ class ResourceDownloadTask : public DependencyTask
 public:
 
   ResourceDownloadTask(DependencyManager* mgr, const RemoteFileId& hash, ResourceRequestor* resourceRequestor);
+  /// Downloads only range of the resource.
+  ResourceDownloadTask(DependencyManager* mgr, const RemoteFileId& hash, ResourceRequestor* resourceRequestor,
+                       const ::Sirikata::Transfer::Range& range);
   virtual ~ResourceDownloadTask();
 
   virtual void operator()();
@@ -69,6 +72,7 @@ protected:
   bool mStarted;
 
   const RemoteFileId mHash;
+  const ::Sirikata::Transfer::Range mRange;
   SubscriptionId mCurrentDownload;
   ResourceRequestor* mResourceRequestor;
 };
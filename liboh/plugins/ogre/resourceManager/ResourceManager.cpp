@@ -124,6 +124,10 @@ Sirikata::Task::SubscriptionId ResourceManager::request (const RemoteFileId &req
     return mTransferManager->downloadByHash(request,downloadFunctor,Transfer::Range(true));
 }
 
+Sirikata::Task::SubscriptionId ResourceManager::request (const RemoteFileId &request, const std::tr1::function<EventResponse(const EventPtr&)>&downloadFunctor, const Transfer::Range &range){
+    return mTransferManager->downloadByHash(request,downloadFunctor,range);
+}
+
 void ResourceManager::nameLookup(const URI &resource_id, std::tr1::function<void(const URI&,const ResourceHash*)>callback) {
     mTransferManager->downloadName(resource_id,callback);
 }
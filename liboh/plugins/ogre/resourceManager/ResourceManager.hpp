@@ -110,6 +110,8 @@ public:
      *  \param rid the ResourceID of the resource to be downloaded
      */
     SubscriptionId request (const RemoteFileId &rid, const std::tr1::function<EventResponse(const EventPtr&)>&);
+    /// Like request, but only downloads the given byte range of the resource.
+    SubscriptionId request (const RemoteFileId &rid, const std::tr1::function<EventResponse(const EventPtr&)>&, const ::Sirikata::Transfer::Range &range);
 
 
     /** Create a new resource from in-memory data.
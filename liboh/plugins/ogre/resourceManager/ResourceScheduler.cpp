@@ -0,0 +1,321 @@
+/*  Meru
+ *  ResourceScheduler.cpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ResourceScheduler.hpp"
+
+using std::pair;
+using std::set;
+using std::vector;
+
+namespace Meru {
+
+MANUAL_SINGLETON_STORAGE(ResourceScheduler);
+
+ResourceScheduler::ResourceScheduler(float budget, float hysteresis)
+: mEpoch(0), mViewerTravel(0), mBudget(budget), mBudgetUsed(0), mHysteresis(hysteresis)
+{
+}
+
+ResourceScheduler::~ResourceScheduler()
+{
+  releaseAll();
+}
+
+void ResourceScheduler::releaseAll()
+{
+  // Resources dropped here unregister themselves, so let go of them while members are valid.
+  ResidentMap residents;
+  residents.swap(mResidents);
+  vector<SharedResourcePtr> pending;
+  pending.swap(mPendingUnload);
+  mResidentHeap.clear();
+  mCharges.clear();
+  mBudgetUsed = 0;
+}
+
+void ResourceScheduler::schedule(double viewerTravel)
+{
+  mEpoch++;
+
+  refreshValues(viewerTravel);
+
+  // The budget may have shrunk since the last tick.
+  while (mBudgetUsed > mBudget && !mResidentHeap.empty())
+    evict(mResidentHeap.top());
+
+  vector<pair<float, GraphicsResource*> > skipped;
+  while (!mCandidates.empty() && skipped.size() < MAX_SKIPPED_PER_TICK) {
+    GraphicsResource* resource = mCandidates.top();
+    float value = mCandidates.topPriority();
+    mCandidates.pop();
+
+    if (resource->getLoadState() == GraphicsResource::LOAD_FAILED)
+      continue;
+    if (makeRoom(resource, value))
+      admit(resource, value);
+    else
+      skipped.push_back(pair<float, GraphicsResource*>(value, resource));
+  }
+  for (size_t i = 0; i < skipped.size(); ++i)
+    mCandidates.update(skipped[i].second, skipped[i].first);
+
+  flushUnloads();
+}
+
+void ResourceScheduler::refreshValues(double viewerTravel)
+{
+  mViewerTravel += viewerTravel;
+
+  vector<GraphicsResource*> due;
+  while (!mRefresh.empty() && mRefresh.topPriority() <= mViewerTravel) {
+    due.push_back(mRefresh.top());
+    mRefresh.pop();
+  }
+  for (size_t i = 0; i < due.size(); ++i) {
+    GraphicsResource* resource = due[i];
+    if (resource->getParseState() == GraphicsResource::PARSE_INVALID) {
+      // Its dependencies changed, so what it was charged for no longer matches.  It keeps
+      // showing what it has until it is admitted again with the new ones.
+      release(resource, false);
+      resource->parse();
+    }
+    resource->refreshValue();
+    mRefresh.update(resource, mViewerTravel + resource->getValueSlack());
+  }
+
+  // Regathering one resource may change what it trickles up to the next.
+  while (!mChanged.empty()) {
+    GraphicsResource* resource = *mChanged.begin();
+    mChanged.erase(mChanged.begin());
+    resource->refreshValue();
+  }
+}
+
+void ResourceScheduler::trackValue(GraphicsResource* resource)
+{
+  mRefresh.update(resource, mViewerTravel);
+}
+
+void ResourceScheduler::valueChanged(GraphicsResource* resource)
+{
+  if (mRefresh.contains(resource))
+    mRefresh.update(resource, mViewerTravel);
+  else
+    mChanged.insert(resource);
+}
+
+void ResourceScheduler::viewersChanged()
+{
+  vector<GraphicsResource*> tracked;
+  while (!mRefresh.empty()) {
+    tracked.push_back(mRefresh.top());
+    mRefresh.pop();
+  }
+  for (size_t i = 0; i < tracked.size(); ++i)
+    mRefresh.update(tracked[i], mViewerTravel);
+}
+
+float ResourceScheduler::marginalCost(GraphicsResource* resource, vector<SharedResourcePtr> &closure)
+{
+  float cost = 0;
+  if (mCharges.find(resource) == mCharges.end())
+    cost += resource->getOwnCost();
+
+  set<GraphicsResource*> visited;
+  vector<GraphicsResource*> stack(1, resource);
+  visited.insert(resource);
+  while (!stack.empty()) {
+    GraphicsResource* cur = stack.back();
+    stack.pop_back();
+    const set<SharedResourcePtr> &deps = cur->getDependencies();
+    for (set<SharedResourcePtr>::const_iterator ditr = deps.begin(); ditr != deps.end(); ++ditr) {
+      if (visited.insert(ditr->get()).second) {
+        closure.push_back(*ditr);
+        stack.push_back(ditr->get());
+        if (mCharges.find(ditr->get()) == mCharges.end())
+          cost += (*ditr)->getOwnCost();
+      }
+    }
+  }
+  return cost;
+}
+
+bool ResourceScheduler::makeRoom(GraphicsResource* resource, float value)
+{
+  vector<SharedResourcePtr> closure;
+  if (mBudgetUsed + marginalCost(resource, closure) <= mBudget)
+    return true;
+
+  vector<pair<GraphicsResource*, Resident> > evicted;
+  bool fits = false;
+  while (!fits && !mResidentHeap.empty()) {
+    GraphicsResource* worst = mResidentHeap.top();
+    ResidentMap::iterator ritr = mResidents.find(worst);
+    if (ritr->second.mEpoch == mEpoch
+     || mResidentHeap.topPriority() * (1.0f + mHysteresis) >= value)
+      break;
+
+    evicted.push_back(pair<GraphicsResource*, Resident>(worst, ritr->second));
+    evict(worst);
+
+    closure.clear();
+    fits = mBudgetUsed + marginalCost(resource, closure) <= mBudget;
+  }
+
+  if (!fits) {
+    // Not worth it after all: nothing has been unloaded yet, so put the residents back.
+    for (size_t i = 0; i < evicted.size(); ++i) {
+      GraphicsResource* restored = evicted[i].first;
+      mCandidates.erase(restored);
+      charge(restored, evicted[i].second.mDependencies);
+      mResidents[restored] = evicted[i].second;
+      mResidentHeap.update(restored, restored->value());
+    }
+  }
+  return fits;
+}
+
+void ResourceScheduler::admit(GraphicsResource* resource, float value)
+{
+  Resident &resident = mResidents[resource];
+  marginalCost(resource, resident.mDependencies);
+  resident.mEpoch = mEpoch;
+  charge(resource, resident.mDependencies);
+  mResidentHeap.update(resource, value);
+
+  GraphicsResource::LoadState loadState = resource->getLoadState();
+  if (loadState != GraphicsResource::LOAD_LOADING
+   && loadState != GraphicsResource::LOAD_LOADED
+   && loadState != GraphicsResource::LOAD_WAITING_LOAD) {
+    resource->load(mEpoch);
+  }
+}
+
+void ResourceScheduler::release(GraphicsResource* resource, bool unloadSelf)
+{
+  ResidentMap::iterator ritr = mResidents.find(resource);
+  if (ritr == mResidents.end())
+    return;
+
+  vector<SharedResourcePtr> closure;
+  closure.swap(ritr->second.mDependencies);
+  mResidents.erase(ritr);
+  mResidentHeap.erase(resource);
+  discharge(resource, closure, unloadSelf);
+}
+
+void ResourceScheduler::evict(GraphicsResource* resource)
+{
+  release(resource, true);
+  if (resource->getParseState() == GraphicsResource::PARSE_VALID && resource->value() > 0)
+    mCandidates.update(resource, resource->value());
+}
+
+void ResourceScheduler::charge(GraphicsResource* resource, const vector<SharedResourcePtr> &closure)
+{
+  for (size_t i = 0; i <= closure.size(); ++i) {
+    GraphicsResource* cur = (i == closure.size() ? resource : closure[i].get());
+    ChargeMap::iterator citr = mCharges.find(cur);
+    if (citr == mCharges.end()) {
+      Charge newCharge;
+      newCharge.mRefs = 1;
+      newCharge.mCost = cur->getOwnCost();
+      mCharges.insert(ChargeMap::value_type(cur, newCharge));
+      mBudgetUsed += newCharge.mCost;
+    }
+    else
+      citr->second.mRefs++;
+  }
+}
+
+void ResourceScheduler::discharge(GraphicsResource* resource, const vector<SharedResourcePtr> &closure, bool unloadSelf)
+{
+  for (size_t i = 0; i < closure.size(); ++i)
+    dischargeOne(closure[i].get(), closure[i]);
+  dischargeOne(resource, unloadSelf ? resource->getSharedPtr() : SharedResourcePtr());
+}
+
+void ResourceScheduler::dischargeOne(GraphicsResource* resource, const SharedResourcePtr &keepAlive)
+{
+  ChargeMap::iterator citr = mCharges.find(resource);
+  assert(citr != mCharges.end());
+  if (--citr->second.mRefs == 0) {
+    mBudgetUsed -= citr->second.mCost;
+    mCharges.erase(citr);
+    if (keepAlive)
+      mPendingUnload.push_back(keepAlive);
+  }
+}
+
+void ResourceScheduler::flushUnloads()
+{
+  vector<SharedResourcePtr> pending;
+  pending.swap(mPendingUnload);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    GraphicsResource* resource = pending[i].get();
+    if (mCharges.find(resource) != mCharges.end())
+      continue; // charged again by something admitted this tick
+
+    GraphicsResource::LoadState loadState = resource->getLoadState();
+    if (loadState != GraphicsResource::LOAD_UNLOADED
+     && loadState != GraphicsResource::LOAD_UNLOADING
+     && loadState != GraphicsResource::LOAD_NEW
+     && loadState != GraphicsResource::LOAD_WAITING_UNLOAD)
+      resource->unload(mEpoch);
+  }
+}
+
+void ResourceScheduler::registerLoad(GraphicsResource* resource)
+{
+  if (resource->getParseState() != GraphicsResource::PARSE_VALID) {
+    mCandidates.erase(resource);
+    return;
+  }
+
+  // Only moves in the heap if the value actually changed.
+  float value = resource->value();
+  if (mResidents.find(resource) != mResidents.end())
+    mResidentHeap.update(resource, value);
+  else if (value > 0)
+    mCandidates.update(resource, value);
+  else
+    mCandidates.erase(resource); // nothing wants it any more
+}
+
+void ResourceScheduler::unregisterResource(GraphicsResource* resource)
+{
+  release(resource, false);
+  mCandidates.erase(resource);
+  mRefresh.erase(resource);
+  mChanged.erase(resource);
+}
+
+}
@@ -0,0 +1,156 @@
+/*  Meru
+ *  ResourceScheduler.hpp
+ *
+ *  Copyright (c) 2009, Stanford University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _RESOURCE_SCHEDULER_HPP_
+#define _RESOURCE_SCHEDULER_HPP_
+
+#include "GraphicsResource.hpp"
+#include "Singleton.hpp"
+#include <util/IndexedHeap.hpp>
+
+namespace Meru {
+
+/**
+ * Decides which graphics resources are loaded, keeping the cost of the loaded set within a
+ * video memory budget.  The decision is incremental: resources wait in a heap ordered by value,
+ * and only those whose value changed since the last tick are moved in it.  Loaded resources
+ * stay loaded until a candidate clearly worth more needs their room, so small changes in value
+ * do not make resources flicker in and out.
+ *
+ * Values are recomputed lazily too.  Tracked resources (entities) are only refreshed once the
+ * viewers have travelled as far as the resource says its value can stand, or when they report
+ * a change themselves, and a dependency only regathers what its dependents trickle up to it
+ * when one of them changed.
+ */
+class ResourceScheduler : public ManualSingleton<ResourceScheduler>
+{
+protected:
+  /// Resources waiting to be loaded, most valuable first.
+  typedef Sirikata::IndexedHeap<GraphicsResource*, float, std::less<float> > CandidateHeap;
+  /// Resources kept loaded, least valuable first since that is the one to evict.
+  typedef Sirikata::IndexedHeap<GraphicsResource*, float, std::greater<float> > ResidentHeap;
+  /// Tracked resources by the viewer travel at which their value is next refreshed, soonest first.
+  typedef Sirikata::IndexedHeap<GraphicsResource*, double, std::greater<double> > RefreshHeap;
+
+  struct Resident {
+    std::vector<SharedResourcePtr> mDependencies; ///< everything charged when it was admitted
+    unsigned int mEpoch; ///< epoch it was admitted in; it is not evicted in that epoch
+  };
+  typedef std::tr1::unordered_map<GraphicsResource*, Resident> ResidentMap;
+
+  /// Share of the budget held by a resource on behalf of every resident that depends on it.
+  struct Charge {
+    unsigned int mRefs;
+    float mCost; ///< cost when first charged, so the budget is returned exactly
+  };
+  typedef std::tr1::unordered_map<GraphicsResource*, Charge> ChargeMap;
+
+  /// Candidates that do not fit are set aside at most this many times per tick.
+  static const size_t MAX_SKIPPED_PER_TICK = 16;
+
+public:
+
+  /// budget is in bytes; see setHysteresis for hysteresis.
+  ResourceScheduler(float budget, float hysteresis);
+  virtual ~ResourceScheduler();
+
+  /// Refreshes the values that changed, then loads and unloads to match them.
+  /// viewerTravel is the furthest any viewer moved since the last tick.
+  void schedule(double viewerTravel);
+
+  float getBudget() {
+    return mBudget / (1024.0f * 1024.0f);
+  }
+
+  /// Takes effect on the next tick; loaded resources are evicted until they fit again.
+  void setBudget(float budget) {
+    mBudget = budget * (1024.0f * 1024.0f);
+  }
+
+  float getBudgetUsed() {
+    return mBudgetUsed / (1024.0f * 1024.0f);
+  }
+
+  /// A resident is only evicted for a candidate worth this fraction more than it.
+  void setHysteresis(float hysteresis) {
+    mHysteresis = hysteresis;
+  }
+
+  /// Refreshes the value of resource whenever the viewers have travelled its value slack.
+  void trackValue(GraphicsResource* resource);
+  /// The value of resource may have changed; it is recomputed on the next tick.
+  void valueChanged(GraphicsResource* resource);
+  /// Every tracked value is refreshed on the next tick, e.g. because a viewer came or went.
+  void viewersChanged();
+
+  /// Called whenever the value of resource may have changed.
+  void registerLoad(GraphicsResource* resource);
+  virtual void unregisterResource(GraphicsResource* resource);
+
+protected:
+
+  /// Lets go of everything loaded without unloading it, for shutdown.
+  void releaseAll();
+  void refreshValues(double viewerTravel);
+
+  /// Budget resource would add if loaded now; fills closure with its dependencies.
+  float marginalCost(GraphicsResource* resource, std::vector<SharedResourcePtr> &closure);
+  /// Evicts residents worth sufficiently less than value until resource fits.
+  bool makeRoom(GraphicsResource* resource, float value);
+  void admit(GraphicsResource* resource, float value);
+  /// Stops charging for resource; what is no longer charged is unloaded at the end of the tick,
+  /// except resource itself unless unloadSelf.
+  void release(GraphicsResource* resource, bool unloadSelf);
+  void evict(GraphicsResource* resource);
+  void charge(GraphicsResource* resource, const std::vector<SharedResourcePtr> &closure);
+  void discharge(GraphicsResource* resource, const std::vector<SharedResourcePtr> &closure, bool unloadSelf);
+  void dischargeOne(GraphicsResource* resource, const SharedResourcePtr &keepAlive);
+  void flushUnloads();
+
+  CandidateHeap mCandidates;
+  ResidentHeap mResidentHeap;
+  ResidentMap mResidents;
+  ChargeMap mCharges;
+  std::vector<SharedResourcePtr> mPendingUnload;
+  RefreshHeap mRefresh;
+  std::tr1::unordered_set<GraphicsResource*> mChanged;
+
+  unsigned int mEpoch;
+  /// Distance the viewers have travelled in total, the clock mRefresh runs on.
+  double mViewerTravel;
+  float mBudget;
+  float mBudgetUsed;
+  float mHysteresis;
+};
+
+}
+
+#endif
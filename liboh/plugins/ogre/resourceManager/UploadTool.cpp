@@ -37,6 +37,9 @@
 #include <algorithm>
 #include <map>
 #include <set>
+#include <deque>
+#include <sstream>
+#include <ctime>
 #ifndef _WIN32
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -46,11 +49,14 @@
 
 #include "UploadTool.hpp"
 #include "ReplacingDataStream.hpp"
+#include <task/WorkQueue.hpp>
+#include <task/Time.hpp>
 
 #include <OgreDataStream.h>
 #include <OgreCommon.h>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/filesystem.hpp>
 #ifdef _WIN32
 #include <io.h>
@@ -226,6 +232,9 @@ String stripslashes (DiskFile inputdp) {
 
 
 class ResourceFileUploadData : public ResourceFileUpload, public DependencyPair {
+public:
+    ///Names of the materials a script uses, so it can be rewritten after the scripts providing them
+    std::vector<String> mMaterialsUsed;
 //    bool mProcessedDependencies;
 //    ResourceFileUploadData() : mProcessedDependencies(false) {}
 };
@@ -245,6 +254,8 @@ class ResourceFileUploadData : public ResourceFileUpload, public DependencyPair
 class ReplaceMaterialOptionsAndReturn :public ReplaceMaterialOptions {public:
     FileMap mFileMap;
     MaterialMap mMaterialMap;
+    ///Guards mFileMap and the dependency sets of its entries while files are processed in parallel
+    boost::mutex mLock;
     ReplaceMaterialOptionsAndReturn(const ReplaceMaterialOptions&opts):ReplaceMaterialOptions(opts) {}
 };
 
@@ -276,6 +287,7 @@ static ResourceFileUploadData *getFileData(const DiskFile &name, ReplaceMaterial
 
 //    URI hashURI(opts.uploadHashContext, hash.convertToHexString());
     if (!disallowed_file) {
+        boost::unique_lock<boost::mutex> lock(opts.mLock);
         FileMap::iterator iter = opts.mFileMap.find(name);
         bool inserted = false;
         if (iter == opts.mFileMap.end()) {
@@ -647,8 +659,11 @@ public:
           DependencyPair * other_dep=getFileData(where->second,*username);
           if (other_dep == NULL) {
           }
-          my_dependencies->files.insert(other_dep->files.begin(),other_dep->files.end());
-          my_dependencies->files.insert(where->second);
+          {
+              boost::unique_lock<boost::mutex> lock(username->mLock);
+              my_dependencies->files.insert(other_dep->files.begin(),other_dep->files.end());
+              my_dependencies->files.insert(where->second);
+          }
           return '\"'+getFileURI(where->second,*username)+':'+depended+'\"';
         }else {
 
@@ -662,8 +677,11 @@ public:
           DependencyPair * other_dep=getFileData(wheresecond,*username);
           if (other_dep == NULL) {
           }
-          my_dependencies->files.insert(other_dep->files.begin(),other_dep->files.end());
-          my_dependencies->files.insert(wheresecond);
+          {
+              boost::unique_lock<boost::mutex> lock(username->mLock);
+              my_dependencies->files.insert(other_dep->files.begin(),other_dep->files.end());
+              my_dependencies->files.insert(wheresecond);
+          }
           return '\"'+getFileURI(wheresecond,*username)+':'+depended+'\"';
       } else {
           return depended;
@@ -681,10 +699,10 @@ static std::string cutoff;
  * This function opens a file from disk and returns the data within that file
  * it is currently a convenience method but later it will need to handle ogre resource streams
  * \param name is the filename
- * \param len returns the length of the file
+ * \param digest if not NULL, is fed the contents as they are read off the disk
  * \returns data malloced to size len filled with the file's contents
  */
-DenseDataPtr getHashFileData(const DiskFile& name) {
+DenseDataPtr getHashFileData(const DiskFile& name, SHA256Context *digest=NULL) {
   {
       bool isbinary=name.diskpath().find(".mesh")!=Ogre::String::npos;
     if (isbinary) {
@@ -693,6 +711,9 @@ DenseDataPtr getHashFileData(const DiskFile& name) {
     if (isNativeFile(stripslashes(name))) {
         DenseDataPtr data (nativeDataPtr(stripslashes(name)));
         if (data) {
+            if (digest) {
+                digest->update(data->data(), (size_t)data->length());
+            }
             return data;
         }
     }
@@ -700,7 +721,14 @@ DenseDataPtr getHashFileData(const DiskFile& name) {
   Ogre::String retval;
   std::ifstream handle;
   handle.open(name.diskpath().c_str(),std::ios::in|std::ios::binary);
-  if (handle.good()) {
+  if (handle.good() && digest) {
+      char buffer[65536];
+      while (handle.read(buffer, sizeof(buffer)) || handle.gcount()) {
+          digest->update(buffer, (size_t)handle.gcount());
+          retval.append(buffer, (size_t)handle.gcount());
+      }
+      return DenseDataPtr(new DenseData(retval));
+  } else if (handle.good()) {
       Ogre::FileStreamDataStream fp(&handle,false);
       retval=fp.getAsString();
       fp.close();
@@ -718,16 +746,24 @@ void processFileDependency(ResourceFileUploadData *file,FileMap &filemap, const
   if (isNativeFile(filefirst)) {
       return; // don't care.
   }
+  bool unchanged=filefirst.find(".dds")!=Ogre::String::npos||filefirst.find(".gif")!=Ogre::String::npos||filefirst.find(".jpeg")!=Ogre::String::npos||filefirst.find(".png")!=Ogre::String::npos||filefirst.find(".tif")!=Ogre::String::npos||filefirst.find(".tga")!=Ogre::String::npos||filefirst.find(".jpg")!=Ogre::String::npos||filefirst.find(".vert")!=Ogre::String::npos||filefirst.find(".frag")!=Ogre::String::npos||filefirst.find(".hlsl")!=Ogre::String::npos||filefirst.find(".cg")!=Ogre::String::npos||filefirst.find(".glsl")!=Ogre::String::npos;
+  if (unchanged) {
+      // These file formats cannot reference any other files, so do not alter them,
+      // and hash them while they are read.
+      SHA256Context digest;
+      DenseDataPtr data (getHashFileData(file->mSourceFilename, &digest));
+      if (data) {
+          file->mHash=digest.get();
+          file->mData=data;
+      }
+      return;
+  }
   DenseDataPtr processed (getHashFileData(file->mSourceFilename));
   if (!processed) {
       return;
   }
-  if (filefirst.find(".dds")!=Ogre::String::npos||filefirst.find(".gif")!=Ogre::String::npos||filefirst.find(".jpeg")!=Ogre::String::npos||filefirst.find(".png")!=Ogre::String::npos||filefirst.find(".tif")!=Ogre::String::npos||filefirst.find(".tga")!=Ogre::String::npos||filefirst.find(".jpg")!=Ogre::String::npos||filefirst.find(".vert")!=Ogre::String::npos||filefirst.find(".frag")!=Ogre::String::npos||filefirst.find(".hlsl")!=Ogre::String::npos||filefirst.find(".cg")!=Ogre::String::npos||filefirst.find(".glsl")!=Ogre::String::npos) {
-      // These file formats cannot reference any other files, so do not alter them.
-  }else {
-    bool isbinary=filefirst.find(".mesh")!=Ogre::String::npos||filefirst.find(".skeleton")!=Ogre::String::npos;
-    replaceAll(processed,filemap,materialmap,*file,opts,isbinary);//is binary
-  }
+  bool isbinary=filefirst.find(".mesh")!=Ogre::String::npos||filefirst.find(".skeleton")!=Ogre::String::npos;
+  replaceAll(processed,filemap,materialmap,*file,opts,isbinary);//is binary
   Fingerprint fileHash=Fingerprint::computeDigest(processed->data(), processed->length());
   file->mHash=fileHash;
   file->mData = processed;
@@ -777,7 +813,12 @@ bool replaceOne(DenseDataPtr &dataptr, DiskFile src, String strippedsrc, String
                 }*/
             if (dst.length()==0) {
                 if (filename.find(".dds")!=Ogre::String::npos||filename.find(".gif")!=Ogre::String::npos||filename.find(".jpeg")!=Ogre::String::npos||filename.find(".png")!=Ogre::String::npos||filename.find(".tif")!=Ogre::String::npos||filename.find(".tga")!=Ogre::String::npos||filename.find(".jpg")!=Ogre::String::npos||filename.find(".vert")!=Ogre::String::npos||filename.find(".frag")!=Ogre::String::npos||filename.find(".hlsl")!=Ogre::String::npos||filename.find(".cg")!=Ogre::String::npos||filename.find(".glsl")!=Ogre::String::npos) {
-                    processFileDependency(filemap.find(src)->second,filemap,materialmap,opts);
+                    ResourceFileUploadData *srcdata;
+                    {
+                        boost::unique_lock<boost::mutex> lock(opts.mLock);
+                        srcdata=filemap.find(src)->second;
+                    }
+                    processFileDependency(srcdata,filemap,materialmap,opts);
                     dst=getFileURI(src,opts);
                 }else{
                     Ogre::String summary =data.length()>200?data.substr(0,200):data;
@@ -831,19 +872,27 @@ bool replaceOne(DenseDataPtr &dataptr, DiskFile src, String strippedsrc, String
     return retval;
 }
 void replaceAll(DenseDataPtr &data, FileMap &filemap, const MaterialMap&materialmap, DependencyPair&my_dependencies, ReplaceMaterialOptionsAndReturn &opts,bool allow_binary) {
-    for (FileMap::iterator i=filemap.begin(),ie=filemap.end();i!=ie;++i) {
+    //material scripts processed on other threads add the files they reference to filemap, so walk a copy
+    std::vector<std::pair<DiskFile,ResourceFileUploadData*> > files;
+    {
+        boost::unique_lock<boost::mutex> lock(opts.mLock);
+        files.assign(filemap.begin(),filemap.end());
+    }
+    for (std::vector<std::pair<DiskFile,ResourceFileUploadData*> >::const_iterator i=files.begin(),ie=files.end();i!=ie;++i) {
         if (i->second->mType != MATERIAL && i->second->mType != MESH) {
             if (replaceOne(data,i->first,std::string(),getFileURI(i->first, opts),filemap,materialmap,opts, true,allow_binary)) {
-                my_dependencies.files.insert(i->first);
                 DependencyPair *dp=i->second;
+                boost::unique_lock<boost::mutex> lock(opts.mLock);
+                my_dependencies.files.insert(i->first);
                 my_dependencies.files.insert(dp->files.begin(),dp->files.end());
             }
         }
     }
     for (MaterialMap::const_iterator i=materialmap.begin(),ie=materialmap.end();i!=ie;++i) {
         if (replaceOne(data,i->second,i->first,'\"'+getFileURI(i->second,opts)+":"+i->first+'\"',filemap,materialmap,opts,false,allow_binary)) {
-            my_dependencies.files.insert(i->second);
             DependencyPair *dp=getFileData(i->second,opts);
+            boost::unique_lock<boost::mutex> lock(opts.mLock);
+            my_dependencies.files.insert(i->second);
             my_dependencies.files.insert(dp->files.begin(),dp->files.end());
         }
     }
@@ -913,9 +962,193 @@ bool find_all_files_from_file( std::string mesh_path,         // in this directo
                           path_found);
 }
 
+/**
+ * This function reads a material script, qualifies the materials it uses with the names of the
+ * scripts providing them, and hashes the result into file.  The scripts providing those materials
+ * should already have been processed, since their dependencies are copied into file's.
+ */
+static void processMaterialScript(ResourceFileUploadData *file, ReplaceMaterialOptionsAndReturn &opts) {
+    std::ifstream fhandle;
+    DiskFile depsecond (file->mSourceFilename);
+    Ogre::DataStreamPtr input;
+    if (isNativeFile(stripslashes(depsecond))) {
+        input = Ogre::DataStreamPtr(nativeStream(stripslashes(depsecond)));
+    } else {
+        fhandle.open(depsecond.diskpath().c_str(),std::ios::in|std::ios::binary);
+        if (!fhandle.good()) {
+            fprintf(stderr, "Error: Dependent File %s does not exist!\n", depsecond.diskpath().c_str());
+            return;
+        }
+        input = Ogre::DataStreamPtr(new Ogre::FileStreamDataStream(&fhandle,false));
+    }
+    Ogre::DataStreamPtr rds (new DependencyReplacingDataStream (input,depsecond.diskpath(),&opts.mMaterialMap,&opts.mFileMap,file,opts));
+    DenseDataPtr data (new DenseData(rds->getAsString()));
+    file->mHash=Fingerprint::computeDigest(data->data(), data->length());
+    file->mData = data;
+}
+
+typedef std::tr1::function<void(const ResourceFileUpload&)> IngestFinishedCallback;
+
+/**
+ * Reads, rewrites and hashes every file in the file map on a pool of worker threads.
+ * A script copies the dependencies of the scripts providing the materials it uses, so it only
+ * starts once those are finished; meshes may name any material, so they wait for every script.
+ * Textures and shaders reference nothing and start right away.  A cycle between scripts is
+ * broken at the first edge found to close it.
+ */
+class IngestPipeline {
+public:
+    IngestPipeline(ReplaceMaterialOptionsAndReturn &opts, const IngestFinishedCallback &finished)
+        : mOpts(opts), mFinished(finished), mNumRemaining(0) {
+    }
+    ~IngestPipeline() {
+        for (size_t i=0;i<mNodes.size();++i) {
+            delete mNodes[i];
+        }
+    }
+    /**
+     * Processes each file that has no data yet and returns once all of them are done.  Every file
+     * that ends up with data is passed to the finished callback, on whichever thread produced it.
+     */
+    void run(int numThreads) {
+        std::map<DiskFile,Node*> scripts;
+        for (FileMap::iterator i=mOpts.mFileMap.begin(),ie=mOpts.mFileMap.end();i!=ie;++i) {
+            if (i->second->mData) {
+                if (mFinished) mFinished(*i->second);
+                continue;
+            }
+            Node *node = new Node(i->second);
+            mNodes.push_back(node);
+            if (node->mFile->mType == MATERIAL) {
+                scripts[i->first] = node;
+            }
+        }
+        for (std::map<DiskFile,Node*>::iterator i=scripts.begin(),ie=scripts.end();i!=ie;++i) {
+            if (i->second->mVisited == UNVISITED) {
+                orderScripts(i->second, scripts);
+            }
+        }
+        for (size_t i=0;i<mNodes.size();++i) {
+            if (mNodes[i]->mFile->mType == MESH) {
+                for (std::map<DiskFile,Node*>::iterator j=scripts.begin(),je=scripts.end();j!=je;++j) {
+                    addDependency(mNodes[i], j->second);
+                }
+            }
+        }
+        mNumRemaining = mNodes.size();
+        if (!mNumRemaining) {
+            return;
+        }
+        for (size_t i=0;i<mNodes.size();++i) {
+            if (mNodes[i]->mWaitingOn == 0) {
+                mQueue.enqueue(new ProcessTask(this, mNodes[i]));
+            }
+        }
+        Task::WorkQueueThread *threads = mQueue.createWorkerThreads(numThreads>0?numThreads:1);
+        {
+            boost::unique_lock<boost::mutex> lock(mLock);
+            while (mNumRemaining) {
+                mDone.wait(lock);
+            }
+        }
+        mQueue.destroyWorkerThreads(threads);
+    }
+private:
+    enum Visit { UNVISITED, VISITING, VISITED };
+    struct Node {
+        ResourceFileUploadData *mFile;
+        std::vector<Node*> mDependents;
+        int mWaitingOn;
+        Visit mVisited; ///< Progress of the depth first search that orders the scripts
+        Node(ResourceFileUploadData *file) : mFile(file), mWaitingOn(0), mVisited(UNVISITED) {}
+    };
+    class ProcessTask : public Task::WorkItem {
+        IngestPipeline *mParent;
+        Node *mNode;
+    public:
+        ProcessTask(IngestPipeline *parent, Node *node) : mParent(parent), mNode(node) {}
+        virtual void operator()() {
+            AutoPtr deleteMe(this);
+            mParent->process(mNode);
+        }
+    };
+    friend class ProcessTask;
+
+    void addDependency(Node *node, Node *dependency) {
+        dependency->mDependents.push_back(node);
+        ++node->mWaitingOn;
+    }
+    /// Makes node wait for the scripts providing its materials, skipping edges that would close a cycle.
+    void orderScripts(Node *node, std::map<DiskFile,Node*> &scripts) {
+        node->mVisited = VISITING;
+        std::set<Node*> providers;
+        const std::vector<String> &used = node->mFile->mMaterialsUsed;
+        for (size_t i=0;i<used.size();++i) {
+            MaterialMap::const_iterator where = mOpts.mMaterialMap.find(used[i]);
+            if (where == mOpts.mMaterialMap.end()) {
+                continue;
+            }
+            std::map<DiskFile,Node*>::iterator provider = scripts.find(where->second);
+            if (provider == scripts.end() || provider->second == node ||
+                provider->second->mVisited == VISITING ||
+                !providers.insert(provider->second).second) {
+                continue;
+            }
+            if (provider->second->mVisited == UNVISITED) {
+                orderScripts(provider->second, scripts);
+            }
+            addDependency(node, provider->second);
+        }
+        node->mVisited = VISITED;
+    }
+    void process(Node *node) {
+        ResourceFileUploadData *file = node->mFile;
+        if (file->mType == MATERIAL) {
+            processMaterialScript(file, mOpts);
+        } else {
+            processFileDependency(file, mOpts.mFileMap, mOpts.mMaterialMap, mOpts);
+        }
+        if (file->mData && mFinished) {
+            mFinished(*file);
+        }
+        boost::unique_lock<boost::mutex> lock(mLock);
+        for (size_t i=0;i<node->mDependents.size();++i) {
+            if (--node->mDependents[i]->mWaitingOn == 0) {
+                mQueue.enqueue(new ProcessTask(this, node->mDependents[i]));
+            }
+        }
+        if (--mNumRemaining == 0) {
+            mDone.notify_all();
+        }
+    }
+
+    ReplaceMaterialOptionsAndReturn &mOpts;
+    IngestFinishedCallback mFinished;
+    std::vector<Node*> mNodes;
+    Task::ThreadSafeWorkQueue mQueue;
+    boost::mutex mLock;
+    boost::condition_variable mDone;
+    size_t mNumRemaining;
+};
+
+static void printThroughput(const char *what, size_t numFiles, uint64 numBytes, const Duration &elapsed) {
+    double seconds = elapsed.toSeconds();
+    double megabytes = numBytes/(1024.*1024.);
+    std::cout << what << " " << numFiles << " files (" << megabytes << " MB) in " << seconds << " s";
+    if (seconds > 0) {
+        std::cout << ": " << numFiles/seconds << " files/s, " << megabytes/seconds << " MB/s";
+    }
+    std::cout << std::endl;
+}
+
 //////////////// This function is really long and convoluted?!?! I wish there were comments here!
 
-std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::vector<DiskFile> &origfilenames,const ReplaceMaterialOptions&options) {
+/**
+ * Finds every file the given meshes and scripts depend on, then reads, rewrites and hashes them
+ * all into opts.mFileMap, passing each finished file to finished as soon as it is ready.
+ */
+static void ingestOgreMeshMaterialDependencies(const std::vector<DiskFile> &origfilenames, ReplaceMaterialOptionsAndReturn &opts, const IngestFinishedCallback &finished) {
+  Task::LocalTime processStart = Task::LocalTime::now();
   std::vector<DiskFile> filenames = origfilenames;
   if (!filenames.empty()) {
       std::vector<boost::filesystem::path> output;
@@ -936,7 +1169,6 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
           }
       }
   }
-  ReplaceMaterialOptionsAndReturn opts(options);
   opts.disallowedThirdLevelFiles.insert("meru:///UeberShader.hlsl");//this file should be updated manually by devs, not by artists
 
 /////////////// Not sure what this code does at all
@@ -1003,12 +1235,7 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
                   opts.mMaterialMap[*iter]=filenames[i];
                }
           }
-/*
-          for (size_t j=0;j<tmprds->dependsOnMaterial.size();++j) {
-              if (opts.mMaterialMap[tmprds->dependsOnMaterial[j]]!=filenames[i]) {
-              }
-          }
-*/
+          deps->mMaterialsUsed.swap(tmprds->dependsOnMaterial);
       }
       {
         bool depends_on_nothing=true;
@@ -1027,58 +1254,38 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
   }
   }
 
-
-
-  for (size_t i=0;i<filenames.size();++i) {
-    ResourceFileUploadData *deps = getFileData(filenames[i], opts);
-    if (deps->mType == MATERIAL) {
-        std::ifstream fhandle;
-        DiskFile depsecond (filenames[i]);
-        {
-            Ogre::DataStreamPtr input;
-            if (isNativeFile(stripslashes(depsecond))) {
-                input = Ogre::DataStreamPtr(nativeStream(stripslashes(depsecond)));
-            } else {
-                fhandle.open(depsecond.diskpath().c_str(),std::ios::in|std::ios::binary);
-                if (fhandle.good()) {
-                    input = Ogre::DataStreamPtr(new Ogre::FileStreamDataStream(&fhandle,false));
-                } else {
-                    fprintf(stderr, "Error: Dependent File %s does not exist!\n", filenames[i].diskpath().c_str());
-                    filenames.erase(filenames.begin()+i);
-                    --i;
-                }
-            }
-            ResourceFileUploadData *mydeps = getFileData(depsecond, opts);
-
-            Ogre::DataStreamPtr rds (new DependencyReplacingDataStream (input,depsecond.diskpath(),&opts.mMaterialMap,&opts.mFileMap,mydeps,opts));
-            DenseDataPtr data (new DenseData(rds->getAsString()));
-
-            //printf ("Processing %s\n",dep->second.c_str());
-            //fflush(stdout);
-            //replaceAll(data,opts.mFileMap,MaterialMap(),*mydeps,opts, false);
-            Fingerprint fileHash=Fingerprint::computeDigest(data->data(), data->length());
-
-            mydeps->mHash = fileHash;
-            mydeps->mData = data;
-        }
-    }
-  }
+  IngestPipeline(opts, finished).run(opts.ingestThreads);
+  // Rewriting scripts may have discovered more files, such as delegated programs.
   for (FileMap::iterator i=opts.mFileMap.begin(),ie=opts.mFileMap.end();i!=ie;++i) {
       if (!i->second->mData) {
           processFileDependency(i->second,opts.mFileMap,opts.mMaterialMap,opts);
+          if (i->second->mData && finished) {
+              finished(*i->second);
+          }
       }
   }
 
+  size_t numFiles = 0;
+  uint64 numBytes = 0;
+  for (FileMap::const_iterator i=opts.mFileMap.begin(),ie=opts.mFileMap.end();i!=ie;++i) {
+      if (i->second->mData) {
+          ++numFiles;
+          numBytes += i->second->mData->length();
+      }
+  }
+  printThroughput("Processed", numFiles, numBytes, Task::LocalTime::now()-processStart);
+}
 
-#if 0
-
-
-  std::map<URI,ResourceFileUpload> existingFiles;
-  std::multimap<Fingerprint,URI> reverseExistingFiles;//a map from any shasum to its file.  No, really??? Actually, it's a *MULTIMAP*, so file should be plural.
-#endif
-
-// Delete 150 additional lines of completely useless code. That feels so much better.
+static void deleteFileMap(FileMap &filemap) {
+  for (FileMap::const_iterator iter = filemap.begin(); iter != filemap.end(); ++iter) {
+      delete iter->second;
+  }
+  filemap.clear();
+}
 
+std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::vector<DiskFile> &origfilenames,const ReplaceMaterialOptions&options) {
+  ReplaceMaterialOptionsAndReturn opts(options);
+  ingestOgreMeshMaterialDependencies(origfilenames, opts, IngestFinishedCallback());
 
   std::vector<ResourceFileUpload> retval;
   retval.reserve(opts.mFileMap.size());
@@ -1088,28 +1295,57 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
       } else {
           // File did not exist.
       }
-      delete iter->second;
   }
+  deleteFileMap(opts.mFileMap);
 
   return retval;
 }
 
+/**
+ * Tracks a set of uploads, of which at most mMaxInFlight are given to the TransferManager at once.
+ * It is shared by the upload callbacks, and mCallback runs once everything queued has finished
+ * and no more files will be queued.
+ */
 struct UploadStatus {
+    ::Sirikata::Transfer::TransferManager *mTransferManager;
+    URIContext mHashContext;
     std::tr1::function<void(ResourceStatusMap const &)> mCallback;
     ResourceStatusMap mStatusMap;
+    std::set<String> mQueuedIDs;
+    std::deque<ResourceFileUpload> mWaiting;
+    int mMaxInFlight;
+    int mInFlight;
     int mNumberRemaining;
+    bool mAllQueued;
+    uint64 mNumBytes;
+    Task::LocalTime mStart;
     boost::mutex mLock;
-    UploadStatus (const std::tr1::function<void(ResourceStatusMap const &)> &cb, int count)
-        : mCallback(cb), mNumberRemaining(count) {
+    UploadStatus (::Sirikata::Transfer::TransferManager *tm,
+                  const URIContext &hashContext,
+                  const std::tr1::function<void(ResourceStatusMap const &)> &cb,
+                  int maxInFlight)
+        : mTransferManager(tm), mHashContext(hashContext), mCallback(cb),
+          mMaxInFlight(maxInFlight>0?maxInFlight:1), mInFlight(0), mNumberRemaining(0),
+          mAllQueued(false), mNumBytes(0), mStart(Task::LocalTime::now()) {
     }
 };
+typedef std::tr1::shared_ptr<UploadStatus> UploadStatusPtr;
+
+/// Calls the callback if every queued upload has finished. Must hold stat->mLock.
+static void checkUploadsFinished(UploadStatus *stat) {
+    if (stat->mAllQueued && stat->mNumberRemaining == 0) {
+        printThroughput("Uploaded", stat->mStatusMap.size(), stat->mNumBytes, Task::LocalTime::now()-stat->mStart);
+        stat->mCallback(stat->mStatusMap);
+    }
+}
+
+static void issueUploads(const UploadStatusPtr &stat);
 
-EventResponse UploadFinished(UploadStatus *stat, const ResourceFileUpload &current, EventPtr ev) {
+EventResponse UploadFinished(const UploadStatusPtr &stat, const ResourceFileUpload &current, EventPtr ev) {
     Transfer::UploadEventPtr uploadev (std::tr1::static_pointer_cast<UploadEvent>(ev));
     if (!uploadev) {
         return EventResponse::nop();
     }
-    bool del = false;
     {
         boost::unique_lock<boost::mutex> mylock (stat->mLock);
         ResourceUploadStatus st;
@@ -1118,56 +1354,135 @@ EventResponse UploadFinished(UploadStatus *stat, const ResourceFileUpload &curre
         if (stat->mStatusMap.insert(ResourceStatusMap::value_type(current, st)).second==false) {
             std::cout << "Warning: Duplicate upload finished for "<<uploadev->uri()<<std::endl;
         }
-        if (--stat->mNumberRemaining == 0) {
-            stat->mCallback(stat->mStatusMap);
-            del = true;
-        }
+        --stat->mInFlight;
+        --stat->mNumberRemaining;
         std::cout <<"FINISHED UPLOAD " << current.mID << "! Number left = "<<stat->mNumberRemaining<<std::endl;
+        checkUploadsFinished(stat.get());
     }
-    if (del) {
-        delete stat;
-    }
+    issueUploads(stat);
     return EventResponse::del();
 }
 
-void UploadFilesAndConfirmReplacement(::Sirikata::Transfer::TransferManager*tm,
-                                      const std::vector<ResourceFileUpload> &origFilesToUpload,
-                                      const ::Sirikata::Transfer::URIContext &hashContext,
-                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback) {
-    std::vector<const ResourceFileUpload*> filesToUpload;
-    {
-        std::set<String> duplicateTracking;
-        for (size_t i = 0; i < origFilesToUpload.size(); ++i) {
-            if (duplicateTracking.insert(origFilesToUpload[i].mID.toString()).second) {
-                filesToUpload.push_back(&origFilesToUpload[i]);
+/// Hands waiting uploads to the TransferManager until mMaxInFlight are in flight.
+static void issueUploads(const UploadStatusPtr &stat) {
+    while (true) {
+        ResourceFileUpload current;
+        {
+            boost::unique_lock<boost::mutex> mylock (stat->mLock);
+            if (stat->mWaiting.empty() || stat->mInFlight >= stat->mMaxInFlight) {
+                return;
             }
+            current = stat->mWaiting.front();
+            stat->mWaiting.pop_front();
+            ++stat->mInFlight;
         }
-    }
-    UploadStatus *status = new UploadStatus(callback, filesToUpload.size());
-    for (size_t i = 0; i < filesToUpload.size(); ++i) {
-        const ResourceFileUpload &current = *(filesToUpload[i]);
+        // The lock is released first since the TransferManager may call UploadFinished right away.
         std::cout << "Uploading "<<stripslashes(current.mSourceFilename)<<" to URI " << current.mID<<". Hash = "<<current.mHash<<"; Size = "<<current.mData->length()<<std::endl;
-        if (current.mID.context() == hashContext) {
-            tm->uploadByHash(Transfer::RemoteFileId(current.mHash, current.mID),
+        if (current.mID.context() == stat->mHashContext) {
+            stat->mTransferManager->uploadByHash(Transfer::RemoteFileId(current.mHash, current.mID),
                        current.mData,
-                       std::tr1::bind(&UploadFinished, status, current, _1),true);
+                       std::tr1::bind(&UploadFinished, stat, current, _1),true);
         } else {
-            tm->upload(current.mID,
-                       Transfer::RemoteFileId(current.mHash, hashContext),
+            stat->mTransferManager->upload(current.mID,
+                       Transfer::RemoteFileId(current.mHash, stat->mHashContext),
                        current.mData,
-                       std::tr1::bind(&UploadFinished, status, current, _1),true);
+                       std::tr1::bind(&UploadFinished, stat, current, _1),true);
         }
     }
 }
 
+/// Queues current for upload unless a file with the same URI has already been queued.
+static void queueUpload(const UploadStatusPtr &stat, const ResourceFileUpload &current) {
+    {
+        boost::unique_lock<boost::mutex> mylock (stat->mLock);
+        if (!stat->mQueuedIDs.insert(current.mID.toString()).second) {
+            return;
+        }
+        stat->mWaiting.push_back(current);
+        ++stat->mNumberRemaining;
+        stat->mNumBytes += current.mData->length();
+    }
+    issueUploads(stat);
+}
+
+static void finishQueueingUploads(const UploadStatusPtr &stat) {
+    boost::unique_lock<boost::mutex> mylock (stat->mLock);
+    stat->mAllQueued = true;
+    checkUploadsFinished(stat.get());
+}
+
+void UploadFilesAndConfirmReplacement(::Sirikata::Transfer::TransferManager*tm,
+                                      const std::vector<ResourceFileUpload> &filesToUpload,
+                                      const ::Sirikata::Transfer::URIContext &hashContext,
+                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback,
+                                      int maxConcurrentUploads) {
+    UploadStatusPtr status(new UploadStatus(tm, hashContext, callback, maxConcurrentUploads));
+    for (size_t i = 0; i < filesToUpload.size(); ++i) {
+        queueUpload(status, filesToUpload[i]);
+    }
+    finishQueueingUploads(status);
+}
+
+void ProcessAndUploadOgreMeshMaterialDependencies(::Sirikata::Transfer::TransferManager*tm,
+                                                  const std::vector<DiskFile> &filenames,
+                                                  const ReplaceMaterialOptions&options,
+                                                  const std::tr1::function<void(ResourceStatusMap const &)> &callback) {
+    UploadStatusPtr status(new UploadStatus(tm, options.uploadHashContext, callback, options.maxConcurrentUploads));
+    {
+        ReplaceMaterialOptionsAndReturn opts(options);
+        ingestOgreMeshMaterialDependencies(filenames, opts, std::tr1::bind(&queueUpload, status, _1));
+        deleteFileMap(opts.mFileMap);
+    }
+    finishQueueingUploads(status);
+}
+
 }
 
 #ifdef STANDALONE
+/**
+ * Rewrites a generated material library of numMaterials materials with a ReplacingDataStream,
+ * resolving half its textures through aliases, and prints how long that took.
+ */
+static void benchmarkReplacingDataStream(int numMaterials) {
+  std::ostringstream script;
+  script << "import * from \"meru://bench@/base.material\"\n";
+  for (int i=0;i<numMaterials;++i) {
+    script << "vertex_program swirl" << i << " cg\n{\n\tsource \"meru://bench@/swirl.cg\"\n\tentry_point main\n}\n"
+           << "material mat" << i << (i%3==0?" : base\n":"\n") << "{\n\ttechnique\n\t{\n\t\tpass\n\t\t{\n"
+           << "\t\t\tvertex_program_ref swirl" << i << "\n\t\t\t{\n\t\t\t}\n"
+           << "\t\t\tfragment_program_ref \"meru://bench@/shared.program:Glow\"\n\t\t\t{\n\t\t\t}\n"
+           << "\t\t\ttexture_unit\n\t\t\t{\n\t\t\t\ttexture \"meru://bench@/tex" << (i%100) << ".png\" 2d\n\t\t\t}\n"
+           << "\t\t\ttexture_unit\n\t\t\t{\n\t\t\t\tanim_texture meru://bench@/a.png meru://bench@/b.png 2.5 // animated\n\t\t\t}\n"
+           << "\t\t}\n\t}\n}\n";
+  }
+  String text=script.str();
+  Ogre::NameValuePairList aliases;
+  for (int i=0;i<100;i+=2) {
+    std::ostringstream name;
+    name << "meru://bench@/tex" << i << ".png";
+    aliases[name.str()]="mhash:///"+String(64,'a'+i%26);
+  }
+  aliases["meru://bench@/shared.program"]="mhash:///"+String(64,'f');
+
+  clock_t start=clock();
+  Ogre::DataStreamPtr input(new Ogre::MemoryDataStream((void*)text.data(),text.length()));
+  ReplacingDataStream rds(input,"meru://bench@/bench.material",&aliases);
+  std::vector<Ogre::String> provides,depends_on;
+  rds.preprocessData(provides,depends_on);
+  double seconds=double(clock()-start)/CLOCKS_PER_SEC;
+  std::cout << "Rewrote " << text.length() << " bytes (" << provides.size() << " provides, "
+            << depends_on.size() << " depends) in " << seconds*1000 << " ms" << std::endl;
+}
+
 int main (int argc, char ** argv) {
   ReplaceMaterialOptions opts;
   for (int i=0;i<argc;++i) {
     char match=0;
     int j;
+    if (strncmp(argv[i],"-b",2)==0&&!match) {
+        benchmarkReplacingDataStream(atoi(argv[i]+2));
+        return 0;
+    }
     if (strncmp(argv[i],"-u",2)==0&&!match) {
         opts.username = argv[i]+2;
         match=1;
@@ -115,7 +115,14 @@ public:
     URIContext uploadHashContext; ///< URI of the form "mhash:///"
     URIContext uploadNameContext; ///< URI of the form "meru:///"
 
+    ///Number of threads reading, rewriting and hashing files
+    int ingestThreads;
+    ///Most uploads ProcessAndUploadOgreMeshMaterialDependencies keeps in flight at once
+    int maxConcurrentUploads;
+
     ReplaceMaterialOptions() {
+        ingestThreads=4;
+        maxConcurrentUploads=8;
         namedTileable=true;
         forceThirdLevelNames=false;
         forceFirstLevelNames=false;
@@ -208,6 +215,7 @@ std::vector<ResourceFileUpload> ProcessOgreMeshMaterialDependencies(const std::v
  * \param username_to_resource_upload_choices is a map of previously chosen responses to uploads from usernames
  * \callback is the function to call when its over...it takes a map mapping resource uploads to whether they succeeded so that a second try can be establised, the result of new resource_upload_choices and a set of usernames to logout when this is all over
  * \param actuallyUpload dictates if the file should actually be uploaded
+ * \param maxConcurrentUploads is the most uploads kept in flight at once; the rest wait for one to finish
 
    FIXME, Reimplement using Sirikata::Transfer::TransferManager::upload().
 
@@ -217,7 +225,19 @@ typedef std::map<ResourceFileUpload,ResourceUploadStatus> ResourceStatusMap;
 void UploadFilesAndConfirmReplacement(::Sirikata::Transfer::TransferManager*tm,
                                       const std::vector<ResourceFileUpload> &filesToUpload,
                                       const URIContext &hashContext,
-                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback);
+                                      const std::tr1::function<void(ResourceStatusMap const &)> &callback,
+                                      int maxConcurrentUploads=8);
+
+/**
+ * Processes filenames as ProcessOgreMeshMaterialDependencies does, but uploads each file to
+ * options.uploadHashContext as soon as it has been rewritten and hashed instead of waiting for
+ * the whole set, keeping at most options.maxConcurrentUploads uploads in flight.
+ * \param callback is called once every upload has finished, as with UploadFilesAndConfirmReplacement
+ */
+void ProcessAndUploadOgreMeshMaterialDependencies(::Sirikata::Transfer::TransferManager*tm,
+                                                  const std::vector<DiskFile> &filenames,
+                                                  const ReplaceMaterialOptions&options,
+                                                  const std::tr1::function<void(ResourceStatusMap const &)> &callback);
 
 
 
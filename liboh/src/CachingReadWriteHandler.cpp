@@ -0,0 +1,450 @@
+/*  Sirikata liboh -- Object Host
+ *  CachingReadWriteHandler.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "oh/CachingReadWriteHandler.hpp"
+#include <util/KnownServices.hpp>
+#include <ObjectHost_Persistence.pbj.hpp>
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+namespace Persistence {
+
+namespace {
+/// Flushes the destructor sends before giving up on a backend that keeps failing them.
+const int sShutdownFlushAttempts=3;
+}
+
+class CachingReadWriteHandler::UniqueLock :public boost::mutex {
+};
+class CachingReadWriteHandler::Condition :public boost::condition_variable {
+};
+
+/// A client's ReadWriteSet and the response being assembled for it.
+class CachingReadWriteHandler::Request {
+public:
+    Protocol::ReadWriteSet *mReadWrite;
+    void (*mDestroyReadWrite)(Protocol::ReadWriteSet*);
+    ResultCallback mCallback;
+    RoutableMessageHeader mHeader;
+    bool mIsMessage;
+    Protocol::Response *mResponse;
+    std::vector<int> mMisses; ///< indices of reads the backend was asked for, in order
+    Request(Protocol::ReadWriteSet *rws, void (*destroy)(Protocol::ReadWriteSet*))
+        : mReadWrite(rws), mDestroyReadWrite(destroy), mIsMessage(false), mResponse(new Protocol::Response) {
+    }
+};
+
+class CachingReadWriteHandler::Deliver : public Task::WorkItem {
+    std::vector<MessageService*> mInterestedParties;
+    Request *mRequest;
+public:
+    Deliver(const std::vector<MessageService*> &interestedParties, Request *req)
+        : mInterestedParties(interestedParties),mRequest(req){}
+    void operator()() {
+        std::auto_ptr<Deliver> deleteMe(this);
+        Request *req = mRequest;
+        const Protocol::ReadWriteSet &rws = *req->mReadWrite;
+        if (rws.has_options() && (rws.options()&Protocol::ReadWriteSet::RETURN_READ_NAMES)!=0) {
+            for (int i = 0; i < rws.reads_size(); ++i) {
+                mergeStorageKey(req->mResponse->mutable_reads(i), rws.reads(i));
+            }
+        }
+        (*req->mDestroyReadWrite)(req->mReadWrite);
+        if (req->mIsMessage) {
+            std::string body;
+            req->mResponse->SerializeToString(&body);
+            req->mHeader.swap_source_and_destination();
+            for (std::vector<MessageService*>::iterator i=mInterestedParties.begin(),ie=mInterestedParties.end(); i!=ie; ++i) {
+                (*i)->processMessage(req->mHeader, MemoryReference(body));
+            }
+            delete req->mResponse;
+        } else {
+            req->mCallback(req->mResponse);
+        }
+        delete req;
+    }
+};
+
+CachingReadWriteHandler::CachingReadWriteHandler(ReadWriteHandler *backend,
+                                                 Task::WorkQueue *replyQueue,
+                                                 const Duration &flushInterval,
+                                                 size_t maxEntries,
+                                                 size_t maxDirty)
+ : mBackend(backend),
+   mBackendListener(this),
+   mReplyQueue(replyQueue),
+   mFlushInterval(flushInterval),
+   mLastFlush(Task::LocalTime::now()),
+   mMaxEntries(maxEntries),
+   mMaxDirty(maxDirty),
+   mLock(new UniqueLock),
+   mFlushed(new Condition),
+   mNumUnflushed(0),
+   mSending(false),
+   mNextId(1),
+   mWritesReceived(0),
+   mWritesFlushed(0) {
+    mBackend->forwardMessagesTo(&mBackendListener);
+}
+
+CachingReadWriteHandler::~CachingReadWriteHandler() {
+    for (int attempt=1;;++attempt) {
+        flush();
+        boost::unique_lock<boost::mutex> lok(*mLock);
+        while (!mFlushes.empty()) {
+            mFlushed->wait(lok);
+        }
+        if (mNumUnflushed==0)
+            break;
+        if (attempt==sShutdownFlushAttempts) {
+            SILOG(persistence,error,"Write-behind cache dropping "<<mNumUnflushed<<" values the backend failed to store");
+            break;
+        }
+    }
+    SILOG(persistence,info,"Write-behind cache received "<<mWritesReceived<<" writes and flushed "<<mWritesFlushed);
+    delete mBackend;
+    // nothing will answer these reads now, so their callers hear that they failed
+    for (PendingMap::iterator i=mPending.begin(),ie=mPending.end(); i!=ie; ++i) {
+        i->second->mResponse->set_return_status(Protocol::Response::INTERNAL_ERROR);
+        deliver(i->second);
+    }
+    delete mFlushed;
+    delete mLock;
+}
+
+void CachingReadWriteHandler::destroyResponse(Protocol::Response *res) {
+    delete res;
+}
+
+bool CachingReadWriteHandler::forwardMessagesTo(MessageService *ms) {
+    mInterestedParties.push_back(ms);
+    return true;
+}
+
+bool CachingReadWriteHandler::endForwardingMessagesTo(MessageService *ms) {
+    std::vector<MessageService*>::iterator where=std::find(mInterestedParties.begin(),mInterestedParties.end(),ms);
+    if (where==mInterestedParties.end())
+        return false;
+    mInterestedParties.erase(where);
+    return true;
+}
+
+void CachingReadWriteHandler::processMessage(const RoutableMessageHeader &hdr, MemoryReference body) {
+    Protocol::ReadWriteSet *rws=new Protocol::ReadWriteSet;
+    if (rws->ParseFromArray(body.data(),body.size())) {
+        applyMessage(hdr,rws);
+    } else {
+        delete rws;
+    }
+}
+
+void CachingReadWriteHandler::applyInternal(Protocol::ReadWriteSet *rws, const ResultCallback &cb, void (*destroy)(Protocol::ReadWriteSet*)) {
+    Request *req=new Request(rws,destroy);
+    req->mCallback=cb;
+    handle(req);
+}
+
+void CachingReadWriteHandler::applyInternal(const RoutableMessageHeader &hdr, Protocol::ReadWriteSet *rws, void (*destroy)(Protocol::ReadWriteSet*)) {
+    Request *req=new Request(rws,destroy);
+    req->mHeader=hdr;
+    req->mIsMessage=true;
+    handle(req);
+}
+
+template <class StorageElement> CachingReadWriteHandler::Key CachingReadWriteHandler::getKey(const StorageElement &el) {
+    Key key;
+    key.mObject=el.object_uuid();
+    key.mFieldId=el.field_id();
+    key.mFieldName=el.field_name();
+    return key;
+}
+
+CachingReadWriteHandler::Entry &CachingReadWriteHandler::touch(const Key &key) {
+    std::pair<EntryMap::iterator,bool> where=mEntries.insert(EntryMap::value_type(key,Entry()));
+    Entry &entry=where.first->second;
+    if (where.second) {
+        entry.mPresent=false;
+        entry.mDirty=false;
+        entry.mUnflushed=false;
+        entry.mVersion=0;
+        mLru.push_front(key);
+    } else {
+        mLru.splice(mLru.begin(),mLru,entry.mLru);
+    }
+    entry.mLru=mLru.begin();
+    return entry;
+}
+
+void CachingReadWriteHandler::evict() {
+    // dirty values stay until the backend acknowledges them; a full cache of them is bounded by mMaxDirty
+    LruList::iterator candidate=mLru.end();
+    while (mEntries.size()>mMaxEntries && candidate!=mLru.begin()) {
+        --candidate;
+        EntryMap::iterator where=mEntries.find(*candidate);
+        if (!where->second.mDirty) {
+            mEntries.erase(where);
+            candidate=mLru.erase(candidate);
+        }
+    }
+}
+
+void CachingReadWriteHandler::handle(Request *req) {
+    const Protocol::ReadWriteSet &rws=*req->mReadWrite;
+    Protocol::Response &response=*req->mResponse;
+    bool waiting;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        Protocol::ReadWriteSet misses;
+        // reads see the values from before this request's writes
+        for (int i=0;i<rws.reads_size();++i) {
+            response.add_reads();
+            Key key=getKey(rws.reads(i));
+            EntryMap::iterator where=mEntries.find(key);
+            if (where==mEntries.end()) {
+                req->mMisses.push_back(i);
+                misses.add_reads();
+                copyStorageKey(misses.mutable_reads(misses.reads_size()-1),rws.reads(i));
+            } else {
+                Entry &entry=touch(key);
+                if (entry.mPresent) {
+                    response.mutable_reads(i).set_data(entry.mValue);
+                } else {
+                    response.mutable_reads(i).set_return_status(Protocol::StorageElement::KEY_MISSING);
+                }
+            }
+            if (rws.reads(i).has_index()) {
+                response.mutable_reads(i).set_index(rws.reads(i).index());
+            }
+        }
+        for (int i=0;i<rws.writes_size();++i) {
+            Entry &entry=touch(getKey(rws.writes(i)));
+            entry.mDirty=true;
+            ++entry.mVersion;
+            if (!entry.mUnflushed) {
+                entry.mUnflushed=true;
+                ++mNumUnflushed;
+            }
+            entry.mPresent=rws.writes(i).has_data();
+            if (entry.mPresent) {
+                entry.mValue=rws.writes(i).data();
+            } else {
+                entry.mValue=String();
+            }
+            ++mWritesReceived;
+        }
+        if (mNumUnflushed>=mMaxDirty) {
+            flushLocked();
+        }
+        evict();
+        waiting=!req->mMisses.empty();
+        if (waiting) {
+            std::string body;
+            misses.SerializeToString(&body);
+            mPending[queueBackend(body)]=req;
+        }
+    }
+    sendQueued();
+    if (!waiting) {
+        deliver(req);
+    }
+}
+
+void CachingReadWriteHandler::flushLocked() {
+    if (mNumUnflushed==0)
+        return;
+    Protocol::ReadWriteSet rws;
+    FlushedVersions flushed;
+    for (EntryMap::iterator i=mEntries.begin(),ie=mEntries.end(); i!=ie; ++i) {
+        Entry &entry=i->second;
+        if (!entry.mUnflushed)
+            continue;
+        rws.add_writes();
+        int w=rws.writes_size()-1;
+        rws.mutable_writes(w).set_object_uuid(i->first.mObject);
+        rws.mutable_writes(w).set_field_id(i->first.mFieldId);
+        rws.mutable_writes(w).set_field_name(i->first.mFieldName);
+        if (entry.mPresent)
+            rws.mutable_writes(w).set_data(entry.mValue);
+        // the backend applies requests in order, so later misses will see this write
+        entry.mUnflushed=false;
+        flushed.push_back(FlushedVersions::value_type(i->first,entry.mVersion));
+        ++mWritesFlushed;
+    }
+    mNumUnflushed=0;
+    mLastFlush=Task::LocalTime::now();
+    std::string body;
+    rws.SerializeToString(&body);
+    mFlushes[queueBackend(body)].swap(flushed);
+}
+
+void CachingReadWriteHandler::flushAcknowledged(const FlushedVersions &flushed, bool failed) {
+    for (FlushedVersions::const_iterator i=flushed.begin(),ie=flushed.end(); i!=ie; ++i) {
+        EntryMap::iterator where=mEntries.find(i->first);
+        // a key written since this flush was sent is carried by a later one
+        if (where==mEntries.end() || where->second.mVersion!=i->second)
+            continue;
+        Entry &entry=where->second;
+        if (!failed) {
+            entry.mDirty=false;
+        } else if (!entry.mUnflushed) {
+            entry.mUnflushed=true;
+            ++mNumUnflushed;
+        }
+    }
+}
+
+int64 CachingReadWriteHandler::queueBackend(const std::string &body) {
+    // queued under mLock so the backend sees flushes and misses in the order they were decided
+    int64 id=mNextId++;
+    mOutgoing.push_back(OutgoingQueue::value_type(id,body));
+    return id;
+}
+
+void CachingReadWriteHandler::sendQueued() {
+    OutgoingQueue::value_type next;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        if (mSending || mOutgoing.empty())
+            return;
+        mSending=true;
+        next.first=mOutgoing.front().first;
+        next.second.swap(mOutgoing.front().second);
+        mOutgoing.pop_front();
+    }
+    // whoever is sending drains the queue, so messages queued meanwhile by other threads keep their order
+    for (;;) {
+        RoutableMessageHeader hdr;
+        hdr.set_id(next.first);
+        hdr.set_destination_port(Services::PERSISTENCE);
+        mBackend->processMessage(hdr,MemoryReference(next.second));
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        if (mOutgoing.empty()) {
+            mSending=false;
+            return;
+        }
+        next.first=mOutgoing.front().first;
+        next.second.swap(mOutgoing.front().second);
+        mOutgoing.pop_front();
+    }
+}
+
+void CachingReadWriteHandler::flush() {
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        flushLocked();
+    }
+    sendQueued();
+}
+
+void CachingReadWriteHandler::tick() {
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        if (mNumUnflushed && Task::LocalTime::now()-mLastFlush>=mFlushInterval) {
+            flushLocked();
+        }
+    }
+    sendQueued();
+}
+
+void CachingReadWriteHandler::BackendListener::processMessage(const RoutableMessageHeader &hdr, MemoryReference body) {
+    mParent->backendReply(hdr,body);
+}
+
+void CachingReadWriteHandler::backendReply(const RoutableMessageHeader &hdr, MemoryReference body) {
+    if (!hdr.has_reply_id())
+        return;
+    Protocol::Response reply;
+    reply.ParseFromArray(body.data(),body.size());
+    Request *req;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        FlushMap::iterator flushed=mFlushes.find(hdr.reply_id());
+        if (flushed!=mFlushes.end()) {
+            bool failed=hdr.has_return_status() || reply.has_return_status();
+            if (failed) {
+                SILOG(persistence,error,"Write-behind flush of "<<flushed->second.size()<<" values failed: "<<(int)reply.return_status()<<"; they will be sent again");
+            }
+            flushAcknowledged(flushed->second,failed);
+            mFlushes.erase(flushed);
+            if (mFlushes.empty()) {
+                mFlushed->notify_all();
+            }
+            evict();
+            return;
+        }
+        PendingMap::iterator where=mPending.find(hdr.reply_id());
+        if (where==mPending.end())
+            return;
+        req=where->second;
+        mPending.erase(where);
+        bool failed=hdr.has_return_status() || reply.has_return_status() || reply.reads_size()<(int)req->mMisses.size();
+        if (failed) {
+            req->mResponse->set_return_status(reply.has_return_status()?reply.return_status():Protocol::Response::INTERNAL_ERROR);
+        }
+        for (size_t i=0;i<req->mMisses.size() && !failed;++i) {
+            int index=req->mMisses[i];
+            const Protocol::ReadWriteSet &rws=*req->mReadWrite;
+            bool present=reply.reads(i).has_data() && !reply.reads(i).has_return_status();
+            if (present) {
+                req->mResponse->mutable_reads(index).set_data(reply.reads(i).data());
+            } else {
+                req->mResponse->mutable_reads(index).set_return_status(Protocol::StorageElement::KEY_MISSING);
+            }
+            // anything written since the read was sent is newer than the backend's answer
+            Key key=getKey(rws.reads(index));
+            if (mEntries.find(key)==mEntries.end()) {
+                Entry &entry=touch(key);
+                entry.mPresent=present;
+                if (present)
+                    entry.mValue=reply.reads(i).data();
+            }
+        }
+        evict();
+    }
+    deliver(req);
+}
+
+void CachingReadWriteHandler::deliver(Request *req) {
+    mReplyQueue->enqueue(new Deliver(mInterestedParties,req));
+}
+
+uint64 CachingReadWriteHandler::getWritesReceived() const {
+    return mWritesReceived;
+}
+
+uint64 CachingReadWriteHandler::getWritesFlushed() const {
+    return mWritesFlushed;
+}
+
+}
+}
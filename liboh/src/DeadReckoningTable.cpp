@@ -0,0 +1,233 @@
+/*  Sirikata liboh -- Object Host
+ *  DeadReckoningTable.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <ObjectHost_Sirikata.pbj.hpp>
+#include "util/RoutableMessage.hpp"
+#include "util/KnownServices.hpp"
+#include "oh/ProxyObject.hpp"
+#include "oh/HostedObject.hpp"
+#include "oh/DeadReckoningTable.hpp"
+#include <boost/thread.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Sirikata {
+
+namespace {
+///Distance the space's extrapolation may drift before an update is sent, matching ProxyObject::UpdateNeeded
+const float64 sDefaultThreshold=1.0;
+/**
+ * ProxyObject::UpdateNeeded resends once any axis of the orientation turns more than acos(.9) away.
+ * For a rotation by theta the two quaternions' dot product d is cos(theta/2), so cos(theta)=2d*d-1<.9
+ * whenever d*d<.95, which costs four multiplies per row instead of two sets of axes.
+ */
+const float64 sOrientationDot2=.95;
+
+#ifdef __SSE2__
+inline __m128d load2(const std::vector<float64>&v, size_t i) {
+    return _mm_loadu_pd(&v[i]);
+}
+#endif
+}
+
+class DeadReckoningTable::UniqueLock :public boost::mutex {
+};
+
+DeadReckoningTable::DeadReckoningTable(const SpaceID&space)
+ : mLock(new UniqueLock),mSpace(space),mEpoch(Time::now(Duration::zero())) {
+}
+DeadReckoningTable::~DeadReckoningTable() {
+    delete mLock;
+}
+
+size_t DeadReckoningTable::size()const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    return mOwners.size();
+}
+
+float64 DeadReckoningTable::secondsSinceEpoch(const Time&t)const {
+    return (t-mEpoch).toSeconds();
+}
+
+void DeadReckoningTable::insert(HostedObject*owner, const ProxyObjectPtr&proxy, Row*rowHandle, const Time&now, const Location&loc) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    Row row=mOwners.size();
+    *rowHandle=row;
+    mOwners.push_back(owner);
+    mProxies.push_back(proxy);
+    mRowHandles.push_back(rowHandle);
+    mPosX.push_back(0);mPosY.push_back(0);mPosZ.push_back(0);
+    mVelX.push_back(0);mVelY.push_back(0);mVelZ.push_back(0);
+    mRotX.push_back(0);mRotY.push_back(0);mRotZ.push_back(0);mRotW.push_back(1);
+    mSentPosX.push_back(0);mSentPosY.push_back(0);mSentPosZ.push_back(0);
+    mSentVelX.push_back(0);mSentVelY.push_back(0);mSentVelZ.push_back(0);
+    mSentRotX.push_back(0);mSentRotY.push_back(0);mSentRotZ.push_back(0);mSentRotW.push_back(1);
+    mSentTime.push_back(0);
+    mThreshold2.push_back(sDefaultThreshold*sDefaultThreshold);
+    resetRow(row,now,loc);
+}
+
+namespace {
+template <class T> void swapRemove(std::vector<T>&v, size_t row) {
+    v[row]=v.back();
+    v.pop_back();
+}
+}
+
+void DeadReckoningTable::remove(const Row*rowHandle) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    Row row=*rowHandle;
+    assert(row<mOwners.size());
+    Row last=mOwners.size()-1;
+    if (row!=last) {
+        *mRowHandles[last]=row;
+    }
+    swapRemove(mOwners,row);swapRemove(mProxies,row);swapRemove(mRowHandles,row);
+    swapRemove(mPosX,row);swapRemove(mPosY,row);swapRemove(mPosZ,row);
+    swapRemove(mVelX,row);swapRemove(mVelY,row);swapRemove(mVelZ,row);
+    swapRemove(mRotX,row);swapRemove(mRotY,row);swapRemove(mRotZ,row);swapRemove(mRotW,row);
+    swapRemove(mSentPosX,row);swapRemove(mSentPosY,row);swapRemove(mSentPosZ,row);
+    swapRemove(mSentVelX,row);swapRemove(mSentVelY,row);swapRemove(mSentVelZ,row);
+    swapRemove(mSentRotX,row);swapRemove(mSentRotY,row);swapRemove(mSentRotZ,row);swapRemove(mSentRotW,row);
+    swapRemove(mSentTime,row);
+    swapRemove(mThreshold2,row);
+}
+
+void DeadReckoningTable::storeSent(Row row, float64 t, const Location&loc) {
+    const Vector3d&pos=loc.getPosition();
+    const Vector3f&vel=loc.getVelocity();
+    const Quaternion&rot=loc.getOrientation();
+    mSentPosX[row]=pos.x;mSentPosY[row]=pos.y;mSentPosZ[row]=pos.z;
+    mSentVelX[row]=vel.x;mSentVelY[row]=vel.y;mSentVelZ[row]=vel.z;
+    mSentRotX[row]=rot.x;mSentRotY[row]=rot.y;mSentRotZ[row]=rot.z;mSentRotW[row]=rot.w;
+    mSentTime[row]=t;
+}
+
+void DeadReckoningTable::reset(const Row*rowHandle, const Time&now, const Location&loc) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    resetRow(*rowHandle,now,loc);
+}
+
+void DeadReckoningTable::resetRow(Row row, const Time&now, const Location&loc) {
+    Location still(loc);
+    still.setVelocity(Vector3f::nil());
+    still.setAngularSpeed(0);
+    storeSent(row,secondsSinceEpoch(now),still);
+}
+
+void DeadReckoningTable::setThreshold(const Row*rowHandle, float64 distance) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    mThreshold2[*rowHandle]=distance*distance;
+}
+
+void DeadReckoningTable::findStaleRows(float64 tnow) {
+    mStaleRows.resize(0);
+    const size_t n=mOwners.size();
+    size_t i=0;
+#ifdef __SSE2__
+    const __m128d now2=_mm_set1_pd(tnow);
+    const __m128d dotLimit=_mm_set1_pd(sOrientationDot2);
+    for (;i+2<=n;i+=2) {
+        __m128d dt=_mm_sub_pd(now2,load2(mSentTime,i));
+        __m128d ex=_mm_sub_pd(load2(mPosX,i),_mm_add_pd(load2(mSentPosX,i),_mm_mul_pd(load2(mSentVelX,i),dt)));
+        __m128d ey=_mm_sub_pd(load2(mPosY,i),_mm_add_pd(load2(mSentPosY,i),_mm_mul_pd(load2(mSentVelY,i),dt)));
+        __m128d ez=_mm_sub_pd(load2(mPosZ,i),_mm_add_pd(load2(mSentPosZ,i),_mm_mul_pd(load2(mSentVelZ,i),dt)));
+        __m128d err2=_mm_add_pd(_mm_add_pd(_mm_mul_pd(ex,ex),_mm_mul_pd(ey,ey)),_mm_mul_pd(ez,ez));
+        __m128d dot=_mm_add_pd(_mm_add_pd(_mm_mul_pd(load2(mRotX,i),load2(mSentRotX,i)),
+                                          _mm_mul_pd(load2(mRotY,i),load2(mSentRotY,i))),
+                               _mm_add_pd(_mm_mul_pd(load2(mRotZ,i),load2(mSentRotZ,i)),
+                                          _mm_mul_pd(load2(mRotW,i),load2(mSentRotW,i))));
+        int stale=_mm_movemask_pd(_mm_or_pd(_mm_cmpgt_pd(err2,load2(mThreshold2,i)),
+                                            _mm_cmplt_pd(_mm_mul_pd(dot,dot),dotLimit)));
+        if (stale&1) mStaleRows.push_back(i);
+        if (stale&2) mStaleRows.push_back(i+1);
+    }
+#endif
+    for (;i<n;++i) {
+        float64 dt=tnow-mSentTime[i];
+        float64 ex=mPosX[i]-(mSentPosX[i]+mSentVelX[i]*dt);
+        float64 ey=mPosY[i]-(mSentPosY[i]+mSentVelY[i]*dt);
+        float64 ez=mPosZ[i]-(mSentPosZ[i]+mSentVelZ[i]*dt);
+        float64 dot=mRotX[i]*mSentRotX[i]+mRotY[i]*mSentRotY[i]+mRotZ[i]*mSentRotZ[i]+mRotW[i]*mSentRotW[i];
+        if (ex*ex+ey*ey+ez*ez>mThreshold2[i]||dot*dot<sOrientationDot2) {
+            mStaleRows.push_back(i);
+        }
+    }
+}
+
+void DeadReckoningTable::sendUpdates(float64 tnow) {
+    if (mStaleRows.empty()) {
+        return;
+    }
+    RoutableMessageHeader header;
+    header.set_destination_port(Services::LOC);
+    header.set_destination_object(ObjectReference::spaceServiceID());
+    header.set_destination_space(mSpace);
+    std::string bodyStr;
+    for (std::vector<Row>::const_iterator iter=mStaleRows.begin(),iterEnd=mStaleRows.end();iter!=iterEnd;++iter) {
+        Row row=*iter;
+        Location loc(Vector3d(mPosX[row],mPosY[row],mPosZ[row]),
+                     Quaternion(mRotX[row],mRotY[row],mRotZ[row],mRotW[row],Quaternion::XYZW()),
+                     Vector3f(mVelX[row],mVelY[row],mVelZ[row]),
+                     Vector3f(0,1,0),0);
+        Protocol::ObjLoc toSet;
+        toSet.set_position(loc.getPosition());
+        toSet.set_orientation(loc.getOrientation());
+        toSet.set_velocity(loc.getVelocity());
+        RoutableMessageBody body;
+        toSet.SerializeToString(body.add_message("ObjLoc"));
+        body.SerializeToString(&bodyStr);
+        mOwners[row]->sendViaSpace(header, MemoryReference(bodyStr));
+        storeSent(row,tnow,loc);
+    }
+}
+
+void DeadReckoningTable::tick(const Time&now) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    const size_t n=mOwners.size();
+    for (size_t i=0;i<n;++i) {
+        Location loc(mProxies[i]->globalLocation(now));
+        const Vector3d&pos=loc.getPosition();
+        const Vector3f&vel=loc.getVelocity();
+        const Quaternion&rot=loc.getOrientation();
+        mPosX[i]=pos.x;mPosY[i]=pos.y;mPosZ[i]=pos.z;
+        mVelX[i]=vel.x;mVelY[i]=vel.y;mVelZ[i]=vel.z;
+        mRotX[i]=rot.x;mRotY[i]=rot.y;mRotZ[i]=rot.z;mRotW[i]=rot.w;
+    }
+    float64 tnow=secondsSinceEpoch(now);
+    findStaleRows(tnow);
+    sendUpdates(tnow);
+}
+
+}
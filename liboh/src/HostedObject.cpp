@@ -45,6 +45,9 @@
 #include "oh/HostedObject.hpp"
 #include "util/SentMessage.hpp"
 #include "oh/ObjectHost.hpp"
+#include "oh/DeadReckoningTable.hpp"
+#include "oh/InterestTable.hpp"
+#include "oh/MessageBatcher.hpp"
 #include "oh/ProxyMeshObject.hpp"
 #include "oh/ProxyLightObject.hpp"
 #include "oh/ProxyCameraObject.hpp"
@@ -62,46 +65,23 @@ class HostedObject::PerSpaceData {
 public:
     SpaceConnection mSpaceConnection;
     ProxyObjectPtr mProxyObject;
-    ProxyObject::Extrapolator mUpdatedLocation;
-
-    void locationWasReset(Time timestamp, Location loc) {
-        loc.setVelocity(Vector3f::nil());
-        loc.setAngularSpeed(0);
-        mUpdatedLocation.resetValue(timestamp, loc);
-    }
-    void locationWasSet(const Protocol::ObjLoc &msg) {
-        Time timestamp = msg.timestamp();
-        Location loc = mUpdatedLocation.extrapolate(timestamp);
-        ProxyObject::updateLocationWithObjLoc(loc, msg);
-        loc.setVelocity(Vector3f::nil());
-        loc.setAngularSpeed(0);
-        mUpdatedLocation.updateValue(timestamp, loc);
-    }
-
-    void updateLocation(HostedObject *ho) {
-        if (!mProxyObject) {
-            return;
-        }
-        SpaceID space = mProxyObject->getObjectReference().space();
-        Time now = Time::now(ho->getSpaceTimeOffset(space));
-        Location realLocation = mProxyObject->globalLocation(now);
-        if (mUpdatedLocation.needsUpdate(now, realLocation)) {
-            Protocol::ObjLoc toSet;
-            toSet.set_position(realLocation.getPosition());
-            toSet.set_velocity(realLocation.getVelocity());
-            RoutableMessageBody body;
-            toSet.SerializeToString(body.add_message("ObjLoc"));
-            RoutableMessageHeader header;
-            header.set_destination_port(Services::LOC);
-            header.set_destination_object(ObjectReference::spaceServiceID());
-            header.set_destination_space(space);
-            std::string bodyStr;
-            body.SerializeToString(&bodyStr);
-            // Avoids waiting a loop.
-            ho->sendViaSpace(header, MemoryReference(bodyStr));
-
-            locationWasSet(toSet);
+    ///the row tracking mProxyObject in the ObjectHost's dead reckoning table for this space, once the space knows the object.
+    ///Held weakly since the ObjectHost may delete its tables before the last HostedObject goes away.
+    std::tr1::weak_ptr<DeadReckoningTable> mDeadReckoning;
+    DeadReckoningTable::Row mDeadReckoningRow;
+
+    void removeDeadReckoningRow() {
+        std::tr1::shared_ptr<DeadReckoningTable> table(mDeadReckoning.lock());
+        if (table) {
+            table->remove(&mDeadReckoningRow);
         }
+        mDeadReckoning.reset();
+    }
+    void locationWasReset(HostedObject *ho, const SpaceID &space, Time timestamp, const Location &loc) {
+        removeDeadReckoningRow();
+        std::tr1::shared_ptr<DeadReckoningTable> table(ho->getObjectHost()->getDeadReckoningTable(space));
+        table->insert(ho, mProxyObject, &mDeadReckoningRow, timestamp, loc);
+        mDeadReckoning = table;
     }
 
     typedef std::map<uint32, std::set<ObjectReference> > ProxQueryMap;
@@ -109,12 +89,11 @@ public:
 
     PerSpaceData(const std::tr1::shared_ptr<TopLevelSpaceConnection>&topLevel,Network::Stream*stream)
         :mSpaceConnection(topLevel,stream),
-        mUpdatedLocation(
-            Duration::seconds(.1),
-            TemporalValue<Location>::Time::null(),
-            Location(Vector3d(0,0,0),Quaternion(Quaternion::identity()),
-                     Vector3f(0,0,0),Vector3f(0,1,0),0),
-            ProxyObject::UpdateNeeded()) {
+        mDeadReckoningRow(0) {
+    }
+    // Only ever copied into the SpaceDataMap before the space returns the object, so copies never own a row.
+    ~PerSpaceData() {
+        removeDeadReckoningRow();
     }
 };
 
@@ -132,6 +111,10 @@ HostedObject::HostedObject(ObjectHost*parent, const UUID &objectName)
 }
 
 HostedObject::~HostedObject() {
+    // The ObjectHost's tick may be sending on our behalf from another thread, so stop it before tearing anything down.
+    for (SpaceDataMap::iterator iter = mSpaceData->begin(); iter != mSpaceData->end(); ++iter) {
+        iter->second.removeDeadReckoningRow();
+    }
     if (mObjectScript) {
         delete mObjectScript;
     }
@@ -151,6 +134,7 @@ HostedObject::~HostedObject() {
         }
     }
     mObjectHost->unregisterHostedObject(mInternalObjectReference);
+    mObjectHost->releaseMailbox(mMailbox);
     mTracker.endForwardingMessagesTo(&mSendService);
     delete mSpaceData;
 }
@@ -169,20 +153,33 @@ struct HostedObject::PrivateCallbacks {
             delete msg;
             return; // unable to get starting position.
         }
+        restoreFromReads(realThis, spaceID, msg->body(), 0, msg->body().reads_size());
+        delete msg;
+        realThis->mObjectHost->getWorkQueue()->dequeueAll();
+    }
+
+    /// Applies the database fields in reads [first, first+count) of readSet to realThis and announces it to spaceID
+    template <class ReadSet> static void restoreFromReads(
+        HostedObject *realThis,
+        const SpaceID &spaceID,
+        const ReadSet &readSet,
+        int first,
+        int count)
+    {
         String scriptName;
         std::map<String,String> scriptParams;
         Location location(Vector3d::nil(),Quaternion::identity(),Vector3f::nil(),Vector3f(1,0,0),0);
-        for (int i = 0; i < msg->body().reads_size(); i++) {
-            String name = msg->body().reads(i).field_name();
-            if (msg->body().reads(i).has_return_status() || !msg->body().reads(i).has_data()) {
+        for (int i = first; i < first + count; i++) {
+            String name = readSet.reads(i).field_name();
+            if (readSet.reads(i).has_return_status() || !readSet.reads(i).has_data()) {
                 continue;
             }
             if (!name.empty() && name[0] != '_') {
-                realThis->setProperty(name, msg->body().reads(i).data());
+                realThis->setProperty(name, readSet.reads(i).data());
             }
             if (name == "Loc") {
                 ObjLoc loc;
-                loc.ParseFromString(msg->body().reads(i).data());
+                loc.ParseFromString(readSet.reads(i).data());
                 SILOG(cppoh,debug,"Creating object "<<ObjectReference(realThis->getUUID())
                       <<" at position "<<loc.position());
                 if (loc.has_position()) {
@@ -203,12 +200,12 @@ struct HostedObject::PrivateCallbacks {
             }
             if (name == "_Script") {
                 Protocol::StringProperty scrProp;
-                scrProp.ParseFromString(msg->body().reads(i).data());
+                scrProp.ParseFromString(readSet.reads(i).data());
                 scriptName = scrProp.value();
             }
             if (name == "_ScriptParams") {
                 Protocol::StringMapProperty scrProp;
-                scrProp.ParseFromString(msg->body().reads(i).data());
+                scrProp.ParseFromString(readSet.reads(i).data());
                 int numkeys = scrProp.keys_size();
                 {
                     int numvalues = scrProp.values_size();
@@ -224,11 +221,9 @@ struct HostedObject::PrivateCallbacks {
         // Temporary Hack because we do not have access to the CDN here.
         BoundingSphere3f sphere(Vector3f::nil(),1);
         realThis->sendNewObj(location, sphere, spaceID);
-        delete msg;
         if (!scriptName.empty()) {
             realThis->initializeScript(scriptName, scriptParams);
         }
-        realThis->mObjectHost->getWorkQueue()->dequeueAll();
     }
 
     static void receivedRoutableMessage(const HostedObjectWPtr&thus,const SpaceID&sid, const Network::Chunk&msgChunk) {
@@ -238,7 +233,7 @@ struct HostedObject::PrivateCallbacks {
         MemoryReference bodyData = header.ParseFromArray(&(msgChunk[0]),msgChunk.size());
         header.set_source_space(sid);
         header.set_destination_space(sid);
-        {
+        if (realThis) {
             ProxyObjectPtr destinationObject = realThis->getProxy(header.source_space());
             if (destinationObject) {
                 header.set_destination_object(destinationObject->getObjectReference().object());
@@ -253,7 +248,8 @@ struct HostedObject::PrivateCallbacks {
             return;
         }
 
-        realThis->processRoutableMessage(header, bodyData);
+        // through the mailbox, so that with mailbox threads this object's handlers never run on the connection's thread
+        realThis->mObjectHost->deliver(realThis, header, bodyData);
     }
 
     static void handlePersistenceResponse(
@@ -589,6 +585,16 @@ struct HostedObject::PrivateCallbacks {
         return;
     }
 
+    /// Radius used to judge how large a proxy looks from its viewer.
+    static float64 proxyRadius(const ProxyObjectPtr &obj) {
+        ProxyMeshObject *mesh = dynamic_cast<ProxyMeshObject*>(obj.get());
+        if (mesh) {
+            const Vector3f &scale = mesh->getScale();
+            return std::max(scale.x, std::max(scale.y, scale.z));
+        }
+        return 1.0;
+    }
+
     static void receivedPositionUpdateResponse(
         const HostedObjectWPtr &weakThus,
         SentMessage* sentMessage,
@@ -596,9 +602,11 @@ struct HostedObject::PrivateCallbacks {
         MemoryReference bodyData)
     {
         RoutableMessage responseMessage(hdr, bodyData.data(), bodyData.length());
+        RPCMessage *request = static_cast<RPCMessage*>(sentMessage);
         HostedObjectPtr thus(weakThus.lock());
         if (!thus) {
-            delete static_cast<RPCMessage*>(sentMessage);
+            delete request;
+            return;
         }
         if (responseMessage.header().return_status()) {
             return;
@@ -607,16 +615,46 @@ struct HostedObject::PrivateCallbacks {
         loc.ParseFromString(responseMessage.body().message_arguments(0));
 
         const SpaceID &space = sentMessage->getSpace();
+        Time now = Time::now(thus->getSpaceTimeOffset(space));
+        InterestTable *interest = thus->getObjectHost()->getInterestTable(space);
+        Duration wait = Duration::seconds(0.0);
+        uint32 fields = 0;
         ProxyManager *pm = thus->getObjectHost()->getProxyManager(space);
         if (pm) {
             ProxyObjectPtr obj(pm->getProxyObject(
                 SpaceObjectReference(space, sentMessage->getRecipient())));
             if (obj) {
+                ProxyObjectPtr viewer(thus->getProxy(space));
+                float64 angularError = 0;
+                if (viewer && loc.has_position()) {
+                    Time stamp = loc.has_timestamp() ? loc.timestamp() : now;
+                    // how far off the locally extrapolated position was, as seen from the viewer
+                    float64 error = (obj->globalLocation(stamp).getPosition() - loc.position()).length();
+                    float64 distance = (loc.position() - viewer->globalLocation(stamp).getPosition()).length();
+                    angularError = distance > 0 ? error / distance : 0;
+                }
+                interest->recordUpdate(angularError, bodyData.length());
                 thus->receivedPositionUpdate(obj,loc,false);
+                if (viewer) {
+                    wait = interest->updateInterval(viewer->globalLocation(now), obj->globalLocation(now),
+                                                    proxyRadius(obj), &fields);
+                }
             }
         }
 
-        static_cast<RPCMessage*>(sentMessage)->serializeSend(); // Resend position update each time we get one.
+        // Ask again for the next update; proxies that look small wait in the interest table first,
+        // while their ProxyObject extrapolates them from the velocity just received.
+        request->body().clear_message();
+        Protocol::LocRequest next;
+        if (fields) {
+            next.set_requested_fields((Protocol::LocRequest::Fields)fields);
+        }
+        next.SerializeToString(request->body().add_message("LocRequest"));
+        if (wait.toMicroseconds() > 0) {
+            interest->schedule(weakThus, request, now + wait);
+        } else {
+            request->serializeSend();
+        }
     }
 
     static void disconnectionEvent(const HostedObjectWPtr&weak_thus,const SpaceID&sid, const String&reason) {
@@ -783,16 +821,10 @@ void HostedObject::initializeRestoreFromDatabase(const SpaceID&spaceID, const Ho
                          &PrivateCallbacks::initializeDatabaseCallback,
                          this, spaceID,
                          _1, _2, _3));
-    msg->body().add_reads().set_field_name("MeshURI");
-    msg->body().add_reads().set_field_name("MeshScale");
-    msg->body().add_reads().set_field_name("Name");
-    msg->body().add_reads().set_field_name("PhysicalParameters");
-    msg->body().add_reads().set_field_name("LightInfo");
-    msg->body().add_reads().set_field_name("IsCamera");
-    msg->body().add_reads().set_field_name("Parent");
-    msg->body().add_reads().set_field_name("Loc");
-    msg->body().add_reads().set_field_name("_Script");
-    msg->body().add_reads().set_field_name("_ScriptParams");
+    const std::vector<String> &fields = getRestoreFieldNames();
+    for (size_t i = 0; i < fields.size(); i++) {
+        msg->body().add_reads().set_field_name(fields[i]);
+    }
     for (int i = 0; i < msg->body().reads_size(); i++) {
         msg->body().reads(i).set_object_uuid(getUUID()); // database assumes uuid 0 if omitted
     }
@@ -801,6 +833,19 @@ void HostedObject::initializeRestoreFromDatabase(const SpaceID&spaceID, const Ho
     msg->serializeSend();
     mObjectHost->getWorkQueue()->dequeueAll(); // don't need to wait until next frame.
 }
+void HostedObject::initializeRestoreFromReads(const SpaceID&spaceID, const Persistence::Protocol::Response&response, int firstRead, const HostedObjectPtr&spaceConnectionHint) {
+    mObjectHost->registerHostedObject(getSharedPtr());
+    connectToSpace(spaceID, spaceConnectionHint);
+    PrivateCallbacks::restoreFromReads(this, spaceID, response, firstRead, (int)getRestoreFieldNames().size());
+}
+const std::vector<String> &HostedObject::getRestoreFieldNames() {
+    static const char *names[] = {
+        "MeshURI", "MeshScale", "Name", "PhysicalParameters", "LightInfo",
+        "IsCamera", "Parent", "Loc", "_Script", "_ScriptParams"
+    };
+    static const std::vector<String> fields(names, names + sizeof(names) / sizeof(names[0]));
+    return fields;
+}
 void HostedObject::initializeScript(const String& script, const ObjectScriptManager::Arguments &args) {
     assert(!mObjectScript); // Don't want to kill a live script!
     mObjectHost->registerHostedObject(getSharedPtr());
@@ -862,6 +907,10 @@ void HostedObject::processRoutableMessage(const RoutableMessageHeader &header, M
     }
 }
 
+bool HostedObject::handledOnMessageQueue(const RoutableMessageHeader &header) {
+    return header.has_reply_id() || header.destination_port() == 0 || header.destination_port() == Services::PERSISTENCE;
+}
+
 void HostedObject::sendViaSpace(const RoutableMessageHeader &hdrOrig, MemoryReference body) {
     ///// MessageService::processMessage
     assert(hdrOrig.has_destination_object());
@@ -874,7 +923,13 @@ void HostedObject::sendViaSpace(const RoutableMessageHeader &hdrOrig, MemoryRefe
         hdr.clear_source_object();
         String serialized_header;
         hdr.SerializeToString(&serialized_header);
-        where->second.mSpaceConnection.getStream()->send(MemoryReference(serialized_header),body, Network::ReliableOrdered);
+        MessageBatcher *batcher = where->second.mSpaceConnection.getTopLevelStream()->getBatcher();
+        if (batcher) {
+            batcher->send(where->second.mSpaceConnection.getStream(), hdr.destination_port(),
+                          MemoryReference(serialized_header), body);
+        } else {
+            where->second.mSpaceConnection.getStream()->send(MemoryReference(serialized_header),body, Network::ReliableOrdered);
+        }
     }
     assert(where!=mSpaceData->end());
 }
@@ -902,11 +957,8 @@ void HostedObject::send(const RoutableMessageHeader &hdrOrig, MemoryReference bo
 }
 
 void HostedObject::tick() {
-    for (SpaceDataMap::iterator iter = mSpaceData->begin(); iter != mSpaceData->end(); ++iter) {
-        // send update to LOC (2) service in the space, if necessary
-        iter->second.updateLocation(this);
-        // Is it useful to call every script's tick() function?
-    }
+    // Updates to the LOC (2) service are batched across all objects by ObjectHost::tick in its DeadReckoningTables.
+    // Is it useful to call every script's tick() function?
 }
 
 void HostedObject::receivedPositionUpdate(
@@ -1043,7 +1095,7 @@ void HostedObject::processRPC(const RoutableMessageHeader &msg, const std::strin
             perSpaceIter->second.mProxyObject = proxyObj;
             proxyMgr->registerHostedObject(objectId.object(), getSharedPtr());
             receivedPositionUpdate(proxyObj, retObj.location(), true);
-            perSpaceIter->second.locationWasReset(retObj.location().timestamp(), proxyObj->getLastLocation());
+            perSpaceIter->second.locationWasReset(this, msg.source_space(), retObj.location().timestamp(), proxyObj->getLastLocation());
             if (proxyMgr) {
                 proxyMgr->createObject(proxyObj);
                 ProxyCameraObject* cam = dynamic_cast<ProxyCameraObject*>(proxyObj.get());
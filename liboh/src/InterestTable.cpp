@@ -0,0 +1,159 @@
+/*  Sirikata liboh -- Object Host
+ *  InterestTable.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <ObjectHost_Sirikata.pbj.hpp>
+#include "util/RoutableMessageBody.hpp"
+#include "util/SentMessage.hpp"
+#include "oh/HostedObject.hpp"
+#include "oh/InterestTable.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+
+namespace {
+///Proxies this many times smaller than fullRateSize stop asking for orientation and rotation
+const float64 sPositionOnlyFactor=8.0;
+}
+
+class InterestTable::UniqueLock :public boost::mutex {
+};
+
+InterestTable::InterestTable(const SpaceID&space)
+ : mSpace(space),
+   mFullRateSize(.05),
+   mFalloff(Duration::seconds(.1)),
+   mMaxInterval(Duration::seconds(2.0)),
+   mLock(new UniqueLock),
+   mUpdates(0),
+   mBytes(0),
+   mErrorSum(0),
+   mMaxError(0) {
+}
+
+InterestTable::~InterestTable() {
+    SILOG(objecthost,info,"Interest table for space "<<mSpace<<" received "<<mUpdates<<" position updates ("<<mBytes
+          <<" bytes), mean angular error "<<getMeanAngularError()<<", max "<<mMaxError);
+    for (WaitingMap::iterator iter=mWaiting.begin();iter!=mWaiting.end();++iter) {
+        // a dead owner took the request's QueryTracker with it, which leaks it like any other outstanding query
+        if (!iter->second.first.expired()) {
+            delete iter->second.second;
+        }
+    }
+    delete mLock;
+}
+
+void InterestTable::setPolicy(float64 fullRateSize, const Duration&falloff, const Duration&maxInterval) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    mFullRateSize=fullRateSize;
+    mFalloff=falloff;
+    mMaxInterval=maxInterval;
+}
+
+Duration InterestTable::updateInterval(const Location&viewer, const Location&target, float64 radius, uint32*fields)const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    *fields=0;
+    float64 distance=(target.getPosition()-viewer.getPosition()).length();
+    if (mFullRateSize<=0||radius>=distance*mFullRateSize) {
+        return Duration::seconds(0.0);
+    }
+    float64 smaller=distance*mFullRateSize/radius;
+    if (smaller>=sPositionOnlyFactor) {
+        *fields=Protocol::LocRequest::POSITION|Protocol::LocRequest::VELOCITY;
+    }
+    float64 seconds=mFalloff.toSeconds()*(smaller-1.0);
+    if (seconds>mMaxInterval.toSeconds()) {
+        return mMaxInterval;
+    }
+    return Duration::seconds(seconds);
+}
+
+void InterestTable::schedule(const std::tr1::weak_ptr<HostedObject>&owner, Request*request, const Time&due) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    mWaiting.insert(WaitingMap::value_type(due,Waiting(owner,request)));
+}
+
+void InterestTable::recordUpdate(float64 angularError, size_t bytes) {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    ++mUpdates;
+    mBytes+=bytes;
+    mErrorSum+=angularError;
+    if (angularError>mMaxError) {
+        mMaxError=angularError;
+    }
+}
+
+void InterestTable::tick(const Time&now) {
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        WaitingMap::iterator end=mWaiting.upper_bound(now);
+        for (WaitingMap::iterator iter=mWaiting.begin();iter!=end;++iter) {
+            mDue.push_back(iter->second);
+        }
+        mWaiting.erase(mWaiting.begin(),end);
+        // the owner's QueryTracker died with it, so its request can only be dropped, like any other outstanding query
+        for (WaitingMap::iterator iter=mWaiting.begin();iter!=mWaiting.end();) {
+            if (iter->second.first.expired()) {
+                mWaiting.erase(iter++);
+            } else {
+                ++iter;
+            }
+        }
+    }
+    // sent without the lock, since an answer may come back and schedule itself again on another thread
+    for (std::vector<Waiting>::iterator iter=mDue.begin();iter!=mDue.end();++iter) {
+        std::tr1::shared_ptr<HostedObject> owner(iter->first.lock());
+        if (owner) {
+            iter->second->serializeSend();
+        }
+    }
+    mDue.clear();
+}
+
+uint64 InterestTable::getUpdatesReceived()const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    return mUpdates;
+}
+uint64 InterestTable::getBytesReceived()const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    return mBytes;
+}
+float64 InterestTable::getMeanAngularError()const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    return mUpdates?mErrorSum/mUpdates:0;
+}
+float64 InterestTable::getMaxAngularError()const {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    return mMaxError;
+}
+
+}
@@ -0,0 +1,137 @@
+/*  Sirikata liboh -- Object Host
+ *  Mailbox.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include "oh/Mailbox.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+
+class EnvelopePool::UniqueLock :public boost::mutex {
+};
+class Mailbox::UniqueLock :public boost::mutex {
+};
+
+EnvelopePool::EnvelopePool(size_t maxFree)
+ : mLock(new UniqueLock),mFree(NULL),mNumFree(0),mMaxFree(maxFree) {
+}
+EnvelopePool::~EnvelopePool() {
+    while (mFree) {
+        Envelope *next=mFree->mNext;
+        delete mFree;
+        mFree=next;
+    }
+    delete mLock;
+}
+Envelope *EnvelopePool::allocate(ObjectHost *parent, const RoutableMessageHeader&header, MemoryReference body) {
+    Envelope *retval=NULL;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        if (mFree) {
+            retval=mFree;
+            mFree=retval->mNext;
+            --mNumFree;
+        }
+    }
+    if (!retval) {
+        retval=new Envelope;
+    }
+    retval->mParent=parent;
+    retval->mNext=NULL;
+    retval->mHeader=header;
+    retval->mBody.assign((const char*)body.begin(),(const char*)body.end());
+    return retval;
+}
+void EnvelopePool::release(Envelope *envelope) {
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        if (mNumFree<mMaxFree) {
+            envelope->mNext=mFree;
+            mFree=envelope;
+            ++mNumFree;
+            return;
+        }
+    }
+    delete envelope;
+}
+
+Mailbox::Mailbox()
+ : mLock(new UniqueLock),mHead(NULL),mTail(NULL),mScheduled(false) {
+}
+Mailbox::~Mailbox() {
+    assert(mHead==NULL&&"Mailbox must be cleared into its pool before destruction");
+    delete mLock;
+}
+bool Mailbox::push(Envelope *envelope) {
+    envelope->mNext=NULL;
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    if (mTail) {
+        mTail->mNext=envelope;
+    }else {
+        mHead=envelope;
+    }
+    mTail=envelope;
+    if (mScheduled) {
+        return false;
+    }
+    mScheduled=true;
+    return true;
+}
+Envelope *Mailbox::pop() {
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    Envelope *retval=mHead;
+    if (retval) {
+        mHead=retval->mNext;
+        if (!mHead) {
+            mTail=NULL;
+        }
+        retval->mNext=NULL;
+    }else {
+        mScheduled=false;
+    }
+    return retval;
+}
+void Mailbox::clear(EnvelopePool &pool) {
+    Envelope *head;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        head=mHead;
+        mHead=mTail=NULL;
+    }
+    while (head) {
+        Envelope *next=head->mNext;
+        pool.release(head);
+        head=next;
+    }
+}
+
+}
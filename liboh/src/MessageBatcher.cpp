@@ -0,0 +1,156 @@
+/*  Sirikata liboh -- Object Host
+ *  MessageBatcher.cpp
+ *
+ *  Copyright (c) 2009, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <oh/Platform.hpp>
+#include <network/Stream.hpp>
+#include <task/WorkQueue.hpp>
+#include "util/RoutableMessageHeader.hpp"
+#include "util/KnownServices.hpp"
+#include "oh/MessageBatcher.hpp"
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+
+class MessageBatcher::UniqueLock :public boost::mutex {
+};
+
+class MessageBatcher::FlushItem : public Task::WorkItem {
+    std::tr1::weak_ptr<MessageBatcher> mBatcher;
+public:
+    FlushItem(const std::tr1::weak_ptr<MessageBatcher> &batcher) : mBatcher(batcher) {
+    }
+    void operator() () {
+        std::tr1::shared_ptr<MessageBatcher> batcher(mBatcher.lock());
+        delete this;
+        if (batcher) {
+            batcher->flush();
+        }
+    }
+};
+
+MessageBatcher::MessageBatcher(Task::WorkQueue *flushQueue)
+ : mFlushQueue(flushQueue),
+   mLock(new UniqueLock),
+   mFlushScheduled(false),
+   mMessagesQueued(0),
+   mWritesSent(0) {
+    RoutableMessageHeader hdr;
+    hdr.set_destination_object(ObjectReference::spaceServiceID());
+    hdr.set_destination_port(Services::MESSAGE_BATCH);
+    hdr.SerializeToString(&mBatchHeader);
+}
+
+MessageBatcher::~MessageBatcher() {
+    flush();
+    SILOG(objecthost,debug,"Message batcher sent "<<mMessagesQueued<<" messages in "<<mWritesSent<<" writes");
+    delete mLock;
+}
+
+bool MessageBatcher::bypassesBatch(MessagePort port) {
+    // time probes measure round trips, so holding them until a flush would skew the clock offset
+    return port == Services::TIMESYNC;
+}
+
+void MessageBatcher::send(Network::Stream *stream, MessagePort port, MemoryReference header, MemoryReference body) {
+    bool scheduleFlush = false;
+    {
+        boost::lock_guard<boost::mutex> lok(*mLock);
+        ++mMessagesQueued;
+        if (bypassesBatch(port)) {
+            // keep the stream's order: whatever it queued earlier goes first
+            PendingMap::iterator where = mPending.find(stream);
+            if (where != mPending.end()) {
+                flushStream(where);
+            }
+            stream->send(header, body, Network::ReliableOrdered);
+            ++mWritesSent;
+            return;
+        }
+        Pending &pending = mPending[stream];
+        uint8 lengthBuffer[vuint32::MAX_SERIALIZED_LENGTH];
+        unsigned int lengthSize = vuint32(header.size() + body.size()).serialize(lengthBuffer, sizeof(lengthBuffer));
+        if (pending.mCount == 0) {
+            pending.mFirstLength = lengthSize;
+            mDirty.push_back(stream);
+        }
+        pending.mRecords.append(reinterpret_cast<const char*>(lengthBuffer), lengthSize);
+        pending.mRecords.append(static_cast<const char*>(header.data()), header.size());
+        pending.mRecords.append(static_cast<const char*>(body.data()), body.size());
+        ++pending.mCount;
+        if (!mFlushScheduled) {
+            mFlushScheduled = true;
+            scheduleFlush = true;
+        }
+    }
+    if (scheduleFlush) {
+        mFlushQueue->enqueue(new FlushItem(getWeakPtr()));
+    }
+}
+
+void MessageBatcher::flushStream(PendingMap::iterator where) {
+    Network::Stream *stream = where->first;
+    Pending &pending = where->second;
+    if (pending.mCount == 1) {
+        // nothing to coalesce, so send it as a plain message without the frame
+        stream->send(MemoryReference(pending.mRecords.data() + pending.mFirstLength,
+                                     pending.mRecords.size() - pending.mFirstLength),
+                     Network::ReliableOrdered);
+    } else {
+        stream->send(MemoryReference(mBatchHeader), MemoryReference(pending.mRecords), Network::ReliableOrdered);
+    }
+    ++mWritesSent;
+    mPending.erase(where);
+}
+
+void MessageBatcher::flush() {
+    // streams copy what they are sent, so sending under the lock keeps each stream's order across threads
+    boost::lock_guard<boost::mutex> lok(*mLock);
+    mFlushScheduled = false;
+    for (std::vector<Network::Stream*>::iterator iter = mDirty.begin(); iter != mDirty.end(); ++iter) {
+        // a stream whose queue a bypassing message already sent may be listed more than once
+        PendingMap::iterator where = mPending.find(*iter);
+        if (where != mPending.end()) {
+            flushStream(where);
+        }
+    }
+    mDirty.resize(0);
+}
+
+uint64 MessageBatcher::getMessagesQueued() const {
+    return mMessagesQueued;
+}
+
+uint64 MessageBatcher::getWritesSent() const {
+    return mWritesSent;
+}
+
+}
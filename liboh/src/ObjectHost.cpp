@@ -38,9 +38,14 @@
 #include <network/IOServiceFactory.hpp>
 #include <util/AtomicTypes.hpp>
 #include <util/RoutableMessageHeader.hpp>
+#include <util/ThreadSafeQueue.hpp>
 #include <task/WorkQueue.hpp>
 #include "graphics/GraphicsObject.hpp"
 #include "oh/TopLevelSpaceConnection.hpp"
+#include "oh/DeadReckoningTable.hpp"
+#include "oh/InterestTable.hpp"
+#include "oh/MessageBatcher.hpp"
+#include "oh/Mailbox.hpp"
 #include "oh/ObjectScriptManager.hpp"
 #include "oh/ObjectScript.hpp"
 #include "oh/ObjectScriptManagerFactory.hpp"
@@ -48,6 +53,9 @@
 
 namespace Sirikata {
 
+class ObjectHost::UniqueLock :public boost::recursive_mutex {
+};
+
 struct ObjectHost::AtomicInt : public AtomicValue<int> {
     ObjectHost::AtomicInt*mNext;
     AtomicInt(int val, std::auto_ptr<AtomicInt>&genq) : AtomicValue<int>(val) {mNext=genq.release();}
@@ -56,7 +64,11 @@ struct ObjectHost::AtomicInt : public AtomicValue<int> {
             delete mNext;
     }
 };
-ObjectHost::ObjectHost(SpaceIDMap *spaceMap, Task::WorkQueue *messageQueue, Network::IOService *ioServ) {
+ObjectHost::ObjectHost(SpaceIDMap *spaceMap, Task::WorkQueue *messageQueue, Network::IOService *ioServ)
+ : mInterestFullRateSize(.05),
+   mInterestFalloff(Duration::seconds(.1)),
+   mInterestMaxInterval(Duration::seconds(2.0)) {
+    mLock = new UniqueLock;
     mSpaceIDMap = spaceMap;
     mMessageQueue = messageQueue;
     mSpaceConnectionIO=ioServ;
@@ -64,6 +76,7 @@ ObjectHost::ObjectHost(SpaceIDMap *spaceMap, Task::WorkQueue *messageQueue, Netw
     mEnqueuers = new AtomicInt(0,gEnqueuers);
     std::auto_ptr<AtomicInt> tmp(mEnqueuers);
     gEnqueuers=tmp;
+    mEnvelopes = new EnvelopePool;
 }
 
 ObjectHost::~ObjectHost() {
@@ -76,102 +89,206 @@ ObjectHost::~ObjectHost() {
         // silently wait for everyone to finish adding themselves.
     }
     queue->dequeueAll(); // filter through everything that might have an ObjectHost message in it.
+    setMailboxThreads(0);
     {
         HostedObjectMap objs;
-        mHostedObjects.swap(objs);
+        {
+            boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+            mHostedObjects.swap(objs);
+        }
         objs.clear(); // The HostedObject destructor will attempt to delete from mHostedObjects
     }
-}
-
-class ObjectHost::MessageProcessor : public Task::WorkItem {
-    ObjectHost *parent;
-    RoutableMessageHeader header;
-    std::string body;
-public:
-    MessageProcessor(ObjectHost *parent,
-                     const RoutableMessageHeader&header,
-                     MemoryReference message_body)
-        : parent(parent), header(header), body((char*)message_body.begin(), (char*)message_body.end()) {
+    {
+        boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+        mDeadReckoning.clear(); // rows of HostedObjects still alive see their table expire and skip removing themselves
     }
-    ~MessageProcessor() {
+    for (InterestMap::iterator iter = mInterest.begin(); iter != mInterest.end(); ++iter) {
+        delete iter->second;
     }
+    delete mEnvelopes;
+    delete mLock;
+}
 
-    void operator() () {
-        AutoPtr delete_me(this);
-
-        if (!header.has_destination_space() || header.destination_space() == SpaceID::null()) {
-            header.set_source_space(SpaceID::null());
-            ReturnStatus status = RoutableMessageHeader::SUCCESS;
-            if (header.destination_object() == ObjectReference::spaceServiceID()) {
-                MessageService *destService = parent->getService(header.destination_port());
-                if (destService) {
-                    destService->processMessage(header, MemoryReference(body));
-                    return;
+void Envelope::operator() () {
+    ObjectHost *parent = mParent;
+    RoutableMessageHeader &header = mHeader;
+    if (!header.has_destination_space() || header.destination_space() == SpaceID::null()) {
+        header.set_source_space(SpaceID::null());
+        ReturnStatus status = RoutableMessageHeader::SUCCESS;
+        if (header.destination_object() == ObjectReference::spaceServiceID()) {
+            MessageService *destService = parent->getService(header.destination_port());
+            if (destService) {
+                destService->processMessage(header, MemoryReference(mBody));
+                parent->mEnvelopes->release(this);
+                return;
+            }
+            status = RoutableMessageHeader::PORT_FAILURE;
+        } else {
+            HostedObjectPtr dest = parent->getHostedObject(header.destination_object().getAsUUID());
+            if (dest) {
+                parent->deliver(dest, this);
+                return;
+            }
+            status = RoutableMessageHeader::UNKNOWN_OBJECT;
+        }
+        if (status) {
+            RoutableMessageHeader response(header);
+            response.swap_source_and_destination();
+            response.set_return_status(status);
+            if (header.source_object() == ObjectReference::spaceServiceID()) {
+                MessageService *srcService = parent->getService(header.destination_port());
+                if (srcService) {
+                    srcService->processMessage(response, MemoryReference::null());
+                } else {
+                    // Neither source service nor destination exist.
                 }
-                status = RoutableMessageHeader::PORT_FAILURE;
             } else {
-                HostedObjectPtr dest = parent->getHostedObject(header.destination_object().getAsUUID());
-                if (dest) {
-                    dest->processRoutableMessage(header, MemoryReference(body));
-                    return;
-                }
-                status = RoutableMessageHeader::UNKNOWN_OBJECT;
-            }
-            if (status) {
-                RoutableMessageHeader response(header);
-                response.swap_source_and_destination();
-                response.set_return_status(status);
-                if (header.source_object() == ObjectReference::spaceServiceID()) {
-                    MessageService *srcService = parent->getService(header.destination_port());
-                    if (srcService) {
-                        srcService->processMessage(response, MemoryReference::null());
-                    } else {
-                        // Neither source service nor destination exist.
-                    }
+                HostedObjectPtr src = parent->getHostedObject(header.source_object().getAsUUID());
+                if (src) {
+                    parent->deliver(src, parent->mEnvelopes->allocate(parent, response, MemoryReference::null()));
                 } else {
-                    HostedObjectPtr src = parent->getHostedObject(header.source_object().getAsUUID());
-                    if (src) {
-                        src->processRoutableMessage(response, MemoryReference::null());
-                    } else {
-                        // Neither source object nor destination exist.
-                    }
+                    // Neither source object nor destination exist.
                 }
             }
-        } else {
-            std::tr1::shared_ptr<TopLevelSpaceConnection> tlsc;
-            SpaceConnectionMap::iterator iter = parent->mSpaceConnections.find(header.destination_space());
+        }
+    } else {
+        std::tr1::shared_ptr<TopLevelSpaceConnection> tlsc;
+        {
+            boost::recursive_mutex::scoped_lock uniqMap(*parent->mLock);
+            ObjectHost::SpaceConnectionMap::iterator iter = parent->mSpaceConnections.find(header.destination_space());
             if (iter != parent->mSpaceConnections.end()) {
                 tlsc = iter->second.lock();
             }
-            HostedObjectPtr dest;
-            if (!tlsc) {
-                SILOG(cppoh, error, "Invalid destination space in ObjectHost::processMessage");
-                // ERROR: the space does not exist on this OH.
-                assert(tlsc);
-                return;
-            }
-            if (header.destination_object() != ObjectReference::spaceServiceID()) {
-                dest = tlsc->getHostedObject(header.destination_object());
+        }
+        HostedObjectPtr dest;
+        if (!tlsc) {
+            SILOG(cppoh, error, "Invalid destination space in ObjectHost::processMessage");
+            // ERROR: the space does not exist on this OH.
+            assert(tlsc);
+            parent->mEnvelopes->release(this);
+            return;
+        }
+        if (header.destination_object() != ObjectReference::spaceServiceID()) {
+            dest = tlsc->getHostedObject(header.destination_object());
+        }
+        if (dest) {
+            header.set_source_space(header.destination_space());
+            parent->deliver(dest, this);
+            return;
+        } else {
+            HostedObjectPtr src;
+            if (tlsc) {
+                src = tlsc->getHostedObject(header.source_object());
             }
-            if (dest) {
-                header.set_source_space(header.destination_space());
-                dest->processRoutableMessage(header, MemoryReference(body));
+            if (src) {
+                src->sendViaSpace(header, MemoryReference(mBody));
             } else {
-                HostedObjectPtr src;
-                if (tlsc) {
-                    src = tlsc->getHostedObject(header.source_object());
-                }
-                if (src) {
-                    src->sendViaSpace(header, MemoryReference(body));
-                } else {
-                    // ERROR: neither sender nor receiver exist on this OH...
-                    return;
-                }
+                // ERROR: neither sender nor receiver exist on this OH...
+            }
+        }
+    }
+    parent->mEnvelopes->release(this);
+}
+
+/**
+ * Runs one HostedObject's mailbox on the worker thread its UUID is pinned to. When the next message
+ * must be handled on the message queue's thread, the drain moves there with it and comes back for the
+ * next one, so the object's messages keep their order and never run on two threads at once.
+ */
+class ObjectHost::MailboxDrain : public Task::WorkItem {
+    ObjectHost *mParent;
+    HostedObjectWPtr mObject;
+    Task::WorkQueue *mQueue;    ///< the queue running this drain, or NULL if it runs inline
+    Envelope *mHeld;            ///< taken from the mailbox and waiting for the queue it moved to
+public:
+    MailboxDrain(ObjectHost *parent, const HostedObjectPtr &object, Task::WorkQueue *queue)
+        : mParent(parent), mObject(object), mQueue(queue), mHeld(NULL) {
+    }
+    void operator() () {
+        HostedObjectPtr object(mObject.lock());
+        if (!object) {
+            // ~HostedObject already returned the waiting envelopes
+            if (mHeld) {
+                mParent->mEnvelopes->release(mHeld);
             }
+            delete this;
+            return;
         }
+        // Bound each turn so one busy object cannot starve the others pinned to this thread.
+        for (int i = 0; !mQueue || i < 64; ++i) {
+            Envelope *envelope = mHeld ? mHeld : object->mMailbox.pop();
+            mHeld = NULL;
+            if (!envelope) {
+                delete this;
+                return;
+            }
+            Task::WorkQueue *queue = mParent->handlerQueue(object, envelope);
+            if (queue && queue != mQueue) {
+                mHeld = envelope;
+                mQueue = queue;
+                queue->enqueue(this);
+                return;
+            }
+            object->processRoutableMessage(envelope->mHeader, MemoryReference(envelope->mBody));
+            mParent->mEnvelopes->release(envelope);
+        }
+        mQueue->enqueue(this);
     }
 };
 
+Task::WorkQueue *ObjectHost::handlerQueue(const HostedObjectPtr &dest, const Envelope *envelope) const {
+    if (mMailboxQueues.empty()) {
+        return NULL;
+    }
+    if (HostedObject::handledOnMessageQueue(envelope->mHeader)) {
+        return mMessageQueue;
+    }
+    return mMailboxQueues[UUID::Hasher()(dest->getUUID()) % mMailboxQueues.size()];
+}
+
+void ObjectHost::deliver(const HostedObjectPtr &dest, Envelope *envelope) {
+    if (mMailboxQueues.empty()) {
+        dest->processRoutableMessage(envelope->mHeader, MemoryReference(envelope->mBody));
+        mEnvelopes->release(envelope);
+        return;
+    }
+    if (dest->mMailbox.push(envelope)) {
+        Task::WorkQueue *queue = handlerQueue(dest, envelope);
+        MailboxDrain *drain = new MailboxDrain(this, dest, queue);
+        if (queue) {
+            queue->enqueue(drain);
+        } else {
+            (*drain)(); // the message queue is shutting down
+        }
+    }
+}
+
+void ObjectHost::deliver(const HostedObjectPtr &dest, const RoutableMessageHeader &header, MemoryReference body) {
+    deliver(dest, mEnvelopes->allocate(this, header, body));
+}
+
+void ObjectHost::releaseMailbox(Mailbox &mailbox) {
+    mailbox.clear(*mEnvelopes);
+}
+
+void ObjectHost::setMailboxThreads(int numThreads) {
+    for (size_t i = 0; i < mMailboxQueues.size(); ++i) {
+        mMailboxQueues[i]->destroyWorkerThreads(mMailboxThreads[i]);
+    }
+    for (size_t i = 0; i < mMailboxQueues.size(); ++i) {
+        while (mMailboxQueues[i]->dequeuePoll()) {
+            // finish the remaining drains on this thread, which also keeps each object's order
+        }
+        delete mMailboxQueues[i];
+    }
+    mMailboxQueues.clear();
+    mMailboxThreads.clear();
+    for (int i = 0; i < numThreads; ++i) {
+        mMailboxQueues.push_back(new Task::ThreadSafeWorkQueue);
+        mMailboxThreads.push_back(mMailboxQueues.back()->createWorkerThreads(1));
+    }
+}
+
 void ObjectHost::processMessage(const RoutableMessageHeader&header, MemoryReference message_body) {
     assert(header.has_destination_object());
     assert(header.has_source_object());
@@ -179,22 +296,27 @@ void ObjectHost::processMessage(const RoutableMessageHeader&header, MemoryRefere
     if (++mEnqueuers>0) {
         Task::WorkQueue *queue = mMessageQueue;
         if (queue) {
-            queue->enqueue(new MessageProcessor(this, header, message_body));
+            queue->enqueue(mEnvelopes->allocate(this, header, message_body));
         }
     }
     --mEnqueuers;
 }
 
 void ObjectHost::registerHostedObject(const HostedObjectPtr &obj) {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     mHostedObjects.insert(HostedObjectMap::value_type(obj->getUUID(), obj));
 }
 void ObjectHost::unregisterHostedObject(const UUID &objID) {
+    HostedObjectPtr last; // released after the lock so that a dying object never runs its destructor under it
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     HostedObjectMap::iterator iter = mHostedObjects.find(objID);
     if (iter != mHostedObjects.end()) {
+        last = iter->second;
         mHostedObjects.erase(iter);
     }
 }
 HostedObjectPtr ObjectHost::getHostedObject(const UUID &id) const {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     HostedObjectMap::const_iterator iter = mHostedObjects.find(id);
     if (iter != mHostedObjects.end()) {
 //        HostedObjectPtr obj(iter->second.lock());
@@ -206,17 +328,14 @@ HostedObjectPtr ObjectHost::getHostedObject(const UUID &id) const {
 }
 
 
-namespace{
-    boost::recursive_mutex gSpaceConnectionMapLock;
-}
 void ObjectHost::insertAddressMapping(const Network::Address&addy, const std::tr1::weak_ptr<TopLevelSpaceConnection>&val){
-    boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     mAddressConnections[addy]=val;
 }
 std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpace(const SpaceID&id){
     std::tr1::shared_ptr<TopLevelSpaceConnection> retval;
     {
-        boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+        boost::recursive_mutex::scoped_lock uniqMap(*mLock);
         SpaceConnectionMap::iterator where=mSpaceConnections.find(id);
         if ((where==mSpaceConnections.end())||((retval=where->second.lock())==NULL)) {
             std::tr1::shared_ptr<TopLevelSpaceConnection> temp(new TopLevelSpaceConnection(mSpaceConnectionIO));
@@ -237,7 +356,7 @@ std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpace(const S
 std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpaceAddress(const SpaceID&id, const Network::Address&addy){
     std::tr1::shared_ptr<TopLevelSpaceConnection> retval;
     {
-        boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+        boost::recursive_mutex::scoped_lock uniqMap(*mLock);
         AddressConnectionMap::iterator where=mAddressConnections.find(addy);
         if ((where==mAddressConnections.end())||(!(retval=where->second.lock()))) {
             std::tr1::shared_ptr<TopLevelSpaceConnection> temp(new TopLevelSpaceConnection(mSpaceConnectionIO));
@@ -257,7 +376,7 @@ std::tr1::shared_ptr<TopLevelSpaceConnection> ObjectHost::connectToSpaceAddress(
 
 
 void ObjectHost::removeTopLevelSpaceConnection(const SpaceID&id, const Network::Address& addy,const TopLevelSpaceConnection*example){
-    boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);    
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);    
     {
         SpaceConnectionMap::iterator where=mSpaceConnections.find(id);
         for(;where!=mSpaceConnections.end()&&where->first==id;) {
@@ -286,12 +405,73 @@ void ObjectHost::removeTopLevelSpaceConnection(const SpaceID&id, const Network::
 }
 
 void ObjectHost::tick() {
-    for (HostedObjectMap::iterator iter = mHostedObjects.begin(); iter != mHostedObjects.end(); ++iter) {
-        iter->second->tick();
+    std::vector<std::tr1::shared_ptr<DeadReckoningTable> > deadReckoning;
+    std::vector<InterestTable*> interest;
+    std::vector<std::tr1::shared_ptr<TopLevelSpaceConnection> > connections;
+    {
+        boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+        for (DeadReckoningMap::iterator iter = mDeadReckoning.begin(); iter != mDeadReckoning.end(); ++iter) {
+            deadReckoning.push_back(iter->second);
+        }
+        for (InterestMap::iterator iter = mInterest.begin(); iter != mInterest.end(); ++iter) {
+            interest.push_back(iter->second);
+        }
+        for (SpaceConnectionMap::iterator iter = mSpaceConnections.begin(); iter != mSpaceConnections.end(); ++iter) {
+            std::tr1::shared_ptr<TopLevelSpaceConnection> connection(iter->second.lock());
+            if (connection) {
+                connections.push_back(connection);
+            }
+        }
+    }
+    // the tables lock themselves, so mailbox threads may add and remove rows while they send
+    for (std::vector<std::tr1::shared_ptr<DeadReckoningTable> >::iterator iter = deadReckoning.begin(); iter != deadReckoning.end(); ++iter) {
+        (*iter)->tick(Time::now(getSpaceTimeOffset((*iter)->space())));
+    }
+    // tables live until the ObjectHost dies; ticking them unlocked lets answers look their table up again
+    for (std::vector<InterestTable*>::iterator iter = interest.begin(); iter != interest.end(); ++iter) {
+        (*iter)->tick(Time::now(getSpaceTimeOffset((*iter)->space())));
+    }
+    // everything this tick queued goes out now, one write per object stream
+    for (std::vector<std::tr1::shared_ptr<TopLevelSpaceConnection> >::iterator iter = connections.begin(); iter != connections.end(); ++iter) {
+        if ((*iter)->getBatcher()) {
+            (*iter)->getBatcher()->flush();
+        }
+    }
+}
+
+InterestTable *ObjectHost::getInterestTable(const SpaceID&space) {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+    InterestMap::iterator where = mInterest.find(space);
+    if (where == mInterest.end()) {
+        InterestTable *table = new InterestTable(space);
+        table->setPolicy(mInterestFullRateSize, mInterestFalloff, mInterestMaxInterval);
+        where = mInterest.insert(InterestMap::value_type(space, table)).first;
+    }
+    return where->second;
+}
+
+void ObjectHost::setInterestPolicy(float64 fullRateSize, const Duration&falloff, const Duration&maxInterval) {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+    mInterestFullRateSize = fullRateSize;
+    mInterestFalloff = falloff;
+    mInterestMaxInterval = maxInterval;
+    for (InterestMap::iterator iter = mInterest.begin(); iter != mInterest.end(); ++iter) {
+        iter->second->setPolicy(fullRateSize, falloff, maxInterval);
+    }
+}
+
+std::tr1::shared_ptr<DeadReckoningTable> ObjectHost::getDeadReckoningTable(const SpaceID&space) {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
+    DeadReckoningMap::iterator where = mDeadReckoning.find(space);
+    if (where == mDeadReckoning.end()) {
+        std::tr1::shared_ptr<DeadReckoningTable> table(new DeadReckoningTable(space));
+        where = mDeadReckoning.insert(DeadReckoningMap::value_type(space, table)).first;
     }
+    return where->second;
 }
 
 const Duration&ObjectHost::getSpaceTimeOffset(const SpaceID&id)const{
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     SpaceConnectionMap::const_iterator where=mSpaceConnections.find(id);
     if (where!=mSpaceConnections.end()) {
         std::tr1::shared_ptr<TopLevelSpaceConnection> topLevelConnection=where->second.lock();
@@ -303,7 +483,7 @@ const Duration&ObjectHost::getSpaceTimeOffset(const SpaceID&id)const{
     return nil;
 }
 const Duration&ObjectHost::getSpaceTimeOffset(const Network::Address&id)const{
-    boost::recursive_mutex::scoped_lock uniqMap(gSpaceConnectionMapLock);
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     AddressConnectionMap::const_iterator where=mAddressConnections.find(id);
     if (where!=mAddressConnections.end()) {
         std::tr1::shared_ptr<TopLevelSpaceConnection> topLevelConnection=where->second.lock();
@@ -315,6 +495,7 @@ const Duration&ObjectHost::getSpaceTimeOffset(const Network::Address&id)const{
     return nil;
 }
 ProxyManager *ObjectHost::getProxyManager(const SpaceID&space) const {
+    boost::recursive_mutex::scoped_lock uniqMap(*mLock);
     SpaceConnectionMap::const_iterator iter = mSpaceConnections.find(space);
     if (iter != mSpaceConnections.end()) {
         std::tr1::shared_ptr<TopLevelSpaceConnection> spaceConnPtr = iter->second.lock();
@@ -119,9 +119,45 @@ void ProxyObject::setLocation(TemporalValue<Location>::Time timeStamp,
                               const Location&location) {
     mLocation.updateValue(timeStamp,
                           location);
+    if (mLocationAuthority) {
+        mLocationAuthority->locationChanged(timeStamp, location);
+    }
     PositionProvider::notify(&PositionListener::updateLocation, timeStamp, location);
 }
 
+namespace {
+/// Iterates over the proxies of a LocationUpdateVector for PositionProvider::notifyEach.
+class UpdatedProxyIterator {
+    ProxyObject::LocationUpdateVector::const_iterator mIter;
+public:
+    UpdatedProxyIterator(const ProxyObject::LocationUpdateVector::const_iterator &iter):mIter(iter){}
+    ProxyObject *operator*() const {
+        return mIter->mProxy;
+    }
+    UpdatedProxyIterator &operator++() {
+        ++mIter;
+        return *this;
+    }
+    bool operator!=(const UpdatedProxyIterator &other) const {
+        return mIter!=other.mIter;
+    }
+};
+/// Passes a proxy's last location update on to one of its listeners.
+struct UpdatedLocationCall {
+    void operator()(const ProxyObject &proxy, PositionListener *listener) const {
+        listener->updateLocation(proxy.getLastUpdated(), proxy.getLastLocation());
+    }
+};
+}
+
+void ProxyObject::setLocations(const LocationUpdateVector &updates) {
+    for (LocationUpdateVector::const_iterator iter=updates.begin(),end=updates.end();iter!=end;++iter) {
+        iter->mProxy->mLocation.updateValue(iter->mTime, iter->mLocation);
+    }
+    UpdatedLocationCall call;
+    PositionProvider::notifyEach(UpdatedProxyIterator(updates.begin()), UpdatedProxyIterator(updates.end()), call);
+}
+
 void ProxyObject::updateLocationWithObjLoc(
         Location & loc,
         const Protocol::ObjLoc& reqLoc)
@@ -158,6 +194,9 @@ void ProxyObject::resetLocation(TemporalValue<Location>::Time timeStamp,
                                 const Location&location) {
     mLocation.resetValue(timeStamp,
                          location);
+    if (mLocationAuthority) {
+        mLocationAuthority->locationChanged(timeStamp, location);
+    }
     PositionProvider::notify(&PositionListener::resetLocation, timeStamp, location);
 }
 void ProxyObject::setParent(const ProxyObjectPtr &parent,
@@ -206,6 +245,9 @@ void ProxyObject::setParent(const ProxyObjectPtr &parent,
     */
     mLocation.resetValue(timeStamp, lastPosition.toLocal(newparentLastGlobal));
     mLocation.updateValue(timeStamp, relLocation);
+    if (mLocationAuthority) {
+        mLocationAuthority->locationChanged(timeStamp, relLocation);
+    }
 
     PositionProvider::notify(&PositionListener::setParent,
                              parent,
@@ -231,6 +273,9 @@ void ProxyObject::unsetParent(TemporalValue<Location>::Time timeStamp,
 
     mLocation.resetValue(timeStamp, lastPosition);
     mLocation.updateValue(timeStamp, absLocation);
+    if (mLocationAuthority) {
+        mLocationAuthority->locationChanged(timeStamp, absLocation);
+    }
 
     PositionProvider::notify(&PositionListener::unsetParent,
                              timeStamp,
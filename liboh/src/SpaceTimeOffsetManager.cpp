@@ -18,6 +18,7 @@ namespace {
 SharedMutex sSpaceIdDurationMutex;
 std::tr1::unordered_map<SpaceID,Duration,SpaceID::Hasher> sSpaceIdDuration;
 Duration nilDuration(Duration::seconds(0));;
+std::tr1::unordered_map<SpaceID,std::tr1::weak_ptr<Network::TimeSync>,SpaceID::Hasher> sSpaceIdTimeSync;
 }
 
 SpaceTimeOffsetManager::SpaceTimeOffsetManager(){}
@@ -43,6 +44,20 @@ void SpaceTimeOffsetManager::setSpaceTimeOffset(const SpaceID& sid, const Durati
     UniqueLock lok(sSpaceIdDurationMutex);
     sSpaceIdDuration[sid]=dur;
 }
+bool SpaceTimeOffsetManager::claimSpaceTimeSync(const SpaceID& sid, const std::tr1::weak_ptr<Network::TimeSync>&sampler) {
+    std::tr1::shared_ptr<Network::TimeSync> candidate(sampler.lock());
+    if (!candidate) {
+        return false;
+    }
+    UniqueLock lok(sSpaceIdDurationMutex);
+    std::tr1::weak_ptr<Network::TimeSync>&claim=sSpaceIdTimeSync[sid];
+    std::tr1::shared_ptr<Network::TimeSync> holder(claim.lock());
+    if (holder&&holder!=candidate) {
+        return false;
+    }
+    claim=sampler;
+    return true;
+}
 
 }
 AUTO_SINGLETON_INSTANCE(Sirikata::SpaceTimeOffsetManager);
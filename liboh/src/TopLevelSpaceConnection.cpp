@@ -42,7 +42,12 @@
 #include "util/KnownServices.hpp"
 #include "network/TimeSyncImpl.hpp"
 #include "oh/SpaceTimeOffsetManager.hpp"
+#include "oh/MessageBatcher.hpp"
+#include <task/WorkQueue.hpp>
+#include <boost/thread.hpp>
 namespace Sirikata {
+class TopLevelSpaceConnection::UniqueLock :public boost::mutex {
+};
 namespace {
 void connectionStatus(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thus,Network::Stream::ConnectionStatus status,const std::string&reason){
     std::tr1::shared_ptr<TopLevelSpaceConnection>thus=weak_thus.lock();
@@ -55,6 +60,7 @@ void connectionStatus(const std::tr1::weak_ptr<TopLevelSpaceConnection>&weak_thu
 }
 
 TopLevelSpaceConnection::TopLevelSpaceConnection(Network::IOService*io):mRegisteredAddress(Network::Address::null()) {
+    mHostedObjectsLock=new UniqueLock;
     mParent=NULL;
     mIOService=io;
     mTopLevelStream=Network::StreamFactory::getSingleton().getDefaultConstructor()(io);
@@ -62,6 +68,7 @@ TopLevelSpaceConnection::TopLevelSpaceConnection(Network::IOService*io):mRegiste
 }
 void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConnection>&thus, ObjectHost * oh,  const SpaceID & id) {
     mSpaceID=id;
+    mBatcher=SelfWeakPtr<MessageBatcher>::construct<MessageBatcher>(oh->getWorkQueue());
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
     std::tr1::shared_ptr<Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> > > sync(new Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> >(thus,mIOService));
@@ -71,6 +78,7 @@ void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConn
                                                std::tr1::bind(&connectionStatus, thus,_1,_2),                                               
                                                std::tr1::bind(&Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> >::bytesReceived,weak_sync,_1));
     sync->setCallback(std::tr1::bind(&SpaceTimeOffsetManager::setSpaceTimeOffset,id,_1));
+    sync->setShouldSample(std::tr1::bind(&SpaceTimeOffsetManager::claimSpaceTimeSync,id,std::tr1::weak_ptr<Network::TimeSync>(sync)));
     sync->go(sync,3,6,Duration::seconds(10),mTopLevelStream);
     oh->spaceIDMap()->lookup(id,std::tr1::bind(&TopLevelSpaceConnection::connectToAddress,thus,oh,_1));
 }
@@ -79,6 +87,7 @@ void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConn
 void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConnection>&thus, ObjectHost * oh,  const SpaceID & id, const Network::Address&addy) {
     mSpaceID=id;
     mParent=oh;
+    mBatcher=SelfWeakPtr<MessageBatcher>::construct<MessageBatcher>(oh->getWorkQueue());
     using std::tr1::placeholders::_1;
     using std::tr1::placeholders::_2;
     std::tr1::shared_ptr<Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> > > sync(new Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> >(thus,mIOService));
@@ -89,6 +98,7 @@ void TopLevelSpaceConnection::connect(const std::tr1::weak_ptr<TopLevelSpaceConn
                              std::tr1::bind(&connectionStatus, thus,_1,_2),                                               
                              std::tr1::bind(&Network::TimeSyncImpl<std::tr1::weak_ptr<TopLevelSpaceConnection> >::bytesReceived,weak_sync,_1));
     sync->setCallback(std::tr1::bind(&SpaceTimeOffsetManager::setSpaceTimeOffset,id,_1));
+    sync->setShouldSample(std::tr1::bind(&SpaceTimeOffsetManager::claimSpaceTimeSync,id,std::tr1::weak_ptr<Network::TimeSync>(sync)));
     sync->go(sync,3,6,Duration::seconds(10),mTopLevelStream);
 }
 
@@ -101,6 +111,7 @@ void TopLevelSpaceConnection::remoteDisconnection(const std::string&reason) {
         //maybe resolution is to connect nowhere?
         Network::Stream *topLevel=mTopLevelStream;
         mTopLevelStream=NULL;
+        mBatcher=std::tr1::shared_ptr<MessageBatcher>();
         topLevel->connect(Network::Address("0.0.0.0","0"));
         delete topLevel;
     }
@@ -123,16 +134,25 @@ TopLevelSpaceConnection::~TopLevelSpaceConnection() {
     while (weakTimeSync.lock())
         SILOG(objecthost,warning,"Weak Time Sync holding onto resources. Waiting until unacquired");
     ObjectHostProxyManager::destroy();
+    mBatcher=std::tr1::shared_ptr<MessageBatcher>();//sends what is left on the substreams before they go
     if (mParent) {
         removeFromMap();
         delete mTopLevelStream;
     }
+    delete mHostedObjectsLock;
+}
+
+const Duration& TopLevelSpaceConnection::getServerTimeOffset()const {
+    //only one connection per space samples its clock, so ask the process wide offset rather than our own TimeSync
+    return SpaceTimeOffsetManager::getSpaceTimeOffset(mSpaceID);
 }
 
 void TopLevelSpaceConnection::registerHostedObject(const ObjectReference &mRef, const HostedObjectPtr &hostedObj) {
+    boost::lock_guard<boost::mutex> lok(*mHostedObjectsLock);
     mHostedObjects.insert(HostedObjectMap::value_type(mRef, hostedObj));
 }
 void TopLevelSpaceConnection::unregisterHostedObject(const ObjectReference &mRef) {
+    boost::lock_guard<boost::mutex> lok(*mHostedObjectsLock);
     HostedObjectMap::iterator iter = mHostedObjects.find(mRef);
     assert (iter != mHostedObjects.end());
     if (iter != mHostedObjects.end()) {
@@ -140,11 +160,11 @@ void TopLevelSpaceConnection::unregisterHostedObject(const ObjectReference &mRef
     }
 }
 HostedObjectPtr TopLevelSpaceConnection::getHostedObject(const ObjectReference &mref) const {
+    boost::lock_guard<boost::mutex> lok(*mHostedObjectsLock);
     HostedObjectMap::const_iterator iter = mHostedObjects.find(mref);
     if (iter != mHostedObjects.end()) {
-        HostedObjectPtr obj(iter->second.lock());
-        assert(obj);
-        return obj;
+        // may already have expired on a mailbox thread that is about to unregister it
+        return iter->second.lock();
     }
     return HostedObjectPtr();
 }
@@ -103,6 +103,8 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
     Network::StreamListener*mListener;
     ///The message that lets users know which services the space supports and on what ObjectReferences
     String mSpaceServiceIntroductionMessage;
+    ///The reply header shared by all time sync probes that name no source, which is what object hosts send
+    String mAnonymousTimeSyncReplyHeader;
     ///processes a message from the RegistrationService: returns true if the object is a new object (false if the object was deleted)
     bool processNewObject(const RoutableMessageHeader&hdr,MemoryReference body_array,ObjectReference&);
     ///processes a message for an object that exists in the Space (i.e. not a temporary object with fake UUID), forwarding message if necessary
@@ -118,6 +120,10 @@ class SIRIKATA_SPACE_EXPORT ObjectConnections : public MessageService {
      *                                     that they may to a service or a forwader
      */
     void bytesReceivedCallback(Network::Stream*stream,const Network::Chunk&chunk);
+    ///handles one message received on stream, either a whole chunk or, if batched, one record of a batch
+    void processChunk(Network::Stream*stream,MemoryReference chunk,bool batched);
+    ///handles each record of a MESSAGE_BATCH frame in order, as if it had arrived as its own chunk; records that are batches themselves are dropped
+    void processBatch(Network::Stream*stream,MemoryReference frame);
     ///makes a Disconnection message for the Registration service in the event a connection should unexpectedly close
     void forgeDisconnectionMessage(const ObjectReference&ref);
     ///actually close a Stream connection to an object.
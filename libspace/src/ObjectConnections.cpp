@@ -44,6 +44,25 @@
 #include "Space_Time.pbj.hpp"
 
 namespace Sirikata {
+namespace {
+Network::Chunk toChunk(MemoryReference ref) {
+    const uint8*data=static_cast<const uint8*>(ref.data());
+    return Network::Chunk(data,data+ref.size());
+}
+std::string serializeTimeSyncReplyHeader(const RoutableMessageHeader&hdr) {
+    RoutableMessageHeader retval;
+    retval.set_source_object(ObjectReference::spaceServiceID());
+    retval.set_source_port(Services::TIMESYNC);
+    retval.set_destination_port(hdr.source_port());
+    if (hdr.has_source_object())
+        retval.set_destination_object(hdr.source_object());
+    if (hdr.has_source_space())
+        retval.set_destination_space(hdr.source_space());
+    std::string toSend;
+    retval.SerializeToString(&toSend);
+    return toSend;
+}
+}
 ObjectConnections::ObjectConnections(Network::StreamListener*listener,
                                      const Network::Address&listenAddress) {
 
@@ -55,6 +74,7 @@ ObjectConnections::ObjectConnections(Network::StreamListener*listener,
 //    svc.set_pre_connection_buffer(mPerObjectTemporarySizeMaximum);
 //    svc.set_max_pre_connection_messages(mPerObjectTemporaryNumMessagesMaximum);
 //    svc.AppendToString(&mSpaceServiceIntroductionMessage);
+    mAnonymousTimeSyncReplyHeader=serializeTimeSyncReplyHeader(RoutableMessageHeader());
     mListener=listener;
     using std::tr1::placeholders::_1;    using std::tr1::placeholders::_2;
     mListener->listen(listenAddress,
@@ -75,21 +95,21 @@ void ObjectConnections::newStreamCallback(Network::Stream*stream, Network::Strea
     }
 }
 
-void processTimePacket(MessageService* mSpace, Network::Stream *stream, const RoutableMessageHeader&hdr,MemoryReference message_body) {
-    RoutableMessageHeader retval;
-    retval.set_source_object(ObjectReference::spaceServiceID());
-    retval.set_source_port(Services::TIMESYNC);
-    retval.set_destination_port(hdr.source_port());
-    if (hdr.has_source_object())
-        retval.set_destination_object(hdr.source_object());
-    if (hdr.has_source_space())
-        retval.set_destination_space(hdr.source_space());
+void processTimePacket(MessageService* mSpace, const std::string&anonymousReplyHeader, Network::Stream *stream, const RoutableMessageHeader&hdr,MemoryReference message_body) {
     std::string toSend;
-    retval.SerializeToString(&toSend);
+    if (hdr.has_source_object()||hdr.has_source_space()||hdr.source_port()!=0) {
+        toSend=serializeTimeSyncReplyHeader(hdr);
+    }else {
+        //object host probes name no source, so their replies all share the header serialized when the connections were set up
+        toSend=anonymousReplyHeader;
+    }
+    //echo the probe verbatim and append the server time after it rather than rebuilding the whole message
+    toSend.append(static_cast<const char*>(message_body.data()),message_body.size());
     Network::Protocol::TimeSync sync;
     sync.ParseFromArray(message_body.data(),message_body.size());
-    sync.set_server_time(mSpace!=NULL?static_cast<Space*>(mSpace)->now():Time::now(Duration::zero()));
-    sync.AppendToString(&toSend);
+    Network::Protocol::TimeSync stamp;
+    stamp.set_server_time(mSpace!=NULL?static_cast<Space*>(mSpace)->now():Time::now(Duration::zero()));
+    stamp.AppendToString(&toSend);
     Network::StreamReliability rel=Network::Unreliable;
     if (sync.has_return_options()) {
         if (sync.return_options()&Network::Protocol::TimeSync::REPLY_RELIABLE) {
@@ -107,11 +127,42 @@ void processTimePacket(MessageService* mSpace, Network::Stream *stream, const Ro
 
 
 void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Network::Chunk&chunk) {
+    processChunk(stream,MemoryReference(chunk),false);
+}
+void ObjectConnections::processBatch(Network::Stream*stream, MemoryReference frame) {
+    const uint8*data=static_cast<const uint8*>(frame.data());
+    size_t remaining=frame.size();
+    while (remaining) {
+        vuint32 length;
+        unsigned int lengthSize=remaining<vuint32::MAX_SERIALIZED_LENGTH?(unsigned int)remaining:(unsigned int)vuint32::MAX_SERIALIZED_LENGTH;
+        if (!length.unserialize(data,lengthSize)||remaining-lengthSize<length.read()) {
+            SILOG(space,warning,"Dropping the rest of a malformed message batch");
+            return;
+        }
+        data+=lengthSize;
+        remaining-=lengthSize;
+        processChunk(stream,MemoryReference(data,length.read()),true);
+        if (mStreams.find(stream)==mStreams.end()) {
+            return;//one of the messages shut this stream down
+        }
+        data+=length.read();
+        remaining-=length.read();
+    }
+}
+void ObjectConnections::processChunk(Network::Stream*stream, MemoryReference chunkRef, bool batched) {
     RoutableMessageHeader hdr;
-    MemoryReference chunkRef(chunk);//parse header
     MemoryReference message_body=hdr.ParseFromArray(chunkRef.data(),chunkRef.size());
     if (hdr.destination_port()==Services::TIMESYNC&&hdr.has_destination_object()&&hdr.destination_object()==ObjectReference::spaceServiceID()) {
-        processTimePacket(mSpace,stream,hdr,message_body);//for low latency shortcut the other processing
+        processTimePacket(mSpace,mAnonymousTimeSyncReplyHeader,stream,hdr,message_body);//for low latency shortcut the other processing
+        return;
+    }
+    if (hdr.destination_port()==Services::MESSAGE_BATCH&&hdr.has_destination_object()&&hdr.destination_object()==ObjectReference::spaceServiceID()) {
+        if (batched) {
+            //object hosts never nest frames, and unpacking them would let one chunk recurse without bound
+            SILOG(space,warning,"Dropping a message batch nested in another");
+        }else {
+            processBatch(stream,message_body);//the object host coalesced several messages from this stream into one frame
+        }
         return;
     }
     //find the temporary stream ID and connected boolean
@@ -145,10 +196,10 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
             }else {//push other requests for registration to the queue
                 TemporaryStreamMultimap::iterator twhere=mTemporaryStreams.find(where->second.uuid());
                 if (twhere!=mTemporaryStreams.end()) {//find the queue on which the request should live
-                    if (twhere->second.mTotalMessageSize+chunk.size()<mPerObjectTemporarySizeMaximum
+                    if (twhere->second.mTotalMessageSize+chunkRef.size()<mPerObjectTemporarySizeMaximum
                         &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
-                        twhere->second.mTotalMessageSize+=chunk.size();//annotate size
-                        twhere->second.mPendingMessages.push_back(chunk);//push back to array
+                        twhere->second.mTotalMessageSize+=chunkRef.size();//annotate size
+                        twhere->second.mPendingMessages.push_back(toChunk(chunkRef));//push back to array
                     }
                 }else{
                     SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
@@ -164,8 +215,8 @@ void ObjectConnections::bytesReceivedCallback(Network::Stream*stream, const Netw
         if (twhere!=mTemporaryStreams.end()) {
             if (twhere->second.mTotalMessageSize<mPerObjectTemporarySizeMaximum
                 &&twhere->second.mPendingMessages.size()<mPerObjectTemporaryNumMessagesMaximum) {//if message queue has space
-                twhere->second.mTotalMessageSize+=chunk.size();//annotate size
-                twhere->second.mPendingMessages.push_back(chunk);//push back to array
+                twhere->second.mTotalMessageSize+=chunkRef.size();//annotate size
+                twhere->second.mPendingMessages.push_back(toChunk(chunkRef));//push back to array
             }
         }else{
             SILOG(space,warning,"Dropping message from "<<where->second.uuid().toString()<<" due to already disconnected object");
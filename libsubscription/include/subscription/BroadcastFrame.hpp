@@ -0,0 +1,74 @@
+/*  Sirikata Subscription and Broadcasting System -- Subscription Services
+ *  BroadcastFrame.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_SUBSCRIPTION_BROADCAST_FRAME_HPP_
+#define _SIRIKATA_SUBSCRIPTION_BROADCAST_FRAME_HPP_
+namespace Sirikata { namespace Subscription {
+
+///An immutable broadcast payload, encoded once and shared by every subscriber it is sent to
+typedef std::tr1::shared_ptr<const Network::Chunk> SharedFrame;
+
+/**
+ * Wire format for subscribers that asked for delta encoding (Subscribe.keyframe_interval).
+ * Every frame starts with a type byte and the 16 bit epoch of the update it carries.
+ * A Keyframe is followed by the complete payload.
+ * A Delta names the epoch it was diffed against, the size of the new payload and then
+ * a list of (unchanged bytes to copy from the base, changed bytes length, changed bytes) runs.
+ * Bytes past the last run are copied from the base.
+ */
+class SIRIKATA_SUBSCRIPTION_EXPORT BroadcastFrame {
+public:
+    enum FrameType {
+        Keyframe=0,
+        Delta=1
+    };
+    enum {
+        KeyframeHeaderSize=3,
+        DeltaHeaderSize=5,
+        ///identical stretches shorter than this are folded into the surrounding changed run
+        MinimumCopyRun=4
+    };
+    ///makes a single refcounted copy of data that may be handed to any number of subscribers
+    static SharedFrame makeShared(const MemoryReference&data);
+    ///encodes payload as a self contained frame for the given epoch
+    static SharedFrame encodeKeyframe(uint16 epoch, const MemoryReference&payload);
+    ///encodes payload as a diff against base (sent as baseEpoch). Returns a keyframe instead if that would be smaller
+    static SharedFrame encodeDelta(uint16 baseEpoch, const MemoryReference&base, uint16 epoch, const MemoryReference&payload);
+    /**
+     * Applies an encoded frame to current, the last payload decoded from the same stream.
+     * \param epoch the epoch of current on input, the epoch of the new payload on success
+     * \returns false if the frame is malformed or was diffed against a payload other than current
+     */
+    static bool decode(const Network::Chunk&frame, uint16&epoch, Network::Chunk&current);
+};
+
+} }
+#endif
@@ -34,6 +34,9 @@
 #include <network/Stream.hpp>
 #include <network/StreamListener.hpp>
 #include <util/UUID.hpp>
+#include <util/Time.hpp>
+#include "subscription/BroadcastFrame.hpp"
+#include "subscription/SubscriptionClient.hpp"
 namespace Sirikata { namespace Subscription {
 
 namespace Protocol {
@@ -41,38 +44,75 @@ class Subscribe;
 }
 class SubscriptionState;
 
+/**
+ * Accepts broadcasters and subscribers and forwards each broadcast to the subscribers of its UUID.
+ * Broadcasts are sharded by UUID across one or more IOServices: every subscription, waiting subscriber
+ * and poll timer of a broadcast lives in the shard that owns its UUID and is only touched from that
+ * shard's IOService, so busy broadcasters only delay the broadcasts that share their shard.
+ */
 class SIRIKATA_SUBSCRIPTION_EXPORT Server:public std::tr1::enable_shared_from_this<Server> {
+    class Shard;
+    ///a connected broadcaster along with the shard that owns it once it has named itself
+    class BroadcasterStream;
     class UniqueLock;
-    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>mSubscriptions;
-    class WaitingStreams {public:
-            std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >mStream;
-        Protocol::Subscribe mSubscriptionRequest;
-        WaitingStreams(){}
-        WaitingStreams(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&strm,
-                       const Protocol::Subscribe&sub):mStream(strm),mSubscriptionRequest(sub){}
+    std::vector<Shard*>mShards;
+    ///a broadcast this server relays from an upstream server
+    class RelayedBroadcast {
+    public:
+        std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> mUpstream;
+        SubscriptionState*mState;
     };
-    typedef std::tr1::unordered_map<UUID,std::vector<WaitingStreams >, UUID::Hasher > WaitingStreamMap;
-    WaitingStreamMap mWaitingStreams;
-    std::tr1::unordered_map<SubscriptionState*,UUID>mBroadcasters;
-    UniqueLock*mBroadcastersSubscriptionsLock;
+    typedef std::tr1::unordered_map<UUID,RelayedBroadcast,UUID::Hasher> RelayMap;
+    RelayMap mRelays;
+    UniqueLock*mRelayLock;
     Network::StreamListener*mBroadcastListener;
-    Network::IOService*mBroadcastIOService;
     Network::StreamListener*mSubscriberListener;
     Duration mMaxSubscribeDelay;
     unsigned int mMaxCachedMessageSize;
+    void listen(const Network::Address&broadcastAddress, const Network::Address&subscriberAddress);
+    Shard*shardFor(const UUID&)const;
     void subscriberStreamCallback(Network::Stream*,Network::Stream::SetCallbacks&);
-    static void purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr<Server> &,const UUID&uuid, size_t which);
+    static void purgeWaitingSubscriberOnShard(const std::tr1::weak_ptr<Server> &,Shard*,const UUID&uuid, size_t which);
     void subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&,const Network::Chunk&);
-    void subscriberBytesReceivedCallbackOnBroadcastIOService(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest);
+    void subscriberBytesReceivedCallbackOnShard(Shard*,const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest);
     static void subscriberConnectionCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&,Network::Stream::ConnectionStatus,const std::string&reason);
-    void broadcastConnectionCallback(SubscriptionState*,Network::Stream::ConnectionStatus,const std::string&reason);
+    void broadcastConnectionCallback(const std::tr1::shared_ptr<BroadcasterStream>&,Network::Stream::ConnectionStatus,const std::string&reason);
     void broadcastStreamCallback(Network::Stream*,Network::Stream::SetCallbacks&);
-    void broadcastBytesReceivedCallback(SubscriptionState*, const Network::Chunk&);
-    static void poll(const std::tr1::weak_ptr<Server> &, const UUID&);
+    void broadcastBytesReceivedCallback(const std::tr1::shared_ptr<BroadcasterStream>&, const Network::Chunk&);
+    static void registerBroadcasterOnShard(const std::tr1::weak_ptr<Server>&,Shard*,SubscriptionState*);
+    static void broadcastOnShard(const std::tr1::weak_ptr<Server>&,Shard*,SubscriptionState*,const SharedFrame&,bool cacheFrame);
+    static void removeBroadcasterOnShard(const std::tr1::weak_ptr<Server>&,Shard*,SubscriptionState*);
+    static void relayBytesReceived(const std::tr1::weak_ptr<Server>&,Shard*,SubscriptionState*,const Network::Chunk&);
+    static void relayDisconnected(const std::tr1::weak_ptr<Server>&,Shard*,SubscriptionState*);
+    ///forgets the relayed broadcast if it is still backed by state and removes the state from its shard
+    void stopRelaying(const UUID&name, SubscriptionState*state);
+    ///arms the poll timer of the shard for the given deadline
+    void armPollTimer(Shard*, const Task::LocalTime&deadline, const Task::LocalTime&now);
+    static void poll(const std::tr1::weak_ptr<Server> &, Shard*, uint32 generation);
 public:
 
     Server(Network::IOService*broadcastIOSerivce, Network::StreamListener*broadcastListener, const Network::Address& broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxCachedMessageSize);
+    /**
+     * Creates a server with one shard per IOService. Each IOService must be run by a single thread,
+     * and they should all be stopped before the Server is destroyed.
+     */
+    Server(const std::vector<Network::IOService*>&shardIOServices, Network::StreamListener*broadcastListener, const Network::Address& broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxCachedMessageSize);
     ~Server();
+    size_t numShards()const{return mShards.size();}
+    /**
+     * Subscribes to the named broadcast on the upstream server through client and re-broadcasts it to this server's own subscribers.
+     * The upstream server is told that this server can be reached by subscribers at advertisedAddress,
+     * so it may redirect new subscribers here when it is more loaded than this relay.
+     * keyframeInterval requests delta encoded updates over the upstream link, 0 for raw updates.
+     */
+    void relay(SubscriptionClient*client,
+               const Network::Address&upstreamAddress,
+               const UUID&name,
+               const Network::Address&advertisedAddress,
+               uint32 keyframeInterval=0);
+    ///Stops relaying the named broadcast, disconnecting its local subscribers
+    void stopRelaying(const UUID&name);
+    ///Schedules a poll of the named subscription. Must be called from the IOService of the shard that owns the name
     void initiatePolling(const UUID&, const Duration&waitFor);
 };
 
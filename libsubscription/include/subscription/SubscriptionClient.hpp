@@ -105,18 +105,31 @@ protected:
         Network::Chunk mLastDeliveredMessage;
         std::tr1::shared_ptr<Network::Stream> mTopLevelStream;
         SubscriptionClient*mParent;
+        ///the full payload reconstructed from keyframes and deltas when mKeyframeInterval is nonzero
+        Network::Chunk mCurrentFrame;
+        uint16 mCurrentEpoch;
     public:
         ///this function goes through all subscribers of this State and sees if any are dead (probably). Also computes the maximum needed period and potentially downgrades the subscribers if it's too high
         void purgeSubscribersFromIOThread(const std::tr1::weak_ptr<State>&weak_thus, SubscriptionClient *parent);
         const Network::Address mAddress;
         const UUID mUUID;
         Duration mPeriod;
+        ///0 for raw updates, otherwise the keyframe interval requested from the server for delta encoded updates
+        uint32 mKeyframeInterval;
+        ///true until the Redirect the server sends to subscribers that accept redirects has been received
+        bool mAwaitingRedirect;
         std::tr1::shared_ptr<Network::Stream> mStream;
+        ///streams to the servers that redirected this subscription, left open so those servers can tell when it ends
+        std::vector<std::tr1::shared_ptr<Network::Stream> > mRedirectLeases;
         std::vector<std::tr1::weak_ptr<IndividualSubscription> > mSubscribers;
         State(const Duration &period,
               const Network::Address&address,
               const UUID&uuid,
-              SubscriptionClient *parent);
+              SubscriptionClient *parent,
+              uint32 keyframeInterval=0,
+              bool acceptRedirect=false);
+        ///moves every subscriber of this state to a new subscription of the same broadcast on the relay
+        void redirectFromIOThread(const std::tr1::weak_ptr<State>&weak_thus, const Network::Address&relay);
         void setStream(const std::tr1::shared_ptr<State>thus, const std::tr1::shared_ptr<Network::Stream>topLevelStream, const String&serialized_introduction=String());
         static void bytesReceived(const std::tr1::weak_ptr<State>&,
                                   const Network::Chunk&data);
@@ -32,10 +32,11 @@
 #ifndef _SIRIKATA_SUBSCRIPTION_STATE_HPP_
 #define _SIRIKATA_SUBSCRIPTION_STATE_HPP_
 #include "util/Time.hpp"
+#include "subscription/BroadcastFrame.hpp"
 namespace Sirikata { namespace Subscription {
 class Server;
 
-class SubscriptionState :public Noncopyable{
+class SIRIKATA_SUBSCRIPTION_EXPORT SubscriptionState :public Noncopyable{
     friend class Server;
     typedef uint16 EpochType;
 public:
@@ -45,63 +46,93 @@ public:
         ReservedEpoch=0
     };
 private:
+    ///A single update along with its lazily computed keyframe and delta encodings, shared by all subscribers it goes out to
+    class EncodedFrames;
     class Subscriber {
         friend class SubscriptionState;
         std::tr1::weak_ptr<Network::Stream>mSender;
         Duration mPeriod;
         EpochType mSentEpoch;
+        ///0 if this subscriber wants raw updates, otherwise the maximum number of updates between keyframes
+        uint32 mKeyframeInterval;
+        uint32 mFramesSinceKeyframe;
+        ///the last payload this subscriber was sent, which its next delta is computed against
+        SharedFrame mSentFrame;
     public:
         ///registers self with parent and finds appropriate parentOffset from array size
         Subscriber(const std::tr1::shared_ptr<Network::Stream>&sender,const Protocol::Subscribe&);
-        ///broadcasts the message to the mSender
-        void broadcast(const MemoryReference&);
-        Task::LocalTime computeNextUpdateFromNow();
+        ///broadcasts the update to the mSender, as a raw payload or a keyframe/delta as requested
+        void broadcast(EncodedFrames&);
     };
-    class SubscriberTimePair {
-        friend class SubscriptionState;
-      public:
+    /**
+     * All subscribers that asked for the same update period.
+     * They share one schedule, so a broadcast only touches the buckets that are due and the subscribers inside them.
+     */
+    class Bucket {
+    public:
+        Duration mPeriod;
+        ///when the subscribers in this bucket may next receive an update
         Task::LocalTime mNextUpdateTime;
-        Subscriber* mSubscriber;
-        SubscriberTimePair(const Task::LocalTime&nextUpdate, Subscriber*subscriber):mNextUpdateTime(nextUpdate) {
-            mSubscriber=subscriber;
-        }
-        bool operator <(const SubscriberTimePair&other)const {
-            return mNextUpdateTime<other.mNextUpdateTime;
-        }
-        bool operator ==(const SubscriberTimePair&other) const{
-            return mNextUpdateTime==other.mNextUpdateTime;
+        ///the epoch of the last update sent to this bucket, used to detect buckets that missed the latest update
+        EpochType mSentEpoch;
+        std::vector<Subscriber*> mSubscribers;
+        Bucket(const Duration&period):mPeriod(period),mNextUpdateTime(Task::LocalTime::null()) {
+            mSentEpoch=ReservedEpoch;
         }
-        
     };
+    ///A relay server that subscribed to this broadcast and offered to carry some of its subscribers
+    class Relay {
+    public:
+        Network::Address mAddress;
+        std::tr1::weak_ptr<Network::Stream> mStream;
+        ///the subscribers redirected to this relay. They keep their stream to this server open for as long as they stay with the relay
+        std::vector<std::tr1::weak_ptr<Network::Stream> > mRedirected;
+        ///how many redirected subscribers are still with this relay, recounted by leastLoadedRelay
+        uint32 mAssigned;
+        Relay(const Network::Address&address, const std::tr1::shared_ptr<Network::Stream>&stream):mAddress(address),mStream(stream),mAssigned(0){}
+    };
+    typedef std::map<Duration,Bucket*> BucketMap;
+    typedef std::multimap<Task::LocalTime,Bucket*> BucketSchedule;
     UUID mName;
     Network::Stream*mBroadcaster;
-    Task::LocalTime mLatestSentTime;
-    Task::LocalTime mLatestUnsentTime;
     EpochType mEpoch;
     bool mEverReceivedMessage;
-    bool mPolling;
-    Network::Chunk mLastSentMessage;
-	void setLastSentMessage(Network::Chunk&chunk);
+    ///the time of the poll this state has already asked the Server for, null if none is pending
+    Task::LocalTime mScheduledPoll;
+    ///the last update, kept for late joiners and polled subscribers. Empty if it was too large to cache
+    SharedFrame mLastSentMessage;
+    EpochType mLastSentEpoch;
+	void setLastSentMessage(const SharedFrame&frame);
 	void clearLastSentMessage();
-    ///this is the heap of subscribers who opted out of the last message
-    std::vector<SubscriberTimePair>mUnsentSubscribersHeap;
-    ///this is the heap of subscribers that received the last message
-    std::vector<SubscriberTimePair>mSentSubscribersHeap;
-    ///does the heap management for sent or unsent subscribers based on the passed vector
-    Task::LocalTime pushSubscriber(Subscriber*,std::vector<SubscriberTimePair>*);
-    ///Push a subscriber who missed a broadcast into the mUnsentSubscribersHeap
-    void pushNewSubscriber(Subscriber*,const Task::LocalTime&);
-    ///Push a Subscriber who has just heard a broadcast into the mSentSubscribersHeap
-    void pushJustReceivedSubscriber(Subscriber*);
+    ///every bucket, by period
+    BucketMap mBuckets;
+    ///buckets whose period has not yet elapsed since they were last sent an update, ordered by when it will have
+    BucketSchedule mWaitingBuckets;
+    ///buckets that will receive the next update as soon as it arrives
+    std::vector<Bucket*> mReadyBuckets;
+    std::vector<Relay> mRelays;
+    ///how many subscriber streams, relays included, this state sends to itself
+    size_t mNumSubscribers;
+    ///the relay carrying fewer subscribers than this server and every other relay, or NULL if this server is the least loaded. Forgets subscribers that left their relay
+    Relay*leastLoadedRelay();
+    ///moves every waiting bucket whose period has elapsed by now into mReadyBuckets
+    void promoteDueBuckets(const Task::LocalTime&now);
+    ///sends the update to every live subscriber in the bucket, dropping dead ones, and makes the bucket wait out its period. Deletes the bucket if no subscriber is left
+    void sendToBucket(Bucket*, EncodedFrames&, const Task::LocalTime&now);
+    ///asks parent to poll this state when the earliest bucket that missed the last update becomes due
+    void schedulePoll(Server*parent, const Task::LocalTime&now);
 public:
     void setUUID(const UUID&name){mName=name;}
     ///Creates a new subscription state class for a given named subscription associated with a given network stream
     SubscriptionState(Network::Stream*broadcaster);
-    ///register a new Stream to get updates who subscribed with the given protocol message. Must be called from IOServiceThread of *broadcaster*, instead of new subscriber
+    /**
+     * register a new Stream to get updates who subscribed with the given protocol message. Must be called from IOServiceThread of *broadcaster*, instead of new subscriber
+     * Subscribers that accept redirects are first sent a Redirect, and are not registered if it points them to a less loaded relay
+     */
     void registerSubscriber(const std::tr1::shared_ptr<Network::Stream>&, const Protocol::Subscribe&);
-    ///Take a memory reference and broadcast it to all interested parties who are within a receive window. Also schedules a poll if no other polls are present to retry for unsent subscribers
-    void broadcast(Server*parent, const MemoryReference&);
-    ///Check if any of the subscribers who had not received the last message when it was broadcast are able to receive it by now. If there are still unsent subscribers then ask the server to schedule a second polling
+    ///Take a shared frame and broadcast it to all interested parties who are within a receive window. Also schedules a poll if no other polls are present to retry for unsent subscribers
+    void broadcast(Server*parent, const SharedFrame&);
+    ///Check if any of the buckets who had not received the last message when it was broadcast are able to receive it by now. If there are still unsent buckets then ask the server to schedule a second polling
     void poll(Server*parent);
     ~SubscriptionState();
 };
@@ -0,0 +1,175 @@
+/*  Sirikata Subscription Library
+ *  BroadcastFrame.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH package.
+ */
+
+#include <subscription/Platform.hpp>
+
+#include "subscription/BroadcastFrame.hpp"
+
+namespace Sirikata { namespace Subscription {
+
+namespace {
+void writeEpoch(Network::Chunk&output, uint16 epoch) {
+    output.push_back((uint8)(epoch&255));
+    output.push_back((uint8)(epoch>>8));
+}
+uint16 readEpoch(const uint8*data) {
+    return (uint16)data[0]|((uint16)data[1]<<8);
+}
+void writeVarint(Network::Chunk&output, size_t value) {
+    uint8 buffer[vuint32::MAX_SERIALIZED_LENGTH];
+    unsigned int size=vuint32((uint32)value).serialize(buffer,vuint32::MAX_SERIALIZED_LENGTH);
+    output.insert(output.end(),buffer,buffer+size);
+}
+bool readVarint(const Network::Chunk&input, size_t&offset, size_t&value) {
+    vuint32 retval;
+    unsigned int size=input.size()-offset;
+    if (offset>=input.size()||!retval.unserialize(&input[offset],size)) {
+        return false;
+    }
+    offset+=size;
+    value=retval.read();
+    return true;
+}
+}
+
+SharedFrame BroadcastFrame::makeShared(const MemoryReference&data) {
+    const uint8*begin=(const uint8*)data.data();
+    return SharedFrame(new Network::Chunk(begin,begin+data.size()));
+}
+
+SharedFrame BroadcastFrame::encodeKeyframe(uint16 epoch, const MemoryReference&payload) {
+    const uint8*begin=(const uint8*)payload.data();
+    Network::Chunk*frame=new Network::Chunk;
+    frame->reserve(KeyframeHeaderSize+payload.size());
+    frame->push_back(Keyframe);
+    writeEpoch(*frame,epoch);
+    frame->insert(frame->end(),begin,begin+payload.size());
+    return SharedFrame(frame);
+}
+
+SharedFrame BroadcastFrame::encodeDelta(uint16 baseEpoch, const MemoryReference&base, uint16 epoch, const MemoryReference&payload) {
+    const uint8*oldData=(const uint8*)base.data();
+    const uint8*newData=(const uint8*)payload.data();
+    size_t oldSize=base.size();
+    size_t newSize=payload.size();
+    std::tr1::shared_ptr<Network::Chunk> frame(new Network::Chunk);
+    frame->reserve(DeltaHeaderSize+vuint32::MAX_SERIALIZED_LENGTH+newSize/4);
+    frame->push_back(Delta);
+    writeEpoch(*frame,epoch);
+    writeEpoch(*frame,baseEpoch);
+    writeVarint(*frame,newSize);
+    size_t pos=0;
+    while (pos<newSize) {
+        size_t copyStart=pos;
+        while (pos<newSize&&pos<oldSize&&newData[pos]==oldData[pos]) {
+            ++pos;
+        }
+        if (pos==newSize) {
+            break;//the decoder copies the remaining bytes from the base
+        }
+        size_t changeStart=pos;
+        while (pos<newSize) {
+            if (pos<oldSize&&newData[pos]==oldData[pos]) {
+                size_t same=pos;
+                while (same<newSize&&same<oldSize&&newData[same]==oldData[same]&&same-pos<MinimumCopyRun) {
+                    ++same;
+                }
+                if (same-pos>=MinimumCopyRun||same==newSize) {
+                    break;
+                }
+                pos=same;
+            }else {
+                ++pos;
+            }
+        }
+        writeVarint(*frame,changeStart-copyStart);
+        writeVarint(*frame,pos-changeStart);
+        frame->insert(frame->end(),newData+changeStart,newData+pos);
+        if (frame->size()>=KeyframeHeaderSize+newSize) {
+            break;
+        }
+    }
+    if (frame->size()>=KeyframeHeaderSize+newSize) {
+        return encodeKeyframe(epoch,payload);
+    }
+    return frame;
+}
+
+bool BroadcastFrame::decode(const Network::Chunk&frame, uint16&epoch, Network::Chunk&current) {
+    if (frame.size()<KeyframeHeaderSize) {
+        return false;
+    }
+    if (frame[0]==Keyframe) {
+        epoch=readEpoch(&frame[1]);
+        current.assign(frame.begin()+KeyframeHeaderSize,frame.end());
+        return true;
+    }
+    if (frame[0]!=Delta||frame.size()<DeltaHeaderSize||readEpoch(&frame[3])!=epoch) {
+        return false;
+    }
+    size_t offset=DeltaHeaderSize;
+    size_t newSize;
+    if (!readVarint(frame,offset,newSize)) {
+        return false;
+    }
+    Network::Chunk result(newSize);
+    size_t pos=0;
+    while (offset<frame.size()) {
+        size_t copyLength,changeLength;
+        if (!readVarint(frame,offset,copyLength)||!readVarint(frame,offset,changeLength)) {
+            return false;
+        }
+        if (pos+copyLength>current.size()||pos+copyLength+changeLength>newSize||offset+changeLength>frame.size()) {
+            return false;
+        }
+        if (copyLength) {
+            std::memcpy(&result[pos],&current[pos],copyLength);
+            pos+=copyLength;
+        }
+        if (changeLength) {
+            std::memcpy(&result[pos],&frame[offset],changeLength);
+            pos+=changeLength;
+            offset+=changeLength;
+        }
+    }
+    if (pos<newSize) {
+        if (newSize>current.size()) {
+            return false;
+        }
+        std::memcpy(&result[pos],&current[pos],newSize-pos);
+    }
+    epoch=readEpoch(&frame[1]);
+    current.swap(result);
+    return true;
+}
+
+} }
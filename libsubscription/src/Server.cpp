@@ -46,35 +46,79 @@ namespace Sirikata { namespace Subscription {
 
 class Server::UniqueLock :public boost::mutex{
 
+};
+class Server::Shard {
+public:
+    class WaitingStreams {public:
+        std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >mStream;
+        Protocol::Subscribe mSubscriptionRequest;
+        WaitingStreams(){}
+        WaitingStreams(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&strm,
+                       const Protocol::Subscribe&sub):mStream(strm),mSubscriptionRequest(sub){}
+    };
+    typedef std::tr1::unordered_map<UUID,std::vector<WaitingStreams >, UUID::Hasher > WaitingStreamMap;
+    ///the subscriptions that asked to be polled, by when they want it. A single timer serves all of them
+    typedef std::multimap<Task::LocalTime,UUID> PollSchedule;
+    Network::IOService*mIOService;
+    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>mSubscriptions;
+    std::tr1::unordered_map<SubscriptionState*,UUID>mBroadcasters;
+    WaitingStreamMap mWaitingStreams;
+    PollSchedule mPollSchedule;
+    ///when the outstanding poll timer fires, or null if none is armed
+    Task::LocalTime mPollTimerDeadline;
+    ///identifies the outstanding poll timer so that timers superseded by an earlier one do nothing
+    uint32 mPollTimerGeneration;
+    Shard(Network::IOService*io):mIOService(io),mPollTimerDeadline(Task::LocalTime::null()),mPollTimerGeneration(0){}
+    ~Shard() {
+        for (std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator i=mSubscriptions.begin(),ie=mSubscriptions.end();i!=ie;++i) {
+            delete i->second;
+        }
+    }
+};
+class Server::BroadcasterStream {
+public:
+    SubscriptionState*mState;
+    ///NULL until the broadcaster sends its registration. Only touched from the broadcast listener's callbacks
+    Shard*mShard;
+    BroadcasterStream(SubscriptionState*state):mState(state),mShard(NULL){}
 };
 Server::Server(Network::IOService*broadcastIOService,Network::StreamListener*broadcastListener, const Network::Address&broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxMessageSize):mMaxSubscribeDelay(maxSubscribeDelay),mMaxCachedMessageSize(maxMessageSize){
-    mBroadcastIOService=broadcastIOService;
-    mBroadcastersSubscriptionsLock=new UniqueLock;
+    mShards.push_back(new Shard(broadcastIOService));
+    mRelayLock=new UniqueLock;
     mBroadcastListener=broadcastListener;
-    if (!broadcastListener->listen(broadcastAddress,std::tr1::bind(&Server::broadcastStreamCallback,this,_1,_2))) {
-        SILOG(subscription,error,"Error listening to broadcast on port "<<broadcastAddress.getHostName()<<':'<<broadcastAddress.getService());
+    mSubscriberListener=subscriberListener;
+    listen(broadcastAddress,subscriberAddress);
+}
+Server::Server(const std::vector<Network::IOService*>&shardIOServices,Network::StreamListener*broadcastListener, const Network::Address&broadcastAddress, Network::StreamListener*subscriberListener, const Network::Address&subscriberAddress, const Duration&maxSubscribeDelay, unsigned int maxMessageSize):mMaxSubscribeDelay(maxSubscribeDelay),mMaxCachedMessageSize(maxMessageSize){
+    assert(!shardIOServices.empty());
+    for (std::vector<Network::IOService*>::const_iterator i=shardIOServices.begin(),ie=shardIOServices.end();i!=ie;++i) {
+        mShards.push_back(new Shard(*i));
     }
-
+    mRelayLock=new UniqueLock;
+    mBroadcastListener=broadcastListener;
     mSubscriberListener=subscriberListener;
-    if (!subscriberListener->listen(subscriberAddress,std::tr1::bind(&Server::subscriberStreamCallback,this,_1,_2))) {
+    listen(broadcastAddress,subscriberAddress);
+}
+void Server::listen(const Network::Address&broadcastAddress, const Network::Address&subscriberAddress) {
+    if (!mBroadcastListener->listen(broadcastAddress,std::tr1::bind(&Server::broadcastStreamCallback,this,_1,_2))) {
+        SILOG(subscription,error,"Error listening to broadcast on port "<<broadcastAddress.getHostName()<<':'<<broadcastAddress.getService());
+    }
+    if (!mSubscriberListener->listen(subscriberAddress,std::tr1::bind(&Server::subscriberStreamCallback,this,_1,_2))) {
         SILOG(subscription,error,"Error listening to broadcast on port "<<broadcastAddress.getHostName()<<':'<<broadcastAddress.getService());
     }
 }
 Server::~Server() {
     delete mBroadcastListener;
     delete mSubscriberListener;
-    {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator iter1=mSubscriptions.begin(),iter1e=mSubscriptions.end();
-        //std::tr1::unordered_map<SubscriptionState*,UUID>::iterator iter2=mBroadcasters.begin(),iter2e=mBroadcasters.end();
-        for(;iter1!=iter1e;++iter1) {
-            delete iter1->second;
-        }
-        mBroadcasters.clear();
-        mSubscriptions.clear();
+    mRelays.clear();
+    delete mRelayLock;
+    for (std::vector<Shard*>::iterator i=mShards.begin(),ie=mShards.end();i!=ie;++i) {
+        delete *i;
     }
-    delete mBroadcastersSubscriptionsLock;
-    
+    mShards.clear();
+}
+Server::Shard*Server::shardFor(const UUID&uuid)const {
+    return mShards[UUID::Hasher()(uuid)%mShards.size()];
 }
 void Server::subscriberStreamCallback(Network::Stream*newStream,Network::Stream::SetCallbacks&cb){
     if (newStream) {
@@ -89,12 +133,13 @@ void Server::subscriberStreamCallback(Network::Stream*newStream,Network::Stream:
 }
 void Server::subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Network::Chunk&dat){
     Protocol::Subscribe subscriptionRequest;
-    bool success=false;
     if (!dat.empty()&&subscriptionRequest.ParseFromArray(&dat[0],dat.size())&&subscriptionRequest.has_broadcast_name()) {
+        Shard*shard=shardFor(subscriptionRequest.broadcast_name());
         Network::IOServiceFactory::
-            dispatchServiceMessage(mBroadcastIOService,
-                                   std::tr1::bind(&Server::subscriberBytesReceivedCallbackOnBroadcastIOService,
+            dispatchServiceMessage(shard->mIOService,
+                                   std::tr1::bind(&Server::subscriberBytesReceivedCallbackOnShard,
                                                   this,
+                                                  shard,
                                                   stream,
                                                   subscriptionRequest));
     }else {
@@ -105,14 +150,14 @@ void Server::subscriberBytesReceivedCallback(const std::tr1::shared_ptr<std::tr1
         *stream=std::tr1::shared_ptr<Stream>();
     }
 }
-void Server::purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr<Server> &weak_thus, const UUID&uuid, size_t which){
+void Server::purgeWaitingSubscriberOnShard(const std::tr1::weak_ptr<Server> &weak_thus, Shard*shard, const UUID&uuid, size_t which){
     std::tr1::shared_ptr<Server>thus=weak_thus.lock();
     if (thus) {
-        WaitingStreamMap::iterator where=thus->mWaitingStreams.find(uuid);
-        if (where!=thus->mWaitingStreams.end()) {
+        Shard::WaitingStreamMap::iterator where=shard->mWaitingStreams.find(uuid);
+        if (where!=shard->mWaitingStreams.end()) {
             SILOG (subscription,debug,"Purging Broadcaster "<<uuid.toString());
             if (which+1==where->second.size()) {
-                thus->mWaitingStreams.erase(where);//last one to be erased
+                shard->mWaitingStreams.erase(where);//last one to be erased
             }else if (which<where->second.size()) {
                 while (true) {
                     if (where->second[which].mStream) {
@@ -129,35 +174,33 @@ void Server::purgeWaitingSubscriberOnBroadcastIOService(const std::tr1::weak_ptr
         }
     }
 }
-void Server::subscriberBytesReceivedCallbackOnBroadcastIOService(const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest){
+void Server::subscriberBytesReceivedCallbackOnShard(Shard*shard,const std::tr1::shared_ptr<std::tr1::shared_ptr<Network::Stream> >&stream,const Protocol::Subscribe&subscriptionRequest){
     bool success=false;
-    {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where
-            =mSubscriptions.find(subscriptionRequest.broadcast_name());
-        if (where!=mSubscriptions.end()) {
-            if (*stream) {
-                where->second->registerSubscriber(*stream,subscriptionRequest);
-                success=true;
-            }else {
-
-            }
+    std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where
+        =shard->mSubscriptions.find(subscriptionRequest.broadcast_name());
+    if (where!=shard->mSubscriptions.end()) {
+        if (*stream) {
+            where->second->registerSubscriber(*stream,subscriptionRequest);
+            success=true;
         }else {
-			success=true;
-            UUID uuid(subscriptionRequest.broadcast_name());
-            std::vector<WaitingStreams>*waiting=&mWaitingStreams[uuid];
-            size_t which=waiting->size();
-            waiting->push_back(WaitingStreams(stream,subscriptionRequest));
-            std::tr1::weak_ptr<Server> thus=shared_from_this();
-            Network::IOServiceFactory::
-                dispatchServiceMessage(mBroadcastIOService,
-                                       mMaxSubscribeDelay,
-                                       std::tr1::bind(&Server::purgeWaitingSubscriberOnBroadcastIOService,
-                                                      thus,
-                                                      uuid,
-                                                      which));
-                           
+
         }
+    }else {
+        success=true;
+        UUID uuid(subscriptionRequest.broadcast_name());
+        std::vector<Shard::WaitingStreams>*waiting=&shard->mWaitingStreams[uuid];
+        size_t which=waiting->size();
+        waiting->push_back(Shard::WaitingStreams(stream,subscriptionRequest));
+        std::tr1::weak_ptr<Server> thus=shared_from_this();
+        Network::IOServiceFactory::
+            dispatchServiceMessage(shard->mIOService,
+                                   mMaxSubscribeDelay,
+                                   std::tr1::bind(&Server::purgeWaitingSubscriberOnShard,
+                                                  thus,
+                                                  shard,
+                                                  uuid,
+                                                  which));
+
     }
     if (!success) {
         std::tr1::shared_ptr<Stream> strongStream(*stream);
@@ -177,62 +220,109 @@ void Server::subscriberConnectionCallback(const std::tr1::shared_ptr<std::tr1::s
         *stream=std::tr1::shared_ptr<Stream>();
     }
 }
-void Server::broadcastConnectionCallback(SubscriptionState*subscription,Network::Stream::ConnectionStatus status,const std::string&reason){
-    if (status!=Stream::Connected) {
-        boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where;
-        std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
-        whichuuid=mBroadcasters.find(subscription);
-        if (whichuuid!=mBroadcasters.end()) {
-            where=mSubscriptions.find(whichuuid->second);
-            mBroadcasters.erase(whichuuid);
-            if (where!=mSubscriptions.end()) {
-                mSubscriptions.erase(where);
+void Server::broadcastConnectionCallback(const std::tr1::shared_ptr<BroadcasterStream>&broadcaster,Network::Stream::ConnectionStatus status,const std::string&reason){
+    if (status!=Stream::Connected&&broadcaster->mState) {
+        if (broadcaster->mShard) {
+            //the shard may still have broadcasts from this stream queued, so it has to be the one to delete it
+            Network::IOServiceFactory::
+                dispatchServiceMessage(broadcaster->mShard->mIOService,
+                                       std::tr1::bind(&Server::removeBroadcasterOnShard,
+                                                      std::tr1::weak_ptr<Server>(shared_from_this()),
+                                                      broadcaster->mShard,
+                                                      broadcaster->mState));
+        }else {
+            delete broadcaster->mState;
+        }
+        broadcaster->mState=NULL;
+    }
+}
+void Server::removeBroadcasterOnShard(const std::tr1::weak_ptr<Server>&weak_thus, Shard*shard, SubscriptionState*subscription) {
+    std::tr1::shared_ptr<Server>thus=weak_thus.lock();
+    if (thus) {
+        std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid=shard->mBroadcasters.find(subscription);
+        if (whichuuid!=shard->mBroadcasters.end()) {
+            std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where=shard->mSubscriptions.find(whichuuid->second);
+            shard->mBroadcasters.erase(whichuuid);
+            if (where!=shard->mSubscriptions.end()) {
+                shard->mSubscriptions.erase(where);
             }
         }
         delete subscription;
     }
 }
-void Server::broadcastBytesReceivedCallback(SubscriptionState*state, const Network::Chunk&chunk) {
-    if (state->mEpoch==SubscriptionState::ReservedEpoch) {
+void Server::broadcastBytesReceivedCallback(const std::tr1::shared_ptr<BroadcasterStream>&broadcaster, const Network::Chunk&chunk) {
+    SubscriptionState*state=broadcaster->mState;
+    if (state==NULL) {
+        return;
+    }
+    if (broadcaster->mShard==NULL) {
         Protocol::Broadcast broadcastRegistration;
         if (!chunk.empty()&&broadcastRegistration.ParseFromArray(&chunk[0],chunk.size())&&broadcastRegistration.has_broadcast_name()) {
-            ++state->mEpoch;
-            boost::lock_guard<boost::mutex>lok(*mBroadcastersSubscriptionsLock);
-            std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
-            whichuuid=mBroadcasters.find(state);
-            if (whichuuid==mBroadcasters.end()) {
-                UUID uuid=broadcastRegistration.broadcast_name();
-                if (mSubscriptions.find(broadcastRegistration.broadcast_name())==mSubscriptions.end()) {
-                    mSubscriptions[uuid]=state;
-                    mBroadcasters[state]=uuid;
-                    state->setUUID(uuid);
-                    WaitingStreamMap::iterator where=mWaitingStreams.find(uuid);
-                    if (where!=mWaitingStreams.end()) {
-                        for (std::vector<WaitingStreams>::iterator i=where->second.begin(),ie=where->second.end();
-                             i!=ie;
-                             ++i) {
-                            if (i->mStream&&*i->mStream) {
-                                state->registerSubscriber(*i->mStream,i->mSubscriptionRequest);
-                            }
-                        }
-                        mWaitingStreams.erase(where);
+            UUID uuid=broadcastRegistration.broadcast_name();
+            state->setUUID(uuid);
+            broadcaster->mShard=shardFor(uuid);
+            Network::IOServiceFactory::
+                dispatchServiceMessage(broadcaster->mShard->mIOService,
+                                       std::tr1::bind(&Server::registerBroadcasterOnShard,
+                                                      std::tr1::weak_ptr<Server>(shared_from_this()),
+                                                      broadcaster->mShard,
+                                                      state));
+        }else {
+            state->setLastSentMessage(BroadcastFrame::makeShared(MemoryReference(chunk)));
+        }
+    }else {
+        //one copy of the update is shared by every subscriber and by the late joiner cache.
+        //the shard IOService may outlive the Server, which deletes the shards, so the handler only holds it weakly
+        Network::IOServiceFactory::
+            dispatchServiceMessage(broadcaster->mShard->mIOService,
+                                   std::tr1::bind(&Server::broadcastOnShard,
+                                                  std::tr1::weak_ptr<Server>(shared_from_this()),
+                                                  broadcaster->mShard,
+                                                  state,
+                                                  BroadcastFrame::makeShared(MemoryReference(chunk)),
+                                                  chunk.size()<=mMaxCachedMessageSize));
+    }
+}
+void Server::registerBroadcasterOnShard(const std::tr1::weak_ptr<Server>&weak_thus, Shard*shard, SubscriptionState*state) {
+    std::tr1::shared_ptr<Server>thus=weak_thus.lock();
+    if (!thus) {
+        return;
+    }
+    ++state->mEpoch;
+    const UUID&uuid=state->mName;
+    std::tr1::unordered_map<SubscriptionState*,UUID>::iterator whichuuid;
+    whichuuid=shard->mBroadcasters.find(state);
+    if (whichuuid==shard->mBroadcasters.end()) {
+        if (shard->mSubscriptions.find(uuid)==shard->mSubscriptions.end()) {
+            shard->mSubscriptions[uuid]=state;
+            shard->mBroadcasters[state]=uuid;
+            Shard::WaitingStreamMap::iterator where=shard->mWaitingStreams.find(uuid);
+            if (where!=shard->mWaitingStreams.end()) {
+                for (std::vector<Shard::WaitingStreams>::iterator i=where->second.begin(),ie=where->second.end();
+                     i!=ie;
+                     ++i) {
+                    if (i->mStream&&*i->mStream) {
+                        state->registerSubscriber(*i->mStream,i->mSubscriptionRequest);
                     }
-                }else {
-                    SILOG(subscription,warning,"Duplicate UUID for broadcast "<<broadcastRegistration.broadcast_name().toString()<<" Already in map");
                 }
-            }else {
-                SILOG(subscription,error,"UUID "<<whichuuid->second.toString()<<" Already in map");
+                shard->mWaitingStreams.erase(where);
             }
         }else {
-			Network::Chunk chk(chunk);
-            state->setLastSentMessage(chk);
+            SILOG(subscription,warning,"Duplicate UUID for broadcast "<<uuid.toString()<<" Already in map");
         }
     }else {
-        state->broadcast(this,MemoryReference(chunk));
-        if (chunk.size()<=mMaxCachedMessageSize) {
-			Network::Chunk chk(chunk);
-            state->setLastSentMessage(chk);
+        SILOG(subscription,error,"UUID "<<whichuuid->second.toString()<<" Already in map");
+    }
+}
+void Server::broadcastOnShard(const std::tr1::weak_ptr<Server>&weak_thus, Shard*shard, SubscriptionState*state, const SharedFrame&frame, bool cacheFrame) {
+    std::tr1::shared_ptr<Server>thus=weak_thus.lock();
+    if (!thus) {
+        return;
+    }
+    if (shard->mBroadcasters.find(state)!=shard->mBroadcasters.end()) {
+        state->broadcast(&*thus,frame);
+        if (cacheFrame) {
+            state->setLastSentMessage(frame);
         }else {
             state->clearLastSentMessage();
         }
@@ -240,32 +330,134 @@ void Server::broadcastBytesReceivedCallback(SubscriptionState*state, const Netwo
 }
 void Server::broadcastStreamCallback(Network::Stream* stream,Network::Stream::SetCallbacks&cb) {
     if (stream ) {
-        SubscriptionState*state=new SubscriptionState(stream);
-        cb(std::tr1::bind(&Server::broadcastConnectionCallback,this,state,_1,_2),
-           std::tr1::bind(&Server::broadcastBytesReceivedCallback,this,state,_1));
+        std::tr1::shared_ptr<BroadcasterStream> broadcaster(new BroadcasterStream(new SubscriptionState(stream)));
+        cb(std::tr1::bind(&Server::broadcastConnectionCallback,this,broadcaster,_1,_2),
+           std::tr1::bind(&Server::broadcastBytesReceivedCallback,this,broadcaster,_1));
     }else {
         //tls (top level stream) deleted
     }
 }
 
+void Server::relay(SubscriptionClient*client,
+                   const Network::Address&upstreamAddress,
+                   const UUID&name,
+                   const Network::Address&advertisedAddress,
+                   uint32 keyframeInterval) {
+    stopRelaying(name);
+    Shard*shard=shardFor(name);
+    std::tr1::weak_ptr<Server>thus=shared_from_this();
+    //a relayed broadcast is a broadcaster without a stream of its own: the upstream subscription feeds it instead
+    SubscriptionState*state=new SubscriptionState(NULL);
+    state->setUUID(name);
+    Network::IOServiceFactory::
+        dispatchServiceMessage(shard->mIOService,
+                               std::tr1::bind(&Server::registerBroadcasterOnShard,
+                                              thus,
+                                              shard,
+                                              state));
+    Protocol::Subscribe subscription;
+    subscription.set_broadcast_name(name);
+    subscription.mutable_relay_address().set_hostname(advertisedAddress.getHostName());
+    subscription.mutable_relay_address().set_service(advertisedAddress.getService());
+    if (keyframeInterval) {
+        subscription.set_keyframe_interval(keyframeInterval);
+    }
+    RelayedBroadcast relayed;
+    relayed.mState=state;
+    relayed.mUpstream=client->subscribe(upstreamAddress,
+                                        subscription,
+                                        std::tr1::bind(&Server::relayBytesReceived,thus,shard,state,_1),
+                                        std::tr1::bind(&Server::relayDisconnected,thus,shard,state));
+    boost::lock_guard<boost::mutex>lok(*mRelayLock);
+    mRelays[name]=relayed;
+}
+void Server::relayBytesReceived(const std::tr1::weak_ptr<Server>&weak_thus, Shard*shard, SubscriptionState*state, const Network::Chunk&chunk) {
+    std::tr1::shared_ptr<Server>thus=weak_thus.lock();
+    if (thus&&!chunk.empty()) {//the subscription client signals a new connection with an empty chunk
+        Network::IOServiceFactory::
+            dispatchServiceMessage(shard->mIOService,
+                                   std::tr1::bind(&Server::broadcastOnShard,
+                                                  weak_thus,
+                                                  shard,
+                                                  state,
+                                                  BroadcastFrame::makeShared(MemoryReference(chunk)),
+                                                  chunk.size()<=thus->mMaxCachedMessageSize));
+    }
+}
+void Server::relayDisconnected(const std::tr1::weak_ptr<Server>&weak_thus, Shard*shard, SubscriptionState*state) {
+    std::tr1::shared_ptr<Server>thus=weak_thus.lock();
+    if (thus) {
+        SILOG(subscription,warning,"Lost upstream of relayed broadcast "<<state->mName.toString());
+        thus->stopRelaying(state->mName,state);
+    }
+}
+void Server::stopRelaying(const UUID&name) {
+    stopRelaying(name,NULL);
+}
+void Server::stopRelaying(const UUID&name, SubscriptionState*state) {
+    std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> upstream;
+    {
+        boost::lock_guard<boost::mutex>lok(*mRelayLock);
+        RelayMap::iterator where=mRelays.find(name);
+        if (where==mRelays.end()||(state&&where->second.mState!=state)) {
+            return;
+        }
+        state=where->second.mState;
+        upstream=where->second.mUpstream;
+        mRelays.erase(where);
+    }
+    Shard*shard=shardFor(name);
+    Network::IOServiceFactory::
+        dispatchServiceMessage(shard->mIOService,
+                               std::tr1::bind(&Server::removeBroadcasterOnShard,
+                                              std::tr1::weak_ptr<Server>(shared_from_this()),
+                                              shard,
+                                              state));
+    //upstream is released here, outside the lock, since dropping it may call back into the subscription client
+}
 void Server::initiatePolling(const UUID&name, const Duration&waitTime) {
+    Shard*shard=shardFor(name);
+    Task::LocalTime now=Task::LocalTime::now();
+    Task::LocalTime when=now+waitTime;
+    shard->mPollSchedule.insert(Shard::PollSchedule::value_type(when,name));
+    if (shard->mPollTimerDeadline==Task::LocalTime::null()||when<shard->mPollTimerDeadline) {
+        armPollTimer(shard,when,now);
+    }
+}
+void Server::armPollTimer(Shard*shard, const Task::LocalTime&deadline, const Task::LocalTime&now) {
+    shard->mPollTimerDeadline=deadline;
     std::tr1::weak_ptr<Server>thus=shared_from_this();
     Network::IOServiceFactory::
-        dispatchServiceMessage(mBroadcastIOService,
-                               waitTime,
+        dispatchServiceMessage(shard->mIOService,
+                               now<deadline?deadline-now:Duration::seconds(0),
                                std::tr1::bind(&poll,
                                               thus,
-                                              name));
-
+                                              shard,
+                                              ++shard->mPollTimerGeneration));
 }
-void Server::poll(const std::tr1::weak_ptr<Server> &weak_thus, const UUID&name) {
+void Server::poll(const std::tr1::weak_ptr<Server> &weak_thus, Shard*shard, uint32 generation) {
     std::tr1::shared_ptr<Server>thus=weak_thus.lock();
     if (thus) {
-        boost::lock_guard<boost::mutex>lok(*thus->mBroadcastersSubscriptionsLock);
-        std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where=thus->mSubscriptions.find(name);
-
-        if (where!=thus->mSubscriptions.end()) {
-            where->second->poll(&*thus);
+        if (generation!=shard->mPollTimerGeneration) {
+            return;//an earlier timer was armed after this one and took over
+        }
+        shard->mPollTimerDeadline=Task::LocalTime::null();
+        Task::LocalTime now=Task::LocalTime::now();
+        //polling may ask for more polls, so take the due entries out of the schedule first
+        std::vector<UUID> due;
+        Shard::PollSchedule::iterator i=shard->mPollSchedule.begin(),ie=shard->mPollSchedule.end();
+        for (;i!=ie&&!(now<i->first);++i) {
+            due.push_back(i->second);
+        }
+        shard->mPollSchedule.erase(shard->mPollSchedule.begin(),i);
+        for (std::vector<UUID>::iterator i=due.begin(),ie=due.end();i!=ie;++i) {
+            std::tr1::unordered_map<UUID,SubscriptionState*,UUID::Hasher>::iterator where=shard->mSubscriptions.find(*i);
+            if (where!=shard->mSubscriptions.end()) {
+                where->second->poll(&*thus);
+            }
+        }
+        if (!shard->mPollSchedule.empty()&&shard->mPollTimerDeadline==Task::LocalTime::null()) {
+            thus->armPollTimer(shard,shard->mPollSchedule.begin()->first,Task::LocalTime::now());
         }
     }
 }
@@ -36,6 +36,7 @@
 #include "network/Stream.hpp"
 #include "network/StreamFactory.hpp"
 #include "Subscription_Subscription.pbj.hpp"
+#include "subscription/BroadcastFrame.hpp"
 #include <boost/thread.hpp>
 namespace Sirikata { namespace Subscription {
 class SubscriptionClient::UniqueLock : public boost::mutex {
@@ -57,6 +58,8 @@ void SubscriptionClient::upgradeFromIOThread(const std::tr1::weak_ptr<State>&wea
             }
         }
         source->mSubscribers.clear();//get it off this queue in case there are pending subscriptions for this defunct subscriptions.
+        dest->mRedirectLeases.insert(dest->mRedirectLeases.end(),source->mRedirectLeases.begin(),source->mRedirectLeases.end());
+        source->mRedirectLeases.clear();
     }
 }
 
@@ -116,8 +119,11 @@ SubscriptionClient::~SubscriptionClient(){
 SubscriptionClient::State::State(const Duration &period,
                                  const Network::Address&address,
                                  const UUID&uuid,
-                                 SubscriptionClient *parent):mAddress(address),mUUID(uuid),mPeriod(period){
+                                 SubscriptionClient *parent,
+                                 uint32 keyframeInterval,
+                                 bool acceptRedirect):mAddress(address),mUUID(uuid),mPeriod(period),mKeyframeInterval(keyframeInterval),mAwaitingRedirect(acceptRedirect){
     mParent=parent;
+    mCurrentEpoch=0;
 }
 void SubscriptionClient::State::setStream(const std::tr1::shared_ptr<State> thus,
                       const std::tr1::shared_ptr<Network::Stream>topLevelStream,
@@ -183,6 +189,8 @@ void SubscriptionClient::State::purgeSubscribersFromIOThread(const std::tr1::wea
             Protocol::Subscribe subscription;//make a subscription packet
             subscription.set_broadcast_name(mUUID);//populate it with fields from this
             subscription.set_update_period(period);//and with the desired slower period
+            if (mKeyframeInterval)
+                subscription.set_keyframe_interval(mKeyframeInterval);
             
             //FIXME any more properties? we don't have a way to determine to edit the code if there are
             parent->subscribe(mAddress,
@@ -196,13 +204,69 @@ void SubscriptionClient::State::purgeSubscribersFromIOThread(const std::tr1::wea
         }
     }
 }
+void SubscriptionClient::State::redirectFromIOThread(const std::tr1::weak_ptr<State>&weak_thus, const Network::Address&relay) {
+    {
+        boost::lock_guard<boost::mutex>lok(*mParent->mMapLock);
+        BroadcastMap::iterator where=mParent->mBroadcasts.find(AddressUUID(mAddress,mUUID));
+        if (where!=mParent->mBroadcasts.end()&&where->second.lock().get()==this) {
+            mParent->mBroadcasts.erase(where);
+        }
+    }
+    std::tr1::shared_ptr<IndividualSubscription> guineaPig;
+    while (mSubscribers.size()&&!(guineaPig=mSubscribers.back().lock())) {
+        mSubscribers.pop_back();
+    }
+    if (guineaPig) {
+        mSubscribers.pop_back();//the guinea pig gets the new subscription, the rest are upgraded onto it
+        Protocol::Subscribe subscription;
+        subscription.set_broadcast_name(mUUID);
+        subscription.set_update_period(mPeriod);
+        if (mKeyframeInterval)
+            subscription.set_keyframe_interval(mKeyframeInterval);
+        subscription.set_accept_redirect(true);//the relay may pass us on to one of its own relays
+        mParent->subscribe(relay,
+                           subscription,
+                           guineaPig->mFunction,
+                           guineaPig->mDisconFunction,
+                           String(),
+                           guineaPig);
+        if (mStream) {
+            //the redirecting server counts us against the relay until this stream closes
+            mRedirectLeases.push_back(mStream);
+        }
+        mParent->upgradeFromIOThread(weak_thus,
+                                     guineaPig->mSubscriptionState);
+    }else if (mStream) {
+        mStream->close();
+    }
+}
 namespace {
 size_t sMaximumSubscriptionStateSize=1360;
 }
 void SubscriptionClient::State::bytesReceived(const std::tr1::weak_ptr<State>&weak_thus,
-                          const Network::Chunk&data) {
+                          const Network::Chunk&encoded) {
     std::tr1::shared_ptr<State> thus=weak_thus.lock();
     if (thus) {
+        if (thus->mAwaitingRedirect) {
+            thus->mAwaitingRedirect=false;
+            Protocol::Redirect redirect;
+            if (!encoded.empty()&&redirect.ParseFromArray(&encoded[0],encoded.size())) {
+                if (redirect.has_relay_address()) {
+                    thus->redirectFromIOThread(weak_thus,
+                                               Network::Address(redirect.relay_address().hostname(),
+                                                                redirect.relay_address().service()));
+                }
+                return;
+            }
+            SILOG(subscription,warning,"Expected a redirect for broadcast "<<thus->mUUID.toString()<<" from "<<thus->mAddress.getHostName()<<':'<<thus->mAddress.getService());
+        }
+        if (thus->mKeyframeInterval) {
+            if (!BroadcastFrame::decode(encoded,thus->mCurrentEpoch,thus->mCurrentFrame)) {
+                SILOG(subscription,warning,"Dropping undecodable update for broadcast "<<thus->mUUID.toString()<<": waiting for next keyframe");
+                return;
+            }
+        }
+        const Network::Chunk&data=thus->mKeyframeInterval?thus->mCurrentFrame:encoded;
         bool eraseAny=false;
         for (std::vector<std::tr1::weak_ptr<IndividualSubscription> >::iterator i
                      =thus->mSubscribers.begin(),ie=thus->mSubscribers.end();
@@ -242,6 +306,10 @@ void SubscriptionClient::State::connectionCallback(const std::tr1::weak_ptr<Stat
                 }
             }
             thus->mSubscribers.clear();
+            for (std::vector<std::tr1::shared_ptr<Network::Stream> >::iterator i=thus->mRedirectLeases.begin(),ie=thus->mRedirectLeases.end();i!=ie;++i) {
+                (*i)->close();
+            }
+            thus->mRedirectLeases.clear();
             thus->mStream=std::tr1::shared_ptr<Network::Stream>();
             thus->mTopLevelStream=std::tr1::shared_ptr<Network::Stream>();
         }
@@ -251,6 +319,8 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription> SubscriptionCli
     Protocol::Subscribe sub;
     sub.set_broadcast_name(mSubscriptionState->mUUID);
     sub.set_update_period(period);
+    if (mSubscriptionState->mKeyframeInterval)
+        sub.set_keyframe_interval(mSubscriptionState->mKeyframeInterval);
     return mSubscriptionState->mParent->subscribe(mSubscriptionState->mAddress,sub,mFunction,mDisconFunction);
 }
 std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
@@ -297,7 +367,9 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
                 std::tr1::shared_ptr<State> state(new State(
                                                       subscription.update_period(),
                                                       address,
-                                                      subscription.broadcast_name(),this));//setup state
+                                                      subscription.broadcast_name(),this,
+                                                      subscription.has_keyframe_interval()?std::max(subscription.keyframe_interval(),(uint32)1):0,
+                                                      subscription.has_accept_redirect()&&subscription.accept_redirect()));//setup state
 
                 state->setStream(state,topLevelStreamPtr,serializedSubscription.length()?serializedSubscription:localSerializedSubscription);//set state to use a given toplevel stream and serialize
                                                                                                                            //out a broadcast join request
@@ -321,7 +393,9 @@ std::tr1::shared_ptr<SubscriptionClient::IndividualSubscription>
             std::tr1::shared_ptr<State> state(new State(subscription.update_period(),
                                                                   address,
                                                                   subscription.broadcast_name(),
-                                                                  this));
+                                                                  this,
+                                                                  subscription.has_keyframe_interval()?std::max(subscription.keyframe_interval(),(uint32)1):0,
+                                                                  subscription.has_accept_redirect()&&subscription.accept_redirect()));
             if (do_upgrade) {
                 upgrade_dest=state;
             }
@@ -42,171 +42,260 @@
 
 
 namespace Sirikata { namespace Subscription {
-SubscriptionState::SubscriptionState(Network::Stream*broadcaster):mName(UUID::null()),mLatestSentTime(Task::LocalTime::null()),mLatestUnsentTime(Task::LocalTime::null()){
+
+class SubscriptionState::EncodedFrames {
+    SharedFrame mPayload;
+    EpochType mEpoch;
+    SharedFrame mKeyframe;
+    ///deltas already computed for this update, keyed by the payload they were diffed against
+    std::vector<std::pair<SharedFrame,SharedFrame> > mDeltas;
+public:
+    EncodedFrames(const SharedFrame&payload, EpochType epoch):mPayload(payload),mEpoch(epoch){}
+    const SharedFrame&payload()const {
+        return mPayload;
+    }
+    EpochType epoch()const {
+        return mEpoch;
+    }
+    const SharedFrame&keyframe() {
+        if (!mKeyframe) {
+            mKeyframe=BroadcastFrame::encodeKeyframe(mEpoch,MemoryReference(*mPayload));
+        }
+        return mKeyframe;
+    }
+    const SharedFrame&delta(const SharedFrame&base, EpochType baseEpoch) {
+        for (std::vector<std::pair<SharedFrame,SharedFrame> >::iterator i=mDeltas.begin(),ie=mDeltas.end();i!=ie;++i) {
+            if (i->first==base)
+                return i->second;
+        }
+        mDeltas.push_back(std::pair<SharedFrame,SharedFrame>(base,
+                                                             BroadcastFrame::encodeDelta(baseEpoch,
+                                                                                         MemoryReference(*base),
+                                                                                         mEpoch,
+                                                                                         MemoryReference(*mPayload))));
+        return mDeltas.back().second;
+    }
+};
+
+SubscriptionState::SubscriptionState(Network::Stream*broadcaster):mName(UUID::null()),mScheduledPoll(Task::LocalTime::null()){
     mEpoch=ReservedEpoch;
+    mLastSentEpoch=ReservedEpoch;
     mBroadcaster=broadcaster;
     mEverReceivedMessage=false;
-    mPolling=false;
+    mNumSubscribers=0;
 }
 void SubscriptionState::clearLastSentMessage() {
 	mEverReceivedMessage=true;
-	mLastSentMessage.resize(0);
+	mLastSentMessage=SharedFrame();
+	mLastSentEpoch=mEpoch;
 }
 
-void SubscriptionState::setLastSentMessage(Network::Chunk&chunk) {
+void SubscriptionState::setLastSentMessage(const SharedFrame&frame) {
 	mEverReceivedMessage=true;
-	mLastSentMessage.swap(chunk);
+	mLastSentMessage=frame;
+	mLastSentEpoch=mEpoch;
 }
 
-
-Task::LocalTime SubscriptionState::pushSubscriber(Subscriber*subscriber,std::vector<SubscriberTimePair>*heap) {
-    Task::LocalTime retval=subscriber->computeNextUpdateFromNow();
-    heap->push_back(SubscriberTimePair(retval,subscriber));
-    std::push_heap(heap->begin(),heap->end());
-    return retval;
+void SubscriptionState::promoteDueBuckets(const Task::LocalTime&now) {
+    BucketSchedule::iterator i=mWaitingBuckets.begin(),ie=mWaitingBuckets.end();
+    for (;i!=ie&&!(now<i->first);++i) {
+        mReadyBuckets.push_back(i->second);
+    }
+    mWaitingBuckets.erase(mWaitingBuckets.begin(),i);
 }
 
-void SubscriptionState::pushNewSubscriber(Subscriber*s,const Task::LocalTime&oldTime) {
-    mUnsentSubscribersHeap.push_back(SubscriberTimePair(oldTime,s));
-    std::push_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-    if (mLatestUnsentTime<oldTime) {
-        mLatestUnsentTime=oldTime;
+void SubscriptionState::sendToBucket(Bucket*bucket, EncodedFrames&data, const Task::LocalTime&now) {
+    std::vector<Subscriber*>&subscribers=bucket->mSubscribers;
+    for (size_t i=0;i<subscribers.size();) {
+        if (subscribers[i]->mSender.expired()) {
+            delete subscribers[i];
+            subscribers[i]=subscribers.back();
+            subscribers.pop_back();
+            --mNumSubscribers;
+        }else {
+            subscribers[i++]->broadcast(data);
+        }
     }
-}
-void SubscriptionState::pushJustReceivedSubscriber(Subscriber*s) {
-    Task::LocalTime retval=pushSubscriber(s,&mSentSubscribersHeap);
-    if (mLatestSentTime<retval) {
-        mLatestSentTime=retval;
+    if (subscribers.empty()) {
+        //callers have already taken the bucket off the schedule, so forgetting the period is enough
+        mBuckets.erase(bucket->mPeriod);
+        delete bucket;
+        return;
+    }
+    bucket->mSentEpoch=data.epoch();
+    bucket->mNextUpdateTime=now+bucket->mPeriod;
+    if (bucket->mPeriod==Duration::seconds(0)) {
+        mReadyBuckets.push_back(bucket);//unthrottled subscribers never have to wait
+    }else {
+        mWaitingBuckets.insert(BucketSchedule::value_type(bucket->mNextUpdateTime,bucket));
     }
-}
-void SubscriptionState::registerSubscriber(const std::tr1::shared_ptr<Network::Stream>&stream, const Protocol::Subscribe&subscriptionMessage){
-    Subscriber*subscriber =new Subscriber(stream,subscriptionMessage);
-    if (mEverReceivedMessage)
-        subscriber->broadcast(MemoryReference(mLastSentMessage));
-    pushJustReceivedSubscriber(subscriber);
 }
 
-
-void SubscriptionState::broadcast(Server*poll,const MemoryReference&data){
-    Task::LocalTime now=Task::LocalTime::now();
-    std::vector<SubscriberTimePair> newUnsenders;
-    if (mLatestSentTime<now||mLatestUnsentTime<now) {//there exists a completing queue
-        Task::LocalTime latestSentTime=mLatestSentTime;
-        bool unsentSwap=false;
-        if (!(mLatestSentTime<now)) {//if the queue of those items that were marked as having sent the last packet isn't fully ready to send
-            mLatestSentTime=now;//make sure to reset the time for things in the sent queue
-            mSentSubscribersHeap.swap(mUnsentSubscribersHeap);//swap it with that queue that is... since by the end of this operation all items that haven't sent this latest packet won't
-                                                              //have sent the latest packet and can be placed in the unsent heap
-            unsentSwap=true;//swap the latest times
-        }
-        if (mLatestSentTime<now&&mLatestUnsentTime<now) {//if both queues are going to empty, combine them as the sent queue
-            mSentSubscribersHeap.insert(mSentSubscribersHeap.end(),mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-            mUnsentSubscribersHeap.clear();
-        }else if (!mUnsentSubscribersHeap.empty()) {//otherwise pop items off the Unsent queue onto the sent queue for mass processing
-            if (unsentSwap)
-                mLatestUnsentTime=latestSentTime;
-            while(mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-                mSentSubscribersHeap.push_back(mUnsentSubscribersHeap.front());
-                std::pop_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-                mUnsentSubscribersHeap.pop_back();
+void SubscriptionState::schedulePoll(Server*parent, const Task::LocalTime&now) {
+    for (BucketSchedule::iterator i=mWaitingBuckets.begin(),ie=mWaitingBuckets.end();i!=ie;++i) {
+        if (i->second->mSentEpoch!=mEpoch) {
+            if (mScheduledPoll==Task::LocalTime::null()||i->first<mScheduledPoll) {
+                assert(mName!=UUID::null());
+                mScheduledPoll=i->first;
+                parent->initiatePolling(mName,i->first-now);
             }
+            break;
         }
-        std::vector<SubscriberTimePair>::iterator i,ie=mSentSubscribersHeap.end();
-        for (i=mSentSubscribersHeap.begin(); i!=ie;++i) {
-            i->mSubscriber->broadcast(data);
-            i->mNextUpdateTime=i->mSubscriber->computeNextUpdateFromNow();
-            if (mLatestSentTime<i->mNextUpdateTime) {
-                mLatestSentTime=i->mNextUpdateTime;
+    }
+}
+
+SubscriptionState::Relay*SubscriptionState::leastLoadedRelay() {
+    Relay*best=NULL;
+    for (size_t i=0;i<mRelays.size();) {
+        if (mRelays[i].mStream.expired()) {
+            mRelays[i]=mRelays.back();
+            mRelays.pop_back();
+        }else {
+            std::vector<std::tr1::weak_ptr<Network::Stream> >&redirected=mRelays[i].mRedirected;
+            for (size_t j=0;j<redirected.size();) {
+                if (redirected[j].expired()) {
+                    redirected[j]=redirected.back();
+                    redirected.pop_back();
+                    --mRelays[i].mAssigned;
+                }else {
+                    ++j;
+                }
             }
-        }
-        std::make_heap(mSentSubscribersHeap.begin(),mSentSubscribersHeap.end());//since the sent queue's heap property was violated, reheapify
-    }else {
-        //neither queue completes, meaning both will have partial entries that will need to be merged into a heap
-        std::vector<SubscriberTimePair> temp,sent;
-        sent.swap(mSentSubscribersHeap);
-        mLatestSentTime=now;
-        std::vector<SubscriberTimePair>::iterator unsentHeapEnd=mUnsentSubscribersHeap.end(),sentEnd=sent.end(),iter;
-        size_t unsentSize=mUnsentSubscribersHeap.size();
-        for (size_t i=0;i<unsentSize;++i) {
-            if (mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-                mUnsentSubscribersHeap.front().mSubscriber->broadcast(data);
-                std::pop_heap(mUnsentSubscribersHeap.begin(),unsentHeapEnd);
-                --unsentHeapEnd;
-                pushJustReceivedSubscriber(unsentHeapEnd->mSubscriber);
-            }else {
-                if (unsentHeapEnd!=mUnsentSubscribersHeap.end())
-                    mUnsentSubscribersHeap.erase(unsentHeapEnd,mUnsentSubscribersHeap.end());
-                break;
+            if (best==NULL||mRelays[i].mAssigned<best->mAssigned) {
+                best=&mRelays[i];
             }
+            ++i;
         }
-        size_t sentSize=sent.size();
-        for (size_t i=0;i<sentSize;++i) {
-            if (sent.front().mNextUpdateTime<now) {
-                sent.front().mSubscriber->broadcast(data);
-                std::pop_heap(sent.begin(),sentEnd);
-                --sentEnd;
-                pushJustReceivedSubscriber(sentEnd->mSubscriber);
-            }else {
-                for (iter=sent.begin();iter!=sentEnd;++iter) {
-                    pushNewSubscriber(iter->mSubscriber,iter->mNextUpdateTime);
-                }
-                break;
-            }
+    }
+    if (best&&best->mAssigned<mNumSubscribers) {
+        return best;
+    }
+    return NULL;
+}
+
+void SubscriptionState::registerSubscriber(const std::tr1::shared_ptr<Network::Stream>&stream, const Protocol::Subscribe&subscriptionMessage){
+    if (subscriptionMessage.has_accept_redirect()&&subscriptionMessage.accept_redirect()) {
+        Relay*relay=leastLoadedRelay();
+        Protocol::Redirect redirect;
+        redirect.set_broadcast_name(mName);
+        if (relay) {
+            redirect.mutable_relay_address().set_hostname(relay->mAddress.getHostName());
+            redirect.mutable_relay_address().set_service(relay->mAddress.getService());
+            relay->mRedirected.push_back(stream);
+            ++relay->mAssigned;
         }
+        String serialized;
+        redirect.SerializeToString(&serialized);
+        stream->send(MemoryReference(serialized),Network::ReliableOrdered);
+        if (relay) {
+            return;//the subscriber will take it up with the relay
+        }
+    }
+    if (subscriptionMessage.has_relay_address()) {
+        mRelays.push_back(Relay(Network::Address(subscriptionMessage.relay_address().hostname(),
+                                                 subscriptionMessage.relay_address().service()),
+                                stream));
+    }
+    ++mNumSubscribers;
+    Subscriber*subscriber =new Subscriber(stream,subscriptionMessage);
+    if (mEverReceivedMessage) {
+        EncodedFrames lastSent(mLastSentMessage,mLastSentEpoch);
+        subscriber->broadcast(lastSent);
     }
-    if (!mUnsentSubscribersHeap.empty()) {
-        poll->initiatePolling(mName,mUnsentSubscribersHeap.front().mNextUpdateTime-now);
+    Bucket*&bucket=mBuckets[subscriber->mPeriod];
+    if (bucket==NULL) {
+        bucket=new Bucket(subscriber->mPeriod);
+        bucket->mSentEpoch=mLastSentEpoch;
+        if (mEverReceivedMessage&&!(bucket->mPeriod==Duration::seconds(0))) {
+            //the new bucket just heard the last update, so it waits out its period like any other
+            Task::LocalTime now=Task::LocalTime::now();
+            bucket->mNextUpdateTime=now+bucket->mPeriod;
+            mWaitingBuckets.insert(BucketSchedule::value_type(bucket->mNextUpdateTime,bucket));
+        }else {
+            mReadyBuckets.push_back(bucket);
+        }
     }
+    bucket->mSubscribers.push_back(subscriber);
+}
+
 
+void SubscriptionState::broadcast(Server*parent,const SharedFrame&frame){
+    Task::LocalTime now=Task::LocalTime::now();
+    if (++mEpoch==ReservedEpoch) {
+        ++mEpoch;
+    }
+    EncodedFrames data(frame,mEpoch);
+    promoteDueBuckets(now);
+    std::vector<Bucket*> ready;
+    ready.swap(mReadyBuckets);
+    for (std::vector<Bucket*>::iterator i=ready.begin(),ie=ready.end();i!=ie;++i) {
+        sendToBucket(*i,data,now);
+    }
+    //every bucket still waiting has now missed this update
+    if (!mWaitingBuckets.empty()) {
+        schedulePoll(parent,now);
+    }
 }
 
 SubscriptionState::~SubscriptionState(){
-    std::vector<SubscriberTimePair>::iterator i=mUnsentSubscribersHeap.begin(),ie=mUnsentSubscribersHeap.end();
-    for (;i!=ie;++i) {
-        delete i->mSubscriber;
-    }
-    i=mSentSubscribersHeap.begin();
-    ie=mSentSubscribersHeap.end();
-    for (;i!=ie;++i) {
-        delete i->mSubscriber;
+    for (BucketMap::iterator i=mBuckets.begin(),ie=mBuckets.end();i!=ie;++i) {
+        for (std::vector<Subscriber*>::iterator j=i->second->mSubscribers.begin(),je=i->second->mSubscribers.end();j!=je;++j) {
+            delete *j;
+        }
+        delete i->second;
     }
     delete mBroadcaster;
 }
 
 SubscriptionState::Subscriber::Subscriber(const std::tr1::shared_ptr<Network::Stream>&sender,const Protocol::Subscribe&msg):mSender(sender),mPeriod(msg.has_update_period()?msg.update_period():Duration::microseconds(0)) {
     mSentEpoch=ReservedEpoch;
+    mKeyframeInterval=msg.has_keyframe_interval()?(msg.keyframe_interval()?msg.keyframe_interval():1):0;
+    mFramesSinceKeyframe=0;
 }
-void SubscriptionState::Subscriber::broadcast(const MemoryReference&data){
+void SubscriptionState::Subscriber::broadcast(EncodedFrames&data){
     std::tr1::shared_ptr<Network::Stream> sender=mSender.lock();
-    if (sender) {
-        sender->send(data,Network::ReliableOrdered);
+    if (!sender) {
+        return;
+    }
+    if (mKeyframeInterval==0) {
+        if (data.payload()) {
+            sender->send(MemoryReference(*data.payload()),Network::ReliableOrdered);
+        }else {
+            sender->send(MemoryReference::null(),Network::ReliableOrdered);
+        }
+    }else if (data.payload()&&data.payload()!=mSentFrame) {
+        //streams are reliable and ordered, so the last frame sent is the one the subscriber will diff against
+        const SharedFrame*encoded;
+        if (mSentFrame&&mFramesSinceKeyframe+1<mKeyframeInterval) {
+            encoded=&data.delta(mSentFrame,mSentEpoch);
+        }else {
+            encoded=&data.keyframe();
+        }
+        if ((**encoded)[0]==BroadcastFrame::Keyframe) {
+            mFramesSinceKeyframe=0;
+        }else {
+            ++mFramesSinceKeyframe;
+        }
+        sender->send(MemoryReference(**encoded),Network::ReliableOrdered);
+        mSentFrame=data.payload();
+        mSentEpoch=data.epoch();
     }
 }
 void SubscriptionState::poll(Server*parent) {
     Task::LocalTime now=Task::LocalTime::now();
-    while (!mUnsentSubscribersHeap.empty()) {
-        SubscriberTimePair* iter=&mUnsentSubscribersHeap.front();
-        if (mUnsentSubscribersHeap.front().mNextUpdateTime<now) {
-            iter->mSubscriber->broadcast(MemoryReference(mLastSentMessage));
-            pushJustReceivedSubscriber(iter->mSubscriber);
-            std::pop_heap(mUnsentSubscribersHeap.begin(),mUnsentSubscribersHeap.end());
-            mUnsentSubscribersHeap.pop_back();
+    mScheduledPoll=Task::LocalTime::null();
+    promoteDueBuckets(now);
+    EncodedFrames lastSent(mLastSentMessage,mLastSentEpoch);
+    std::vector<Bucket*> ready;
+    ready.swap(mReadyBuckets);
+    for (std::vector<Bucket*>::iterator i=ready.begin(),ie=ready.end();i!=ie;++i) {
+        if ((*i)->mSentEpoch!=mLastSentEpoch) {
+            sendToBucket(*i,lastSent,now);
         }else {
-            assert(mName!=UUID::null());
-            parent->initiatePolling(mName,mUnsentSubscribersHeap.front().mNextUpdateTime-now);
-            break;
+            mReadyBuckets.push_back(*i);
         }
     }
-    if (mUnsentSubscribersHeap.empty()) {
-        mPolling=false;
-    }
-}
-
-Task::LocalTime SubscriptionState::Subscriber::computeNextUpdateFromNow(){
-    return Task::LocalTime::now()+mPeriod;
+    schedulePoll(parent,now);
 }
 
-
-
-
 } }